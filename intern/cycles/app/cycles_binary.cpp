@@ -0,0 +1,269 @@
+/*
+ * Copyright 2011, Blender Foundation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+
+#include "attribute.h"
+#include "mesh.h"
+#include "scene.h"
+
+#include "util_foreach.h"
+#include "util_path.h"
+#include "util_types.h"
+
+#include "cycles_binary.h"
+
+CCL_NAMESPACE_BEGIN
+
+/* File Layout
+ *
+ * header, verts (float3), triangles (int[3]), smooth flags (uchar) and then
+ * for each attribute an attribute header, its name and its buffer. */
+
+#define BINARY_MESH_MAGIC "CYCLMESH"
+#define BINARY_MESH_VERSION 1
+#define BINARY_MESH_ALIGN 16
+
+struct BinaryMeshHeader {
+	char magic[8];
+	uint version;
+	uint num_verts;
+	uint num_triangles;
+	uint num_attributes;
+	uint pad[2];
+};
+
+struct BinaryAttributeHeader {
+	int std;
+	int element;
+	int basetype;
+	int aggregate;
+	int vecsemantics;
+	int arraylen;
+	uint name_size;
+	uint pad;
+	uint64_t data_size;
+	uint64_t pad2;
+};
+
+static size_t binary_align(size_t size)
+{
+	return (size + BINARY_MESH_ALIGN - 1) & ~(size_t)(BINARY_MESH_ALIGN - 1);
+}
+
+static bool binary_read(FILE *f, void *data, size_t size)
+{
+	if(size == 0)
+		return true;
+
+	if(fread(data, size, 1, f) != 1)
+		return false;
+
+	/* skip padding up to the next array */
+	size_t pad = binary_align(size) - size;
+	return (pad == 0 || fseek(f, pad, SEEK_CUR) == 0);
+}
+
+static bool binary_write(FILE *f, const void *data, size_t size)
+{
+	static const char zero[BINARY_MESH_ALIGN] = {0};
+
+	if(size == 0)
+		return true;
+
+	if(fwrite(data, size, 1, f) != 1)
+		return false;
+
+	size_t pad = binary_align(size) - size;
+	return (pad == 0 || fwrite(zero, pad, 1, f) == 1);
+}
+
+/* attributes that are recomputed on device update are not stored */
+static bool binary_skip_attribute(const Attribute& attr)
+{
+	return (attr.std == ATTR_STD_FACE_NORMAL || attr.std == ATTR_STD_VERTEX_NORMAL);
+}
+
+/* Read */
+
+static bool binary_read_attribute(FILE *f, Mesh *mesh)
+{
+	BinaryAttributeHeader header;
+
+	if(!binary_read(f, &header, sizeof(header)))
+		return false;
+
+	vector<char> name(header.name_size + 1, 0);
+
+	if(!binary_read(f, &name[0], header.name_size))
+		return false;
+
+	TypeDesc type((TypeDesc::BASETYPE)header.basetype,
+		(TypeDesc::AGGREGATE)header.aggregate,
+		(TypeDesc::VECSEMANTICS)header.vecsemantics,
+		header.arraylen);
+	AttributeStandard std = (AttributeStandard)header.std;
+	Attribute *attr;
+
+	if(std != ATTR_STD_NONE)
+		attr = mesh->attributes.add(std, ustring(&name[0]));
+	else
+		attr = mesh->attributes.add(ustring(&name[0]), type, (AttributeElement)header.element);
+
+	/* the buffer was sized by the attribute set from the mesh counts */
+	if(!attr || attr->type != type || attr->element != (AttributeElement)header.element ||
+	   attr->buffer.size() != header.data_size)
+		return false;
+
+	return binary_read(f, attr->data(), header.data_size);
+}
+
+bool binary_read_mesh(Mesh *mesh, const string& filepath, int shader)
+{
+	FILE *f = fopen(filepath.c_str(), "rb");
+
+	if(!f) {
+		fprintf(stderr, "%s: failed to open binary mesh.\n", filepath.c_str());
+		return false;
+	}
+
+	BinaryMeshHeader header;
+	bool ok = binary_read(f, &header, sizeof(header)) &&
+		memcmp(header.magic, BINARY_MESH_MAGIC, sizeof(header.magic)) == 0 &&
+		header.version == BINARY_MESH_VERSION;
+
+	if(ok) {
+		size_t num_verts = header.num_verts;
+		size_t num_triangles = header.num_triangles;
+
+		mesh->reserve(num_verts, num_triangles, 0, 0);
+
+		ok = binary_read(f, (num_verts)? &mesh->verts[0]: NULL, sizeof(float3)*num_verts) &&
+			binary_read(f, (num_triangles)? &mesh->triangles[0]: NULL, sizeof(Mesh::Triangle)*num_triangles);
+
+		/* smooth flags are stored as bytes, vector<bool> is packed */
+		vector<uchar> smooth(num_triangles);
+
+		ok = ok && binary_read(f, (num_triangles)? &smooth[0]: NULL, num_triangles);
+
+		for(size_t i = 0; ok && i < num_triangles; i++) {
+			const Mesh::Triangle& t = mesh->triangles[i];
+
+			if(t.v[0] < 0 || t.v[1] < 0 || t.v[2] < 0 ||
+			   (size_t)t.v[0] >= num_verts || (size_t)t.v[1] >= num_verts || (size_t)t.v[2] >= num_verts)
+				ok = false;
+
+			mesh->shader[i] = shader;
+			mesh->smooth[i] = (smooth[i] != 0);
+		}
+
+		for(uint i = 0; ok && i < header.num_attributes; i++)
+			ok = binary_read_attribute(f, mesh);
+	}
+
+	fclose(f);
+
+	if(!ok) {
+		fprintf(stderr, "%s: invalid binary mesh.\n", filepath.c_str());
+		mesh->clear();
+	}
+
+	return ok;
+}
+
+/* Write */
+
+bool binary_write_mesh(Mesh *mesh, const string& filepath)
+{
+	FILE *f = fopen(filepath.c_str(), "wb");
+
+	if(!f) {
+		fprintf(stderr, "%s: failed to open for writing.\n", filepath.c_str());
+		return false;
+	}
+
+	size_t num_verts = mesh->verts.size();
+	size_t num_triangles = mesh->triangles.size();
+
+	BinaryMeshHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, BINARY_MESH_MAGIC, sizeof(header.magic));
+	header.version = BINARY_MESH_VERSION;
+	header.num_verts = num_verts;
+	header.num_triangles = num_triangles;
+
+	foreach(const Attribute& attr, mesh->attributes.attributes)
+		if(!binary_skip_attribute(attr))
+			header.num_attributes++;
+
+	vector<uchar> smooth(num_triangles);
+
+	for(size_t i = 0; i < num_triangles; i++)
+		smooth[i] = mesh->smooth[i];
+
+	bool ok = binary_write(f, &header, sizeof(header)) &&
+		binary_write(f, (num_verts)? &mesh->verts[0]: NULL, sizeof(float3)*num_verts) &&
+		binary_write(f, (num_triangles)? &mesh->triangles[0]: NULL, sizeof(Mesh::Triangle)*num_triangles) &&
+		binary_write(f, (num_triangles)? &smooth[0]: NULL, num_triangles);
+
+	foreach(const Attribute& attr, mesh->attributes.attributes) {
+		if(!ok)
+			break;
+		if(binary_skip_attribute(attr))
+			continue;
+
+		BinaryAttributeHeader aheader;
+		memset(&aheader, 0, sizeof(aheader));
+		aheader.std = attr.std;
+		aheader.element = attr.element;
+		aheader.basetype = attr.type.basetype;
+		aheader.aggregate = attr.type.aggregate;
+		aheader.vecsemantics = attr.type.vecsemantics;
+		aheader.arraylen = attr.type.arraylen;
+		aheader.name_size = attr.name.size();
+		aheader.data_size = attr.buffer.size();
+
+		ok = binary_write(f, &aheader, sizeof(aheader)) &&
+			binary_write(f, attr.name.c_str(), aheader.name_size) &&
+			binary_write(f, attr.data(), aheader.data_size);
+	}
+
+	if(fclose(f) != 0)
+		ok = false;
+
+	if(!ok)
+		fprintf(stderr, "%s: failed to write binary mesh.\n", filepath.c_str());
+
+	return ok;
+}
+
+void binary_write_meshes(Scene *scene, const string& dirpath)
+{
+	size_t i = 0;
+
+	foreach(Mesh *mesh, scene->meshes) {
+		string filepath = path_join(dirpath, string_printf("mesh_%04d.cymesh", (int)i++));
+
+		if(binary_write_mesh(mesh, filepath))
+			printf("Wrote %s (%d vertices, %d triangles).\n", filepath.c_str(),
+				(int)mesh->verts.size(), (int)mesh->triangles.size());
+	}
+}
+
+CCL_NAMESPACE_END
+
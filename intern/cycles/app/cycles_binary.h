@@ -0,0 +1,42 @@
+/*
+ * Copyright 2011, Blender Foundation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __CYCLES_BINARY__
+#define __CYCLES_BINARY__
+
+#include "util_string.h"
+
+CCL_NAMESPACE_BEGIN
+
+class Mesh;
+class Scene;
+
+/* Binary Mesh Files
+ *
+ * Vertex, triangle and attribute arrays stored in the same layout as in
+ * memory, each starting at a 16 byte aligned offset, so that they can be
+ * read with a single read per array instead of being parsed from XML. */
+
+bool binary_read_mesh(Mesh *mesh, const string& filepath, int shader);
+bool binary_write_mesh(Mesh *mesh, const string& filepath);
+void binary_write_meshes(Scene *scene, const string& dirpath);
+
+CCL_NAMESPACE_END
+
+#endif /* __CYCLES_BINARY__ */
+
@@ -21,6 +21,8 @@
 #include "buffers.h"
 #include "camera.h"
 #include "device.h"
+#include "integrator.h"
+#include "mesh.h"
 #include "scene.h"
 #include "session.h"
 
@@ -33,6 +35,7 @@
 #include "util_time.h"
 #include "util_view.h"
 
+#include "cycles_binary.h"
 #include "cycles_xml.h"
 
 CCL_NAMESPACE_BEGIN
@@ -45,6 +48,11 @@ struct Options {
 	SceneParams scene_params;
 	SessionParams session_params;
 	bool quiet;
+	bool benchmark;
+	int seed;
+	string export_path;
+	double load_time;
+	double render_time;
 } options;
 
 static void session_print(const string& str)
@@ -110,10 +118,60 @@ static void session_init()
 	options.scene = NULL;
 }
 
+static void session_print_benchmark()
+{
+	Scene *scene = options.session->scene;
+	const SceneUpdateTimes& times = scene->update_times;
+
+	/* render time excludes the scene update done by the session */
+	double render_time = max(options.render_time - times.total, 0.0);
+	double samples = options.session_params.samples;
+	double paths = (double)options.width*options.height*samples;
+
+	size_t num_triangles = 0;
+
+	foreach(Mesh *mesh, scene->meshes)
+		num_triangles += mesh->triangles.size();
+
+	printf("Scene            : %s\n", options.filepath.c_str());
+	printf("Resolution       : %d x %d, %d samples, seed %d\n",
+		options.width, options.height, options.session_params.samples, scene->integrator->seed);
+	printf("Geometry         : %d meshes, %d objects, %d triangles\n",
+		(int)scene->meshes.size(), (int)scene->objects.size(), (int)num_triangles);
+	printf("\n");
+	printf("Scene load       : %.4fs\n", options.load_time);
+	printf("Scene update     : %.4fs\n", times.total);
+	printf("  Shaders        : %.4fs\n", times.shaders);
+	printf("  Images         : %.4fs\n", times.images);
+	printf("  Meshes         : %.4fs\n", times.meshes - times.bvh);
+	printf("  BVH build      : %.4fs\n", times.bvh);
+	printf("  Other          : %.4fs\n", times.total - times.shaders - times.images - times.meshes);
+	printf("Render           : %.4fs\n", render_time);
+	printf("\n");
+
+	if(render_time > 0.0) {
+		printf("Samples/sec      : %.2f\n", samples/render_time);
+		printf("Camera rays/sec  : %.0f\n", paths/render_time);
+	}
+}
+
 static void scene_init(int width, int height)
 {
+	double start = time_dt();
+
 	options.scene = new Scene(options.scene_params, options.session_params.device);
 	xml_read_file(options.scene, options.filepath.c_str());
+
+	options.load_time = time_dt() - start;
+
+	/* fixed seed for reproducible renders */
+	if(options.seed >= 0) {
+		options.scene->integrator->seed = options.seed;
+		options.scene->integrator->tag_update(options.scene);
+	}
+
+	if(options.export_path != "")
+		binary_write_meshes(options.scene, options.export_path);
 	
 	if (width == 0 || height == 0) {
 		options.width = options.scene->camera->width;
@@ -204,6 +262,11 @@ static void options_parse(int argc, const char **argv)
 	options.filepath = "";
 	options.session = NULL;
 	options.quiet = false;
+	options.benchmark = false;
+	options.seed = -1;
+	options.export_path = "";
+	options.load_time = 0.0;
+	options.render_time = 0.0;
 
 	/* device names */
 	string device_names = "";
@@ -237,6 +300,9 @@ static void options_parse(int argc, const char **argv)
 		"--shadingsys %s", &ssname, "Shading system to use: svm, osl",
 		"--background", &options.session_params.background, "Render in background, without user interface",
 		"--quiet", &options.quiet, "In background mode, don't print progress messages",
+		"--benchmark", &options.benchmark, "Render in background and print timings of each phase",
+		"--seed %d", &options.seed, "Seed for the random number generator",
+		"--export-meshes %s", &options.export_path, "Directory to write meshes as binary files, for <mesh src=\"file\"/>",
 		"--samples %d", &options.session_params.samples, "Number of samples to render",
 		"--output %s", &options.session_params.output_path, "File path to write output image",
 		"--threads %d", &options.session_params.threads, "CPU Rendering Threads",
@@ -268,6 +334,12 @@ static void options_parse(int argc, const char **argv)
 		exit(EXIT_SUCCESS);
 	}
 
+	/* benchmark renders in the background without progress output */
+	if(options.benchmark) {
+		options.session_params.background = true;
+		options.quiet = true;
+	}
+
 	if(ssname == "osl")
 		options.scene_params.shadingsystem = SceneParams::OSL;
 	else if(ssname == "svm")
@@ -331,8 +403,16 @@ int main(int argc, const char **argv)
 	options_parse(argc, argv);
 
 	if(options.session_params.background) {
+		double start = time_dt();
+
 		session_init();
 		options.session->wait();
+
+		options.render_time = time_dt() - start;
+
+		if(options.benchmark)
+			session_print_benchmark();
+
 		session_exit();
 	}
 	else {
@@ -43,6 +43,7 @@
 #include "util_transform.h"
 #include "util_xml.h"
 
+#include "cycles_binary.h"
 #include "cycles_xml.h"
 
 CCL_NAMESPACE_BEGIN
@@ -281,6 +282,8 @@ static void xml_read_integrator(const XMLReadState& state, pugi::xml_node node)
 	
 	xml_read_int(&integrator->seed, node, "seed");
 	xml_read_float(&integrator->sample_clamp, node, "sample_clamp");
+
+	xml_read_bool(&integrator->deferred_shading, node, "deferred_shading");
 }
 
 /* Camera */
@@ -659,6 +662,14 @@ static void xml_read_mesh(const XMLReadState& state, pugi::xml_node node)
 
 	mesh->displacement_method = state.displacement_method;
 
+	/* read binary mesh file */
+	string src;
+
+	if(xml_read_string(&src, node, "src")) {
+		binary_read_mesh(mesh, path_join(state.base, src), shader);
+		return;
+	}
+
 	/* read vertices and polygons, RIB style */
 	vector<float3> P;
 	vector<int> verts, nverts;
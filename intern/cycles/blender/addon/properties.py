@@ -310,6 +310,22 @@ class CyclesRenderSettings(bpy.types.PropertyGroup):
                 default=0.0,
                 )
 
+        cls.adaptive_threshold = FloatProperty(
+                name="Adaptive Threshold",
+                description="If non-zero, stop sampling pixels once their noise is below this "
+                            "threshold, so render time depends on how difficult parts of the "
+                            "image are (CPU only)",
+                min=0.0, max=1.0,
+                default=0.0,
+                precision=4,
+                )
+        cls.adaptive_min_samples = IntProperty(
+                name="Adaptive Min Samples",
+                description="Number of samples to take before testing if pixels have stopped being noisy",
+                min=2, max=2147483647,
+                default=16,
+                )
+
         cls.debug_tile_size = IntProperty(
                 name="Tile Size",
                 description="",
@@ -355,9 +371,35 @@ class CyclesRenderSettings(bpy.types.PropertyGroup):
                 description="Use BVH spatial splits: longer builder time, faster render",
                 default=False,
                 )
+        cls.debug_use_qbvh = BoolProperty(
+                name="Use QBVH",
+                description="Use a 4-wide BVH with SIMD traversal on the CPU: faster render",
+                default=False,
+                )
+        cls.use_deferred_shading = BoolProperty(
+                name="Deferred Shading",
+                description="Shade the paths of a tile sorted by shader after each bounce, "
+                            "for more coherent memory access in scenes with many shaders (CPU only)",
+                default=False,
+                )
+        cls.use_particle_instancing = BoolProperty(
+                name="Particle Instancing",
+                description="Render meshes duplicated by particle systems as compact instances instead of "
+                            "separate objects, using less memory and sync time for many particles "
+                            "(not used with motion blur or vector pass)",
+                default=True,
+                )
+        cls.texture_cache_size = IntProperty(
+                name="Texture Cache (MB)",
+                description="Load image textures on demand, keeping at most this much image memory "
+                            "(CPU only, 0 to load images in full)",
+                min=0, max=65536,
+                default=0,
+                )
         cls.use_cache = BoolProperty(
-                name="Cache BVH",
-                description="Cache last built BVH to disk for faster re-render if no geometry changed",
+                name="Cache BVH and Images",
+                description="Cache last built BVH and decoded images to disk for faster re-render "
+                            "if no geometry or image files changed",
                 default=False,
                 )
         cls.tile_order = EnumProperty(
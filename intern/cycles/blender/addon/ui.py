@@ -64,6 +64,11 @@ class CyclesRender_PT_sampling(CyclesButtonsPanel, Panel):
         sub.prop(cscene, "seed")
         sub.prop(cscene, "sample_clamp")
 
+        sub = col.column(align=True)
+        sub.active = (device_type == 'NONE' or cscene.device == 'CPU')
+        sub.prop(cscene, "adaptive_threshold")
+        sub.prop(cscene, "adaptive_min_samples", text="Min Samples")
+
         if cscene.progressive or (device_type != 'NONE' and cscene.device == 'GPU'):
             col = split.column()
             col.label(text="Samples:")
@@ -209,7 +214,10 @@ class CyclesRender_PT_performance(CyclesButtonsPanel, Panel):
         sub.label(text="Acceleration structure:")
         sub.prop(cscene, "debug_bvh_type", text="")
         sub.prop(cscene, "debug_use_spatial_splits")
+        sub.prop(cscene, "debug_use_qbvh")
         sub.prop(cscene, "use_cache")
+        sub.prop(cscene, "use_deferred_shading")
+        sub.prop(cscene, "use_particle_instancing")
 
         sub = col.column(align=True)
         sub.label(text="Viewport:")
@@ -219,6 +227,10 @@ class CyclesRender_PT_performance(CyclesButtonsPanel, Panel):
         sub.label(text="Final Render:")
         sub.prop(rd, "use_persistent_data", text="Persistent Images")
 
+        sub = col.column(align=True)
+        sub.label(text="Images:")
+        sub.prop(cscene, "texture_cache_size")
+
 
 class CyclesRender_PT_layers(CyclesButtonsPanel, Panel):
     bl_label = "Layers"
@@ -340,6 +340,12 @@ void BlenderSync::sync_objects(BL::SpaceView3D b_v3d, int motion)
 	/* global particle index counter */
 	int particle_id = 1;
 
+	/* particle duplis of meshes as compact instances. instances have no motion
+	 * of their own, so they are not used when motion is needed */
+	PointerRNA cscene = RNA_pointer_get(&b_scene.ptr, "cycles");
+	bool use_particle_instancing = get_boolean(cscene, "use_particle_instancing") &&
+	                               scene->need_motion() == Scene::MOTION_NONE;
+
 	bool cancel = false;
 
 	for(; b_sce && !cancel; b_sce = b_sce.background_set()) {
@@ -389,6 +395,10 @@ void BlenderSync::sync_objects(BL::SpaceView3D b_v3d, int motion)
 							 * between frames and updates */
 							BL::Array<int, OBJECT_PERSISTENT_ID_SIZE> persistent_id = b_dup->persistent_id();
 
+							/* sync as instance of an object shared by the particle system */
+							if(!motion && use_particle_instancing && sync_dupli_instance(*b_ob, *b_dup, ob_layer))
+								continue;
+
 							/* sync object and mesh or light data */
 							Object *object = sync_object(*b_ob, persistent_id.data, *b_dup, tfm, ob_layer, motion, false);
 
@@ -451,6 +461,9 @@ void BlenderSync::sync_objects(BL::SpaceView3D b_v3d, int motion)
 	if(!cancel && !motion) {
 		sync_background_light();
 
+		/* remove particle instances that are gone */
+		sync_dupli_instances_end();
+
 		/* handle removed data and modified pointers */
 		if(light_map.post_sync())
 			scene->light_manager->tag_update(scene);
@@ -458,8 +471,11 @@ void BlenderSync::sync_objects(BL::SpaceView3D b_v3d, int motion)
 			scene->mesh_manager->tag_update(scene);
 		if(object_map.post_sync())
 			scene->object_manager->tag_update(scene);
-		if(particle_system_map.post_sync())
+		if(particle_system_map.post_sync()) {
+			/* removed particle systems may have had instances */
 			scene->particle_system_manager->tag_update(scene);
+			scene->object_manager->tag_update(scene);
+		}
 		mesh_synced.clear();
 	}
 }
@@ -24,6 +24,7 @@
 #include "blender_util.h"
 
 #include "util_foreach.h"
+#include "util_hash.h"
 
 CCL_NAMESPACE_BEGIN
 
@@ -60,6 +61,7 @@ bool BlenderSync::sync_dupli_particle(BL::Object b_ob, BL::DupliObject b_dup, Ob
 	/* first time used in this sync loop? clear and tag update */
 	if(first_use) {
 		psys->particles.clear();
+		psys->instances.clear();
 		psys->tag_update(scene);
 	}
 
@@ -82,4 +84,140 @@ bool BlenderSync::sync_dupli_particle(BL::Object b_ob, BL::DupliObject b_dup, Ob
 	return true;
 }
 
+static bool particles_equal(const Particle& a, const Particle& b)
+{
+	return (a.index == b.index && a.age == b.age && a.lifetime == b.lifetime &&
+	        a.location == b.location && a.rotation == b.rotation && a.size == b.size &&
+	        a.velocity == b.velocity && a.angular_velocity == b.angular_velocity);
+}
+
+static bool instances_equal(const ObjectInstance& a, const ObjectInstance& b)
+{
+	return (a.tfm == b.tfm && a.object == b.object && a.particle == b.particle &&
+	        a.random_id == b.random_id && a.dupli_generated == b.dupli_generated &&
+	        a.dupli_uv == b.dupli_uv);
+}
+
+bool BlenderSync::sync_dupli_instance(BL::Object b_ob, BL::DupliObject b_dup, uint layer_flag)
+{
+	/* test if this dupli was generated from a particle sytem */
+	BL::ParticleSystem b_psys = b_dup.particle_system();
+	if(!b_psys)
+		return false;
+
+	/* only meshes are instanced, lights are synced as usual */
+	BL::Object b_dup_ob = b_dup.object();
+	if(object_is_light(b_dup_ob) || !object_is_mesh(b_dup_ob))
+		return false;
+
+	/* all instances of an object in a particle system share one object,
+	 * keyed without the particle index and only rendered at the instances */
+	BL::Array<int, OBJECT_PERSISTENT_ID_SIZE> persistent_id = b_dup.persistent_id();
+	int object_id[OBJECT_PERSISTENT_ID_SIZE];
+
+	memcpy(object_id, persistent_id.data, sizeof(object_id));
+	object_id[0] = -1;
+
+	ObjectKey object_key(b_ob, object_id, b_dup_ob);
+	Object *object = object_map.find(object_key);
+
+	if(!object || !object_map.is_used(object_key)) {
+		Transform tfm = transform_identity();
+		object = sync_object(b_ob, object_id, b_dup, tfm, layer_flag, 0, false);
+
+		if(!object->instance_only) {
+			object->instance_only = true;
+			scene->object_manager->tag_update(scene);
+		}
+	}
+
+	/* find particle system */
+	ParticleSystemKey key(b_ob, persistent_id);
+	ParticleSystem *psys;
+
+	particle_system_map.sync(&psys, b_ob, b_dup_ob, key);
+
+	map<ParticleSystem*, int2>::iterator it = particle_instances_synced.find(psys);
+
+	if(it == particle_instances_synced.end())
+		it = particle_instances_synced.insert(std::make_pair(psys, make_int2(0, 0))).first;
+
+	int2& num_synced = it->second;
+
+	/* particle data, child particles don't have any */
+	int particle = -1;
+
+	if(persistent_id[0] < b_psys.particles.length()) {
+		BL::Particle b_pa = b_psys.particles[persistent_id[0]];
+		Particle pa;
+
+		pa.index = persistent_id[0];
+		pa.age = b_scene.frame_current() - b_pa.birth_time();
+		pa.lifetime = b_pa.lifetime();
+		pa.location = get_float3(b_pa.location());
+		pa.rotation = get_float4(b_pa.rotation());
+		pa.size = b_pa.size();
+		pa.velocity = get_float3(b_pa.velocity());
+		pa.angular_velocity = get_float3(b_pa.angular_velocity());
+
+		particle = num_synced.y++;
+
+		if(particle == (int)psys->particles.size()) {
+			psys->particles.push_back(pa);
+			psys->tag_update(scene);
+		}
+		else if(!particles_equal(psys->particles[particle], pa)) {
+			psys->particles[particle] = pa;
+			psys->tag_update(scene);
+		}
+	}
+
+	/* instance, compared with the one synced before in the same place so
+	 * unchanged particle systems don't need a device update */
+	ObjectInstance inst;
+
+	inst.tfm = get_transform(b_dup.matrix());
+	inst.object = object;
+	inst.particle = particle;
+	inst.random_id = hash_int_2d(object->random_id, persistent_id[0]);
+	inst.dupli_generated = get_float3(b_dup.orco());
+	inst.dupli_uv = get_float2(b_dup.uv());
+
+	int index = num_synced.x++;
+
+	if(index == (int)psys->instances.size()) {
+		psys->instances.push_back(inst);
+		scene->object_manager->tag_update(scene);
+	}
+	else if(!instances_equal(psys->instances[index], inst)) {
+		psys->instances[index] = inst;
+		scene->object_manager->tag_update(scene);
+	}
+
+	return true;
+}
+
+void BlenderSync::sync_dupli_instances_end()
+{
+	/* remove instances and particles that were not synced again */
+	map<ParticleSystem*, int2>::iterator it;
+
+	for(it = particle_instances_synced.begin(); it != particle_instances_synced.end(); it++) {
+		ParticleSystem *psys = it->first;
+		int2 num_synced = it->second;
+
+		if(num_synced.x != (int)psys->instances.size()) {
+			psys->instances.resize(num_synced.x);
+			scene->object_manager->tag_update(scene);
+		}
+
+		if(num_synced.y != (int)psys->particles.size()) {
+			psys->particles.resize(num_synced.y);
+			psys->tag_update(scene);
+		}
+	}
+
+	particle_instances_synced.clear();
+}
+
 CCL_NAMESPACE_END
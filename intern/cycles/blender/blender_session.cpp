@@ -295,6 +295,7 @@ void BlenderSession::render()
 	/* get buffer parameters */
 	SessionParams session_params = BlenderSync::get_session_params(b_engine, b_userpref, b_scene, background);
 	BufferParams buffer_params = BlenderSync::get_buffer_params(b_scene, b_v3d, b_rv3d, scene->camera, width, height);
+	PointerRNA cscene = RNA_pointer_get(&b_scene.ptr, "cycles");
 
 	/* render each layer */
 	BL::RenderSettings r = b_scene.render();
@@ -334,6 +335,10 @@ void BlenderSession::render()
 				if(pass_type != PASS_NONE)
 					Pass::add(pass_type, passes);
 			}
+
+			/* sample variance for adaptive sampling */
+			if(get_float(cscene, "adaptive_threshold") != 0.0f)
+				Pass::add(PASS_VARIANCE, passes);
 		}
 
 		/* free result without merging */
@@ -199,6 +199,11 @@ void BlenderSync::sync_integrator()
 	integrator->mesh_light_samples = get_int(cscene, "mesh_light_samples");
 	integrator->progressive = get_boolean(cscene, "progressive");
 
+	integrator->adaptive_threshold = get_float(cscene, "adaptive_threshold");
+	integrator->adaptive_min_samples = get_int(cscene, "adaptive_min_samples");
+
+	integrator->deferred_shading = get_boolean(cscene, "use_deferred_shading");
+
 	if(integrator->modified(previntegrator))
 		integrator->tag_update(scene);
 }
@@ -305,9 +310,12 @@ SceneParams BlenderSync::get_scene_params(BL::Scene b_scene, bool background)
 		params.bvh_type = (SceneParams::BVHType)RNA_enum_get(&cscene, "debug_bvh_type");
 
 	params.use_bvh_spatial_split = RNA_boolean_get(&cscene, "debug_use_spatial_splits");
+	params.use_qbvh = RNA_boolean_get(&cscene, "debug_use_qbvh");
 	params.use_bvh_cache = (background)? RNA_boolean_get(&cscene, "use_cache"): false;
+	params.use_image_cache = params.use_bvh_cache;
 
 	params.persistent_images = (background)? r.use_persistent_data(): false;
+	params.texture_cache_size = RNA_int_get(&cscene, "texture_cache_size");
 
 	return params;
 }
@@ -91,6 +91,8 @@ private:
 
 	/* particles */
 	bool sync_dupli_particle(BL::Object b_ob, BL::DupliObject b_dup, Object *object);
+	bool sync_dupli_instance(BL::Object b_ob, BL::DupliObject b_dup, uint layer_flag);
+	void sync_dupli_instances_end();
 
 	/* util */
 	void find_shader(BL::ID id, vector<uint>& used_shaders, int default_shader);
@@ -108,6 +110,9 @@ private:
 	id_map<void*, Mesh> mesh_map;
 	id_map<ObjectKey, Light> light_map;
 	id_map<ParticleSystemKey, ParticleSystem> particle_system_map;
+	/* number of instances and particles synced per particle system, to
+	 * detect changes in instancing particle systems */
+	map<ParticleSystem*, int2> particle_instances_synced;
 	set<Mesh*> mesh_synced;
 	void *world_map;
 	bool world_recalc;
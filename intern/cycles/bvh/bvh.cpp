@@ -56,6 +56,15 @@ struct BVHStackEntry
 BVH::BVH(const BVHParams& params_, const vector<Object*>& objects_)
 : params(params_), objects(objects_)
 {
+	need_merge = true;
+	refit_cost = 0.0f;
+	build_cost = 0.0f;
+	cache_data = NULL;
+}
+
+BVH::~BVH()
+{
+	delete cache_data;
 }
 
 BVH *BVH::create(const BVHParams& params, const vector<Object*>& objects)
@@ -80,28 +89,47 @@ bool BVH::cache_read(CacheData& key)
 		key.add(&ob->bounds, sizeof(ob->bounds));
 		key.add(&ob->visibility, sizeof(ob->visibility));
 		key.add(&ob->mesh->transform_applied, sizeof(bool));
+		key.add(&ob->instance_only, sizeof(bool));
 	}
 
-	CacheData value;
+	if(instances.size()) {
+		map<Object*, int> object_index;
 
-	if(Cache::global.lookup(key, value)) {
-		cache_filename = key.get_filename();
+		for(size_t i = 0; i < objects.size(); i++)
+			object_index[objects[i]] = i;
 
-		value.read(pack.root_index);
-		value.read(pack.SAH);
+		foreach(ObjectInstance *inst, instances) {
+			key.add(&inst->tfm, sizeof(inst->tfm));
+			key.add(&object_index[inst->object], sizeof(int));
+		}
+	}
 
-		value.read(pack.nodes);
-		value.read(pack.object_node);
-		value.read(pack.tri_woop);
-		value.read(pack.prim_segment);
-		value.read(pack.prim_visibility);
-		value.read(pack.prim_index);
-		value.read(pack.prim_object);
-		value.read(pack.is_leaf);
+	/* map instead of reading, other renders of the same file share the memory */
+	CacheData *value = new CacheData();
+
+	if(Cache::global.map(key, *value)) {
+		bool ok = value->read(&pack.root_index, sizeof(pack.root_index)) &&
+		          value->read(&pack.SAH, sizeof(pack.SAH)) &&
+		          value->map(pack.nodes) &&
+		          value->map(pack.object_node) &&
+		          value->map(pack.tri_woop) &&
+		          value->map(pack.prim_segment) &&
+		          value->map(pack.prim_visibility) &&
+		          value->map(pack.prim_index) &&
+		          value->map(pack.prim_object) &&
+		          value->map(pack.is_leaf);
+
+		if(ok) {
+			delete cache_data;
+			cache_data = value;
+			cache_filename = key.get_filename();
+			return true;
+		}
 
-		return true;
+		pack = PackedBVH();
 	}
 
+	delete value;
 	return false;
 }
 
@@ -165,7 +193,7 @@ void BVH::build(Progress& progress)
 	vector<int> prim_index;
 	vector<int> prim_object;
 
-	BVHBuild bvh_build(objects, prim_segment, prim_index, prim_object, params, progress);
+	BVHBuild bvh_build(objects, instances, prim_segment, prim_index, prim_object, params, progress);
 	BVHNode *root = bvh_build.run();
 
 	if(progress.get_cancel()) {
@@ -206,6 +234,13 @@ void BVH::build(Progress& progress)
 
 	if(progress.get_cancel()) return;
 
+	/* cost of the top level nodes as built, to compare refits against. refit
+	 * would undo the tighter boxes of spatial splits, those always rebuild */
+	if(params.top_level && !params.use_spatial_split) {
+		refit_nodes();
+		build_cost = refit_cost;
+	}
+
 	/* cache write */
 	if(params.use_cache) {
 		progress.set_substatus("Writing BVH cache");
@@ -228,6 +263,8 @@ void BVH::refit(Progress& progress)
 
 	progress.set_substatus("Refitting BVH nodes");
 	refit_nodes();
+
+	need_merge = true;
 }
 
 /* Triangles */
@@ -349,8 +386,6 @@ void BVH::pack_instances(size_t nodes_size)
 	/* The BVH's for instances are built separately, but for traversal all
 	 * BVH's are stored in global arrays. This function merges them into the
 	 * top level BVH, adjusting indexes and offsets where appropriate. */
-	bool use_qbvh = params.use_qbvh;
-	size_t nsize = (use_qbvh)? BVH_QNODE_SIZE: BVH_NODE_SIZE;
 
 	/* adjust primitive index to point to the triangle in the global array, for
 	 * meshes with transform applied and already in the top level BVH */
@@ -363,155 +398,283 @@ void BVH::pack_instances(size_t nodes_size)
 		}
 
 	/* track offsets of instanced BVH data in global array */
-	size_t prim_offset = pack.prim_index.size();
-	size_t nodes_offset = nodes_size;
-
-	/* clear array that gives the node indexes for instanced objects */
-	pack.object_node.clear();
-
-	/* reserve */
 	size_t prim_index_size = pack.prim_index.size();
 	size_t tri_woop_size = pack.tri_woop.size();
 
-	size_t pack_prim_index_offset = prim_index_size;
-	size_t pack_tri_woop_offset = tri_woop_size;
-	size_t pack_nodes_offset = nodes_size;
-	size_t object_offset = 0;
+	merged_instances.clear();
+	merged_object_mesh.clear();
+	merged_object_mesh.reserve(objects.size() + instances.size());
 
 	map<Mesh*, int> mesh_map;
 
-	foreach(Object *ob, objects) {
-		Mesh *mesh = ob->mesh;
+	for(size_t i = 0; i < objects.size() + instances.size(); i++) {
+		/* if mesh transform is applied, that means it's already in the top
+		 * level BVH, and we don't need to merge it in. objects only rendered
+		 * through instances are not in the top level BVH themselves */
+		Mesh *mesh = get_instanced_mesh(i);
+
+		merged_object_mesh.push_back(mesh);
+
+		if(!mesh)
+			continue;
+
+		/* if mesh already added once, don't add it again */
+		if(mesh_map.find(mesh) != mesh_map.end())
+			continue;
+
 		BVH *bvh = mesh->bvh;
+		MergedInstance inst;
 
-		if(!mesh->transform_applied) {
-			if(mesh_map.find(mesh) == mesh_map.end()) {
-				prim_index_size += bvh->pack.prim_index.size();
-				tri_woop_size += bvh->pack.tri_woop.size();
-				nodes_size += bvh->pack.nodes.size()*nsize;
+		inst.mesh = mesh;
+		inst.tri_offset = mesh->tri_offset;
+		inst.curve_offset = mesh->curve_offset;
 
-				mesh_map[mesh] = 1;
-			}
-		}
-	}
+		inst.prim_offset = prim_index_size;
+		inst.tri_woop_offset = tri_woop_size;
+		inst.nodes_offset = nodes_size;
+
+		inst.prim_size = bvh->pack.prim_index.size();
+		inst.tri_woop_size = bvh->pack.tri_woop.size();
+		inst.nodes_size = bvh->pack.nodes.size();
 
-	mesh_map.clear();
+		prim_index_size += inst.prim_size;
+		tri_woop_size += inst.tri_woop_size;
+		nodes_size += inst.nodes_size;
 
+		mesh_map[mesh] = merged_instances.size();
+		merged_instances.push_back(inst);
+	}
+
+	/* reserve */
 	pack.prim_index.resize(prim_index_size);
 	pack.prim_segment.resize(prim_index_size);
 	pack.prim_object.resize(prim_index_size);
 	pack.prim_visibility.resize(prim_index_size);
 	pack.tri_woop.resize(tri_woop_size);
 	pack.nodes.resize(nodes_size);
-	pack.object_node.resize(objects.size());
-
-	int *pack_prim_index = (pack.prim_index.size())? &pack.prim_index[0]: NULL;
-	int *pack_prim_segment = (pack.prim_segment.size())? &pack.prim_segment[0]: NULL;
-	int *pack_prim_object = (pack.prim_object.size())? &pack.prim_object[0]: NULL;
-	uint *pack_prim_visibility = (pack.prim_visibility.size())? &pack.prim_visibility[0]: NULL;
-	float4 *pack_tri_woop = (pack.tri_woop.size())? &pack.tri_woop[0]: NULL;
-	int4 *pack_nodes = (pack.nodes.size())? &pack.nodes[0]: NULL;
 
 	/* merge */
-	foreach(Object *ob, objects) {
-		Mesh *mesh = ob->mesh;
+	foreach(const MergedInstance& inst, merged_instances)
+		merge_instance(inst);
 
-		/* if mesh transform is applied, that means it's already in the top
-		 * level BVH, and we don't need to merge it in */
-		if(mesh->transform_applied) {
-			pack.object_node[object_offset++] = 0;
-			continue;
+	pack_object_nodes();
+}
+
+void BVH::merge_instance(const MergedInstance& inst)
+{
+	size_t nsize = (params.use_qbvh)? BVH_QNODE_SIZE: BVH_NODE_SIZE;
+	BVH *bvh = inst.mesh->bvh;
+
+	int noffset = inst.nodes_offset/nsize;
+	int prim_offset = inst.prim_offset;
+	int mesh_tri_offset = inst.tri_offset;
+	int mesh_curve_offset = inst.curve_offset;
+
+	/* merge primitive and object indexes */
+	if(inst.prim_size) {
+		int *pack_prim_index = &pack.prim_index[prim_offset];
+		int *pack_prim_segment = &pack.prim_segment[prim_offset];
+		int *pack_prim_object = &pack.prim_object[prim_offset];
+		uint *pack_prim_visibility = &pack.prim_visibility[prim_offset];
+
+		int *bvh_prim_index = &bvh->pack.prim_index[0];
+		int *bvh_prim_segment = &bvh->pack.prim_segment[0];
+		uint *bvh_prim_visibility = &bvh->pack.prim_visibility[0];
+
+		for(size_t i = 0; i < inst.prim_size; i++) {
+			if(bvh_prim_segment[i] != ~0)
+				pack_prim_index[i] = bvh_prim_index[i] + mesh_curve_offset;
+			else
+				pack_prim_index[i] = bvh_prim_index[i] + mesh_tri_offset;
+
+			pack_prim_segment[i] = bvh_prim_segment[i];
+			pack_prim_visibility[i] = bvh_prim_visibility[i];
+			pack_prim_object[i] = 0;  // unused for instances
 		}
+	}
 
-		/* if mesh already added once, don't add it again, but used set
-		 * node offset for this object */
-		map<Mesh*, int>::iterator it = mesh_map.find(mesh);
+	/* merge triangle intersection data */
+	if(inst.tri_woop_size) {
+		memcpy(&pack.tri_woop[inst.tri_woop_offset], &bvh->pack.tri_woop[0],
+			inst.tri_woop_size*sizeof(float4));
+	}
 
-		if(mesh_map.find(mesh) != mesh_map.end()) {
-			int noffset = it->second;
-			pack.object_node[object_offset++] = noffset;
-			continue;
+	/* merge nodes */
+	if(inst.nodes_size) {
+		bool use_qbvh = params.use_qbvh;
+		size_t nsize_bbox = (use_qbvh)? nsize-2: nsize-1;
+		int4 *pack_nodes = &pack.nodes[inst.nodes_offset];
+		int4 *bvh_nodes = &bvh->pack.nodes[0];
+		int *bvh_is_leaf = (bvh->pack.is_leaf.size() != 0) ? &bvh->pack.is_leaf[0] : NULL;
+
+		for(size_t i = 0, j = 0; i < inst.nodes_size; i+=nsize, j++) {
+			memcpy(pack_nodes + i, bvh_nodes + i, nsize_bbox*sizeof(int4));
+
+			/* modify offsets into arrays */
+			int4 data = bvh_nodes[i + nsize_bbox];
+
+			if(bvh_is_leaf && bvh_is_leaf[j]) {
+				data.x += prim_offset;
+				data.y += prim_offset;
+			}
+			else {
+				data.x += (data.x < 0)? -noffset: noffset;
+				data.y += (data.y < 0)? -noffset: noffset;
+
+				if(use_qbvh) {
+					data.z += (data.z < 0)? -noffset: noffset;
+					data.w += (data.w < 0)? -noffset: noffset;
+				}
+			}
+
+			pack_nodes[i + nsize_bbox] = data;
+
+			if(use_qbvh)
+				pack_nodes[i + nsize_bbox+1] = bvh_nodes[i + nsize_bbox+1];
 		}
+	}
 
-		BVH *bvh = mesh->bvh;
+	bvh->need_merge = false;
+}
 
-		int noffset = nodes_offset/nsize;
-		int mesh_tri_offset = mesh->tri_offset;
-		int mesh_curve_offset = mesh->curve_offset;
+void BVH::pack_object_nodes()
+{
+	/* fill in node indexes for instanced objects, objects with transform
+	 * applied are in the top level BVH */
+	size_t nsize = (params.use_qbvh)? BVH_QNODE_SIZE: BVH_NODE_SIZE;
+	map<Mesh*, int> mesh_node;
+
+	foreach(const MergedInstance& inst, merged_instances) {
+		BVH *bvh = inst.mesh->bvh;
+		int noffset = inst.nodes_offset/nsize;
 
-		/* fill in node indexes for instances */
 		if((bvh->pack.is_leaf.size() != 0) && bvh->pack.is_leaf[0])
-			pack.object_node[object_offset++] = -noffset-1;
+			mesh_node[inst.mesh] = -noffset-1;
 		else
-			pack.object_node[object_offset++] = noffset;
-
-		mesh_map[mesh] = pack.object_node[object_offset-1];
-
-		/* merge primitive and object indexes */
-		if(bvh->pack.prim_index.size()) {
-			size_t bvh_prim_index_size = bvh->pack.prim_index.size();
-			int *bvh_prim_index = &bvh->pack.prim_index[0];
-			int *bvh_prim_segment = &bvh->pack.prim_segment[0];
-			uint *bvh_prim_visibility = &bvh->pack.prim_visibility[0];
-
-			for(size_t i = 0; i < bvh_prim_index_size; i++) {
-				if(bvh->pack.prim_segment[i] != ~0)
-					pack_prim_index[pack_prim_index_offset] = bvh_prim_index[i] + mesh_curve_offset;
-				else
-					pack_prim_index[pack_prim_index_offset] = bvh_prim_index[i] + mesh_tri_offset;
-
-				pack_prim_segment[pack_prim_index_offset] = bvh_prim_segment[i];
-				pack_prim_visibility[pack_prim_index_offset] = bvh_prim_visibility[i];
-				pack_prim_object[pack_prim_index_offset] = 0;  // unused for instances
-				pack_prim_index_offset++;
-			}
-		}
+			mesh_node[inst.mesh] = noffset;
+	}
 
-		/* merge triangle intersection data */
-		if(bvh->pack.tri_woop.size()) {
-			memcpy(pack_tri_woop + pack_tri_woop_offset, &bvh->pack.tri_woop[0],
-				bvh->pack.tri_woop.size()*sizeof(float4));
-			pack_tri_woop_offset += bvh->pack.tri_woop.size();
-		}
+	pack.object_node.clear();
+	pack.object_node.resize(merged_object_mesh.size());
 
-		/* merge nodes */
-		if( bvh->pack.nodes.size()) {
-			size_t nsize_bbox = (use_qbvh)? nsize-2: nsize-1;
-			int4 *bvh_nodes = &bvh->pack.nodes[0];
-			size_t bvh_nodes_size = bvh->pack.nodes.size(); 
-			int *bvh_is_leaf = (bvh->pack.is_leaf.size() != 0) ? &bvh->pack.is_leaf[0] : NULL;
+	for(size_t i = 0; i < merged_object_mesh.size(); i++)
+		pack.object_node[i] = (merged_object_mesh[i])? mesh_node[merged_object_mesh[i]]: 0;
+}
+
+/* Object Instances */
 
-			for(size_t i = 0, j = 0; i < bvh_nodes_size; i+=nsize, j++) {
-				memcpy(pack_nodes + pack_nodes_offset, bvh_nodes + i, nsize_bbox*sizeof(int4));
+Object *BVH::get_object(int i)
+{
+	if(i < (int)objects.size())
+		return objects[i];
+	else
+		return instances[i - objects.size()]->object;
+}
 
-				/* modify offsets into arrays */
-				int4 data = bvh_nodes[i + nsize_bbox];
+Mesh *BVH::get_instanced_mesh(int i)
+{
+	Object *ob = get_object(i);
 
-				if(bvh_is_leaf && bvh_is_leaf[j]) {
-					data.x += prim_offset;
-					data.y += prim_offset;
-				}
-				else {
-					data.x += (data.x < 0)? -noffset: noffset;
-					data.y += (data.y < 0)? -noffset: noffset;
-
-					if(use_qbvh) {
-						data.z += (data.z < 0)? -noffset: noffset;
-						data.w += (data.w < 0)? -noffset: noffset;
-					}
-				}
+	if(i < (int)objects.size() && (ob->mesh->transform_applied || ob->instance_only))
+		return NULL;
 
-				pack_nodes[pack_nodes_offset + nsize_bbox] = data;
+	return ob->mesh;
+}
+
+/* Top Level Refit */
+
+bool BVH::refit_top_level(Progress& progress)
+{
+	assert(params.top_level);
+
+	if(build_cost == 0.0f)
+		return false;
+
+	/* objects must use the same meshes as when the instances were merged */
+	if(merged_object_mesh.size() != objects.size() + instances.size())
+		return false;
+
+	for(size_t i = 0; i < merged_object_mesh.size(); i++)
+		if(merged_object_mesh[i] != get_instanced_mesh(i))
+			return false;
+
+	/* and the instance BVH's must still fit in their place in the arrays */
+	foreach(const MergedInstance& inst, merged_instances) {
+		Mesh *mesh = inst.mesh;
+		BVH *bvh = mesh->bvh;
+
+		if(!bvh || mesh->tri_offset != inst.tri_offset || mesh->curve_offset != inst.curve_offset)
+			return false;
+		if(bvh->pack.prim_index.size() != inst.prim_size ||
+		   bvh->pack.tri_woop.size() != inst.tri_woop_size ||
+		   bvh->pack.nodes.size() != inst.nodes_size)
+			return false;
+	}
+
+	/* merge only the instance BVH's that changed */
+	progress.set_substatus("Merging instance BVH's");
+
+	foreach(const MergedInstance& inst, merged_instances)
+		if(inst.mesh->bvh->need_merge)
+			merge_instance(inst);
+
+	pack_object_nodes();
+
+	if(progress.get_cancel()) return true;
+
+	/* object bounds and visibility may have changed */
+	progress.set_substatus("Refitting BVH nodes");
+	refit_nodes();
 
-				if(use_qbvh)
-					pack_nodes[pack_nodes_offset + nsize_bbox+1] = bvh_nodes[i + nsize_bbox+1];
+	/* rebuild once moving objects made the tree much worse than as built */
+	if(refit_cost > 2.0f*build_cost)
+		return false;
 
-				pack_nodes_offset += nsize;
+	return true;
+}
+
+/* Refit */
+
+void BVH::refit_primitives(int start, int end, BoundBox& bbox, uint& visibility)
+{
+	for(int prim = start; prim < end; prim++) {
+		int pidx = pack.prim_index[prim];
+		int tob = pack.prim_object[prim];
+		Object *ob = get_object(tob);
+
+		if(pidx == -1) {
+			/* object instance */
+			if(tob < (int)objects.size())
+				bbox.grow(ob->bounds);
+			else
+				bbox.grow(instances[tob - objects.size()]->bounds());
+		}
+		else {
+			/* primitives */
+			const Mesh *mesh = ob->mesh;
+
+			if(pack.prim_segment[prim] != ~0) {
+				/* curves */
+				int str_offset = (params.top_level)? mesh->curve_offset: 0;
+				int k0 = mesh->curves[pidx - str_offset].first_key + pack.prim_segment[prim]; // XXX!
+				int k1 = k0 + 1;
+
+				bbox.grow(mesh->curve_keys[k0].co, mesh->curve_keys[k0].radius);
+				bbox.grow(mesh->curve_keys[k1].co, mesh->curve_keys[k1].radius);
+			}
+			else {
+				/* triangles */
+				int tri_offset = (params.top_level)? mesh->tri_offset: 0;
+				const int *vidx = mesh->triangles[pidx - tri_offset].v;
+				const float3 *vpos = &mesh->verts[0];
+
+				bbox.grow(vpos[vidx[0]]);
+				bbox.grow(vpos[vidx[1]]);
+				bbox.grow(vpos[vidx[2]]);
 			}
 		}
 
-		nodes_offset += bvh->pack.nodes.size();
-		prim_offset += bvh->pack.prim_index.size();
+		visibility |= ob->visibility;
 	}
 }
 
@@ -596,10 +759,10 @@ void RegularBVH::pack_nodes(const array<int>& prims, const BVHNode *root)
 
 void RegularBVH::refit_nodes()
 {
-	assert(!params.top_level);
-
 	BoundBox bbox = BoundBox::empty;
 	uint visibility = 0;
+
+	refit_cost = 0.0f;
 	refit_node(0, (pack.is_leaf[0])? true: false, bbox, visibility);
 }
 
@@ -612,42 +775,11 @@ void RegularBVH::refit_node(int idx, bool leaf, BoundBox& bbox, uint& visibility
 
 	if(leaf) {
 		/* refit leaf node */
-		for(int prim = c0; prim < c1; prim++) {
-			int pidx = pack.prim_index[prim];
-			int tob = pack.prim_object[prim];
-			Object *ob = objects[tob];
-
-			if(pidx == -1) {
-				/* object instance */
-				bbox.grow(ob->bounds);
-			}
-			else {
-				/* primitives */
-				const Mesh *mesh = ob->mesh;
-
-				if(pack.prim_segment[prim] != ~0) {
-					/* curves */
-					int str_offset = (params.top_level)? mesh->curve_offset: 0;
-					int k0 = mesh->curves[pidx - str_offset].first_key + pack.prim_segment[prim]; // XXX!
-					int k1 = k0 + 1;
-
-					bbox.grow(mesh->curve_keys[k0].co, mesh->curve_keys[k0].radius);
-					bbox.grow(mesh->curve_keys[k1].co, mesh->curve_keys[k1].radius);
-				}
-				else {
-					/* triangles */
-					int tri_offset = (params.top_level)? mesh->tri_offset: 0;
-					const int *vidx = mesh->triangles[pidx - tri_offset].v;
-					const float3 *vpos = &mesh->verts[0];
-
-					bbox.grow(vpos[vidx[0]]);
-					bbox.grow(vpos[vidx[1]]);
-					bbox.grow(vpos[vidx[2]]);
-				}
-			}
-
-			visibility |= ob->visibility;
-		}
+		if(c0 < 0)
+			/* object */
+			refit_primitives(~c0, ~c0 + 1, bbox, visibility);
+		else
+			refit_primitives(c0, c1, bbox, visibility);
 
 		pack_node(idx, bbox, bbox, c0, c1, visibility, visibility);
 	}
@@ -661,6 +793,8 @@ void RegularBVH::refit_node(int idx, bool leaf, BoundBox& bbox, uint& visibility
 
 		pack_node(idx, bbox0, bbox1, c0, c1, visibility0, visibility1);
 
+		refit_cost += bbox0.safe_area() + bbox1.safe_area();
+
 		bbox.grow(bbox0);
 		bbox.grow(bbox1);
 		visibility = visibility0|visibility1;
@@ -673,8 +807,6 @@ QBVH::QBVH(const BVHParams& params_, const vector<Object*>& objects_)
 : BVH(params_, objects_)
 {
 	params.use_qbvh = true;
-
-	/* todo: use visibility */
 }
 
 void QBVH::pack_leaf(const BVHStackEntry& e, const LeafNode *leaf)
@@ -698,12 +830,27 @@ void QBVH::pack_leaf(const BVHStackEntry& e, const LeafNode *leaf)
 }
 
 void QBVH::pack_inner(const BVHStackEntry& e, const BVHStackEntry *en, int num)
+{
+	BoundBox bounds[4];
+	int child[4];
+	uint visibility[4];
+
+	for(int i = 0; i < num; i++) {
+		bounds[i] = en[i].node->m_bounds;
+		child[i] = en[i].encodeIdx();
+		visibility[i] = en[i].node->m_visibility;
+	}
+
+	pack_node(e.idx, bounds, child, visibility, num);
+}
+
+void QBVH::pack_node(int idx, const BoundBox *bounds, const int *child, const uint *visibility, int num)
 {
 	float4 data[BVH_QNODE_SIZE];
 
 	for(int i = 0; i < num; i++) {
-		float3 bb_min = en[i].node->m_bounds.min;
-		float3 bb_max = en[i].node->m_bounds.max;
+		float3 bb_min = bounds[i].min;
+		float3 bb_max = bounds[i].max;
 
 		data[0][i] = bb_min.x;
 		data[1][i] = bb_max.x;
@@ -712,24 +859,25 @@ void QBVH::pack_inner(const BVHStackEntry& e, const BVHStackEntry *en, int num)
 		data[4][i] = bb_min.z;
 		data[5][i] = bb_max.z;
 
-		data[6][i] = __int_as_float(en[i].encodeIdx());
-		data[7][i] = 0.0f;
+		data[6][i] = __int_as_float(child[i]);
+		data[7][i] = __uint_as_float(visibility[i]);
 	}
 
 	for(int i = num; i < 4; i++) {
-		data[0][i] = 0.0f;
-		data[1][i] = 0.0f;
-		data[2][i] = 0.0f;
+		/* empty slots get an inverted box that no ray can hit */
+		data[0][i] = FLT_MAX;
+		data[1][i] = -FLT_MAX;
+		data[2][i] = FLT_MAX;
 
-		data[3][i] = 0.0f;
-		data[4][i] = 0.0f;
-		data[5][i] = 0.0f;
+		data[3][i] = -FLT_MAX;
+		data[4][i] = FLT_MAX;
+		data[5][i] = -FLT_MAX;
 
 		data[6][i] = __int_as_float(0);
-		data[7][i] = 0.0f;
+		data[7][i] = __uint_as_float(0);
 	}
 
-	memcpy(&pack.nodes[e.idx * BVH_QNODE_SIZE], data, sizeof(float4)*BVH_QNODE_SIZE);
+	memcpy(&pack.nodes[idx * BVH_QNODE_SIZE], data, sizeof(float4)*BVH_QNODE_SIZE);
 }
 
 /* Quad SIMD Nodes */
@@ -806,7 +954,58 @@ void QBVH::pack_nodes(const array<int>& prims, const BVHNode *root)
 
 void QBVH::refit_nodes()
 {
-	assert(0); /* todo */
+	BoundBox bbox = BoundBox::empty;
+	uint visibility = 0;
+
+	refit_cost = 0.0f;
+	refit_node(0, (pack.is_leaf[0])? true: false, bbox, visibility);
+}
+
+void QBVH::refit_node(int idx, bool leaf, BoundBox& bbox, uint& visibility)
+{
+	int4 *data = &pack.nodes[idx*BVH_QNODE_SIZE];
+
+	if(leaf) {
+		/* refit leaf node, its layout stays the same */
+		int c0 = data[6].x;
+		int c1 = data[6].y;
+
+		if(c0 < 0) {
+			/* single object instance */
+			c0 = ~c0;
+			c1 = c0 + 1;
+		}
+
+		refit_primitives(c0, c1, bbox, visibility);
+	}
+	else {
+		/* refit inner node, set bboxes from children */
+		BoundBox bounds[4];
+		int child[4];
+		uint child_visibility[4];
+		int num;
+
+		/* used slots come first, empty ones have child index 0, which is the
+		 * root and never a child. their box can't be used for this, a refitted
+		 * child without primitives gets an empty box too */
+		for(num = 0; num < 4; num++) {
+			int c = data[6][num];
+
+			if(c == 0)
+				break;
+
+			bounds[num] = BoundBox::empty;
+			child_visibility[num] = 0;
+			refit_node((c < 0)? -c-1: c, (c < 0), bounds[num], child_visibility[num]);
+
+			child[num] = c;
+			refit_cost += bounds[num].safe_area();
+			bbox.grow(bounds[num]);
+			visibility |= child_visibility[num];
+		}
+
+		pack_node(idx, bounds, child, child_visibility, num);
+	}
 }
 
 CCL_NAMESPACE_END
@@ -32,8 +32,10 @@ class BVHParams;
 class BoundBox;
 class CacheData;
 class LeafNode;
+class Mesh;
 class Object;
 class Progress;
+struct ObjectInstance;
 
 #define BVH_NODE_SIZE	4
 #define BVH_QNODE_SIZE	8
@@ -86,20 +88,32 @@ public:
 	PackedBVH pack;
 	BVHParams params;
 	vector<Object*> objects;
+	/* compact instances, with object ids following the objects */
+	vector<ObjectInstance*> instances;
 	string cache_filename;
 
+	/* instance BVH changed since it was merged into the top level BVH */
+	bool need_merge;
+
 	static BVH *create(const BVHParams& params, const vector<Object*>& objects);
-	virtual ~BVH() {}
+	virtual ~BVH();
 
 	void build(Progress& progress);
 	void refit(Progress& progress);
 
+	/* update top level BVH in place, reusing the merged instance BVH's.
+	 * returns false if the objects or instance sizes changed, and a
+	 * rebuild is needed */
+	bool refit_top_level(Progress& progress);
+
 	void clear_cache_except();
 
 protected:
 	BVH(const BVHParams& params, const vector<Object*>& objects);
 
-	/* cache */
+	/* cache, the packed arrays reference the memory mapped cache file */
+	CacheData *cache_data;
+
 	bool cache_read(CacheData& key);
 	void cache_write(CacheData& key);
 
@@ -108,8 +122,40 @@ protected:
 	void pack_triangle(int idx, float4 woop[3]);
 	void pack_curve_segment(int idx, float4 woop[3]);
 
+	/* instance BVH merged into a top level BVH, and its offsets there */
+	struct MergedInstance {
+		Mesh *mesh;
+		size_t tri_offset;
+		size_t curve_offset;
+
+		size_t prim_offset;
+		size_t tri_woop_offset;
+		size_t nodes_offset;
+
+		size_t prim_size;
+		size_t tri_woop_size;
+		size_t nodes_size;
+	};
+
+	vector<MergedInstance> merged_instances;
+	/* mesh of each object and instance, NULL if not instanced in the top level */
+	vector<Mesh*> merged_object_mesh;
+
+	/* object or instance by object id, and its mesh if instanced */
+	Object *get_object(int i);
+	Mesh *get_instanced_mesh(int i);
+
 	/* merge instance BVH's */
 	void pack_instances(size_t nodes_size);
+	void merge_instance(const MergedInstance& inst);
+	void pack_object_nodes();
+
+	/* summed area of all child boxes, set by refit_nodes */
+	float refit_cost;
+	float build_cost;
+
+	/* bounds and visibility of a leaf's primitives, for refit */
+	void refit_primitives(int start, int end, BoundBox& bbox, uint& visibility);
 
 	/* for subclasses to implement */
 	virtual void pack_nodes(const array<int>& prims, const BVHNode *root) = 0;
@@ -151,9 +197,11 @@ protected:
 	void pack_nodes(const array<int>& prims, const BVHNode *root);
 	void pack_leaf(const BVHStackEntry& e, const LeafNode *leaf);
 	void pack_inner(const BVHStackEntry& e, const BVHStackEntry *en, int num);
+	void pack_node(int idx, const BoundBox *bounds, const int *child, const uint *visibility, int num);
 
 	/* refit */
 	void refit_nodes();
+	void refit_node(int idx, bool leaf, BoundBox& bbox, uint& visibility);
 };
 
 CCL_NAMESPACE_END
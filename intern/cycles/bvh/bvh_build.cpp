@@ -45,12 +45,27 @@ public:
 	BVHObjectBinning range;
 };
 
+/* BVH Spatial Split Build Task */
+
+class BVHSpatialSplitBuildTask : public Task {
+public:
+	BVHSpatialSplitBuildTask(BVHBuild *build, InnerNode *node, int child, const BVHRange& range_, BVHSpatialStorage *parent, int level)
+	: range(range_.bounds(), 0, range_.size())
+	{
+		BVHSpatialStorage *storage = build->spatial_storage_create(parent, range_, child, level);
+		run = function_bind(&BVHBuild::thread_build_spatial_split_node, build, node, child, &range, storage, level);
+	}
+
+	BVHRange range;
+};
+
 /* Constructor / Destructor */
 
-BVHBuild::BVHBuild(const vector<Object*>& objects_,
+BVHBuild::BVHBuild(const vector<Object*>& objects_, const vector<ObjectInstance*>& instances_,
 	vector<int>& prim_segment_, vector<int>& prim_index_, vector<int>& prim_object_,
 	const BVHParams& params_, Progress& progress_)
 : objects(objects_),
+  instances(instances_),
   prim_segment(prim_segment_),
   prim_index(prim_index_),
   prim_object(prim_object_),
@@ -63,6 +78,7 @@ BVHBuild::BVHBuild(const vector<Object*>& objects_,
 
 BVHBuild::~BVHBuild()
 {
+	spatial_storage_free();
 }
 
 /* Adding References */
@@ -106,11 +122,11 @@ void BVHBuild::add_reference_mesh(BoundBox& root, BoundBox& center, Mesh *mesh,
 	}
 }
 
-void BVHBuild::add_reference_object(BoundBox& root, BoundBox& center, Object *ob, int i)
+void BVHBuild::add_reference_object(BoundBox& root, BoundBox& center, const BoundBox& bounds, int i)
 {
-	references.push_back(BVHReference(ob->bounds, -1, i, false));
-	root.grow(ob->bounds);
-	center.grow(ob->bounds.center2());
+	references.push_back(BVHReference(bounds, -1, i, false));
+	root.grow(bounds);
+	center.grow(bounds.center2());
 }
 
 static size_t count_curve_segments(Mesh *mesh)
@@ -134,7 +150,7 @@ void BVHBuild::add_references(BVHRange& root)
 				num_alloc_references += ob->mesh->triangles.size();
 				num_alloc_references += count_curve_segments(ob->mesh);
 			}
-			else
+			else if(!ob->instance_only)
 				num_alloc_references++;
 		}
 		else {
@@ -143,6 +159,9 @@ void BVHBuild::add_references(BVHRange& root)
 		}
 	}
 
+	if(params.top_level)
+		num_alloc_references += instances.size();
+
 	references.reserve(num_alloc_references);
 
 	/* add references from objects */
@@ -153,8 +172,8 @@ void BVHBuild::add_references(BVHRange& root)
 		if(params.top_level) {
 			if(ob->mesh->transform_applied)
 				add_reference_mesh(bounds, center, ob->mesh, i);
-			else
-				add_reference_object(bounds, center, ob, i);
+			else if(!ob->instance_only)
+				add_reference_object(bounds, center, ob->bounds, i);
 		}
 		else
 			add_reference_mesh(bounds, center, ob->mesh, i);
@@ -164,6 +183,17 @@ void BVHBuild::add_references(BVHRange& root)
 		if(progress.get_cancel()) return;
 	}
 
+	/* instances reference the BVH of the instanced object's mesh, the same as
+	 * objects without their transform applied */
+	if(params.top_level) {
+		foreach(ObjectInstance *inst, instances) {
+			add_reference_object(bounds, center, inst->bounds(), i);
+			i++;
+		}
+
+		if(progress.get_cancel()) return;
+	}
+
 	/* happens mostly on empty meshes */
 	if(!bounds.valid())
 		bounds.grow(make_float3(0.0f, 0.0f, 0.0f));
@@ -171,6 +201,14 @@ void BVHBuild::add_references(BVHRange& root)
 	root = BVHRange(bounds, center, 0, references.size());
 }
 
+uint BVHBuild::object_visibility(int i)
+{
+	if(i < (int)objects.size())
+		return objects[i]->visibility;
+	else
+		return instances[i - objects.size()]->object->visibility;
+}
+
 /* Build */
 
 BVHNode* BVHBuild::run()
@@ -188,8 +226,6 @@ BVHNode* BVHBuild::run()
 		params.use_spatial_split = false;
 
 	spatial_min_overlap = root.bounds().safe_area() * params.spatial_split_alpha;
-	spatial_right_bounds.clear();
-	spatial_right_bounds.resize(max(root.size(), (int)BVHParams::NUM_SPATIAL_BINS) - 1);
 
 	/* init progress updates */
 	progress_start_time = time_dt();
@@ -197,19 +233,32 @@ BVHNode* BVHBuild::run()
 	progress_total = references.size();
 	progress_original_total = progress_total;
 
-	prim_segment.resize(references.size());
-	prim_index.resize(references.size());
-	prim_object.resize(references.size());
-
 	/* build recursively */
 	BVHNode *rootnode;
 
 	if(params.use_spatial_split) {
-		/* singlethreaded spatial split build */
-		rootnode = build_node(root, 0);
+		/* multithreaded spatial split build, the root storage takes over
+		 * the references, primitives are gathered after the build */
+		BVHSpatialStorage *storage = new BVHSpatialStorage();
+		storage->key = 0;
+		storage->references.swap(references);
+		storage->right_bounds.resize(max(root.size(), (int)BVHParams::NUM_SPATIAL_BINS) - 1);
+		spatial_storage.push_back(storage);
+
+		rootnode = build_node(root, storage, 0);
+		task_pool.wait_work();
+
+		if(rootnode && !progress.get_cancel())
+			spatial_storage_gather();
+
+		spatial_storage_free();
 	}
 	else {
 		/* multithreaded binning build */
+		prim_segment.resize(references.size());
+		prim_index.resize(references.size());
+		prim_object.resize(references.size());
+
 		BVHObjectBinning rootbin(root, (references.size())? &references[0]: NULL);
 		rootnode = build_node(rootbin, 0);
 		task_pool.wait_work();
@@ -221,7 +270,7 @@ BVHNode* BVHBuild::run()
 			rootnode->deleteSubtree();
 			rootnode = NULL;
 		}
-		else if(!params.use_spatial_split) {
+		else {
 			/*rotate(rootnode, 4, 5);*/
 			rootnode->update_visibility();
 		}
@@ -245,6 +294,78 @@ void BVHBuild::progress_update()
 	progress_start_time = time_dt(); 
 }
 
+/* Spatial Split Storage */
+
+BVHSpatialStorage *BVHBuild::spatial_storage_create(const BVHSpatialStorage *parent, const BVHRange& range, int child, int level)
+{
+	BVHSpatialStorage *storage = new BVHSpatialStorage();
+
+	/* subtrees are ordered by key as they would be by a depth first build,
+	 * deeper than 64 levels we can't tell them apart anymore, but tasks are
+	 * only spawned for large ranges near the root */
+	storage->key = parent->key;
+	if(child && level <= 64)
+		storage->key |= (uint64_t)1 << (64 - level);
+
+	if(range.size()) {
+		const BVHReference *ref = &parent->references[range.start()];
+		storage->references.assign(ref, ref + range.size());
+	}
+
+	storage->right_bounds.resize(max(range.size(), (int)BVHParams::NUM_SPATIAL_BINS) - 1);
+
+	thread_scoped_lock lock(build_mutex);
+	spatial_storage.push_back(storage);
+
+	return storage;
+}
+
+static bool spatial_storage_sort(const BVHSpatialStorage *a, const BVHSpatialStorage *b)
+{
+	return a->key < b->key;
+}
+
+void BVHBuild::spatial_storage_gather()
+{
+	/* concatenate primitives of all subtrees in depth first order, and
+	 * offset leaf node ranges to their position in the output arrays */
+	sort(spatial_storage.begin(), spatial_storage.end(), spatial_storage_sort);
+
+	size_t num_prims = 0;
+
+	foreach(BVHSpatialStorage *storage, spatial_storage)
+		num_prims += storage->prim_index.size();
+
+	prim_segment.clear();
+	prim_index.clear();
+	prim_object.clear();
+
+	prim_segment.reserve(num_prims);
+	prim_index.reserve(num_prims);
+	prim_object.reserve(num_prims);
+
+	foreach(BVHSpatialStorage *storage, spatial_storage) {
+		int offset = prim_index.size();
+
+		prim_segment.insert(prim_segment.end(), storage->prim_segment.begin(), storage->prim_segment.end());
+		prim_index.insert(prim_index.end(), storage->prim_index.begin(), storage->prim_index.end());
+		prim_object.insert(prim_object.end(), storage->prim_object.begin(), storage->prim_object.end());
+
+		foreach(LeafNode *leaf, storage->leaves) {
+			leaf->m_lo += offset;
+			leaf->m_hi += offset;
+		}
+	}
+}
+
+void BVHBuild::spatial_storage_free()
+{
+	foreach(BVHSpatialStorage *storage, spatial_storage)
+		delete storage;
+
+	spatial_storage.clear();
+}
+
 void BVHBuild::thread_build_node(InnerNode *inner, int child, BVHObjectBinning *range, int level)
 {
 	if(progress.get_cancel())
@@ -303,44 +424,76 @@ BVHNode* BVHBuild::build_node(const BVHObjectBinning& range, int level)
 	return inner;
 }
 
-/* single threaded spatial split builder */
-BVHNode* BVHBuild::build_node(const BVHRange& range, int level)
+void BVHBuild::thread_build_spatial_split_node(InnerNode *inner, int child, BVHRange *range, BVHSpatialStorage *storage, int level)
+{
+	if(progress.get_cancel())
+		return;
+
+	/* build nodes */
+	BVHNode *node = build_node(*range, storage, level);
+
+	/* set child in inner node */
+	inner->children[child] = node;
+
+	/* update progress */
+	if(range->size() < THREAD_TASK_SIZE) {
+		thread_scoped_lock lock(build_mutex);
+
+		progress_count += storage->prim_index.size();
+		progress_total += storage->prim_index.size() - range->size();
+		progress_update();
+	}
+}
+
+/* multithreaded spatial split builder */
+BVHNode* BVHBuild::build_node(const BVHRange& range, BVHSpatialStorage *storage, int level)
 {
-	/* progress update */
-	progress_update();
 	if(progress.get_cancel())
 		return NULL;
 
 	/* small enough or too deep => create leaf. */
-	if(params.small_enough_for_leaf(range.size(), level)) {
-		progress_count += range.size();
-		return create_leaf_node(range);
-	}
+	if(params.small_enough_for_leaf(range.size(), level))
+		return create_leaf_node(range, storage);
 
 	/* splitting test */
-	BVHMixedSplit split(this, range, level);
+	BVHMixedSplit split(this, storage, range, level);
 
-	if(split.no_split) {
-		progress_count += range.size();
-		return create_leaf_node(range);
-	}
+	if(split.no_split)
+		return create_leaf_node(range, storage);
 	
 	/* do split */
 	BVHRange left, right;
-	split.split(this, left, right, range);
+	split.split(this, storage, left, right, range);
+
+	/* create inner node. */
+	InnerNode *inner;
+
+	if(range.size() < THREAD_TASK_SIZE) {
+		/* local build */
+		size_t num_references = storage->references.size();
+
+		/* left node */
+		BVHNode *leftnode = build_node(left, storage, level + 1);
+
+		/* right node (modify start for splits) */
+		right.set_start(right.start() + storage->references.size() - num_references);
+		BVHNode *rightnode = build_node(right, storage, level + 1);
 
-	progress_total += left.size() + right.size() - range.size();
-	size_t total = progress_total;
+		inner = new InnerNode(range.bounds(), leftnode, rightnode);
+	}
+	else {
+		/* threaded build, the tasks copy their references */
+		inner = new InnerNode(range.bounds());
 
-	/* leaft node */
-	BVHNode *leftnode = build_node(left, level + 1);
+		task_pool.push(new BVHSpatialSplitBuildTask(this, inner, 0, left, storage, level + 1), true);
+		task_pool.push(new BVHSpatialSplitBuildTask(this, inner, 1, right, storage, level + 1), true);
 
-	/* right node (modify start for splits) */
-	right.set_start(right.start() + progress_total - total);
-	BVHNode *rightnode = build_node(right, level + 1);
+		/* ranges this large are only found at the start of a storage, so
+		 * nothing else is built from these references */
+		vector<BVHReference>().swap(storage->references);
+	}
 
-	/* inner node */
-	return new InnerNode(range.bounds(), leftnode, rightnode);
+	return inner;
 }
 
 /* Create Nodes */
@@ -352,20 +505,11 @@ BVHNode *BVHBuild::create_object_leaf_nodes(const BVHReference *ref, int start,
 		return new LeafNode(bounds, 0, 0, 0);
 	}
 	else if(num == 1) {
-		if(start == prim_index.size()) {
-			assert(params.use_spatial_split);
+		prim_segment[start] = ref->prim_segment();
+		prim_index[start] = ref->prim_index();
+		prim_object[start] = ref->prim_object();
 
-			prim_segment.push_back(ref->prim_segment());
-			prim_index.push_back(ref->prim_index());
-			prim_object.push_back(ref->prim_object());
-		}
-		else {
-			prim_segment[start] = ref->prim_segment();
-			prim_index[start] = ref->prim_index();
-			prim_object[start] = ref->prim_object();
-		}
-
-		uint visibility = objects[ref->prim_object()]->visibility;
+		uint visibility = object_visibility(ref->prim_object());
 		return new LeafNode(ref->bounds(), visibility, start, start+1);
 	}
 	else {
@@ -394,18 +538,9 @@ BVHNode* BVHBuild::create_leaf_node(const BVHRange& range)
 		BVHReference& ref = references[range.start() + i];
 
 		if(ref.prim_index() != -1) {
-			if(range.start() + num == prim_index.size()) {
-				assert(params.use_spatial_split);
-
-				p_segment.push_back(ref.prim_segment());
-				p_index.push_back(ref.prim_index());
-				p_object.push_back(ref.prim_object());
-			}
-			else {
-				p_segment[range.start() + num] = ref.prim_segment();
-				p_index[range.start() + num] = ref.prim_index();
-				p_object[range.start() + num] = ref.prim_object();
-			}
+			p_segment[range.start() + num] = ref.prim_segment();
+			p_index[range.start() + num] = ref.prim_index();
+			p_object[range.start() + num] = ref.prim_object();
 
 			bounds.grow(ref.bounds());
 			visibility |= objects[ref.prim_object()]->visibility;
@@ -438,6 +573,33 @@ BVHNode* BVHBuild::create_leaf_node(const BVHRange& range)
 		return oleaf;
 }
 
+BVHNode* BVHBuild::create_leaf_node(const BVHRange& range, BVHSpatialStorage *storage)
+{
+	/* spatial splits are not used for the top level, so there are only
+	 * primitive references here */
+	BoundBox bounds = BoundBox::empty;
+	int lo = storage->prim_index.size();
+	uint visibility = 0;
+
+	for(int i = range.start(); i < range.end(); i++) {
+		const BVHReference& ref = storage->references[i];
+
+		assert(ref.prim_index() != -1);
+
+		storage->prim_segment.push_back(ref.prim_segment());
+		storage->prim_index.push_back(ref.prim_index());
+		storage->prim_object.push_back(ref.prim_object());
+
+		bounds.grow(ref.bounds());
+		visibility |= objects[ref.prim_object()]->visibility;
+	}
+
+	LeafNode *leaf = new LeafNode(bounds, visibility, lo, storage->prim_index.size());
+	storage->leaves.push_back(leaf);
+
+	return leaf;
+}
+
 /* Tree Rotations */
 
 void BVHBuild::rotate(BVHNode *node, int max_depth, int iterations)
@@ -30,11 +30,39 @@
 CCL_NAMESPACE_BEGIN
 
 class BVHBuildTask;
+class BVHSpatialSplitBuildTask;
 class BVHParams;
 class InnerNode;
+class LeafNode;
 class Mesh;
 class Object;
 class Progress;
+struct ObjectInstance;
+
+/* BVH Spatial Split Storage
+ *
+ * Spatial splits duplicate references, so subtrees built in different threads
+ * can't share the reference array. Each subtree task gets its own copy of its
+ * references, with scratch space for finding splits, and collects the
+ * primitives of its leaves to be merged into the output arrays at the end. */
+
+class BVHSpatialStorage
+{
+public:
+	/* position of the subtree in depth first order, one bit per level */
+	uint64_t key;
+
+	/* references and scratch space for splits */
+	vector<BVHReference> references;
+	vector<BoundBox> right_bounds;
+	BVHSpatialBin bins[3][BVHParams::NUM_SPATIAL_BINS];
+
+	/* primitives of leaf nodes, with leaf node ranges relative to them */
+	vector<int> prim_segment;
+	vector<int> prim_index;
+	vector<int> prim_object;
+	vector<LeafNode*> leaves;
+};
 
 /* BVH Builder */
 
@@ -44,6 +72,7 @@ public:
 	/* Constructor/Destructor */
 	BVHBuild(
 		const vector<Object*>& objects,
+		const vector<ObjectInstance*>& instances,
 		vector<int>& prim_segment,
 		vector<int>& prim_index,
 		vector<int>& prim_object,
@@ -58,23 +87,38 @@ protected:
 	friend class BVHObjectSplit;
 	friend class BVHSpatialSplit;
 	friend class BVHBuildTask;
+	friend class BVHSpatialSplitBuildTask;
 
 	/* adding references */
 	void add_reference_mesh(BoundBox& root, BoundBox& center, Mesh *mesh, int i);
-	void add_reference_object(BoundBox& root, BoundBox& center, Object *ob, int i);
+	void add_reference_object(BoundBox& root, BoundBox& center, const BoundBox& bounds, int i);
 	void add_references(BVHRange& root);
 
+	/* visibility of an object id, ids after the objects are instances */
+	uint object_visibility(int i);
+
 	/* building */
-	BVHNode *build_node(const BVHRange& range, int level);
+	BVHNode *build_node(const BVHRange& range, BVHSpatialStorage *storage, int level);
 	BVHNode *build_node(const BVHObjectBinning& range, int level);
 	BVHNode *create_leaf_node(const BVHRange& range);
+	BVHNode *create_leaf_node(const BVHRange& range, BVHSpatialStorage *storage);
 	BVHNode *create_object_leaf_nodes(const BVHReference *ref, int start, int num);
 
 	/* threads */
-	enum { THREAD_TASK_SIZE = 4096 };
+	enum {
+		THREAD_TASK_SIZE = 4096,
+		/* ranges this large also search for the best split in multiple threads */
+		THREAD_SPLIT_SIZE = 8*THREAD_TASK_SIZE
+	};
 	void thread_build_node(InnerNode *node, int child, BVHObjectBinning *range, int level);
+	void thread_build_spatial_split_node(InnerNode *node, int child, BVHRange *range, BVHSpatialStorage *storage, int level);
 	thread_mutex build_mutex;
 
+	/* spatial split storage */
+	BVHSpatialStorage *spatial_storage_create(const BVHSpatialStorage *parent, const BVHRange& range, int child, int level);
+	void spatial_storage_gather();
+	void spatial_storage_free();
+
 	/* progress */
 	void progress_update();
 
@@ -84,6 +128,7 @@ protected:
 
 	/* objects and primitive references */
 	vector<Object*> objects;
+	const vector<ObjectInstance*>& instances;
 	vector<BVHReference> references;
 	int num_original_references;
 
@@ -104,8 +149,7 @@ protected:
 
 	/* spatial splitting */
 	float spatial_min_overlap;
-	vector<BoundBox> spatial_right_bounds;
-	BVHSpatialBin spatial_bins[3][BVHParams::NUM_SPATIAL_BINS];
+	vector<BVHSpatialStorage*> spatial_storage;
 
 	/* threads */
 	TaskPool task_pool;
@@ -28,52 +28,85 @@ CCL_NAMESPACE_BEGIN
 
 /* Object Split */
 
-BVHObjectSplit::BVHObjectSplit(BVHBuild *builder, const BVHRange& range, float nodeSAH)
+BVHObjectSplit::BVHObjectSplit(BVHBuild *builder, BVHSpatialStorage *storage, const BVHRange& range, float nodeSAH)
 : sah(FLT_MAX), dim(0), num_left(0), left_bounds(BoundBox::empty), right_bounds(BoundBox::empty)
 {
-	const BVHReference *ref_ptr = &builder->references[range.start()];
-	float min_sah = FLT_MAX;
+	const BVHReference *ref_ptr = &storage->references[range.start()];
+
+	if(range.size() >= BVHBuild::THREAD_SPLIT_SIZE) {
+		/* sweep the first two axes in threads on sorted copies of the
+		 * references, the last axis is sorted in place as before */
+		vector<BVHReference> refs[2];
+		BVHObjectSplit dim_split[3];
+		TaskPool pool;
+
+		for(int dim = 0; dim < 2; dim++) {
+			refs[dim].assign(ref_ptr, ref_ptr + range.size());
+			pool.push(function_bind(&BVHObjectSplit::thread_sweep, &dim_split[dim], builder, &refs[dim], dim, nodeSAH));
+		}
 
-	for(int dim = 0; dim < 3; dim++) {
-		/* sort references */
-		bvh_reference_sort(range.start(), range.end(), &builder->references[0], dim);
+		bvh_reference_sort(range.start(), range.end(), &storage->references[0], 2);
+		dim_split[2].sweep(builder, ref_ptr, &storage->right_bounds[0], range.size(), 2, nodeSAH);
 
-		/* sweep right to left and determine bounds. */
-		BoundBox right_bounds = BoundBox::empty;
+		pool.wait_work();
 
-		for(int i = range.size() - 1; i > 0; i--) {
-			right_bounds.grow(ref_ptr[i].bounds());
-			builder->spatial_right_bounds[i - 1] = right_bounds;
+		/* pick the lowest SAH, preferring lower axes like the sequential sweep */
+		for(int dim = 0; dim < 3; dim++)
+			if(dim_split[dim].sah < this->sah)
+				*this = dim_split[dim];
+	}
+	else {
+		for(int dim = 0; dim < 3; dim++) {
+			/* sort references */
+			bvh_reference_sort(range.start(), range.end(), &storage->references[0], dim);
+			sweep(builder, ref_ptr, &storage->right_bounds[0], range.size(), dim, nodeSAH);
 		}
+	}
+}
 
-		/* sweep left to right and select lowest SAH. */
-		BoundBox left_bounds = BoundBox::empty;
+void BVHObjectSplit::sweep(BVHBuild *builder, const BVHReference *ref_ptr, BoundBox *spatial_right_bounds, int size, int dim, float nodeSAH)
+{
+	/* sweep right to left and determine bounds. */
+	BoundBox right_bounds = BoundBox::empty;
 
-		for(int i = 1; i < range.size(); i++) {
-			left_bounds.grow(ref_ptr[i - 1].bounds());
-			right_bounds = builder->spatial_right_bounds[i - 1];
+	for(int i = size - 1; i > 0; i--) {
+		right_bounds.grow(ref_ptr[i].bounds());
+		spatial_right_bounds[i - 1] = right_bounds;
+	}
 
-			float sah = nodeSAH +
-				left_bounds.safe_area() * builder->params.triangle_cost(i) +
-				right_bounds.safe_area() * builder->params.triangle_cost(range.size() - i);
+	/* sweep left to right and select lowest SAH. */
+	BoundBox left_bounds = BoundBox::empty;
 
-			if(sah < min_sah) {
-				min_sah = sah;
+	for(int i = 1; i < size; i++) {
+		left_bounds.grow(ref_ptr[i - 1].bounds());
+		right_bounds = spatial_right_bounds[i - 1];
 
-				this->sah = sah;
-				this->dim = dim;
-				this->num_left = i;
-				this->left_bounds = left_bounds;
-				this->right_bounds = right_bounds;
-			}
+		float sah = nodeSAH +
+			left_bounds.safe_area() * builder->params.triangle_cost(i) +
+			right_bounds.safe_area() * builder->params.triangle_cost(size - i);
+
+		if(sah < this->sah) {
+			this->sah = sah;
+			this->dim = dim;
+			this->num_left = i;
+			this->left_bounds = left_bounds;
+			this->right_bounds = right_bounds;
 		}
 	}
 }
 
-void BVHObjectSplit::split(BVHBuild *builder, BVHRange& left, BVHRange& right, const BVHRange& range)
+void BVHObjectSplit::thread_sweep(BVHBuild *builder, vector<BVHReference> *refs, int dim, float nodeSAH)
+{
+	vector<BoundBox> spatial_right_bounds(refs->size() - 1);
+
+	bvh_reference_sort(0, refs->size(), &(*refs)[0], dim);
+	sweep(builder, &(*refs)[0], &spatial_right_bounds[0], refs->size(), dim, nodeSAH);
+}
+
+void BVHObjectSplit::split(BVHBuild *builder, BVHSpatialStorage *storage, BVHRange& left, BVHRange& right, const BVHRange& range)
 {
 	/* sort references according to split */
-	bvh_reference_sort(range.start(), range.end(), &builder->references[0], this->dim);
+	bvh_reference_sort(range.start(), range.end(), &storage->references[0], this->dim);
 
 	/* split node ranges */
 	left = BVHRange(this->left_bounds, range.start(), this->num_left);
@@ -83,7 +116,7 @@ void BVHObjectSplit::split(BVHBuild *builder, BVHRange& left, BVHRange& right, c
 
 /* Spatial Split */
 
-BVHSpatialSplit::BVHSpatialSplit(BVHBuild *builder, const BVHRange& range, float nodeSAH)
+BVHSpatialSplit::BVHSpatialSplit(BVHBuild *builder, BVHSpatialStorage *storage, const BVHRange& range, float nodeSAH)
 : sah(FLT_MAX), dim(0), pos(0.0f)
 {
 	/* initialize bins. */
@@ -91,43 +124,51 @@ BVHSpatialSplit::BVHSpatialSplit(BVHBuild *builder, const BVHRange& range, float
 	float3 binSize = (range.bounds().max - origin) * (1.0f / (float)BVHParams::NUM_SPATIAL_BINS);
 	float3 invBinSize = 1.0f / binSize;
 
-	for(int dim = 0; dim < 3; dim++) {
-		for(int i = 0; i < BVHParams::NUM_SPATIAL_BINS; i++) {
-			BVHSpatialBin& bin = builder->spatial_bins[dim][i];
-
-			bin.bounds = BoundBox::empty;
-			bin.enter = 0;
-			bin.exit = 0;
-		}
-	}
-
 	/* chop references into bins. */
-	for(unsigned int refIdx = range.start(); refIdx < range.end(); refIdx++) {
-		const BVHReference& ref = builder->references[refIdx];
-		float3 firstBinf = (ref.bounds().min - origin) * invBinSize;
-		float3 lastBinf = (ref.bounds().max - origin) * invBinSize;
-		int3 firstBin = make_int3((int)firstBinf.x, (int)firstBinf.y, (int)firstBinf.z);
-		int3 lastBin = make_int3((int)lastBinf.x, (int)lastBinf.y, (int)lastBinf.z);
+	const BVHReference *ref_ptr = &storage->references[range.start()];
+	int num_chunks = 1;
+
+	if(range.size() >= BVHBuild::THREAD_SPLIT_SIZE)
+		num_chunks = min(TaskScheduler::num_threads(), range.size() / (int)BVHBuild::THREAD_TASK_SIZE);
+
+	if(num_chunks > 1) {
+		/* bin chunks of references in threads, and merge their bins. bounds
+		 * and counts don't depend on the order, so this gives the same bins */
+		BVHSpatialBin (*chunk_bins)[BVHParams::NUM_SPATIAL_BINS] =
+			new BVHSpatialBin[(num_chunks - 1) * 3][BVHParams::NUM_SPATIAL_BINS];
+		TaskPool pool;
+
+		for(int chunk = 0; chunk < num_chunks; chunk++) {
+			int chunk_start = (int)(((int64_t)range.size() * chunk) / num_chunks);
+			int chunk_end = (int)(((int64_t)range.size() * (chunk + 1)) / num_chunks);
+			BVHSpatialBin (*bins)[BVHParams::NUM_SPATIAL_BINS] = (chunk == 0)? storage->bins: chunk_bins + (chunk - 1) * 3;
+
+			pool.push(function_bind(&BVHSpatialSplit::bin_references, builder, bins,
+				ref_ptr + chunk_start, chunk_end - chunk_start, origin, binSize, invBinSize));
+		}
 
-		firstBin = clamp(firstBin, 0, BVHParams::NUM_SPATIAL_BINS - 1);
-		lastBin = clamp(lastBin, firstBin, BVHParams::NUM_SPATIAL_BINS - 1);
+		pool.wait_work();
 
-		for(int dim = 0; dim < 3; dim++) {
-			BVHReference currRef = ref;
+		for(int chunk = 1; chunk < num_chunks; chunk++) {
+			BVHSpatialBin (*bins)[BVHParams::NUM_SPATIAL_BINS] = chunk_bins + (chunk - 1) * 3;
 
-			for(int i = firstBin[dim]; i < lastBin[dim]; i++) {
-				BVHReference leftRef, rightRef;
+			for(int dim = 0; dim < 3; dim++) {
+				for(int i = 0; i < BVHParams::NUM_SPATIAL_BINS; i++) {
+					BVHSpatialBin& bin = storage->bins[dim][i];
 
-				split_reference(builder, leftRef, rightRef, currRef, dim, origin[dim] + binSize[dim] * (float)(i + 1));
-				builder->spatial_bins[dim][i].bounds.grow(leftRef.bounds());
-				currRef = rightRef;
+					/* growing with an empty box would make the bounds infinite */
+					if(bins[dim][i].bounds.min.x <= bins[dim][i].bounds.max.x)
+						bin.bounds.grow(bins[dim][i].bounds);
+					bin.enter += bins[dim][i].enter;
+					bin.exit += bins[dim][i].exit;
+				}
 			}
-
-			builder->spatial_bins[dim][lastBin[dim]].bounds.grow(currRef.bounds());
-			builder->spatial_bins[dim][firstBin[dim]].enter++;
-			builder->spatial_bins[dim][lastBin[dim]].exit++;
 		}
+
+		delete [] chunk_bins;
 	}
+	else
+		bin_references(builder, storage->bins, ref_ptr, range.size(), origin, binSize, invBinSize);
 
 	/* select best split plane. */
 	for(int dim = 0; dim < 3; dim++) {
@@ -135,8 +176,8 @@ BVHSpatialSplit::BVHSpatialSplit(BVHBuild *builder, const BVHRange& range, float
 		BoundBox right_bounds = BoundBox::empty;
 
 		for(int i = BVHParams::NUM_SPATIAL_BINS - 1; i > 0; i--) {
-			right_bounds.grow(builder->spatial_bins[dim][i].bounds);
-			builder->spatial_right_bounds[i - 1] = right_bounds;
+			right_bounds.grow(storage->bins[dim][i].bounds);
+			storage->right_bounds[i - 1] = right_bounds;
 		}
 
 		/* sweep left to right and select lowest SAH. */
@@ -145,13 +186,13 @@ BVHSpatialSplit::BVHSpatialSplit(BVHBuild *builder, const BVHRange& range, float
 		int rightNum = range.size();
 
 		for(int i = 1; i < BVHParams::NUM_SPATIAL_BINS; i++) {
-			left_bounds.grow(builder->spatial_bins[dim][i - 1].bounds);
-			leftNum += builder->spatial_bins[dim][i - 1].enter;
-			rightNum -= builder->spatial_bins[dim][i - 1].exit;
+			left_bounds.grow(storage->bins[dim][i - 1].bounds);
+			leftNum += storage->bins[dim][i - 1].enter;
+			rightNum -= storage->bins[dim][i - 1].exit;
 
 			float sah = nodeSAH +
 				left_bounds.safe_area() * builder->params.triangle_cost(leftNum) +
-				builder->spatial_right_bounds[i - 1].safe_area() * builder->params.triangle_cost(rightNum);
+				storage->right_bounds[i - 1].safe_area() * builder->params.triangle_cost(rightNum);
 
 			if(sah < this->sah) {
 				this->sah = sah;
@@ -162,7 +203,48 @@ BVHSpatialSplit::BVHSpatialSplit(BVHBuild *builder, const BVHRange& range, float
 	}
 }
 
-void BVHSpatialSplit::split(BVHBuild *builder, BVHRange& left, BVHRange& right, const BVHRange& range)
+void BVHSpatialSplit::bin_references(BVHBuild *builder, BVHSpatialBin (*bins)[BVHParams::NUM_SPATIAL_BINS],
+	const BVHReference *ref_ptr, int size, float3 origin, float3 binSize, float3 invBinSize)
+{
+	for(int dim = 0; dim < 3; dim++) {
+		for(int i = 0; i < BVHParams::NUM_SPATIAL_BINS; i++) {
+			BVHSpatialBin& bin = bins[dim][i];
+
+			bin.bounds = BoundBox::empty;
+			bin.enter = 0;
+			bin.exit = 0;
+		}
+	}
+
+	for(int refIdx = 0; refIdx < size; refIdx++) {
+		const BVHReference& ref = ref_ptr[refIdx];
+		float3 firstBinf = (ref.bounds().min - origin) * invBinSize;
+		float3 lastBinf = (ref.bounds().max - origin) * invBinSize;
+		int3 firstBin = make_int3((int)firstBinf.x, (int)firstBinf.y, (int)firstBinf.z);
+		int3 lastBin = make_int3((int)lastBinf.x, (int)lastBinf.y, (int)lastBinf.z);
+
+		firstBin = clamp(firstBin, 0, BVHParams::NUM_SPATIAL_BINS - 1);
+		lastBin = clamp(lastBin, firstBin, BVHParams::NUM_SPATIAL_BINS - 1);
+
+		for(int dim = 0; dim < 3; dim++) {
+			BVHReference currRef = ref;
+
+			for(int i = firstBin[dim]; i < lastBin[dim]; i++) {
+				BVHReference leftRef, rightRef;
+
+				split_reference(builder, leftRef, rightRef, currRef, dim, origin[dim] + binSize[dim] * (float)(i + 1));
+				bins[dim][i].bounds.grow(leftRef.bounds());
+				currRef = rightRef;
+			}
+
+			bins[dim][lastBin[dim]].bounds.grow(currRef.bounds());
+			bins[dim][firstBin[dim]].enter++;
+			bins[dim][lastBin[dim]].exit++;
+		}
+	}
+}
+
+void BVHSpatialSplit::split(BVHBuild *builder, BVHSpatialStorage *storage, BVHRange& left, BVHRange& right, const BVHRange& range)
 {
 	/* Categorize references and compute bounds.
 	 *
@@ -170,7 +252,7 @@ void BVHSpatialSplit::split(BVHBuild *builder, BVHRange& left, BVHRange& right,
 	 * Uncategorized/split:		[left_end, right_start[
 	 * Right-hand side:			[right_start, refs.size()[ */
 
-	vector<BVHReference>& refs = builder->references;
+	vector<BVHReference>& refs = storage->references;
 	int left_start = range.start();
 	int left_end = left_start;
 	int right_start = range.end();
@@ -36,10 +36,14 @@ public:
 	BoundBox left_bounds;
 	BoundBox right_bounds;
 
-	BVHObjectSplit() {}
-	BVHObjectSplit(BVHBuild *builder, const BVHRange& range, float nodeSAH);
+	BVHObjectSplit() : sah(FLT_MAX), dim(0), num_left(0) {}
+	BVHObjectSplit(BVHBuild *builder, BVHSpatialStorage *storage, const BVHRange& range, float nodeSAH);
 
-	void split(BVHBuild *builder, BVHRange& left, BVHRange& right, const BVHRange& range);
+	void split(BVHBuild *builder, BVHSpatialStorage *storage, BVHRange& left, BVHRange& right, const BVHRange& range);
+
+protected:
+	void sweep(BVHBuild *builder, const BVHReference *ref_ptr, BoundBox *spatial_right_bounds, int size, int dim, float nodeSAH);
+	void thread_sweep(BVHBuild *builder, vector<BVHReference> *refs, int dim, float nodeSAH);
 };
 
 /* Spatial Split */
@@ -52,10 +56,14 @@ public:
 	float pos;
 
 	BVHSpatialSplit() : sah(FLT_MAX), dim(0), pos(0.0f) {}
-	BVHSpatialSplit(BVHBuild *builder, const BVHRange& range, float nodeSAH);
+	BVHSpatialSplit(BVHBuild *builder, BVHSpatialStorage *storage, const BVHRange& range, float nodeSAH);
+
+	void split(BVHBuild *builder, BVHSpatialStorage *storage, BVHRange& left, BVHRange& right, const BVHRange& range);
+	static void split_reference(BVHBuild *builder, BVHReference& left, BVHReference& right, const BVHReference& ref, int dim, float pos);
 
-	void split(BVHBuild *builder, BVHRange& left, BVHRange& right, const BVHRange& range);
-	void split_reference(BVHBuild *builder, BVHReference& left, BVHReference& right, const BVHReference& ref, int dim, float pos);
+protected:
+	static void bin_references(BVHBuild *builder, BVHSpatialBin (*bins)[BVHParams::NUM_SPATIAL_BINS],
+		const BVHReference *ref_ptr, int size, float3 origin, float3 binSize, float3 invBinSize);
 };
 
 /* Mixed Object-Spatial Split */
@@ -72,7 +80,7 @@ public:
 
 	bool no_split;
 
-	__forceinline BVHMixedSplit(BVHBuild *builder, const BVHRange& range, int level)
+	__forceinline BVHMixedSplit(BVHBuild *builder, BVHSpatialStorage *storage, const BVHRange& range, int level)
 	{
 		/* find split candidates. */
 		float area = range.bounds().safe_area();
@@ -80,14 +88,14 @@ public:
 		leafSAH = area * builder->params.triangle_cost(range.size());
 		nodeSAH = area * builder->params.node_cost(2);
 
-		object = BVHObjectSplit(builder, range, nodeSAH);
+		object = BVHObjectSplit(builder, storage, range, nodeSAH);
 
 		if(builder->params.use_spatial_split && level < BVHParams::MAX_SPATIAL_DEPTH) {
 			BoundBox overlap = object.left_bounds;
 			overlap.intersect(object.right_bounds);
 
 			if(overlap.safe_area() >= builder->spatial_min_overlap)
-				spatial = BVHSpatialSplit(builder, range, nodeSAH);
+				spatial = BVHSpatialSplit(builder, storage, range, nodeSAH);
 		}
 
 		/* leaf SAH is the lowest => create leaf. */
@@ -95,12 +103,12 @@ public:
 		no_split = (minSAH == leafSAH && range.size() <= builder->params.max_leaf_size);
 	}
 
-	__forceinline void split(BVHBuild *builder, BVHRange& left, BVHRange& right, const BVHRange& range)
+	__forceinline void split(BVHBuild *builder, BVHSpatialStorage *storage, BVHRange& left, BVHRange& right, const BVHRange& range)
 	{
 		if(builder->params.use_spatial_split && minSAH == spatial.sah)
-			spatial.split(builder, left, right, range);
+			spatial.split(builder, storage, left, right, range);
 		if(!left.size() || !right.size())
-			object.split(builder, left, right, range);
+			object.split(builder, storage, left, right, range);
 	}
 };
 
@@ -38,21 +38,31 @@
 #include "util_opengl.h"
 #include "util_progress.h"
 #include "util_system.h"
+#include "util_texture_cache.h"
 #include "util_thread.h"
 
 CCL_NAMESPACE_BEGIN
 
+/* size of pixel blocks that stop sampling together with adaptive sampling */
+#define ADAPTIVE_BLOCK_SIZE 8
+
+/* size of pixel blocks whose paths are shaded together with deferred shading */
+#define DEFERRED_BLOCK_SIZE 32
+
 class CPUDevice : public Device
 {
 public:
 	TaskPool task_pool;
 	KernelGlobals kernel_globals;
+	TextureCache tex_cache;
 #ifdef WITH_OSL
 	OSLGlobals osl_globals;
 #endif
 	
 	CPUDevice(Stats &stats) : Device(stats)
 	{
+		kernel_globals.texture_cache = &tex_cache;
+		kernel_globals.texture_cache_tdata = NULL;
 #ifdef WITH_OSL
 		kernel_globals.osl = &osl_globals;
 #endif
@@ -129,6 +139,11 @@ public:
 #endif
 	}
 
+	TextureCache *texture_cache()
+	{
+		return &tex_cache;
+	}
+
 	void thread_run(DeviceTask *task)
 	{
 		if(task->type == DeviceTask::PATH_TRACE)
@@ -156,59 +171,65 @@ public:
 		}
 
 		KernelGlobals kg = kernel_globals;
+		kg.texture_cache_tdata = tex_cache.thread_init();
 
 #ifdef WITH_OSL
 		OSLShader::thread_init(&kg, &kernel_globals, &osl_globals);
 #endif
 
 		RenderTile tile;
+
+		/* adaptive sampling needs the variance pass */
+		bool adaptive = (kg.__data.film.pass_flag & PASS_VARIANCE) &&
+			kg.__data.integrator.adaptive_threshold > 0.0f;
+
+		/* path state memory for deferred shading, float4 for alignment */
+		vector<float4> deferred_memory;
+
+		if(kg.__data.integrator.deferred_shading) {
+			size_t size = kernel_cpu_path_trace_deferred_memory_size(DEFERRED_BLOCK_SIZE*DEFERRED_BLOCK_SIZE);
+			deferred_memory.resize((size + sizeof(float4) - 1)/sizeof(float4));
+		}
 		
 		while(task.acquire_tile(this, tile)) {
-			float *render_buffer = (float*)tile.buffer;
-			uint *rng_state = (uint*)tile.rng_state;
 			int start_sample = tile.start_sample;
 			int end_sample = tile.start_sample + tile.num_samples;
 
-#ifdef WITH_OPTIMIZED_KERNEL
-			if(system_cpu_support_optimized()) {
-				for(int sample = start_sample; sample < end_sample; sample++) {
-					if (task.get_cancel() || task_pool.cancelled()) {
-						if(task.need_finish_queue == false)
-							break;
-					}
-
-					for(int y = tile.y; y < tile.y + tile.h; y++) {
-						for(int x = tile.x; x < tile.x + tile.w; x++) {
-							kernel_cpu_optimized_path_trace(&kg, render_buffer, rng_state,
-								sample, x, y, tile.offset, tile.stride);
-						}
-					}
-
-					tile.sample = sample + 1;
+			/* blocks of pixels that stopped sampling, a whole tile if not adaptive */
+			int block_size = (adaptive)? ADAPTIVE_BLOCK_SIZE: max(tile.w, tile.h);
+			int blocks_x = (tile.w + block_size - 1)/block_size;
+			int blocks_y = (tile.h + block_size - 1)/block_size;
+			vector<bool> converged(blocks_x*blocks_y, false);
 
-					task.update_progress(tile);
+			for(int sample = start_sample; sample < end_sample; sample++) {
+				if (task.get_cancel() || task_pool.cancelled()) {
+					if(task.need_finish_queue == false)
+						break;
 				}
-			}
-			else
-#endif
-			{
-				for(int sample = start_sample; sample < end_sample; sample++) {
-					if (task.get_cancel() || task_pool.cancelled()) {
-						if(task.need_finish_queue == false)
-							break;
-					}
 
-					for(int y = tile.y; y < tile.y + tile.h; y++) {
-						for(int x = tile.x; x < tile.x + tile.w; x++) {
-							kernel_cpu_path_trace(&kg, render_buffer, rng_state,
-								sample, x, y, tile.offset, tile.stride);
-						}
+				for(int by = 0; by < blocks_y; by++) {
+					for(int bx = 0; bx < blocks_x; bx++) {
+						int x = tile.x + bx*block_size;
+						int y = tile.y + by*block_size;
+						int w = min(tile.x + tile.w - x, block_size);
+						int h = min(tile.y + tile.h - y, block_size);
+						int block = bx + by*blocks_x;
+
+						if(adaptive && !converged[block])
+							converged[block] = block_converged(&kg, tile, sample, x, y, w, h);
+
+						if(converged[block])
+							block_converged_fill(&kg, tile, sample, x, y, w, h);
+						else if(deferred_memory.size())
+							block_path_trace_deferred(&kg, tile, sample, x, y, w, h, &deferred_memory[0]);
+						else
+							block_path_trace(&kg, tile, sample, x, y, w, h);
 					}
+				}
 
-					tile.sample = sample + 1;
+				tile.sample = sample + 1;
 
-					task.update_progress(tile);
-				}
+				task.update_progress(tile);
 			}
 
 			task.release_tile(tile);
@@ -222,6 +243,75 @@ public:
 #ifdef WITH_OSL
 		OSLShader::thread_free(&kg);
 #endif
+
+		tex_cache.thread_free(kg.texture_cache_tdata);
+	}
+
+	void block_path_trace(KernelGlobals *kg, RenderTile& tile, int sample, int x, int y, int w, int h)
+	{
+		float *render_buffer = (float*)tile.buffer;
+		uint *rng_state = (uint*)tile.rng_state;
+
+		/* blocks of 2x2 pixels, traced as packets */
+#ifdef WITH_OPTIMIZED_KERNEL
+		if(system_cpu_support_optimized()) {
+			for(int py = y; py < y + h; py += 2)
+				for(int px = x; px < x + w; px += 2)
+					kernel_cpu_optimized_path_trace_packet(kg, render_buffer, rng_state, sample,
+						px, py, min(x + w - px, 2), min(y + h - py, 2), tile.offset, tile.stride);
+		}
+		else
+#endif
+		{
+			for(int py = y; py < y + h; py += 2)
+				for(int px = x; px < x + w; px += 2)
+					kernel_cpu_path_trace_packet(kg, render_buffer, rng_state, sample,
+						px, py, min(x + w - px, 2), min(y + h - py, 2), tile.offset, tile.stride);
+		}
+	}
+
+	void block_path_trace_deferred(KernelGlobals *kg, RenderTile& tile, int sample, int x, int y, int w, int h, void *memory)
+	{
+		float *render_buffer = (float*)tile.buffer;
+		uint *rng_state = (uint*)tile.rng_state;
+
+		/* blocks of at most DEFERRED_BLOCK_SIZE pixels, to bound path state memory */
+		for(int py = y; py < y + h; py += DEFERRED_BLOCK_SIZE) {
+			for(int px = x; px < x + w; px += DEFERRED_BLOCK_SIZE) {
+				int pw = min(x + w - px, DEFERRED_BLOCK_SIZE);
+				int ph = min(y + h - py, DEFERRED_BLOCK_SIZE);
+
+#ifdef WITH_OPTIMIZED_KERNEL
+				if(system_cpu_support_optimized())
+					kernel_cpu_optimized_path_trace_deferred(kg, render_buffer, rng_state, memory,
+						sample, px, py, pw, ph, tile.offset, tile.stride);
+				else
+#endif
+					kernel_cpu_path_trace_deferred(kg, render_buffer, rng_state, memory,
+						sample, px, py, pw, ph, tile.offset, tile.stride);
+			}
+		}
+	}
+
+	bool block_converged(KernelGlobals *kg, RenderTile& tile, int sample, int x, int y, int w, int h)
+	{
+		float *render_buffer = (float*)tile.buffer;
+
+		for(int py = y; py < y + h; py++)
+			for(int px = x; px < x + w; px++)
+				if(!kernel_cpu_converged(kg, render_buffer, sample, px, py, tile.offset, tile.stride))
+					return false;
+
+		return true;
+	}
+
+	void block_converged_fill(KernelGlobals *kg, RenderTile& tile, int sample, int x, int y, int w, int h)
+	{
+		float *render_buffer = (float*)tile.buffer;
+
+		for(int py = y; py < y + h; py++)
+			for(int px = x; px < x + w; px++)
+				kernel_cpu_converged_fill(kg, render_buffer, sample, px, py, tile.offset, tile.stride);
 	}
 
 	void thread_tonemap(DeviceTask& task)
@@ -246,6 +336,7 @@ public:
 	void thread_shader(DeviceTask& task)
 	{
 		KernelGlobals kg = kernel_globals;
+		kg.texture_cache_tdata = tex_cache.thread_init();
 
 #ifdef WITH_OSL
 		OSLShader::thread_init(&kg, &kernel_globals, &osl_globals);
@@ -274,6 +365,8 @@ public:
 #ifdef WITH_OSL
 		OSLShader::thread_free(&kg);
 #endif
+
+		tex_cache.thread_free(kg.texture_cache_tdata);
 	}
 
 	void task_add(DeviceTask& task)
@@ -93,6 +93,21 @@ void kernel_cpu_path_trace(KernelGlobals *kg, float *buffer, unsigned int *rng_s
 	kernel_path_trace(kg, buffer, rng_state, sample, x, y, offset, stride);
 }
 
+void kernel_cpu_path_trace_packet(KernelGlobals *kg, float *buffer, unsigned int *rng_state, int sample, int x, int y, int w, int h, int offset, int stride)
+{
+	kernel_path_trace_packet(kg, buffer, rng_state, sample, x, y, w, h, offset, stride);
+}
+
+size_t kernel_cpu_path_trace_deferred_memory_size(int num)
+{
+	return kernel_path_deferred_memory_size(num);
+}
+
+void kernel_cpu_path_trace_deferred(KernelGlobals *kg, float *buffer, unsigned int *rng_state, void *memory, int sample, int x, int y, int w, int h, int offset, int stride)
+{
+	kernel_path_trace_deferred(kg, buffer, rng_state, memory, sample, x, y, w, h, offset, stride);
+}
+
 /* Tonemapping */
 
 void kernel_cpu_tonemap(KernelGlobals *kg, uchar4 *rgba, float *buffer, int sample, int resolution, int x, int y, int offset, int stride)
@@ -100,6 +115,18 @@ void kernel_cpu_tonemap(KernelGlobals *kg, uchar4 *rgba, float *buffer, int samp
 	kernel_film_tonemap(kg, rgba, buffer, sample, resolution, x, y, offset, stride);
 }
 
+/* Adaptive Sampling */
+
+bool kernel_cpu_converged(KernelGlobals *kg, float *buffer, int sample, int x, int y, int offset, int stride)
+{
+	return kernel_film_converged(kg, buffer, sample, x, y, offset, stride);
+}
+
+void kernel_cpu_converged_fill(KernelGlobals *kg, float *buffer, int sample, int x, int y, int offset, int stride)
+{
+	kernel_film_converged_fill(kg, buffer, sample, x, y, offset, stride);
+}
+
 /* Shader Evaluation */
 
 void kernel_cpu_shader(KernelGlobals *kg, uint4 *input, float4 *output, int type, int i)
@@ -38,14 +38,27 @@ void kernel_tex_copy(KernelGlobals *kg, const char *name, device_ptr mem, size_t
 
 void kernel_cpu_path_trace(KernelGlobals *kg, float *buffer, unsigned int *rng_state,
 	int sample, int x, int y, int offset, int stride);
+void kernel_cpu_path_trace_packet(KernelGlobals *kg, float *buffer, unsigned int *rng_state,
+	int sample, int x, int y, int w, int h, int offset, int stride);
+size_t kernel_cpu_path_trace_deferred_memory_size(int num);
+void kernel_cpu_path_trace_deferred(KernelGlobals *kg, float *buffer, unsigned int *rng_state,
+	void *memory, int sample, int x, int y, int w, int h, int offset, int stride);
 void kernel_cpu_tonemap(KernelGlobals *kg, uchar4 *rgba, float *buffer,
 	int sample, int resolution, int x, int y, int offset, int stride);
+bool kernel_cpu_converged(KernelGlobals *kg, float *buffer,
+	int sample, int x, int y, int offset, int stride);
+void kernel_cpu_converged_fill(KernelGlobals *kg, float *buffer,
+	int sample, int x, int y, int offset, int stride);
 void kernel_cpu_shader(KernelGlobals *kg, uint4 *input, float4 *output,
 	int type, int i);
 
 #ifdef WITH_OPTIMIZED_KERNEL
 void kernel_cpu_optimized_path_trace(KernelGlobals *kg, float *buffer, unsigned int *rng_state,
 	int sample, int x, int y, int offset, int stride);
+void kernel_cpu_optimized_path_trace_packet(KernelGlobals *kg, float *buffer, unsigned int *rng_state,
+	int sample, int x, int y, int w, int h, int offset, int stride);
+void kernel_cpu_optimized_path_trace_deferred(KernelGlobals *kg, float *buffer, unsigned int *rng_state,
+	void *memory, int sample, int x, int y, int w, int h, int offset, int stride);
 void kernel_cpu_optimized_tonemap(KernelGlobals *kg, uchar4 *rgba, float *buffer,
 	int sample, int resolution, int x, int y, int offset, int stride);
 void kernel_cpu_optimized_shader(KernelGlobals *kg, uint4 *input, float4 *output,
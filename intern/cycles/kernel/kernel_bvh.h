@@ -592,8 +592,21 @@ __device_inline bool bvh_intersect_motion(KernelGlobals *kg, const Ray *ray, con
 }
 #endif
 
+CCL_NAMESPACE_END
+
+#ifdef __QBVH__
+#include "kernel_qbvh.h"
+#endif
+
+CCL_NAMESPACE_BEGIN
+
 __device_inline bool scene_intersect(KernelGlobals *kg, const Ray *ray, const uint visibility, Intersection *isect)
 {
+#ifdef __QBVH__
+	if(kernel_data.bvh.use_qbvh)
+		return qbvh_intersect(kg, ray, visibility, isect);
+#endif
+
 #ifdef __OBJECT_MOTION__
 	if(kernel_data.bvh.have_motion)
 		return bvh_intersect_motion(kg, ray, visibility, isect);
@@ -604,6 +617,26 @@ __device_inline bool scene_intersect(KernelGlobals *kg, const Ray *ray, const ui
 #endif
 }
 
+#ifdef __KERNEL_CPU__
+/* closest hits for a number of rays, traversed together when possible */
+__device_inline void scene_intersect_packet(KernelGlobals *kg, const Ray *rays, int num, const uint visibility, Intersection *isects)
+{
+#ifdef __QBVH__
+#ifdef __OBJECT_MOTION__
+	if(kernel_data.bvh.use_qbvh && !kernel_data.bvh.have_motion && num <= QBVH_PACKET_SIZE) {
+#else
+	if(kernel_data.bvh.use_qbvh && num <= QBVH_PACKET_SIZE) {
+#endif
+		qbvh_intersect_packet(kg, rays, num, visibility, isects);
+		return;
+	}
+#endif
+
+	for(int i = 0; i < num; i++)
+		scene_intersect(kg, &rays[i], visibility, &isects[i]);
+}
+#endif
+
 __device_inline float3 ray_offset(float3 P, float3 Ng)
 {
 #ifdef __INTERSECTION_REFINE__
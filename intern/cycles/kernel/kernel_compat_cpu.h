@@ -23,6 +23,7 @@
 
 #include "util_debug.h"
 #include "util_math.h"
+#include "util_texture_cache.h"
 #include "util_types.h"
 
 CCL_NAMESPACE_BEGIN
@@ -159,6 +160,7 @@ typedef texture_image<uchar4> texture_image_uchar4;
 #define kernel_tex_fetch_m128i(tex, index) (kg->tex.fetch_m128i(index))
 #define kernel_tex_interp(tex, t, size) (kg->tex.interp(t, size))
 #define kernel_tex_image_interp(tex, x, y) ((tex < MAX_FLOAT_IMAGES) ? kg->texture_float_images[tex].interp(x, y) : kg->texture_byte_images[tex - MAX_FLOAT_IMAGES].interp(x, y))
+#define kernel_tex_image_interp_filtered(tex, x, y, width) ((kg->texture_cache && kg->texture_cache->has_image(tex)) ? kg->texture_cache->lookup(kg->texture_cache_tdata, tex, x, y, width) : kernel_tex_image_interp(tex, x, y))
 
 #define kernel_data (kg->__data)
 
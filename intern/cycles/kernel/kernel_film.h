@@ -66,5 +66,69 @@ __device void kernel_film_tonemap(KernelGlobals *kg,
 	*rgba = byte_result;
 }
 
+/* Adaptive Sampling
+ *
+ * A pixel has converged once the standard error of its mean is below the
+ * threshold, relative to the square root of its intensity so that dark
+ * regions do not need many more samples than bright ones. Converged pixels
+ * are not sampled anymore, instead their mean is added for each sample that
+ * is skipped, so that all passes still sum the same number of samples. */
+
+__device bool kernel_film_converged(KernelGlobals *kg, __global float *buffer,
+	int sample, int x, int y, int offset, int stride)
+{
+	if(sample < kernel_data.integrator.adaptive_min_samples)
+		return false;
+
+	/* buffer offset */
+	int index = offset + x + y*stride;
+
+	buffer += index*kernel_data.film.pass_stride;
+
+	/* sample mean and variance */
+	float4 sum = *((__global float4*)(buffer + kernel_data.film.pass_combined));
+	float4 sum_sq = *((__global float4*)(buffer + kernel_data.film.pass_variance));
+
+	float inv_n = 1.0f/(float)sample;
+	float3 mean = make_float3(sum.x, sum.y, sum.z)*inv_n;
+	float3 mean_sq = make_float3(sum_sq.x, sum_sq.y, sum_sq.z)*inv_n;
+	float3 variance = max(mean_sq - mean*mean, make_float3(0.0f, 0.0f, 0.0f))*((float)sample/(float)(sample - 1));
+
+	/* standard error of the mean */
+	float error = (sqrtf(variance.x) + sqrtf(variance.y) + sqrtf(variance.z))*sqrtf(inv_n);
+	float intensity = fabsf(mean.x) + fabsf(mean.y) + fabsf(mean.z);
+
+	return (error <= kernel_data.integrator.adaptive_threshold*(1e-4f + sqrtf(intensity)));
+}
+
+__device void kernel_film_converged_fill(KernelGlobals *kg, __global float *buffer,
+	int sample, int x, int y, int offset, int stride)
+{
+	/* buffer offset */
+	int index = offset + x + y*stride;
+	int pass_stride = kernel_data.film.pass_stride;
+
+	buffer += index*pass_stride;
+
+	/* passes written only for the first sample are not sums */
+	int flag = kernel_data.film.pass_flag;
+	float depth = (flag & PASS_DEPTH)? buffer[kernel_data.film.pass_depth]: 0.0f;
+	float object_id = (flag & PASS_OBJECT_ID)? buffer[kernel_data.film.pass_object_id]: 0.0f;
+	float material_id = (flag & PASS_MATERIAL_ID)? buffer[kernel_data.film.pass_material_id]: 0.0f;
+
+	/* add the mean of the samples so far */
+	float scale = (float)(sample + 1)/(float)sample;
+
+	for(int i = 0; i < pass_stride; i++)
+		buffer[i] *= scale;
+
+	if(flag & PASS_DEPTH)
+		buffer[kernel_data.film.pass_depth] = depth;
+	if(flag & PASS_OBJECT_ID)
+		buffer[kernel_data.film.pass_object_id] = object_id;
+	if(flag & PASS_MATERIAL_ID)
+		buffer[kernel_data.film.pass_material_id] = material_id;
+}
+
 CCL_NAMESPACE_END
 
@@ -46,6 +46,10 @@ typedef struct KernelGlobals {
 
 	KernelData __data;
 
+	/* images loaded on demand, instead of the texture arrays above */
+	TextureCache *texture_cache;
+	TextureCache::ThreadData *texture_cache_tdata;
+
 #ifdef __OSL__
 	/* On the CPU, we also have the OSL globals here. Most data structures are shared
 	 * with SVM, the difference is in the shaders and object/mesh attributes. */
@@ -32,14 +32,76 @@ enum ObjectVectorTransform {
 	OBJECT_VECTOR_MOTION_POST = 3
 };
 
-__device_inline Transform object_fetch_transform(KernelGlobals *kg, int object, enum ObjectTransform type)
+/* Instances
+ *
+ * Object ids from kernel_data.bvh.num_objects on are instances of another
+ * object, the prototype. Their rows in __instances only hold what differs
+ * per instance, everything else is looked up from the prototype. */
+
+enum InstanceData {
+	INSTANCE_TRANSFORM = 0,
+	INSTANCE_INVERSE_TRANSFORM = 3,
+	INSTANCE_PROPERTIES = 6,
+	INSTANCE_DUPLI = 7
+};
+
+__device_inline int object_instance(KernelGlobals *kg, int object)
+{
+	return object - kernel_data.bvh.num_objects;
+}
+
+/* properties and dupli rows have the same layout for objects and instances,
+ * except the instance stores its prototype in place of the pass id */
+__device_inline float4 object_fetch_row(KernelGlobals *kg, int object, int object_row, int instance_row)
+{
+	int instance = object_instance(kg, object);
+
+	if(instance >= 0)
+		return kernel_tex_fetch(__instances, instance*INSTANCE_SIZE + instance_row);
+	else
+		return kernel_tex_fetch(__objects, object*OBJECT_SIZE + object_row);
+}
+
+__device_inline int object_prototype(KernelGlobals *kg, int object)
 {
-	int offset = object*OBJECT_SIZE + (int)type;
+	int instance = object_instance(kg, object);
+
+	if(instance < 0)
+		return object;
+
+	float4 f = kernel_tex_fetch(__instances, instance*INSTANCE_SIZE + INSTANCE_PROPERTIES);
+	return __float_as_int(f.y);
+}
+
+__device_inline uint object_fetch_flag(KernelGlobals *kg, int object)
+{
+	/* instances have no motion of their own, and no transform applied */
+	if(object_instance(kg, object) >= 0)
+		return kernel_tex_fetch(__object_flag, object_prototype(kg, object)) & SD_HOLDOUT_MASK;
+
+	return kernel_tex_fetch(__object_flag, object);
+}
 
+__device_inline Transform object_fetch_transform(KernelGlobals *kg, int object, enum ObjectTransform type)
+{
+	int instance = object_instance(kg, object);
 	Transform tfm;
-	tfm.x = kernel_tex_fetch(__objects, offset + 0);
-	tfm.y = kernel_tex_fetch(__objects, offset + 1);
-	tfm.z = kernel_tex_fetch(__objects, offset + 2);
+
+	if(instance >= 0) {
+		int offset = instance*INSTANCE_SIZE + ((type == OBJECT_INVERSE_TRANSFORM)? INSTANCE_INVERSE_TRANSFORM: INSTANCE_TRANSFORM);
+
+		tfm.x = kernel_tex_fetch(__instances, offset + 0);
+		tfm.y = kernel_tex_fetch(__instances, offset + 1);
+		tfm.z = kernel_tex_fetch(__instances, offset + 2);
+	}
+	else {
+		int offset = object*OBJECT_SIZE + (int)type;
+
+		tfm.x = kernel_tex_fetch(__objects, offset + 0);
+		tfm.y = kernel_tex_fetch(__objects, offset + 1);
+		tfm.z = kernel_tex_fetch(__objects, offset + 2);
+	}
+
 	tfm.w = make_float4(0.0f, 0.0f, 0.0f, 1.0f);
 
 	return tfm;
@@ -83,7 +145,7 @@ __device_inline Transform object_fetch_transform_motion(KernelGlobals *kg, int o
 
 __device_inline Transform object_fetch_transform_motion_test(KernelGlobals *kg, int object, float time, Transform *itfm)
 {
-	int object_flag = kernel_tex_fetch(__object_flag, object);
+	int object_flag = object_fetch_flag(kg, object);
 
 	if(object_flag & SD_OBJECT_MOTION) {
 		/* if we do motion blur */
@@ -169,8 +231,7 @@ __device_inline float3 object_location(KernelGlobals *kg, ShaderData *sd)
 
 __device_inline float object_surface_area(KernelGlobals *kg, int object)
 {
-	int offset = object*OBJECT_SIZE + OBJECT_PROPERTIES;
-	float4 f = kernel_tex_fetch(__objects, offset);
+	float4 f = object_fetch_row(kg, object, OBJECT_PROPERTIES, INSTANCE_PROPERTIES);
 	return f.x;
 }
 
@@ -179,7 +240,7 @@ __device_inline float object_pass_id(KernelGlobals *kg, int object)
 	if(object == ~0)
 		return 0.0f;
 
-	int offset = object*OBJECT_SIZE + OBJECT_PROPERTIES;
+	int offset = object_prototype(kg, object)*OBJECT_SIZE + OBJECT_PROPERTIES;
 	float4 f = kernel_tex_fetch(__objects, offset);
 	return f.y;
 }
@@ -189,8 +250,7 @@ __device_inline float object_random_number(KernelGlobals *kg, int object)
 	if(object == ~0)
 		return 0.0f;
 
-	int offset = object*OBJECT_SIZE + OBJECT_PROPERTIES;
-	float4 f = kernel_tex_fetch(__objects, offset);
+	float4 f = object_fetch_row(kg, object, OBJECT_PROPERTIES, INSTANCE_PROPERTIES);
 	return f.z;
 }
 
@@ -199,8 +259,7 @@ __device_inline uint object_particle_id(KernelGlobals *kg, int object)
 	if(object == ~0)
 		return 0.0f;
 
-	int offset = object*OBJECT_SIZE + OBJECT_PROPERTIES;
-	float4 f = kernel_tex_fetch(__objects, offset);
+	float4 f = object_fetch_row(kg, object, OBJECT_PROPERTIES, INSTANCE_PROPERTIES);
 	return __float_as_int(f.w);
 }
 
@@ -209,8 +268,7 @@ __device_inline float3 object_dupli_generated(KernelGlobals *kg, int object)
 	if(object == ~0)
 		return make_float3(0.0f, 0.0f, 0.0f);
 
-	int offset = object*OBJECT_SIZE + OBJECT_DUPLI;
-	float4 f = kernel_tex_fetch(__objects, offset);
+	float4 f = object_fetch_row(kg, object, OBJECT_DUPLI, INSTANCE_DUPLI);
 	return make_float3(f.x, f.y, f.z);
 }
 
@@ -219,11 +277,17 @@ __device_inline float3 object_dupli_uv(KernelGlobals *kg, int object)
 	if(object == ~0)
 		return make_float3(0.0f, 0.0f, 0.0f);
 
-	int offset = object*OBJECT_SIZE + OBJECT_DUPLI;
-	float4 f = kernel_tex_fetch(__objects, offset + 1);
+	float4 f = object_fetch_row(kg, object, OBJECT_DUPLI + 1, INSTANCE_DUPLI + 1);
 	return make_float3(f.x, f.y, 0.0f);
 }
 
+/* object that holds the attributes, for instances the prototype */
+
+__device_inline int object_attribute_object(KernelGlobals *kg, int object)
+{
+	return object_prototype(kg, object);
+}
+
 
 __device int shader_pass_id(KernelGlobals *kg, ShaderData *sd)
 {
@@ -40,6 +40,16 @@ void kernel_cpu_optimized_path_trace(KernelGlobals *kg, float *buffer, unsigned
 	kernel_path_trace(kg, buffer, rng_state, sample, x, y, offset, stride);
 }
 
+void kernel_cpu_optimized_path_trace_packet(KernelGlobals *kg, float *buffer, unsigned int *rng_state, int sample, int x, int y, int w, int h, int offset, int stride)
+{
+	kernel_path_trace_packet(kg, buffer, rng_state, sample, x, y, w, h, offset, stride);
+}
+
+void kernel_cpu_optimized_path_trace_deferred(KernelGlobals *kg, float *buffer, unsigned int *rng_state, void *memory, int sample, int x, int y, int w, int h, int offset, int stride)
+{
+	kernel_path_trace_deferred(kg, buffer, rng_state, memory, sample, x, y, w, h, offset, stride);
+}
+
 /* Tonemapping */
 
 void kernel_cpu_optimized_tonemap(KernelGlobals *kg, uchar4 *rgba, float *buffer, int sample, int resolution, int x, int y, int offset, int stride)
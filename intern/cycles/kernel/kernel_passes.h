@@ -36,6 +36,15 @@ __device_inline void kernel_write_pass_float4(__global float *buffer, int sample
 	*buf = (sample == 0)? value: *buf + value;
 }
 
+__device_inline void kernel_write_variance_pass(KernelGlobals *kg, __global float *buffer, int sample, float4 L)
+{
+#ifdef __PASSES__
+	/* sum of squares, to estimate variance for adaptive sampling */
+	if(kernel_data.film.pass_flag & PASS_VARIANCE)
+		kernel_write_pass_float4(buffer + kernel_data.film.pass_variance, sample, L*L);
+#endif
+}
+
 __device_inline void kernel_write_data_passes(KernelGlobals *kg, __global float *buffer, PathRadiance *L,
 	ShaderData *sd, int sample, int path_flag, float3 throughput)
 {
@@ -0,0 +1,810 @@
+/*
+ * Copyright 2013, Blender Foundation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* QBVH traversal, for the 4-wide node layout packed by QBVH::pack_nodes.
+ *
+ * Each node is 8 float4: rows 0-5 hold min/max x, y and z of the four child
+ * boxes (one child per lane), row 6 the child node addresses and row 7 the
+ * child visibility. Leaf nodes store their primitive range in row 6. All four
+ * child boxes are tested at once, and the hit children are pushed ordered by
+ * distance so the closest one is visited first. */
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define __QBVH_SSE__
+#endif
+
+CCL_NAMESPACE_BEGIN
+
+#define BVH_QNODE_SIZE 8
+/* up to 3 entries pushed per level, for object and mesh BVH */
+#define QBVH_STACK_SIZE 384
+
+/* ray data that stays constant during traversal of one BVH */
+typedef struct QBVHRay {
+#ifdef __QBVH_SSE__
+	__m128 ood[3];
+	__m128 idir[3];
+#else
+	float3 ood;
+	float3 idir;
+#endif
+	/* rows of the near and far planes, depending on ray direction */
+	int near_x, near_y, near_z;
+	int far_x, far_y, far_z;
+} QBVHRay;
+
+__device_inline void qbvh_ray_setup(QBVHRay *qray, float3 P, float3 idir)
+{
+	float3 ood = P * idir;
+
+#ifdef __QBVH_SSE__
+	qray->ood[0] = _mm_set1_ps(ood.x);
+	qray->ood[1] = _mm_set1_ps(ood.y);
+	qray->ood[2] = _mm_set1_ps(ood.z);
+	qray->idir[0] = _mm_set1_ps(idir.x);
+	qray->idir[1] = _mm_set1_ps(idir.y);
+	qray->idir[2] = _mm_set1_ps(idir.z);
+#else
+	qray->ood = ood;
+	qray->idir = idir;
+#endif
+
+	qray->near_x = (idir.x >= 0.0f)? 0: 1;
+	qray->near_y = (idir.y >= 0.0f)? 2: 3;
+	qray->near_z = (idir.z >= 0.0f)? 4: 5;
+	qray->far_x = qray->near_x ^ 1;
+	qray->far_y = qray->near_y ^ 1;
+	qray->far_z = qray->near_z ^ 1;
+}
+
+/* intersect four child boxes, returns a bit mask of the hit children and
+ * their entry distances. Empty child slots have an inverted box and never hit */
+__device_inline int qbvh_node_intersect(KernelGlobals *kg, float dist[4],
+	const QBVHRay *qray, float t, uint visibility, int nodeAddr)
+{
+	const int offset = nodeAddr*BVH_QNODE_SIZE;
+
+	float4 near_x = kernel_tex_fetch(__bvh_nodes, offset + qray->near_x);
+	float4 near_y = kernel_tex_fetch(__bvh_nodes, offset + qray->near_y);
+	float4 near_z = kernel_tex_fetch(__bvh_nodes, offset + qray->near_z);
+	float4 far_x = kernel_tex_fetch(__bvh_nodes, offset + qray->far_x);
+	float4 far_y = kernel_tex_fetch(__bvh_nodes, offset + qray->far_y);
+	float4 far_z = kernel_tex_fetch(__bvh_nodes, offset + qray->far_z);
+#ifdef __VISIBILITY_FLAG__
+	float4 cvis = kernel_tex_fetch(__bvh_nodes, offset + 7);
+#endif
+
+#ifdef __QBVH_SSE__
+	__m128 tnear_x = _mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(&near_x.x), qray->idir[0]), qray->ood[0]);
+	__m128 tnear_y = _mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(&near_y.x), qray->idir[1]), qray->ood[1]);
+	__m128 tnear_z = _mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(&near_z.x), qray->idir[2]), qray->ood[2]);
+	__m128 tfar_x = _mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(&far_x.x), qray->idir[0]), qray->ood[0]);
+	__m128 tfar_y = _mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(&far_y.x), qray->idir[1]), qray->ood[1]);
+	__m128 tfar_z = _mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(&far_z.x), qray->idir[2]), qray->ood[2]);
+
+	__m128 tnear = _mm_max_ps(_mm_max_ps(tnear_x, tnear_y), _mm_max_ps(tnear_z, _mm_setzero_ps()));
+	__m128 tfar = _mm_min_ps(_mm_min_ps(tfar_x, tfar_y), _mm_min_ps(tfar_z, _mm_set1_ps(t)));
+	__m128 hit = _mm_cmple_ps(tnear, tfar);
+
+#ifdef __VISIBILITY_FLAG__
+	__m128i vis = _mm_and_si128(_mm_castps_si128(_mm_loadu_ps(&cvis.x)), _mm_set1_epi32(visibility));
+	hit = _mm_andnot_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(vis, _mm_setzero_si128())), hit);
+#endif
+
+	_mm_storeu_ps(dist, tnear);
+
+	return _mm_movemask_ps(hit);
+#else
+	int mask = 0;
+
+	for(int i = 0; i < 4; i++) {
+		float c0x = near_x[i] * qray->idir.x - qray->ood.x;
+		float c1x = far_x[i] * qray->idir.x - qray->ood.x;
+		float c0y = near_y[i] * qray->idir.y - qray->ood.y;
+		float c1y = far_y[i] * qray->idir.y - qray->ood.y;
+		float c0z = near_z[i] * qray->idir.z - qray->ood.z;
+		float c1z = far_z[i] * qray->idir.z - qray->ood.z;
+		NO_EXTENDED_PRECISION float cmin = max4(c0x, c0y, c0z, 0.0f);
+		NO_EXTENDED_PRECISION float cmax = min4(c1x, c1y, c1z, t);
+
+#ifdef __VISIBILITY_FLAG__
+		if(cmin <= cmax && (__float_as_int(cvis[i]) & visibility))
+#else
+		if(cmin <= cmax)
+#endif
+			mask |= (1 << i);
+
+		dist[i] = cmin;
+	}
+
+	return mask;
+#endif
+}
+
+__device_inline bool qbvh_intersect(KernelGlobals *kg, const Ray *ray, const uint visibility, Intersection *isect)
+{
+	/* traversal stack */
+	int traversalStack[QBVH_STACK_SIZE];
+	traversalStack[0] = ENTRYPOINT_SENTINEL;
+
+	/* traversal variables */
+	int stackPtr = 0;
+	int nodeAddr = kernel_data.bvh.root;
+
+	/* ray parameters */
+	const float tmax = ray->t;
+	float3 P = ray->P;
+	float3 idir = bvh_inverse_direction(ray->D);
+	int object = ~0;
+
+	QBVHRay qray;
+	qbvh_ray_setup(&qray, P, idir);
+
+#ifdef __OBJECT_MOTION__
+	Transform ob_tfm;
+#endif
+
+	isect->t = tmax;
+	isect->object = ~0;
+	isect->prim = ~0;
+	isect->u = 0.0f;
+	isect->v = 0.0f;
+
+	/* traversal loop */
+	do {
+		do
+		{
+			/* traverse internal nodes */
+			while(nodeAddr >= 0 && nodeAddr != ENTRYPOINT_SENTINEL)
+			{
+				float dist[4];
+				int mask = qbvh_node_intersect(kg, dist, &qray, isect->t, visibility, nodeAddr);
+
+				if(mask == 0) {
+					/* no child was intersected */
+					nodeAddr = traversalStack[stackPtr];
+					--stackPtr;
+					continue;
+				}
+
+				float4 cnodes = kernel_tex_fetch(__bvh_nodes, nodeAddr*BVH_QNODE_SIZE+6);
+
+				/* sort hit children, farthest first */
+				int childAddr[4];
+				float childDist[4];
+				int num = 0;
+
+				for(int i = 0; i < 4; i++) {
+					if(!(mask & (1 << i)))
+						continue;
+
+					int j = num++;
+
+					while(j > 0 && childDist[j-1] < dist[i]) {
+						childAddr[j] = childAddr[j-1];
+						childDist[j] = childDist[j-1];
+						j--;
+					}
+
+					childAddr[j] = __float_as_int(cnodes[i]);
+					childDist[j] = dist[i];
+				}
+
+				/* push the farther children, continue with the closest one */
+				for(int i = 0; i < num-1; i++) {
+					++stackPtr;
+					traversalStack[stackPtr] = childAddr[i];
+				}
+
+				nodeAddr = childAddr[num-1];
+			}
+
+			/* if node is leaf, fetch triangle list */
+			if(nodeAddr < 0) {
+				float4 leaf = kernel_tex_fetch(__bvh_nodes, (-nodeAddr-1)*BVH_QNODE_SIZE+6);
+				int primAddr = __float_as_int(leaf.x);
+
+#ifdef __INSTANCING__
+				if(primAddr >= 0) {
+#endif
+					int primAddr2 = __float_as_int(leaf.y);
+
+					/* pop */
+					nodeAddr = traversalStack[stackPtr];
+					--stackPtr;
+
+					/* primitive intersection */
+					while(primAddr < primAddr2) {
+						/* intersect ray against primitive */
+#ifdef __HAIR__
+						uint segment = kernel_tex_fetch(__prim_segment, primAddr);
+						if(segment != ~0)
+							bvh_curve_intersect(kg, isect, P, idir, visibility, object, primAddr, segment);
+						else
+#endif
+							bvh_triangle_intersect(kg, isect, P, idir, visibility, object, primAddr);
+
+						/* shadow ray early termination */
+						if(visibility == PATH_RAY_SHADOW_OPAQUE && isect->prim != ~0)
+							return true;
+
+						primAddr++;
+					}
+#ifdef __INSTANCING__
+				}
+				else {
+					/* instance push */
+					object = kernel_tex_fetch(__prim_object, -primAddr-1);
+
+#ifdef __OBJECT_MOTION__
+					if(kernel_data.bvh.have_motion)
+						bvh_instance_motion_push(kg, object, ray, &P, &idir, &isect->t, &ob_tfm, tmax);
+					else
+#endif
+						bvh_instance_push(kg, object, ray, &P, &idir, &isect->t, tmax);
+
+					qbvh_ray_setup(&qray, P, idir);
+
+					++stackPtr;
+					traversalStack[stackPtr] = ENTRYPOINT_SENTINEL;
+
+					nodeAddr = kernel_tex_fetch(__object_node, object);
+				}
+#endif
+			}
+		} while(nodeAddr != ENTRYPOINT_SENTINEL);
+
+#ifdef __INSTANCING__
+		if(stackPtr >= 0) {
+			kernel_assert(object != ~0);
+
+			/* instance pop */
+#ifdef __OBJECT_MOTION__
+			if(kernel_data.bvh.have_motion)
+				bvh_instance_motion_pop(kg, object, ray, &P, &idir, &isect->t, &ob_tfm, tmax);
+			else
+#endif
+				bvh_instance_pop(kg, object, ray, &P, &idir, &isect->t, tmax);
+
+			qbvh_ray_setup(&qray, P, idir);
+
+			object = ~0;
+			nodeAddr = traversalStack[stackPtr];
+			--stackPtr;
+		}
+#endif
+	} while(nodeAddr != ENTRYPOINT_SENTINEL);
+
+	return (isect->prim != ~0);
+}
+
+/* Packet Traversal
+ *
+ * Closest hits for up to four rays traversed together. When the directions of
+ * all rays have the same signs, as for the camera rays of neighbouring pixels,
+ * child boxes are tested once for the whole packet, using the bounds of the ray
+ * origins and inverse directions to find entry and exit distances that hold for
+ * every ray in it. Only leaves are then tested per ray. Otherwise each ray is
+ * tested on its own, and a node is visited by the rays that hit it, with the
+ * stack keeping the mask of those rays. */
+
+#define QBVH_PACKET_SIZE 4
+
+typedef struct QBVHPacket {
+	QBVHRay qray[QBVH_PACKET_SIZE];
+
+	/* directions of all rays have the same signs */
+	bool coherent;
+	int near_x, near_y, near_z;
+	int far_x, far_y, far_z;
+
+	/* ray origin bounds to subtract from near and far planes, chosen by
+	 * direction sign so entry distances are lowest and exit distances
+	 * highest, and the inverse direction bounds */
+#ifdef __QBVH_SSE__
+	__m128 Pnear[3], Pfar[3];
+	__m128 idir_min[3], idir_max[3];
+
+	/* origins and directions with one ray per lane, for triangle tests */
+	__m128 P[3], dir[3];
+#else
+	float3 Pnear, Pfar;
+	float3 idir_min, idir_max;
+#endif
+} QBVHPacket;
+
+__device_inline void qbvh_packet_setup(QBVHPacket *packet, const float3 *P, const float3 *idir, int num)
+{
+	float3 P_min = P[0], P_max = P[0];
+	float3 idir_min = idir[0], idir_max = idir[0];
+
+	for(int i = 0; i < num; i++) {
+		qbvh_ray_setup(&packet->qray[i], P[i], idir[i]);
+
+		P_min = min(P_min, P[i]);
+		P_max = max(P_max, P[i]);
+		idir_min = min(idir_min, idir[i]);
+		idir_max = max(idir_max, idir[i]);
+	}
+
+#ifdef __QBVH_SSE__
+	/* unused lanes get a copy of the first ray */
+	float lanes[6][QBVH_PACKET_SIZE];
+
+	for(int i = 0; i < QBVH_PACKET_SIZE; i++) {
+		int j = (i < num)? i: 0;
+		float3 dir = 1.0f/idir[j];
+
+		lanes[0][i] = P[j].x;
+		lanes[1][i] = P[j].y;
+		lanes[2][i] = P[j].z;
+		lanes[3][i] = dir.x;
+		lanes[4][i] = dir.y;
+		lanes[5][i] = dir.z;
+	}
+
+	for(int a = 0; a < 3; a++) {
+		packet->P[a] = _mm_loadu_ps(lanes[a]);
+		packet->dir[a] = _mm_loadu_ps(lanes[3 + a]);
+	}
+#endif
+
+	bool pos_x = (idir_min.x >= 0.0f), pos_y = (idir_min.y >= 0.0f), pos_z = (idir_min.z >= 0.0f);
+
+	packet->coherent = (pos_x || idir_max.x < 0.0f) && (pos_y || idir_max.y < 0.0f) && (pos_z || idir_max.z < 0.0f);
+
+	if(!packet->coherent)
+		return;
+
+	packet->near_x = pos_x? 0: 1;
+	packet->near_y = pos_y? 2: 3;
+	packet->near_z = pos_z? 4: 5;
+	packet->far_x = packet->near_x ^ 1;
+	packet->far_y = packet->near_y ^ 1;
+	packet->far_z = packet->near_z ^ 1;
+
+	float3 Pnear = make_float3(pos_x? P_max.x: P_min.x, pos_y? P_max.y: P_min.y, pos_z? P_max.z: P_min.z);
+	float3 Pfar = make_float3(pos_x? P_min.x: P_max.x, pos_y? P_min.y: P_max.y, pos_z? P_min.z: P_max.z);
+
+#ifdef __QBVH_SSE__
+	packet->Pnear[0] = _mm_set1_ps(Pnear.x);
+	packet->Pnear[1] = _mm_set1_ps(Pnear.y);
+	packet->Pnear[2] = _mm_set1_ps(Pnear.z);
+	packet->Pfar[0] = _mm_set1_ps(Pfar.x);
+	packet->Pfar[1] = _mm_set1_ps(Pfar.y);
+	packet->Pfar[2] = _mm_set1_ps(Pfar.z);
+	packet->idir_min[0] = _mm_set1_ps(idir_min.x);
+	packet->idir_min[1] = _mm_set1_ps(idir_min.y);
+	packet->idir_min[2] = _mm_set1_ps(idir_min.z);
+	packet->idir_max[0] = _mm_set1_ps(idir_max.x);
+	packet->idir_max[1] = _mm_set1_ps(idir_max.y);
+	packet->idir_max[2] = _mm_set1_ps(idir_max.z);
+#else
+	packet->Pnear = Pnear;
+	packet->Pfar = Pfar;
+	packet->idir_min = idir_min;
+	packet->idir_max = idir_max;
+#endif
+}
+
+/* intersect four child boxes with the whole packet, returns a bit mask of the
+ * children that may be hit by any of the rays, and a lower bound of their
+ * entry distances. t is the largest distance of the rays */
+__device_inline int qbvh_packet_frustum_intersect(KernelGlobals *kg, float dist[4],
+	const QBVHPacket *packet, float t, uint visibility, int nodeAddr)
+{
+	const int offset = nodeAddr*BVH_QNODE_SIZE;
+
+	float4 near_x = kernel_tex_fetch(__bvh_nodes, offset + packet->near_x);
+	float4 near_y = kernel_tex_fetch(__bvh_nodes, offset + packet->near_y);
+	float4 near_z = kernel_tex_fetch(__bvh_nodes, offset + packet->near_z);
+	float4 far_x = kernel_tex_fetch(__bvh_nodes, offset + packet->far_x);
+	float4 far_y = kernel_tex_fetch(__bvh_nodes, offset + packet->far_y);
+	float4 far_z = kernel_tex_fetch(__bvh_nodes, offset + packet->far_z);
+#ifdef __VISIBILITY_FLAG__
+	float4 cvis = kernel_tex_fetch(__bvh_nodes, offset + 7);
+#endif
+
+#ifdef __QBVH_SSE__
+	__m128 dnear_x = _mm_sub_ps(_mm_loadu_ps(&near_x.x), packet->Pnear[0]);
+	__m128 dnear_y = _mm_sub_ps(_mm_loadu_ps(&near_y.x), packet->Pnear[1]);
+	__m128 dnear_z = _mm_sub_ps(_mm_loadu_ps(&near_z.x), packet->Pnear[2]);
+	__m128 dfar_x = _mm_sub_ps(_mm_loadu_ps(&far_x.x), packet->Pfar[0]);
+	__m128 dfar_y = _mm_sub_ps(_mm_loadu_ps(&far_y.x), packet->Pfar[1]);
+	__m128 dfar_z = _mm_sub_ps(_mm_loadu_ps(&far_z.x), packet->Pfar[2]);
+
+	__m128 tnear_x = _mm_min_ps(_mm_mul_ps(dnear_x, packet->idir_min[0]), _mm_mul_ps(dnear_x, packet->idir_max[0]));
+	__m128 tnear_y = _mm_min_ps(_mm_mul_ps(dnear_y, packet->idir_min[1]), _mm_mul_ps(dnear_y, packet->idir_max[1]));
+	__m128 tnear_z = _mm_min_ps(_mm_mul_ps(dnear_z, packet->idir_min[2]), _mm_mul_ps(dnear_z, packet->idir_max[2]));
+	__m128 tfar_x = _mm_max_ps(_mm_mul_ps(dfar_x, packet->idir_min[0]), _mm_mul_ps(dfar_x, packet->idir_max[0]));
+	__m128 tfar_y = _mm_max_ps(_mm_mul_ps(dfar_y, packet->idir_min[1]), _mm_mul_ps(dfar_y, packet->idir_max[1]));
+	__m128 tfar_z = _mm_max_ps(_mm_mul_ps(dfar_z, packet->idir_min[2]), _mm_mul_ps(dfar_z, packet->idir_max[2]));
+
+	__m128 tnear = _mm_max_ps(_mm_max_ps(tnear_x, tnear_y), _mm_max_ps(tnear_z, _mm_setzero_ps()));
+	__m128 tfar = _mm_min_ps(_mm_min_ps(tfar_x, tfar_y), _mm_min_ps(tfar_z, _mm_set1_ps(t)));
+	__m128 hit = _mm_cmple_ps(tnear, tfar);
+
+#ifdef __VISIBILITY_FLAG__
+	__m128i vis = _mm_and_si128(_mm_castps_si128(_mm_loadu_ps(&cvis.x)), _mm_set1_epi32(visibility));
+	hit = _mm_andnot_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(vis, _mm_setzero_si128())), hit);
+#endif
+
+	_mm_storeu_ps(dist, tnear);
+
+	return _mm_movemask_ps(hit);
+#else
+	int mask = 0;
+
+	for(int i = 0; i < 4; i++) {
+		float dnx = near_x[i] - packet->Pnear.x;
+		float dny = near_y[i] - packet->Pnear.y;
+		float dnz = near_z[i] - packet->Pnear.z;
+		float dfx = far_x[i] - packet->Pfar.x;
+		float dfy = far_y[i] - packet->Pfar.y;
+		float dfz = far_z[i] - packet->Pfar.z;
+		float c0x = min(dnx * packet->idir_min.x, dnx * packet->idir_max.x);
+		float c0y = min(dny * packet->idir_min.y, dny * packet->idir_max.y);
+		float c0z = min(dnz * packet->idir_min.z, dnz * packet->idir_max.z);
+		float c1x = max(dfx * packet->idir_min.x, dfx * packet->idir_max.x);
+		float c1y = max(dfy * packet->idir_min.y, dfy * packet->idir_max.y);
+		float c1z = max(dfz * packet->idir_min.z, dfz * packet->idir_max.z);
+		NO_EXTENDED_PRECISION float cmin = max4(c0x, c0y, c0z, 0.0f);
+		NO_EXTENDED_PRECISION float cmax = min4(c1x, c1y, c1z, t);
+
+#ifdef __VISIBILITY_FLAG__
+		if(cmin <= cmax && (__float_as_int(cvis[i]) & visibility))
+#else
+		if(cmin <= cmax)
+#endif
+			mask |= (1 << i);
+
+		dist[i] = cmin;
+	}
+
+	return mask;
+#endif
+}
+
+/* intersect four child boxes with the rays in mask. returns the mask of rays
+ * that may hit each child, and the closest entry distance among those rays */
+__device_inline int qbvh_packet_node_intersect(KernelGlobals *kg, const QBVHPacket *packet,
+	const float *tmax, int mask, uint visibility, int nodeAddr, int childMask[4], float childDist[4])
+{
+	int any = 0;
+
+	if(packet->coherent) {
+		float t = 0.0f;
+
+		for(int i = 0; i < QBVH_PACKET_SIZE; i++)
+			if(mask & (1 << i))
+				t = max(t, tmax[i]);
+
+		any = qbvh_packet_frustum_intersect(kg, childDist, packet, t, visibility, nodeAddr);
+
+		for(int c = 0; c < 4; c++)
+			childMask[c] = (any & (1 << c))? mask: 0;
+
+		return any;
+	}
+
+	for(int c = 0; c < 4; c++) {
+		childMask[c] = 0;
+		childDist[c] = FLT_MAX;
+	}
+
+	for(int i = 0; i < QBVH_PACKET_SIZE; i++) {
+		if(!(mask & (1 << i)))
+			continue;
+
+		float dist[4];
+		int hit = qbvh_node_intersect(kg, dist, &packet->qray[i], tmax[i], visibility, nodeAddr);
+
+		any |= hit;
+
+		for(int c = 0; c < 4; c++) {
+			if(hit & (1 << c)) {
+				childMask[c] |= (1 << i);
+				childDist[c] = min(childDist[c], dist[c]);
+			}
+		}
+	}
+
+	return any;
+}
+
+/* intersect the rays in mask with a triangle, same as bvh_triangle_intersect
+ * but with one ray per lane */
+__device_inline void qbvh_packet_triangle_intersect(KernelGlobals *kg, Intersection *isects, float *tmax,
+	const QBVHPacket *packet, const float3 *P, const float3 *idir, int mask, uint visibility, int object, int triAddr)
+{
+#ifdef __QBVH_SSE__
+	/* compute and check intersection t-value */
+	float4 v00 = kernel_tex_fetch(__tri_woop, triAddr*TRI_NODE_SIZE+0);
+
+	__m128 Oz = _mm_sub_ps(_mm_sub_ps(_mm_sub_ps(_mm_set1_ps(v00.w),
+		_mm_mul_ps(packet->P[0], _mm_set1_ps(v00.x))),
+		_mm_mul_ps(packet->P[1], _mm_set1_ps(v00.y))),
+		_mm_mul_ps(packet->P[2], _mm_set1_ps(v00.z)));
+	__m128 Dz = _mm_add_ps(_mm_add_ps(
+		_mm_mul_ps(packet->dir[0], _mm_set1_ps(v00.x)),
+		_mm_mul_ps(packet->dir[1], _mm_set1_ps(v00.y))),
+		_mm_mul_ps(packet->dir[2], _mm_set1_ps(v00.z)));
+	__m128 t = _mm_mul_ps(Oz, _mm_div_ps(_mm_set1_ps(1.0f), Dz));
+
+	__m128 hit = _mm_and_ps(_mm_cmpgt_ps(t, _mm_setzero_ps()), _mm_cmplt_ps(t, _mm_loadu_ps(tmax)));
+
+	if(!(_mm_movemask_ps(hit) & mask))
+		return;
+
+	/* compute and check barycentric u */
+	float4 v11 = kernel_tex_fetch(__tri_woop, triAddr*TRI_NODE_SIZE+1);
+
+	__m128 Ox = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_set1_ps(v11.w),
+		_mm_mul_ps(packet->P[0], _mm_set1_ps(v11.x))),
+		_mm_mul_ps(packet->P[1], _mm_set1_ps(v11.y))),
+		_mm_mul_ps(packet->P[2], _mm_set1_ps(v11.z)));
+	__m128 Dx = _mm_add_ps(_mm_add_ps(
+		_mm_mul_ps(packet->dir[0], _mm_set1_ps(v11.x)),
+		_mm_mul_ps(packet->dir[1], _mm_set1_ps(v11.y))),
+		_mm_mul_ps(packet->dir[2], _mm_set1_ps(v11.z)));
+	__m128 u = _mm_add_ps(Ox, _mm_mul_ps(t, Dx));
+
+	hit = _mm_and_ps(hit, _mm_cmpge_ps(u, _mm_setzero_ps()));
+
+	if(!(_mm_movemask_ps(hit) & mask))
+		return;
+
+	/* compute and check barycentric v */
+	float4 v22 = kernel_tex_fetch(__tri_woop, triAddr*TRI_NODE_SIZE+2);
+
+	__m128 Oy = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_set1_ps(v22.w),
+		_mm_mul_ps(packet->P[0], _mm_set1_ps(v22.x))),
+		_mm_mul_ps(packet->P[1], _mm_set1_ps(v22.y))),
+		_mm_mul_ps(packet->P[2], _mm_set1_ps(v22.z)));
+	__m128 Dy = _mm_add_ps(_mm_add_ps(
+		_mm_mul_ps(packet->dir[0], _mm_set1_ps(v22.x)),
+		_mm_mul_ps(packet->dir[1], _mm_set1_ps(v22.y))),
+		_mm_mul_ps(packet->dir[2], _mm_set1_ps(v22.z)));
+	__m128 v = _mm_add_ps(Oy, _mm_mul_ps(t, Dy));
+
+	hit = _mm_and_ps(hit, _mm_cmpge_ps(v, _mm_setzero_ps()));
+	hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+
+	int hit_mask = _mm_movemask_ps(hit) & mask;
+
+	if(!hit_mask)
+		return;
+
+#ifdef __VISIBILITY_FLAG__
+	/* visibility flag test, the same for all rays */
+	if(!(kernel_tex_fetch(__prim_visibility, triAddr) & visibility))
+		return;
+#endif
+
+	/* record intersections */
+	float t_lanes[4], u_lanes[4], v_lanes[4];
+
+	_mm_storeu_ps(t_lanes, t);
+	_mm_storeu_ps(u_lanes, u);
+	_mm_storeu_ps(v_lanes, v);
+
+	for(int i = 0; i < QBVH_PACKET_SIZE; i++) {
+		if(hit_mask & (1 << i)) {
+			isects[i].prim = triAddr;
+			isects[i].object = object;
+			isects[i].u = u_lanes[i];
+			isects[i].v = v_lanes[i];
+			isects[i].t = t_lanes[i];
+			tmax[i] = t_lanes[i];
+		}
+	}
+#else
+	for(int i = 0; i < QBVH_PACKET_SIZE; i++) {
+		if(mask & (1 << i)) {
+			bvh_triangle_intersect(kg, &isects[i], P[i], idir[i], visibility, object, triAddr);
+			tmax[i] = isects[i].t;
+		}
+	}
+#endif
+}
+
+__device_inline void qbvh_intersect_packet(KernelGlobals *kg, const Ray *rays, int num, const uint visibility, Intersection *isects)
+{
+	/* traversal stack, with the mask of rays for each entry */
+	int traversalStack[QBVH_STACK_SIZE];
+	int maskStack[QBVH_STACK_SIZE];
+	traversalStack[0] = ENTRYPOINT_SENTINEL;
+	maskStack[0] = 0;
+
+	/* traversal variables */
+	int stackPtr = 0;
+	int nodeAddr = kernel_data.bvh.root;
+	int mask = (1 << num) - 1;
+	int object = ~0;
+#ifdef __INSTANCING__
+	int instanceMask = 0;
+#endif
+
+	/* ray parameters */
+	float3 P[QBVH_PACKET_SIZE];
+	float3 idir[QBVH_PACKET_SIZE];
+	QBVHPacket packet;
+	float tmax[QBVH_PACKET_SIZE];
+
+	kernel_assert(num > 0 && num <= QBVH_PACKET_SIZE);
+
+	for(int i = 0; i < num; i++) {
+		P[i] = rays[i].P;
+		idir[i] = bvh_inverse_direction(rays[i].D);
+		tmax[i] = rays[i].t;
+
+		isects[i].t = rays[i].t;
+		isects[i].object = ~0;
+		isects[i].prim = ~0;
+		isects[i].u = 0.0f;
+		isects[i].v = 0.0f;
+	}
+
+	/* unused lanes never hit anything, the triangle test loads all four */
+	for(int i = num; i < QBVH_PACKET_SIZE; i++)
+		tmax[i] = 0.0f;
+
+	qbvh_packet_setup(&packet, P, idir, num);
+
+	/* traversal loop */
+	do {
+		do
+		{
+			/* traverse internal nodes */
+			while(nodeAddr >= 0 && nodeAddr != ENTRYPOINT_SENTINEL)
+			{
+				int childMask[4];
+				float childDist[4];
+
+				qbvh_packet_node_intersect(kg, &packet, tmax, mask, visibility, nodeAddr, childMask, childDist);
+
+				float4 cnodes = kernel_tex_fetch(__bvh_nodes, nodeAddr*BVH_QNODE_SIZE+6);
+
+				/* sort hit children, farthest first */
+				int childAddr[4];
+				int childRays[4];
+				float childOrder[4];
+				int num_hit = 0;
+
+				for(int i = 0; i < 4; i++) {
+					if(!childMask[i])
+						continue;
+
+					int j = num_hit++;
+
+					while(j > 0 && childOrder[j-1] < childDist[i]) {
+						childAddr[j] = childAddr[j-1];
+						childRays[j] = childRays[j-1];
+						childOrder[j] = childOrder[j-1];
+						j--;
+					}
+
+					childAddr[j] = __float_as_int(cnodes[i]);
+					childRays[j] = childMask[i];
+					childOrder[j] = childDist[i];
+				}
+
+				if(num_hit == 0) {
+					/* no child was intersected */
+					nodeAddr = traversalStack[stackPtr];
+					mask = maskStack[stackPtr];
+					--stackPtr;
+					continue;
+				}
+
+				/* push the farther children, continue with the closest one */
+				for(int i = 0; i < num_hit-1; i++) {
+					++stackPtr;
+					traversalStack[stackPtr] = childAddr[i];
+					maskStack[stackPtr] = childRays[i];
+				}
+
+				nodeAddr = childAddr[num_hit-1];
+				mask = childRays[num_hit-1];
+			}
+
+			/* if node is leaf, fetch triangle list */
+			if(nodeAddr < 0) {
+				float4 leaf = kernel_tex_fetch(__bvh_nodes, (-nodeAddr-1)*BVH_QNODE_SIZE+6);
+				int primAddr = __float_as_int(leaf.x);
+
+#ifdef __INSTANCING__
+				if(primAddr >= 0) {
+#endif
+					int primAddr2 = __float_as_int(leaf.y);
+					int leafMask = mask;
+
+					/* pop */
+					nodeAddr = traversalStack[stackPtr];
+					mask = maskStack[stackPtr];
+					--stackPtr;
+
+					/* primitive intersection */
+					while(primAddr < primAddr2) {
+						/* intersect rays against primitive */
+#ifdef __HAIR__
+						uint segment = kernel_tex_fetch(__prim_segment, primAddr);
+						if(segment != ~0) {
+							for(int i = 0; i < num; i++) {
+								if(leafMask & (1 << i)) {
+									bvh_curve_intersect(kg, &isects[i], P[i], idir[i], visibility, object, primAddr, segment);
+									tmax[i] = isects[i].t;
+								}
+							}
+						}
+						else
+#endif
+							qbvh_packet_triangle_intersect(kg, isects, tmax, &packet, P, idir, leafMask, visibility, object, primAddr);
+
+						primAddr++;
+					}
+#ifdef __INSTANCING__
+				}
+				else {
+					/* instance push */
+					object = kernel_tex_fetch(__prim_object, -primAddr-1);
+					instanceMask = mask;
+
+					for(int i = 0; i < num; i++) {
+						if(instanceMask & (1 << i)) {
+							bvh_instance_push(kg, object, &rays[i], &P[i], &idir[i], &isects[i].t, rays[i].t);
+							tmax[i] = isects[i].t;
+						}
+					}
+
+					qbvh_packet_setup(&packet, P, idir, num);
+
+					++stackPtr;
+					traversalStack[stackPtr] = ENTRYPOINT_SENTINEL;
+					maskStack[stackPtr] = 0;
+
+					nodeAddr = kernel_tex_fetch(__object_node, object);
+				}
+#endif
+			}
+		} while(nodeAddr != ENTRYPOINT_SENTINEL);
+
+#ifdef __INSTANCING__
+		if(stackPtr >= 0) {
+			kernel_assert(object != ~0);
+
+			/* instance pop */
+			for(int i = 0; i < num; i++) {
+				if(instanceMask & (1 << i)) {
+					bvh_instance_pop(kg, object, &rays[i], &P[i], &idir[i], &isects[i].t, rays[i].t);
+					tmax[i] = isects[i].t;
+				}
+			}
+
+			qbvh_packet_setup(&packet, P, idir, num);
+
+			object = ~0;
+			nodeAddr = traversalStack[stackPtr];
+			mask = maskStack[stackPtr];
+			--stackPtr;
+		}
+#endif
+	} while(nodeAddr != ENTRYPOINT_SENTINEL);
+}
+
+CCL_NAMESPACE_END
+
@@ -60,7 +60,7 @@ __device_inline void shader_setup_from_ray(KernelGlobals *kg, ShaderData *sd,
 	sd->object = (isect->object == ~0)? kernel_tex_fetch(__prim_object, isect->prim): isect->object;
 #endif
 
-	sd->flag = kernel_tex_fetch(__object_flag, sd->object);
+	sd->flag = object_fetch_flag(kg, sd->object);
 
 	/* matrices and time */
 #ifdef __OBJECT_MOTION__
@@ -202,7 +202,7 @@ __device void shader_setup_from_sample(KernelGlobals *kg, ShaderData *sd,
 
 	sd->flag = kernel_tex_fetch(__shader_flag, (sd->shader & SHADER_MASK)*2);
 	if(sd->object != -1) {
-		sd->flag |= kernel_tex_fetch(__object_flag, sd->object);
+		sd->flag |= object_fetch_flag(kg, sd->object);
 
 #ifdef __OBJECT_MOTION__
 		shader_setup_object_transforms(kg, sd, time);
@@ -36,6 +36,7 @@ KERNEL_TEX(uint, texture_uint, __object_node)
 /* objects */
 KERNEL_TEX(float4, texture_float4, __objects)
 KERNEL_TEX(float4, texture_float4, __objects_vector)
+KERNEL_TEX(float4, texture_float4, __instances)
 
 /* triangles */
 KERNEL_TEX(float4, texture_float4, __tri_normal)
@@ -31,6 +31,7 @@ CCL_NAMESPACE_BEGIN
 /* constants */
 #define OBJECT_SIZE 		11
 #define OBJECT_VECTOR_SIZE	6
+#define INSTANCE_SIZE		9
 #define LIGHT_SIZE			4
 #define FILTER_TABLE_SIZE	256
 #define RAMP_TABLE_SIZE		256
@@ -49,6 +50,8 @@ CCL_NAMESPACE_BEGIN
 #define __NON_PROGRESSIVE__
 #define __HAIR__
 #define __LAMP_MIS__
+#define __QBVH__
+#define __TEXTURE_CACHE__
 #endif
 
 #ifdef __KERNEL_CUDA__
@@ -223,7 +226,8 @@ typedef enum PassType {
 	PASS_AO = 131072,
 	PASS_SHADOW = 262144,
 	PASS_MOTION = 524288,
-	PASS_MOTION_WEIGHT = 1048576
+	PASS_MOTION_WEIGHT = 1048576,
+	PASS_VARIANCE = 2097152
 } PassType;
 
 #define PASS_ALL (~0)
@@ -604,7 +608,7 @@ typedef struct KernelFilm {
 	int pass_ao;
 
 	int pass_shadow;
-	int pass_pad1;
+	int pass_variance;
 	int pass_pad2;
 	int pass_pad3;
 } KernelFilm;
@@ -673,7 +677,14 @@ typedef struct KernelIntegrator {
 	int transmission_samples;
 	int ao_samples;
 	int mesh_light_samples;
-	int pad1;
+
+	/* adaptive sampling */
+	float adaptive_threshold;
+	int adaptive_min_samples;
+
+	/* deferred shading */
+	int deferred_shading;
+	int pad1, pad2;
 } KernelIntegrator;
 
 typedef struct KernelBVH {
@@ -681,7 +692,11 @@ typedef struct KernelBVH {
 	int root;
 	int attributes_map_stride;
 	int have_motion;
-	int pad2;
+	int use_qbvh;
+
+	/* object ids from here on are instances */
+	int num_objects;
+	int pad1, pad2, pad3;
 } KernelBVH;
 
 typedef enum CurveFlag {
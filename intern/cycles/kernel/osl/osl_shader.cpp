@@ -457,7 +457,7 @@ float3 OSLShader::volume_eval_phase(const ShaderClosure *sc, const float3 omega_
 int OSLShader::find_attribute(KernelGlobals *kg, const ShaderData *sd, uint id, AttributeElement *elem)
 {
 	/* for OSL, a hash map is used to lookup the attribute by name. */
-	int object = sd->object*ATTR_PRIM_TYPES;
+	int object = object_attribute_object(kg, sd->object)*ATTR_PRIM_TYPES;
 #ifdef __HAIR__
 	if(sd->segment != ~0) object += ATTR_PRIM_CURVE;
 #endif
@@ -50,7 +50,7 @@ __device_inline float svm_image_texture_frac(float x, int *ix)
 	return x - (float)i;
 }
 
-__device float4 svm_image_texture(KernelGlobals *kg, int id, float x, float y, uint srgb)
+__device float4 svm_image_texture(KernelGlobals *kg, int id, float x, float y, float width, uint srgb)
 {
 	/* first slots are used by float textures, which are not supported here */
 	if(id < TEX_NUM_FLOAT_IMAGES)
@@ -99,12 +99,16 @@ __device float4 svm_image_texture(KernelGlobals *kg, int id, float x, float y, u
 
 #else
 
-__device float4 svm_image_texture(KernelGlobals *kg, int id, float x, float y, uint srgb)
+__device float4 svm_image_texture(KernelGlobals *kg, int id, float x, float y, float width, uint srgb)
 {
 	float4 r;
 
 #ifdef __KERNEL_CPU__
+#ifdef __TEXTURE_CACHE__
+	r = kernel_tex_image_interp_filtered(id, x, y, width);
+#else
 	r = kernel_tex_image_interp(id, x, y);
+#endif
 #else
 	/* not particularly proud of this massive switch, what are the
 	 * alternatives?
@@ -233,6 +237,31 @@ __device float4 svm_image_texture(KernelGlobals *kg, int id, float x, float y, u
 
 #endif
 
+/* filter width in texture coordinates, from the ray differentials of the
+ * UV attribute the texture coordinates come from. zero when the coordinates
+ * come from elsewhere, which means no filtering */
+
+__device float svm_image_texture_width(KernelGlobals *kg, ShaderData *sd, uint attr_id)
+{
+	float width = 0.0f;
+
+#if defined(__TEXTURE_CACHE__) && defined(__RAY_DIFFERENTIALS__)
+	if(attr_id != ATTR_STD_NOT_FOUND) {
+		AttributeElement elem;
+		int offset = find_attribute(kg, sd, attr_id, &elem);
+
+		if(offset != ATTR_STD_NOT_FOUND) {
+			float3 dx, dy;
+			primitive_attribute_float3(kg, sd, elem, offset, &dx, &dy);
+
+			width = max(len(make_float2(dx.x, dx.y)), len(make_float2(dy.x, dy.y)));
+		}
+	}
+#endif
+
+	return width;
+}
+
 __device void svm_node_tex_image(KernelGlobals *kg, ShaderData *sd, float *stack, uint4 node)
 {
 	uint id = node.y;
@@ -241,7 +270,8 @@ __device void svm_node_tex_image(KernelGlobals *kg, ShaderData *sd, float *stack
 	decode_node_uchar4(node.z, &co_offset, &out_offset, &alpha_offset, &srgb);
 
 	float3 co = stack_load_float3(stack, co_offset);
-	float4 f = svm_image_texture(kg, id, co.x, co.y, srgb);
+	float width = svm_image_texture_width(kg, sd, node.w);
+	float4 f = svm_image_texture(kg, id, co.x, co.y, width, srgb);
 
 	if(stack_valid(out_offset))
 		stack_store_float3(stack, out_offset, make_float3(f.x, f.y, f.z));
@@ -324,11 +354,11 @@ __device void svm_node_tex_image_box(KernelGlobals *kg, ShaderData *sd, float *s
 	float4 f = make_float4(0.0f, 0.0f, 0.0f, 0.0f);
 
 	if(weight.x > 0.0f)
-		f += weight.x*svm_image_texture(kg, id, co.y, co.z, srgb);
+		f += weight.x*svm_image_texture(kg, id, co.y, co.z, 0.0f, srgb);
 	if(weight.y > 0.0f)
-		f += weight.y*svm_image_texture(kg, id, co.x, co.z, srgb);
+		f += weight.y*svm_image_texture(kg, id, co.x, co.z, 0.0f, srgb);
 	if(weight.z > 0.0f)
-		f += weight.z*svm_image_texture(kg, id, co.y, co.x, srgb);
+		f += weight.z*svm_image_texture(kg, id, co.y, co.x, 0.0f, srgb);
 
 	if(stack_valid(out_offset))
 		stack_store_float3(stack, out_offset, make_float3(f.x, f.y, f.z));
@@ -355,7 +385,7 @@ __device void svm_node_tex_environment(KernelGlobals *kg, ShaderData *sd, float
 	else
 		uv = direction_to_mirrorball(co);
 
-	float4 f = svm_image_texture(kg, id, uv.x, uv.y, srgb);
+	float4 f = svm_image_texture(kg, id, uv.x, uv.y, 0.0f, srgb);
 
 	if(stack_valid(out_offset))
 		stack_store_float3(stack, out_offset, make_float3(f.x, f.y, f.z));
@@ -138,6 +138,9 @@ void Pass::add(PassType type, vector<Pass>& passes)
 			pass.components = 4;
 			pass.exposure = false;
 			break;
+		case PASS_VARIANCE:
+			pass.components = 4;
+			break;
 	}
 
 	passes.push_back(pass);
@@ -275,6 +278,10 @@ void Film::device_update(Device *device, DeviceScene *dscene)
 			case PASS_SHADOW:
 				kfilm->pass_shadow = kfilm->pass_stride;
 				kfilm->use_light_pass = 1;
+				break;
+			case PASS_VARIANCE:
+				kfilm->pass_variance = kfilm->pass_stride;
+				break;
 			case PASS_NONE:
 				break;
 		}
@@ -20,10 +20,12 @@
 #include "image.h"
 #include "scene.h"
 
+#include "util_cache.h"
 #include "util_foreach.h"
 #include "util_image.h"
 #include "util_path.h"
 #include "util_progress.h"
+#include "util_texture_cache.h"
 
 #ifdef WITH_OSL
 #include <OSL/oslexec.h>
@@ -36,6 +38,8 @@ ImageManager::ImageManager()
 	need_update = true;
 	pack_images = false;
 	osl_texture_system = NULL;
+	texture_cache_size = 0;
+	use_cache = false;
 	animation_frame = 0;
 
 	tex_num_images = TEX_NUM_IMAGES;
@@ -56,6 +60,16 @@ void ImageManager::set_pack_images(bool pack_images_)
 	pack_images = pack_images_;
 }
 
+void ImageManager::set_texture_cache_size(size_t size)
+{
+	texture_cache_size = size;
+}
+
+void ImageManager::set_use_cache(bool use_cache_)
+{
+	use_cache = use_cache_;
+}
+
 void ImageManager::set_osl_texture_system(void *texture_system)
 {
 	osl_texture_system = texture_system;
@@ -237,11 +251,69 @@ void ImageManager::remove_image(const string& filename)
 	}
 }
 
+/* Disk cache of decoded pixels, so image files that did not change do not
+ * have to be decoded again for every render. */
+
+static void image_cache_key(CacheData& key, const string& filename, int is_float)
+{
+	uint64_t modified_time = path_modified_time(filename);
+
+	key.add((void*)filename.c_str(), filename.size());
+	key.add(&modified_time, sizeof(modified_time));
+	key.add(is_float);
+
+	/* hash now, the buffers are local */
+	key.get_filename();
+}
+
+template<typename T> static bool image_cache_read(CacheData& key, device_vector<T>& tex_img)
+{
+	CacheData value;
+
+	if(!Cache::global.lookup(key, value))
+		return false;
+
+	int size[2];
+
+	if(!value.read(size, sizeof(size)) || size[0] <= 0 || size[1] <= 0)
+		return false;
+
+	T *pixels = tex_img.resize(size[0], size[1]);
+
+	if(!value.read(pixels, sizeof(T)*size[0]*size[1])) {
+		tex_img.clear();
+		return false;
+	}
+
+	return true;
+}
+
+template<typename T> static void image_cache_write(CacheData& key, device_vector<T>& tex_img)
+{
+	CacheData value;
+	int size[2] = {(int)tex_img.data_width, (int)tex_img.data_height};
+
+	value.add(size, sizeof(size));
+	value.add((void*)tex_img.data_pointer, tex_img.memory_size());
+
+	Cache::global.insert(key, value);
+}
+
 bool ImageManager::file_load_image(Image *img, device_vector<uchar4>& tex_img)
 {
 	if(img->filename == "")
 		return false;
 
+	CacheData key("image");
+
+	if(use_cache) {
+		image_cache_key(key, img->filename, false);
+		img->cache_filename = key.get_filename();
+
+		if(image_cache_read(key, tex_img))
+			return true;
+	}
+
 	/* load image from file through OIIO */
 	ImageInput *in = ImageInput::create(img->filename);
 
@@ -296,6 +368,9 @@ bool ImageManager::file_load_image(Image *img, device_vector<uchar4>& tex_img)
 		}
 	}
 
+	if(use_cache)
+		image_cache_write(key, tex_img);
+
 	return true;
 }
 
@@ -304,6 +379,16 @@ bool ImageManager::file_load_float_image(Image *img, device_vector<float4>& tex_
 	if(img->filename == "")
 		return false;
 
+	CacheData key("image");
+
+	if(use_cache) {
+		image_cache_key(key, img->filename, true);
+		img->cache_filename = key.get_filename();
+
+		if(image_cache_read(key, tex_img))
+			return true;
+	}
+
 	/* load image from file through OIIO */
 	ImageInput *in = ImageInput::create(img->filename);
 
@@ -358,9 +443,29 @@ bool ImageManager::file_load_float_image(Image *img, device_vector<float4>& tex_
 		}
 	}
 
+	if(use_cache)
+		image_cache_write(key, tex_img);
+
 	return true;
 }
 
+bool ImageManager::device_cache_image(Device *device, Image *img, int slot, bool is_float)
+{
+	/* with a texture cache on the device, images are read when they are
+	 * sampled rather than loaded in full here */
+	TextureCache *cache = device->texture_cache();
+
+	if(!cache)
+		return false;
+
+	cache->remove_image(slot);
+
+	if(texture_cache_size == 0 || pack_images)
+		return false;
+
+	return cache->add_image(slot, img->filename, is_float);
+}
+
 void ImageManager::device_load_image(Device *device, DeviceScene *dscene, int slot, Progress *progress)
 {
 	if(progress->get_cancel())
@@ -391,6 +496,12 @@ void ImageManager::device_load_image(Device *device, DeviceScene *dscene, int sl
 			device->tex_free(tex_img);
 		}
 
+		if(device_cache_image(device, img, slot, true)) {
+			tex_img.clear();
+			img->need_load = false;
+			return;
+		}
+
 		if(!file_load_float_image(img, tex_img)) {
 			/* on failure to load, we set a 1x1 pixels pink image */
 			float *pixels = (float*)tex_img.resize(1, 1);
@@ -422,6 +533,12 @@ void ImageManager::device_load_image(Device *device, DeviceScene *dscene, int sl
 			device->tex_free(tex_img);
 		}
 
+		if(device_cache_image(device, img, slot, false)) {
+			tex_img.clear();
+			img->need_load = false;
+			return;
+		}
+
 		if(!file_load_image(img, tex_img)) {
 			/* on failure to load, we set a 1x1 pixels pink image */
 			uchar *pixels = (uchar*)tex_img.resize(1, 1);
@@ -461,6 +578,9 @@ void ImageManager::device_free_image(Device *device, DeviceScene *dscene, int sl
 	}
 
 	if(img) {
+		if(device->texture_cache())
+			device->texture_cache()->remove_image(slot);
+
 		if(osl_texture_system) {
 #ifdef WITH_OSL
 			ustring filename(images[slot]->filename);
@@ -501,6 +621,9 @@ void ImageManager::device_update(Device *device, DeviceScene *dscene, Progress&
 	if(!need_update)
 		return;
 
+	if(device->texture_cache())
+		device->texture_cache()->set_memory_limit(texture_cache_size);
+
 	TaskPool pool;
 
 	for(size_t slot = 0; slot < images.size(); slot++) {
@@ -534,6 +657,20 @@ void ImageManager::device_update(Device *device, DeviceScene *dscene, Progress&
 	if(pack_images)
 		device_pack_images(device, dscene, progress);
 
+	/* clear other image files from cache */
+	if(use_cache) {
+		set<string> except;
+
+		foreach(Image *img, images)
+			if(img && !img->cache_filename.empty())
+				except.insert(img->cache_filename);
+		foreach(Image *img, float_images)
+			if(img && !img->cache_filename.empty())
+				except.insert(img->cache_filename);
+
+		Cache::global.clear_except("image", except);
+	}
+
 	need_update = false;
 }
 
@@ -61,6 +61,8 @@ public:
 	void set_osl_texture_system(void *texture_system);
 	void set_pack_images(bool pack_images_);
 	void set_extended_image_limits(void);
+	void set_texture_cache_size(size_t size);
+	void set_use_cache(bool use_cache_);
 	bool set_animation_frame_update(int frame);
 
 	bool need_update;
@@ -74,6 +76,8 @@ private:
 
 	struct Image {
 		string filename;
+		/* decoded pixels in the disk cache */
+		string cache_filename;
 
 		bool need_load;
 		bool animated;
@@ -84,10 +88,13 @@ private:
 	vector<Image*> float_images;
 	void *osl_texture_system;
 	bool pack_images;
+	size_t texture_cache_size;
+	bool use_cache;
 
 	bool file_load_image(Image *img, device_vector<uchar4>& tex_img);
 	bool file_load_float_image(Image *img, device_vector<float4>& tex_img);
 
+	bool device_cache_image(Device *device, Image *img, int slot, bool is_float);
 	void device_load_image(Device *device, DeviceScene *dscene, int slot, Progress *progess);
 	void device_free_image(Device *device, DeviceScene *dscene, int slot);
 
@@ -56,6 +56,11 @@ Integrator::Integrator()
 	mesh_light_samples = 1;
 	progressive = true;
 
+	adaptive_threshold = 0.0f;
+	adaptive_min_samples = 16;
+
+	deferred_shading = false;
+
 	need_update = true;
 }
 
@@ -109,6 +114,12 @@ void Integrator::device_update(Device *device, DeviceScene *dscene, Scene *scene
 	kintegrator->ao_samples = ao_samples;
 	kintegrator->mesh_light_samples = mesh_light_samples;
 
+	kintegrator->adaptive_threshold = adaptive_threshold;
+	/* variance estimate needs at least two samples */
+	kintegrator->adaptive_min_samples = max(adaptive_min_samples, 2);
+
+	kintegrator->deferred_shading = deferred_shading;
+
 	/* sobol directions table */
 	int max_samples = 1;
 
@@ -163,6 +174,9 @@ bool Integrator::modified(const Integrator& integrator)
 		transmission_samples == integrator.transmission_samples &&
 		ao_samples == integrator.ao_samples &&
 		mesh_light_samples == integrator.mesh_light_samples &&
+		adaptive_threshold == integrator.adaptive_threshold &&
+		adaptive_min_samples == integrator.adaptive_min_samples &&
+		deferred_shading == integrator.deferred_shading &&
 		motion_blur == integrator.motion_blur);
 }
 
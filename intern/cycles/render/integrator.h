@@ -57,6 +57,11 @@ public:
 
 	bool progressive;
 
+	float adaptive_threshold;
+	int adaptive_min_samples;
+
+	bool deferred_shading;
+
 	bool need_update;
 
 	Integrator();
@@ -21,10 +21,12 @@
 #include "light.h"
 #include "mesh.h"
 #include "object.h"
+#include "particles.h"
 #include "scene.h"
 #include "shader.h"
 
 #include "util_foreach.h"
+#include "util_map.h"
 #include "util_progress.h"
 
 CCL_NAMESPACE_BEGIN
@@ -135,6 +137,63 @@ LightManager::~LightManager()
 {
 }
 
+static size_t object_num_emissive_triangles(Scene *scene, Object *object)
+{
+	Mesh *mesh = object->mesh;
+	bool have_emission = false;
+	size_t num_triangles = 0;
+
+	/* skip if we are not visible for BSDFs */
+	if(!(object->visibility & (PATH_RAY_DIFFUSE|PATH_RAY_GLOSSY|PATH_RAY_TRANSMIT)))
+		return 0;
+
+	/* skip if we have no emission shaders */
+	foreach(uint sindex, mesh->used_shaders) {
+		Shader *shader = scene->shaders[sindex];
+
+		if(shader->sample_as_light && shader->has_surface_emission) {
+			have_emission = true;
+			break;
+		}
+	}
+
+	/* count triangles */
+	if(have_emission) {
+		for(size_t i = 0; i < mesh->triangles.size(); i++) {
+			Shader *shader = scene->shaders[mesh->shader[i]];
+
+			if(shader->sample_as_light && shader->has_surface_emission)
+				num_triangles++;
+		}
+	}
+
+	return num_triangles;
+}
+
+static void add_instance_emissive_triangles(Scene *scene, Mesh *mesh, const Transform& tfm, int object_id,
+	float4 *distribution, size_t& offset, float& totarea)
+{
+	/* instanced meshes never have their transform applied */
+	for(size_t i = 0; i < mesh->triangles.size(); i++) {
+		Shader *shader = scene->shaders[mesh->shader[i]];
+
+		if(shader->sample_as_light && shader->has_surface_emission) {
+			distribution[offset].x = totarea;
+			distribution[offset].y = __int_as_float(i + mesh->tri_offset);
+			distribution[offset].z = __int_as_float(~0);
+			distribution[offset].w = __int_as_float(object_id);
+			offset++;
+
+			Mesh::Triangle t = mesh->triangles[i];
+			float3 p1 = transform_point(&tfm, mesh->verts[t.v[0]]);
+			float3 p2 = transform_point(&tfm, mesh->verts[t.v[1]]);
+			float3 p3 = transform_point(&tfm, mesh->verts[t.v[2]]);
+
+			totarea += triangle_area(p1, p2, p3);
+		}
+	}
+}
+
 void LightManager::device_update_distribution(Device *device, DeviceScene *dscene, Scene *scene, Progress& progress)
 {
 	progress.set_status("Updating Lights", "Computing distribution");
@@ -148,8 +207,8 @@ void LightManager::device_update_distribution(Device *device, DeviceScene *dscen
 		Mesh *mesh = object->mesh;
 		bool have_emission = false;
 
-		/* skip if we are not visible for BSDFs */
-		if(!(object->visibility & (PATH_RAY_DIFFUSE|PATH_RAY_GLOSSY|PATH_RAY_TRANSMIT)))
+		/* skip if we are not visible for BSDFs, or only rendered through instances */
+		if(!(object->visibility & (PATH_RAY_DIFFUSE|PATH_RAY_GLOSSY|PATH_RAY_TRANSMIT)) || object->instance_only)
 			continue;
 
 		/* skip if we have no emission shaders */
@@ -182,6 +241,21 @@ void LightManager::device_update_distribution(Device *device, DeviceScene *dscen
 		}
 	}
 
+	/* instances of emissive objects, counting each instanced object once */
+	vector<ObjectInstance*> instances;
+	map<Object*, size_t> instance_triangles;
+
+	scene->object_manager->get_instances(scene, instances);
+
+	foreach(ObjectInstance *inst, instances) {
+		map<Object*, size_t>::iterator it = instance_triangles.find(inst->object);
+
+		if(it == instance_triangles.end())
+			it = instance_triangles.insert(std::make_pair(inst->object, object_num_emissive_triangles(scene, inst->object))).first;
+
+		num_triangles += it->second;
+	}
+
 	size_t num_distribution = num_triangles + num_curve_segments;
 	num_distribution += num_lights;
 
@@ -193,12 +267,13 @@ void LightManager::device_update_distribution(Device *device, DeviceScene *dscen
 	size_t offset = 0;
 	int j = 0;
 
-	foreach(Object *object, scene->objects) {
+	for(j = 0; j < (int)scene->objects.size(); j++) {
+		Object *object = scene->objects[j];
 		Mesh *mesh = object->mesh;
 		bool have_emission = false;
 
-		/* skip if we are not visible for BSDFs */
-		if(!(object->visibility & (PATH_RAY_DIFFUSE|PATH_RAY_GLOSSY|PATH_RAY_TRANSMIT)))
+		/* skip if we are not visible for BSDFs, or only rendered through instances */
+		if(!(object->visibility & (PATH_RAY_DIFFUSE|PATH_RAY_GLOSSY|PATH_RAY_TRANSMIT)) || object->instance_only)
 			continue;
 
 		/* skip if we have no emission shaders */
@@ -281,10 +356,18 @@ void LightManager::device_update_distribution(Device *device, DeviceScene *dscen
 		}
 
 		if(progress.get_cancel()) return;
+	}
+
+	/* instance ids follow the objects */
+	foreach(ObjectInstance *inst, instances) {
+		if(instance_triangles[inst->object])
+			add_instance_emissive_triangles(scene, inst->object->mesh, inst->tfm, j, distribution, offset, totarea);
 
 		j++;
 	}
 
+	if(progress.get_cancel()) return;
+
 	float trianglearea = totarea;
 
 	/* point lights */
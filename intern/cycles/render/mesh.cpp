@@ -33,6 +33,7 @@
 #include "util_foreach.h"
 #include "util_progress.h"
 #include "util_set.h"
+#include "util_time.h"
 
 CCL_NAMESPACE_BEGIN
 
@@ -765,20 +766,34 @@ void MeshManager::device_update_mesh(Device *device, DeviceScene *dscene, Scene
 	}
 }
 
-void MeshManager::device_update_bvh(Device *device, DeviceScene *dscene, Scene *scene, Progress& progress)
+void MeshManager::device_update_bvh(Device *device, DeviceScene *dscene, Scene *scene, bool rebuild, Progress& progress)
 {
-	/* bvh build */
-	progress.set_status("Updating Scene BVH", "Building");
-
 	BVHParams bparams;
 	bparams.top_level = true;
-	bparams.use_qbvh = scene->params.use_qbvh;
+	bparams.use_qbvh = scene->params.use_qbvh && device->info.type == DEVICE_CPU;
 	bparams.use_spatial_split = scene->params.use_bvh_spatial_split;
 	bparams.use_cache = scene->params.use_bvh_cache;
 
-	delete bvh;
-	bvh = BVH::create(bparams, scene->objects);
-	bvh->build(progress);
+	/* if only instanced meshes were refitted or objects moved, refit the top
+	 * level BVH, merging only the instance BVH's that changed */
+	bool refitted = false;
+
+	if(bvh && !rebuild) {
+		progress.set_status("Updating Scene BVH", "Refitting");
+		bvh->objects = scene->objects;
+		scene->object_manager->get_instances(scene, bvh->instances);
+		refitted = bvh->refit_top_level(progress);
+	}
+
+	if(!refitted) {
+		/* bvh build, particle instances go in the top level next to the objects */
+		progress.set_status("Updating Scene BVH", "Building");
+
+		delete bvh;
+		bvh = BVH::create(bparams, scene->objects);
+		scene->object_manager->get_instances(scene, bvh->instances);
+		bvh->build(progress);
+	}
 
 	if(progress.get_cancel()) return;
 
@@ -817,6 +832,7 @@ void MeshManager::device_update_bvh(Device *device, DeviceScene *dscene, Scene *
 	}
 
 	dscene->data.bvh.root = pack.root_index;
+	dscene->data.bvh.use_qbvh = bparams.use_qbvh;
 }
 
 void MeshManager::device_update(Device *device, DeviceScene *dscene, Scene *scene, Progress& progress)
@@ -869,17 +885,28 @@ void MeshManager::device_update(Device *device, DeviceScene *dscene, Scene *scen
 	}
 
 	/* update bvh */
+	double bvh_start = time_dt();
 	size_t i = 0, num_bvh = 0;
+	bool rebuild_top_level = false;
 
-	foreach(Mesh *mesh, scene->meshes)
+	foreach(Mesh *mesh, scene->meshes) {
 		if(mesh->need_update && !mesh->transform_applied)
 			num_bvh++;
 
+		/* meshes with transform applied are built into the top level BVH */
+		if(mesh->need_update && mesh->transform_applied)
+			rebuild_top_level = true;
+	}
+
+	/* the QBVH layout is only traversed by the CPU kernels */
+	SceneParams bvh_params = scene->params;
+	bvh_params.use_qbvh = scene->params.use_qbvh && device->info.type == DEVICE_CPU;
+
 	TaskPool pool;
 
 	foreach(Mesh *mesh, scene->meshes) {
 		if(mesh->need_update) {
-			pool.push(function_bind(&Mesh::compute_bvh, mesh, &scene->params, &progress, i, num_bvh));
+			pool.push(function_bind(&Mesh::compute_bvh, mesh, &bvh_params, &progress, i, num_bvh));
 			i++;
 		}
 	}
@@ -902,7 +929,9 @@ void MeshManager::device_update(Device *device, DeviceScene *dscene, Scene *scen
 
 	if(progress.get_cancel()) return;
 
-	device_update_bvh(device, dscene, scene, progress);
+	device_update_bvh(device, dscene, scene, rebuild_top_level, progress);
+
+	scene->update_times.bvh = time_dt() - bvh_start;
 
 	need_update = false;
 }
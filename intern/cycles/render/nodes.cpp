@@ -197,13 +197,27 @@ void ImageTextureNode::compile(SVMCompiler& compiler)
 		}
 
 		if(projection == "Flat") {
+			/* UV attribute the coordinates come from, so the kernel can find
+			 * the filter width from its ray differentials */
+			uint uv_attr = ATTR_STD_NOT_FOUND;
+			ShaderOutput *vector_link = vector_in->link;
+
+			if(tex_mapping.skip() && vector_link &&
+			   vector_link->parent->name == ustring("texture_coordinate") &&
+			   strcmp(vector_link->name, "UV") == 0 &&
+			   !((TextureCoordinateNode*)vector_link->parent)->from_dupli)
+			{
+				uv_attr = compiler.attribute(ATTR_STD_UV);
+			}
+
 			compiler.add_node(NODE_TEX_IMAGE,
 				slot,
 				compiler.encode_uchar4(
 					vector_offset,
 					color_out->stack_offset,
 					alpha_out->stack_offset,
-					srgb));
+					srgb),
+				uv_attr);
 		}
 		else {
 			compiler.add_node(NODE_TEX_IMAGE_BOX,
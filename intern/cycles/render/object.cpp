@@ -21,6 +21,7 @@
 #include "mesh.h"
 #include "curves.h"
 #include "object.h"
+#include "particles.h"
 #include "scene.h"
 
 #include "util_foreach.h"
@@ -47,6 +48,7 @@ Object::Object()
 	use_motion = false;
 	use_holdout = false;
 	curverender = false;
+	instance_only = false;
 }
 
 Object::~Object()
@@ -151,6 +153,13 @@ void Object::tag_update(Scene *scene)
 	scene->object_manager->need_update = true;
 }
 
+/* Object Instance */
+
+BoundBox ObjectInstance::bounds() const
+{
+	return object->mesh->bounds.transformed(&tfm);
+}
+
 /* Object Manager */
 
 ObjectManager::ObjectManager()
@@ -162,73 +171,22 @@ ObjectManager::~ObjectManager()
 {
 }
 
-void ObjectManager::device_update_transforms(Device *device, DeviceScene *dscene, Scene *scene, uint *object_flag, Progress& progress)
+static float object_surface_area(Mesh *mesh, const Transform& tfm, map<Mesh*, float>& surface_area_map)
 {
-	float4 *objects;
-	float4 *objects_vector = NULL;
-	int i = 0;
-	map<Mesh*, float> surface_area_map;
-	Scene::MotionType need_motion = scene->need_motion(device->info.advanced_shading);
-	bool have_motion = false;
-
-	objects = dscene->objects.resize(OBJECT_SIZE*scene->objects.size());
-	if(need_motion == Scene::MOTION_PASS)
-		objects_vector = dscene->objects_vector.resize(OBJECT_VECTOR_SIZE*scene->objects.size());
-
-	foreach(Object *ob, scene->objects) {
-		Mesh *mesh = ob->mesh;
-		uint flag = 0;
-
-		/* compute transformations */
-		Transform tfm = ob->tfm;
-		Transform itfm = transform_inverse(tfm);
-
-		/* compute surface area. for uniform scale we can do avoid the many
-		 * transform calls and share computation for instances */
-		/* todo: correct for displacement, and move to a better place */
-		float uniform_scale;
-		float surface_area = 0.0f;
-		float pass_id = ob->pass_id;
-		float random_number = (float)ob->random_id * (1.0f/(float)0xFFFFFFFF);
-		
-		if(transform_uniform_scale(tfm, uniform_scale)) {
-			map<Mesh*, float>::iterator it = surface_area_map.find(mesh);
-
-			if(it == surface_area_map.end()) {
-				foreach(Mesh::Triangle& t, mesh->triangles) {
-					float3 p1 = mesh->verts[t.v[0]];
-					float3 p2 = mesh->verts[t.v[1]];
-					float3 p3 = mesh->verts[t.v[2]];
-
-					surface_area += triangle_area(p1, p2, p3);
-				}
+	/* compute surface area. for uniform scale we can do avoid the many
+	 * transform calls and share computation for instances */
+	/* todo: correct for displacement, and move to a better place */
+	float uniform_scale;
+	float surface_area = 0.0f;
 
-				foreach(Mesh::Curve& curve, mesh->curves) {
-					int first_key = curve.first_key;
+	if(transform_uniform_scale(tfm, uniform_scale)) {
+		map<Mesh*, float>::iterator it = surface_area_map.find(mesh);
 
-					for(int i = 0; i < curve.num_segments(); i++) {
-						float3 p1 = mesh->curve_keys[first_key + i].co;
-						float r1 = mesh->curve_keys[first_key + i].radius;
-						float3 p2 = mesh->curve_keys[first_key + i + 1].co;
-						float r2 = mesh->curve_keys[first_key + i + 1].radius;
-
-						/* currently ignores segment overlaps*/
-						surface_area += M_PI_F *(r1 + r2) * len(p1 - p2);
-					}
-				}
-
-				surface_area_map[mesh] = surface_area;
-			}
-			else
-				surface_area = it->second;
-
-			surface_area *= uniform_scale;
-		}
-		else {
+		if(it == surface_area_map.end()) {
 			foreach(Mesh::Triangle& t, mesh->triangles) {
-				float3 p1 = transform_point(&tfm, mesh->verts[t.v[0]]);
-				float3 p2 = transform_point(&tfm, mesh->verts[t.v[1]]);
-				float3 p3 = transform_point(&tfm, mesh->verts[t.v[2]]);
+				float3 p1 = mesh->verts[t.v[0]];
+				float3 p2 = mesh->verts[t.v[1]];
+				float3 p3 = mesh->verts[t.v[2]];
 
 				surface_area += triangle_area(p1, p2, p3);
 			}
@@ -242,15 +200,165 @@ void ObjectManager::device_update_transforms(Device *device, DeviceScene *dscene
 					float3 p2 = mesh->curve_keys[first_key + i + 1].co;
 					float r2 = mesh->curve_keys[first_key + i + 1].radius;
 
-					p1 = transform_point(&tfm, p1);
-					p2 = transform_point(&tfm, p2);
-
 					/* currently ignores segment overlaps*/
 					surface_area += M_PI_F *(r1 + r2) * len(p1 - p2);
 				}
 			}
+
+			surface_area_map[mesh] = surface_area;
+		}
+		else
+			surface_area = it->second;
+
+		surface_area *= uniform_scale;
+	}
+	else {
+		foreach(Mesh::Triangle& t, mesh->triangles) {
+			float3 p1 = transform_point(&tfm, mesh->verts[t.v[0]]);
+			float3 p2 = transform_point(&tfm, mesh->verts[t.v[1]]);
+			float3 p3 = transform_point(&tfm, mesh->verts[t.v[2]]);
+
+			surface_area += triangle_area(p1, p2, p3);
+		}
+
+		foreach(Mesh::Curve& curve, mesh->curves) {
+			int first_key = curve.first_key;
+
+			for(int i = 0; i < curve.num_segments(); i++) {
+				float3 p1 = mesh->curve_keys[first_key + i].co;
+				float r1 = mesh->curve_keys[first_key + i].radius;
+				float3 p2 = mesh->curve_keys[first_key + i + 1].co;
+				float r2 = mesh->curve_keys[first_key + i + 1].radius;
+
+				p1 = transform_point(&tfm, p1);
+				p2 = transform_point(&tfm, p2);
+
+				/* currently ignores segment overlaps*/
+				surface_area += M_PI_F *(r1 + r2) * len(p1 - p2);
+			}
+		}
+	}
+
+	return surface_area;
+}
+
+/* surface area of a mesh only depends on M^T M of the instance transform M,
+ * which for particle duplis is the same for all instances up to the particle
+ * size, so the exact area is computed once per mesh and normalized M^T M */
+struct InstanceAreaKey {
+	Mesh *mesh;
+	int metric[6];
+
+	bool operator<(const InstanceAreaKey& other) const
+	{
+		if(mesh != other.mesh)
+			return mesh < other.mesh;
+		for(int i = 0; i < 6; i++)
+			if(metric[i] != other.metric[i])
+				return metric[i] < other.metric[i];
+		return false;
+	}
+};
+
+typedef map<InstanceAreaKey, float2> InstanceAreaMap;
+
+static float instance_surface_area(Mesh *mesh, const Transform& tfm, map<Mesh*, float>& surface_area_map, InstanceAreaMap& instance_area_map)
+{
+	float uniform_scale;
+
+	if(transform_uniform_scale(tfm, uniform_scale))
+		return object_surface_area(mesh, tfm, surface_area_map);
+
+	float3 c0 = transform_get_column(&tfm, 0);
+	float3 c1 = transform_get_column(&tfm, 1);
+	float3 c2 = transform_get_column(&tfm, 2);
+
+	/* normalize by the trace, which scales like the area */
+	float trace = dot(c0, c0) + dot(c1, c1) + dot(c2, c2);
+	float inv_trace = 1.0f/trace;
+	float metric[6] = {dot(c0, c0), dot(c1, c1), dot(c2, c2), dot(c0, c1), dot(c0, c2), dot(c1, c2)};
+
+	/* quantized to about float precision, entries are in [-1, 1] */
+	InstanceAreaKey key;
+	key.mesh = mesh;
+	for(int i = 0; i < 6; i++)
+		key.metric[i] = (int)floorf(metric[i]*inv_trace*(float)(1 << 22) + 0.5f);
+
+	InstanceAreaMap::iterator it = instance_area_map.find(key);
+	float2 area;
+
+	if(it == instance_area_map.end()) {
+		/* triangle and curve area of the normalized transform, curve radii
+		 * are not transformed so the curve area only scales with length.
+		 * translation doesn't change the area and only costs precision */
+		float inv_scale = sqrtf(inv_trace);
+		Transform ntfm = tfm * transform_scale(inv_scale, inv_scale, inv_scale);
+		ntfm.x.w = 0.0f;
+		ntfm.y.w = 0.0f;
+		ntfm.z.w = 0.0f;
+
+		area = make_float2(0.0f, 0.0f);
+
+		foreach(Mesh::Triangle& t, mesh->triangles) {
+			float3 p1 = transform_point(&ntfm, mesh->verts[t.v[0]]);
+			float3 p2 = transform_point(&ntfm, mesh->verts[t.v[1]]);
+			float3 p3 = transform_point(&ntfm, mesh->verts[t.v[2]]);
+
+			area.x += triangle_area(p1, p2, p3);
+		}
+
+		foreach(Mesh::Curve& curve, mesh->curves) {
+			int first_key = curve.first_key;
+
+			for(int i = 0; i < curve.num_segments(); i++) {
+				float3 p1 = transform_point(&ntfm, mesh->curve_keys[first_key + i].co);
+				float r1 = mesh->curve_keys[first_key + i].radius;
+				float3 p2 = transform_point(&ntfm, mesh->curve_keys[first_key + i + 1].co);
+				float r2 = mesh->curve_keys[first_key + i + 1].radius;
+
+				/* currently ignores segment overlaps*/
+				area.y += M_PI_F *(r1 + r2) * len(p1 - p2);
+			}
 		}
 
+		instance_area_map[key] = area;
+	}
+	else
+		area = it->second;
+
+	return area.x*trace + area.y*sqrtf(trace);
+}
+
+void ObjectManager::device_update_transforms(Device *device, DeviceScene *dscene, Scene *scene, uint *object_flag, Progress& progress)
+{
+	float4 *objects;
+	float4 *objects_vector = NULL;
+	int i = 0;
+	map<Mesh*, float> surface_area_map;
+	InstanceAreaMap instance_area_map;
+	map<Object*, int> object_index_map;
+	Scene::MotionType need_motion = scene->need_motion(device->info.advanced_shading);
+	bool have_motion = false;
+
+	size_t num_objects = scene->objects.size();
+	size_t num_inst = num_instances(scene);
+
+	objects = dscene->objects.resize(OBJECT_SIZE*num_objects);
+	if(need_motion == Scene::MOTION_PASS)
+		objects_vector = dscene->objects_vector.resize(OBJECT_VECTOR_SIZE*(num_objects + num_inst));
+
+	foreach(Object *ob, scene->objects) {
+		Mesh *mesh = ob->mesh;
+		uint flag = 0;
+
+		/* compute transformations */
+		Transform tfm = ob->tfm;
+		Transform itfm = transform_inverse(tfm);
+
+		float surface_area = object_surface_area(mesh, tfm, surface_area_map);
+		float pass_id = ob->pass_id;
+		float random_number = (float)ob->random_id * (1.0f/(float)0xFFFFFFFF);
+
 		/* pack in texture */
 		int offset = i*OBJECT_SIZE;
 
@@ -296,16 +404,66 @@ void ObjectManager::device_update_transforms(Device *device, DeviceScene *dscene
 			flag |= SD_HOLDOUT_MASK;
 		object_flag[i] = flag;
 
+		object_index_map[ob] = i;
 		i++;
 
 		if(progress.get_cancel()) return;
 	}
 
+	/* instances only store their transform, the prototype object, surface area,
+	 * random number, particle and dupli coords. flags, pass id and attributes
+	 * are taken from the prototype in the kernel */
+	float4 *instances = (num_inst)? dscene->instances.resize(INSTANCE_SIZE*num_inst): NULL;
+	size_t particle_offset = 1;
+	size_t j = 0;
+
+	foreach(ParticleSystem *psys, scene->particle_systems) {
+		foreach(ObjectInstance& inst, psys->instances) {
+			Object *ob = inst.object;
+			Mesh *mesh = ob->mesh;
+			int ob_index = object_index_map[ob];
+
+			Transform tfm = inst.tfm;
+			Transform itfm = transform_inverse(tfm);
+
+			float surface_area = instance_surface_area(mesh, tfm, surface_area_map, instance_area_map);
+			float random_number = (float)inst.random_id * (1.0f/(float)0xFFFFFFFF);
+			int particle_id = (inst.particle == -1)? 0: (int)particle_offset + inst.particle;
+
+			int offset = j*INSTANCE_SIZE;
+
+			memcpy(&instances[offset], &tfm, sizeof(float4)*3);
+			memcpy(&instances[offset+3], &itfm, sizeof(float4)*3);
+			instances[offset+6] = make_float4(surface_area, __int_as_float(ob_index), random_number, __int_as_float(particle_id));
+			instances[offset+7] = make_float4(inst.dupli_generated[0], inst.dupli_generated[1], inst.dupli_generated[2], 0.0f);
+			instances[offset+8] = make_float4(inst.dupli_uv[0], inst.dupli_uv[1], 0.0f, 0.0f);
+
+			if(need_motion == Scene::MOTION_PASS) {
+				/* instances have no motion of their own */
+				Transform mtfm_pre = (mesh->attributes.find(ATTR_STD_MOTION_PRE))? tfm: transform_identity();
+				Transform mtfm_post = (mesh->attributes.find(ATTR_STD_MOTION_POST))? tfm: transform_identity();
+
+				memcpy(&objects_vector[i*OBJECT_VECTOR_SIZE+0], &mtfm_pre, sizeof(float4)*3);
+				memcpy(&objects_vector[i*OBJECT_VECTOR_SIZE+3], &mtfm_post, sizeof(float4)*3);
+			}
+
+			i++;
+			j++;
+
+			if(j % 65536 == 0 && progress.get_cancel()) return;
+		}
+
+		particle_offset += psys->particles.size();
+	}
+
 	device->tex_alloc("__objects", dscene->objects);
+	if(num_inst)
+		device->tex_alloc("__instances", dscene->instances);
 	if(need_motion == Scene::MOTION_PASS)
 		device->tex_alloc("__objects_vector", dscene->objects_vector);
 
 	dscene->data.bvh.have_motion = have_motion;
+	dscene->data.bvh.num_objects = num_objects;
 }
 
 void ObjectManager::device_update(Device *device, DeviceScene *dscene, Scene *scene, Progress& progress)
@@ -318,7 +476,7 @@ void ObjectManager::device_update(Device *device, DeviceScene *dscene, Scene *sc
 	if(scene->objects.size() == 0)
 		return;
 
-	/* object info flag */
+	/* object info flag, instances use the flag of their prototype */
 	uint *object_flag = dscene->object_flag.resize(scene->objects.size());
 
 	/* set object transform matrices, before applying static transforms */
@@ -348,6 +506,9 @@ void ObjectManager::device_free(Device *device, DeviceScene *dscene)
 	device->tex_free(dscene->objects_vector);
 	dscene->objects_vector.clear();
 
+	device->tex_free(dscene->instances);
+	dscene->instances.clear();
+
 	device->tex_free(dscene->object_flag);
 	dscene->object_flag.clear();
 }
@@ -376,11 +537,16 @@ void ObjectManager::apply_static_transforms(Scene *scene, uint *object_flag, Pro
 			it->second++;
 	}
 
+	/* instanced meshes keep their own transform */
+	foreach(ParticleSystem *psys, scene->particle_systems)
+		foreach(ObjectInstance& inst, psys->instances)
+			mesh_users[inst.object->mesh] = 2;
+
 	if(progress.get_cancel()) return;
 
 	/* apply transforms for objects with single user meshes */
 	foreach(Object *object, scene->objects) {
-		if(mesh_users[object->mesh] == 1) {
+		if(mesh_users[object->mesh] == 1 && !object->instance_only) {
 			if(!(motion_blur && object->use_motion)) {
 				if(!object->mesh->transform_applied) {
 					object->apply_transform();
@@ -397,6 +563,26 @@ void ObjectManager::apply_static_transforms(Scene *scene, uint *object_flag, Pro
 	}
 }
 
+size_t ObjectManager::num_instances(Scene *scene)
+{
+	size_t num = 0;
+
+	foreach(ParticleSystem *psys, scene->particle_systems)
+		num += psys->instances.size();
+
+	return num;
+}
+
+void ObjectManager::get_instances(Scene *scene, vector<ObjectInstance*>& instances)
+{
+	instances.clear();
+	instances.reserve(num_instances(scene));
+
+	foreach(ParticleSystem *psys, scene->particle_systems)
+		foreach(ObjectInstance& inst, psys->instances)
+			instances.push_back(&inst);
+}
+
 void ObjectManager::tag_update(Scene *scene)
 {
 	need_update = true;
@@ -23,6 +23,7 @@
 #include "util_param.h"
 #include "util_transform.h"
 #include "util_types.h"
+#include "util_vector.h"
 
 CCL_NAMESPACE_BEGIN
 
@@ -55,6 +56,9 @@ public:
 
 	int particle_id;
 
+	/* only rendered through its instances, not at tfm itself */
+	bool instance_only;
+
 	Object();
 	~Object();
 
@@ -64,6 +68,23 @@ public:
 	void apply_transform();
 };
 
+/* Object Instance
+ *
+ * Object placed once more with its own transform. Particle systems store these
+ * compactly instead of creating a full Object for every particle, instances
+ * get the object ids following the scene objects, in particle system order. */
+
+struct ObjectInstance {
+	Transform tfm;
+	Object *object;
+	int particle;
+	uint random_id;
+	float3 dupli_generated;
+	float2 dupli_uv;
+
+	BoundBox bounds() const;
+};
+
 /* Object Manager */
 
 class ObjectManager {
@@ -79,6 +100,8 @@ public:
 
 	void tag_update(Scene *scene);
 
+	size_t num_instances(Scene *scene);
+	void get_instances(Scene *scene, vector<ObjectInstance*>& instances);
 	void apply_static_transforms(Scene *scene, uint *object_flag, Progress& progress);
 };
 
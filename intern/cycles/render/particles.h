@@ -19,6 +19,8 @@
 #ifndef __PARTICLES_H__
 #define __PARTICLES_H__
 
+#include "object.h"
+
 #include "util_types.h"
 #include "util_vector.h"
 
@@ -50,6 +52,10 @@ public:
 	void tag_update(Scene *scene);
 
 	vector<Particle> particles;
+
+	/* objects instanced at the particles, with particle indexing into the
+	 * particles above or -1 when there is no particle data */
+	vector<ObjectInstance> instances;
 };
 
 /* ParticleSystem Manager */
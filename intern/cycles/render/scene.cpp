@@ -36,6 +36,7 @@
 
 #include "util_foreach.h"
 #include "util_progress.h"
+#include "util_time.h"
 
 CCL_NAMESPACE_BEGIN
 
@@ -63,8 +64,12 @@ Scene::Scene(const SceneParams& params_, const DeviceInfo& device_info_)
 	else
 		shader_manager = ShaderManager::create(this, SceneParams::SVM);
 
-	if (device_info_.type == DEVICE_CPU)
+	if (device_info_.type == DEVICE_CPU) {
 		image_manager->set_extended_image_limits();
+		image_manager->set_texture_cache_size((size_t)params.texture_cache_size*1024*1024);
+	}
+
+	image_manager->set_use_cache(params.use_image_cache);
 }
 
 Scene::~Scene()
@@ -144,18 +149,25 @@ void Scene::device_update(Device *device_, Progress& progress)
 	
 	image_manager->set_pack_images(device->info.pack_images);
 
+	update_times.reset();
+	double update_start = time_dt(), start;
+
 	progress.set_status("Updating Background");
 	background->device_update(device, &dscene, this);
 
 	if(progress.get_cancel()) return;
 
 	progress.set_status("Updating Shaders");
+	start = time_dt();
 	shader_manager->device_update(device, &dscene, this, progress);
+	update_times.shaders = time_dt() - start;
 
 	if(progress.get_cancel()) return;
 
 	progress.set_status("Updating Images");
+	start = time_dt();
 	image_manager->device_update(device, &dscene, progress);
+	update_times.images = time_dt() - start;
 
 	if(progress.get_cancel()) return;
 
@@ -175,7 +187,9 @@ void Scene::device_update(Device *device_, Progress& progress)
 	if(progress.get_cancel()) return;
 
 	progress.set_status("Updating Meshes");
+	start = time_dt();
 	mesh_manager->device_update(device, &dscene, this, progress);
+	update_times.meshes = time_dt() - start;
 
 	if(progress.get_cancel()) return;
 
@@ -206,6 +220,8 @@ void Scene::device_update(Device *device_, Progress& progress)
 
 	progress.set_status("Updating Device", "Writing constant memory");
 	device->const_copy_to("__data", &dscene.data, sizeof(dscene.data));
+
+	update_times.total = time_dt() - update_start;
 }
 
 Scene::MotionType Scene::need_motion(bool advanced_shading)
@@ -79,6 +79,7 @@ public:
 	/* objects */
 	device_vector<float4> objects;
 	device_vector<float4> objects_vector;
+	device_vector<float4> instances;
 
 	/* attributes */
 	device_vector<uint4> attributes_map;
@@ -123,16 +124,21 @@ public:
 	enum { OSL, SVM } shadingsystem;
 	enum BVHType { BVH_DYNAMIC, BVH_STATIC } bvh_type;
 	bool use_bvh_cache;
+	bool use_image_cache;
 	bool use_bvh_spatial_split;
 	bool use_qbvh;
 	bool persistent_images;
+	/* texture cache size in MB, 0 to load images in full */
+	int texture_cache_size;
 
 	SceneParams()
 	{
 		shadingsystem = SVM;
 		bvh_type = BVH_DYNAMIC;
 		use_bvh_cache = false;
+		use_image_cache = false;
 		use_bvh_spatial_split = false;
+		texture_cache_size = 0;
 #ifdef __QBVH__
 		use_qbvh = true;
 #else
@@ -144,9 +150,28 @@ public:
 	{ return !(shadingsystem == params.shadingsystem
 		&& bvh_type == params.bvh_type
 		&& use_bvh_cache == params.use_bvh_cache
+		&& use_image_cache == params.use_image_cache
 		&& use_bvh_spatial_split == params.use_bvh_spatial_split
 		&& use_qbvh == params.use_qbvh
-		&& persistent_images == params.persistent_images); }
+		&& persistent_images == params.persistent_images
+		&& texture_cache_size == params.texture_cache_size); }
+};
+
+/* Scene Update Times
+ *
+ * Time in seconds spent in the last device update, per phase. Used for
+ * benchmarking, the BVH time is included in the mesh time. */
+
+class SceneUpdateTimes {
+public:
+	double shaders;
+	double images;
+	double meshes;
+	double bvh;
+	double total;
+
+	SceneUpdateTimes() { reset(); }
+	void reset() { shaders = images = meshes = bvh = total = 0.0; }
 };
 
 /* Scene */
@@ -190,6 +215,9 @@ public:
 	/* parameters */
 	SceneParams params;
 
+	/* statistics */
+	SceneUpdateTimes update_times;
+
 	/* mutex must be locked manually by callers */
 	thread_mutex mutex;
 
@@ -18,12 +18,24 @@
 
 #include <stdio.h>
 
+#ifdef _WIN32
+#include <windows.h>
+#include <process.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include "util_cache.h"
 #include "util_debug.h"
 #include "util_foreach.h"
 #include "util_map.h"
 #include "util_md5.h"
 #include "util_path.h"
+#include "util_string.h"
+#include "util_time.h"
 #include "util_types.h"
 
 #include <boost/version.hpp>
@@ -37,6 +49,9 @@
 
 CCL_NAMESPACE_BEGIN
 
+/* layout of cache files, to be increased when it changes */
+static const int cache_file_version = 1;
+
 /* CacheData */
 
 CacheData::CacheData(const string& name_)
@@ -44,12 +59,24 @@ CacheData::CacheData(const string& name_)
 	name = name_;
 	f = NULL;
 	have_filename = false;
+
+	map_data = NULL;
+	map_size = 0;
+	map_offset = 0;
 }
 
 CacheData::~CacheData()
 {
 	if(f)
 		fclose(f);
+
+	if(map_data) {
+#ifdef _WIN32
+		UnmapViewOfFile(map_data);
+#else
+		munmap(map_data, map_size);
+#endif
+	}
 }
 
 const string& CacheData::get_filename()
@@ -60,7 +87,10 @@ const string& CacheData::get_filename()
 		foreach(const CacheBuffer& buffer, buffers)
 			if(buffer.size)
 				hash.append((uint8_t*)buffer.data, buffer.size);
-		
+
+		/* files written with an older layout get a different name */
+		hash.append((uint8_t*)&cache_file_version, sizeof(cache_file_version));
+
 		filename = name + "_" + hash.get_hex();
 		have_filename = true;
 	}
@@ -81,22 +111,58 @@ void Cache::insert(CacheData& key, CacheData& value)
 {
 	string filename = data_filename(key);
 	path_create_directories(filename);
-	FILE *f = fopen(filename.c_str(), "wb");
+
+	/* write to a temporary file first, so other renders using the same cache
+	 * never read a partially written file */
+#ifdef _WIN32
+	int pid = _getpid();
+#else
+	int pid = getpid();
+#endif
+	string tmp_filename = string_printf("%s.%d.%llx.tmp", filename.c_str(), pid,
+		(unsigned long long)(time_dt()*1e6));
+	FILE *f = fopen(tmp_filename.c_str(), "wb");
 
 	if(!f) {
-		fprintf(stderr, "Failed to open file %s for writing.\n", filename.c_str());
+		fprintf(stderr, "Failed to open file %s for writing.\n", tmp_filename.c_str());
 		return;
 	}
 
+	bool ok = true;
+	char zero[CACHE_ALIGN] = {0};
+
 	foreach(CacheBuffer& buffer, value.buffers) {
-		if(!fwrite(&buffer.size, sizeof(buffer.size), 1, f))
-			fprintf(stderr, "Failed to write to file %s.\n", filename.c_str());
+		char header[CACHE_ALIGN] = {0};
+		size_t padding = (CACHE_ALIGN - buffer.size % CACHE_ALIGN) % CACHE_ALIGN;
+
+		memcpy(header, &buffer.size, sizeof(buffer.size));
+
+		if(!fwrite(header, sizeof(header), 1, f))
+			ok = false;
 		if(buffer.size)
 			if(!fwrite(buffer.data, buffer.size, 1, f))
-				fprintf(stderr, "Failed to write to file %s.\n", filename.c_str());
+				ok = false;
+		if(padding)
+			if(!fwrite(zero, padding, 1, f))
+				ok = false;
 	}
 	
-	fclose(f);
+	if(fclose(f) != 0)
+		ok = false;
+
+	if(!ok) {
+		fprintf(stderr, "Failed to write to file %s.\n", tmp_filename.c_str());
+		boost::filesystem::remove(tmp_filename);
+		return;
+	}
+
+	boost::system::error_code ec;
+	boost::filesystem::rename(tmp_filename, filename, ec);
+
+	if(ec) {
+		fprintf(stderr, "Failed to rename file %s.\n", tmp_filename.c_str());
+		boost::filesystem::remove(tmp_filename, ec);
+	}
 }
 
 bool Cache::lookup(CacheData& key, CacheData& value)
@@ -113,6 +179,66 @@ bool Cache::lookup(CacheData& key, CacheData& value)
 	return true;
 }
 
+bool Cache::map(CacheData& key, CacheData& value)
+{
+	string filename = data_filename(key);
+	void *data = NULL;
+	size_t size = 0;
+
+#ifdef _WIN32
+	HANDLE file = CreateFile(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if(file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER file_size;
+
+	if(GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0) {
+		HANDLE mapping = CreateFileMapping(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+
+		if(mapping) {
+			/* copy on write, refitting changes BVH nodes in place */
+			data = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+			size = (size_t)file_size.QuadPart;
+			CloseHandle(mapping);
+		}
+	}
+
+	CloseHandle(file);
+#else
+	int fd = open(filename.c_str(), O_RDONLY);
+
+	if(fd == -1)
+		return false;
+
+	struct stat st;
+
+	if(fstat(fd, &st) == 0 && st.st_size > 0) {
+		/* private mapping, refitting changes BVH nodes in place */
+		size = (size_t)st.st_size;
+		data = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+
+		if(data == MAP_FAILED)
+			data = NULL;
+	}
+
+	close(fd);
+#endif
+
+	if(!data) {
+		fprintf(stderr, "Failed to map file %s.\n", filename.c_str());
+		return false;
+	}
+
+	value.name = key.name;
+	value.map_data = (char*)data;
+	value.map_size = size;
+	value.map_offset = 0;
+
+	return true;
+}
+
 void Cache::clear_except(const string& name, const set<string>& except)
 {
 	string dir = path_user_get("cache");
@@ -30,6 +30,11 @@
  * invalidate cache entries, at the cost of exta computation. If everything
  * is stored in a global cache, computations can perhaps even be shared between
  * different scenes where it may be hard to detect duplicate work.
+ *
+ * In the file each buffer is stored as its size followed by the data, with
+ * both padded to 16 bytes. A file can then also be memory mapped, and arrays
+ * reference the buffers in place instead of reading them into memory. Several
+ * renders on the same machine then share one copy of the data.
  */
 
 #include "util_set.h"
@@ -47,6 +52,9 @@ public:
 	{ data = data_; size = size_; }
 };
 
+/* size of the buffer size header and alignment of buffers in files */
+#define CACHE_ALIGN 16
+
 class CacheData {
 public:
 	vector<CacheBuffer> buffers;
@@ -55,6 +63,11 @@ public:
 	bool have_filename;
 	FILE *f;
 
+	/* memory mapped file, and read position in it */
+	char *map_data;
+	size_t map_size;
+	size_t map_offset;
+
 	CacheData(const string& name = "");
 	~CacheData();
 
@@ -102,7 +115,7 @@ public:
 	{
 		size_t size;
 
-		if(!fread(&size, sizeof(size), 1, f)) {
+		if(!read_header(size)) {
 			fprintf(stderr, "Failed to read vector size from cache.\n");
 			return;
 		}
@@ -116,37 +129,116 @@ public:
 			fprintf(stderr, "Failed to read vector data from cache (%lu).\n", (unsigned long)size);
 			return;
 		}
+
+		skip_padding(size);
 	}
 
 	void read(int& data)
 	{
-		size_t size;
-
-		if(!fread(&size, sizeof(size), 1, f))
-			fprintf(stderr, "Failed to read int size from cache.\n");
-		if(!fread(&data, sizeof(data), 1, f))
+		if(!read(&data, sizeof(data)))
 			fprintf(stderr, "Failed to read int from cache.\n");
 	}
 
 	void read(float& data)
 	{
-		size_t size;
-
-		if(!fread(&size, sizeof(size), 1, f))
-			fprintf(stderr, "Failed to read float size from cache.\n");
-		if(!fread(&data, sizeof(data), 1, f))
+		if(!read(&data, sizeof(data)))
 			fprintf(stderr, "Failed to read float from cache.\n");
 	}
 
 	void read(size_t& data)
+	{
+		if(!read(&data, sizeof(data)))
+			fprintf(stderr, "Failed to read size_t from cache.\n");
+	}
+
+	/* read buffer of known size, returns false if the size does not match */
+	bool read(void *data, size_t size)
+	{
+		size_t file_size;
+
+		if(map_data) {
+			const void *buffer = map_next(file_size);
+
+			if(!buffer || file_size != size) {
+				fprintf(stderr, "Failed to read buffer from cache.\n");
+				return false;
+			}
+
+			memcpy(data, buffer, size);
+			return true;
+		}
+
+		if(!read_header(file_size) || file_size != size) {
+			fprintf(stderr, "Failed to read buffer size from cache.\n");
+			return false;
+		}
+		if(size && !fread(data, size, 1, f)) {
+			fprintf(stderr, "Failed to read buffer from cache (%lu).\n", (unsigned long)size);
+			return false;
+		}
+
+		skip_padding(size);
+
+		return true;
+	}
+
+	/* reference the next buffer of a memory mapped file, returns false when
+	 * the file is shorter than expected */
+	template<typename T> bool map(array<T>& data)
 	{
 		size_t size;
+		char *buffer = map_next(size);
 
-		if(!fread(&size, sizeof(size), 1, f))
-			fprintf(stderr, "Failed to read size_t size from cache.\n");
-		if(!fread(&data, sizeof(data), 1, f))
-			fprintf(stderr, "Failed to read size_t from cache.\n");
+		if(!buffer) {
+			fprintf(stderr, "Failed to map vector from cache.\n");
+			data.clear();
+			return false;
+		}
+
+		data.reference((T*)buffer, size/sizeof(T));
+		return true;
+	}
+
+protected:
+	static size_t padding(size_t size)
+	{
+		return (CACHE_ALIGN - size % CACHE_ALIGN) % CACHE_ALIGN;
+	}
+
+	bool read_header(size_t& size)
+	{
+		char header[CACHE_ALIGN];
+
+		if(!fread(header, sizeof(header), 1, f))
+			return false;
+
+		memcpy(&size, header, sizeof(size));
+		return true;
 	}
+
+	void skip_padding(size_t size)
+	{
+		if(padding(size))
+			fseek(f, padding(size), SEEK_CUR);
+	}
+
+	char *map_next(size_t& size)
+	{
+		if(map_offset + CACHE_ALIGN > map_size)
+			return NULL;
+
+		memcpy(&size, map_data + map_offset, sizeof(size));
+
+		if(size > map_size - map_offset - CACHE_ALIGN)
+			return NULL;
+
+		char *buffer = map_data + map_offset + CACHE_ALIGN;
+		map_offset += CACHE_ALIGN + size + padding(size);
+
+		return buffer;
+	}
+
+	friend class Cache;
 };
 
 class Cache {
@@ -156,6 +248,10 @@ public:
 	void insert(CacheData& key, CacheData& value);
 	bool lookup(CacheData& key, CacheData& value);
 
+	/* like lookup, but memory maps the file instead. mapped buffers stay valid
+	 * as long as value exists, and can be written to without changing the file */
+	bool map(CacheData& key, CacheData& value);
+
 	void clear_except(const string& name, const set<string>& except);
 
 protected:
@@ -0,0 +1,694 @@
+/*
+ * Copyright 2013, Blender Foundation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <algorithm>
+#include <math.h>
+
+#ifdef _MSC_VER
+#  include <intrin.h>
+#endif
+
+#include "util_foreach.h"
+#include "util_image.h"
+#include "util_math.h"
+#include "util_texture_cache.h"
+
+CCL_NAMESPACE_BEGIN
+
+/* Memory Ordering
+ *
+ * Tile pointers are read by lookups without a lock. Publishing a tile only
+ * needs its pixels written before the pointer, which the barrier ensures. A
+ * thread about to read tiles stores its epoch and then reads tile pointers,
+ * while eviction clears tile pointers and then reads the thread epochs, both
+ * sides need a full fence for that. */
+
+#if defined(_MSC_VER)
+#  define TEXTURE_CACHE_BARRIER() _ReadWriteBarrier()
+#  define TEXTURE_CACHE_FENCE() _mm_mfence()
+#elif defined(__i386__) || defined(__x86_64__)
+/* stores are not reordered with earlier loads or stores on x86 */
+#  define TEXTURE_CACHE_BARRIER() __asm__ __volatile__("" ::: "memory")
+#  define TEXTURE_CACHE_FENCE() __sync_synchronize()
+#else
+#  define TEXTURE_CACHE_BARRIER() __sync_synchronize()
+#  define TEXTURE_CACHE_FENCE() __sync_synchronize()
+#endif
+
+/* Tiles, Levels and Images */
+
+struct TextureCache::Tile {
+	Image *image;
+	int level;
+	int index;
+
+	/* sampled since the last eviction check, set by lookups without a lock */
+	volatile bool used;
+	/* just inserted, not to be evicted in the same update */
+	bool pinned;
+	/* epoch at which the tile was evicted */
+	uint retired_epoch;
+
+	/* RGBA texels, TILE_SIZE texels per row, as uchar or float */
+	uchar *pixels;
+	size_t memory_size;
+};
+
+struct TextureCache::Level {
+	int width, height;
+	int tiles_x, tiles_y;
+
+	/* level is stored in the file, otherwise it's filtered from the level below */
+	bool in_file;
+
+	/* NULL for tiles not in memory, read by lookups without a lock and
+	 * changed with the cache mutex locked */
+	vector<Tile*> tiles;
+
+	Tile *tile(int index) const
+	{
+		return *(Tile * const volatile*)&tiles[index];
+	}
+};
+
+struct TextureCache::Image {
+	string filename;
+	bool is_float;
+	int components;
+
+	vector<Level> levels;
+
+	/* file is kept open, and read from by one thread at a time */
+	thread_mutex file_mutex;
+	ImageInput *in;
+	int in_level;
+};
+
+struct TextureCache::ThreadData {
+	/* epoch when the thread started reading tiles, 0 while it isn't */
+	volatile uint epoch;
+};
+
+/* epochs wrap around, and 0 is reserved for threads not reading tiles */
+static bool texture_cache_epoch_before(uint a, uint b)
+{
+	return (int)(a - b) < 0;
+}
+
+/* Constructor / Destructor */
+
+TextureCache::TextureCache()
+{
+	memory_limit = 0;
+	tiles_memory = 0;
+	epoch = 1;
+}
+
+TextureCache::~TextureCache()
+{
+	for(size_t slot = 0; slot < images.size(); slot++)
+		remove_image(slot);
+
+	foreach(Tile *tile, retired_tiles)
+		tile_free(tile);
+}
+
+/* Threads */
+
+TextureCache::ThreadData *TextureCache::thread_init()
+{
+	thread_scoped_lock cache_lock(cache_mutex);
+	ThreadData *tdata = new ThreadData();
+
+	tdata->epoch = 0;
+	threads.push_back(tdata);
+
+	return tdata;
+}
+
+void TextureCache::thread_free(ThreadData *tdata)
+{
+	thread_scoped_lock cache_lock(cache_mutex);
+
+	threads.erase(std::find(threads.begin(), threads.end(), tdata));
+	delete tdata;
+
+	tiles_reclaim();
+}
+
+void TextureCache::set_memory_limit(size_t limit)
+{
+	thread_scoped_lock cache_lock(cache_mutex);
+
+	memory_limit = limit;
+	tiles_evict();
+}
+
+size_t TextureCache::memory_used()
+{
+	thread_scoped_lock cache_lock(cache_mutex);
+	return tiles_memory;
+}
+
+/* Images */
+
+bool TextureCache::add_image(int slot, const string& filename, bool is_float)
+{
+	if(filename == "")
+		return false;
+
+	ImageInput *in = ImageInput::create(filename);
+
+	if(!in)
+		return false;
+
+	ImageSpec spec;
+
+	if(!in->open(filename, spec)) {
+		delete in;
+		return false;
+	}
+
+	/* we only handle certain number of components */
+	int components = spec.nchannels;
+
+	if(!(components == 1 || components == 3 || components == 4) || spec.width < 1 || spec.height < 1) {
+		in->close();
+		delete in;
+		return false;
+	}
+
+	Image *img = new Image();
+
+	img->filename = filename;
+	img->is_float = is_float;
+	img->components = components;
+	img->in = in;
+
+	/* mip levels down to 1x1, using the ones stored in the file if any */
+	int width = spec.width;
+	int height = spec.height;
+	bool in_file = true;
+
+	for(int level = 0; ; level++) {
+		if(level > 0 && in_file) {
+			ImageSpec level_spec;
+
+			in_file = in->seek_subimage(0, level, level_spec) &&
+			          level_spec.width == width && level_spec.height == height &&
+			          level_spec.nchannels == components;
+		}
+
+		Level lev;
+
+		lev.width = width;
+		lev.height = height;
+		lev.tiles_x = (width + TILE_SIZE - 1)/TILE_SIZE;
+		lev.tiles_y = (height + TILE_SIZE - 1)/TILE_SIZE;
+		lev.in_file = in_file;
+		lev.tiles.resize(lev.tiles_x*lev.tiles_y, NULL);
+
+		img->levels.push_back(lev);
+
+		if(width == 1 && height == 1)
+			break;
+
+		width = max(width/2, 1);
+		height = max(height/2, 1);
+	}
+
+	img->in_level = (in->seek_subimage(0, 0, spec))? 0: -1;
+
+	thread_scoped_lock cache_lock(cache_mutex);
+
+	if(slot >= (int)images.size())
+		images.resize(slot + 1, NULL);
+
+	if(images[slot])
+		image_free(images[slot]);
+
+	images[slot] = img;
+
+	return true;
+}
+
+void TextureCache::remove_image(int slot)
+{
+	thread_scoped_lock cache_lock(cache_mutex);
+
+	if(slot < (int)images.size() && images[slot]) {
+		image_free(images[slot]);
+		images[slot] = NULL;
+	}
+}
+
+void TextureCache::image_free(Image *img)
+{
+	/* cache mutex must be locked, and no lookups of the image running */
+	list<Tile*>::iterator it = tiles.begin();
+
+	while(it != tiles.end()) {
+		Tile *tile = *it;
+
+		if(tile->image == img) {
+			tiles_memory -= tile->memory_size;
+			tile_free(tile);
+			it = tiles.erase(it);
+		}
+		else
+			it++;
+	}
+
+	it = retired_tiles.begin();
+
+	while(it != retired_tiles.end()) {
+		if((*it)->image == img) {
+			tile_free(*it);
+			it = retired_tiles.erase(it);
+		}
+		else
+			it++;
+	}
+
+	if(img->in) {
+		img->in->close();
+		delete img->in;
+	}
+
+	delete img;
+}
+
+/* Lookup */
+
+static int texture_cache_wrap_periodic(int x, int width)
+{
+	x %= width;
+	if(x < 0)
+		x += width;
+	return x;
+}
+
+static float texture_cache_frac(float x, int *ix)
+{
+	int i = (int)x - ((x < 0.0f)? 1: 0);
+	*ix = i;
+	return x - (float)i;
+}
+
+float4 TextureCache::lookup(ThreadData *tdata, int slot, float x, float y, float width)
+{
+	Image *img = images[slot];
+	int num_levels = img->levels.size();
+	float level = 0.0f;
+
+	if(width > 0.0f) {
+		/* level at which the filter width covers about one texel */
+		const Level& base = img->levels[0];
+
+		level = logf(width*max(base.width, base.height))/logf(2.0f);
+		level = clamp(level, 0.0f, (float)(num_levels - 1));
+	}
+
+	int ilevel = (int)level;
+	float t = level - (float)ilevel;
+	float4 r = sample_level(tdata, img, ilevel, x, y);
+
+	if(t > 0.0f && ilevel + 1 < num_levels)
+		r = (1.0f - t)*r + t*sample_level(tdata, img, ilevel + 1, x, y);
+
+	return r;
+}
+
+float4 TextureCache::sample_level(ThreadData *tdata, Image *img, int level, float x, float y)
+{
+	/* same bilinear interpolation as regular image textures */
+	const Level& lev = img->levels[level];
+	int ix, iy;
+	float tx = texture_cache_frac(x*lev.width - 0.5f, &ix);
+	float ty = texture_cache_frac(y*lev.height - 0.5f, &iy);
+
+	ix = texture_cache_wrap_periodic(ix, lev.width);
+	iy = texture_cache_wrap_periodic(iy, lev.height);
+
+	int nix = texture_cache_wrap_periodic(ix+1, lev.width);
+	int niy = texture_cache_wrap_periodic(iy+1, lev.height);
+
+	int xs[4] = {ix, nix, ix, nix};
+	int ys[4] = {iy, iy, niy, niy};
+	float4 texels[4];
+
+	fetch_texels(tdata, img, level, xs, ys, 4, texels);
+
+	float4 r = (1.0f - ty)*(1.0f - tx)*texels[0];
+	r += (1.0f - ty)*tx*texels[1];
+	r += ty*(1.0f - tx)*texels[2];
+	r += ty*tx*texels[3];
+
+	return r;
+}
+
+void TextureCache::fetch_texels(ThreadData *tdata, Image *img, int level, const int *x, const int *y, int num, float4 *texels)
+{
+	const Level& lev = img->levels[level];
+
+	for(;;) {
+		int missing = -1;
+
+		/* tiles evicted from now on are not deleted until we are done */
+		tdata->epoch = epoch;
+		TEXTURE_CACHE_FENCE();
+
+		for(int i = 0; i < num; i++) {
+			int index = (y[i]/TILE_SIZE)*lev.tiles_x + x[i]/TILE_SIZE;
+			Tile *tile = lev.tile(index);
+
+			if(!tile) {
+				missing = index;
+				break;
+			}
+
+			/* avoid writing to the cache line shared by all threads */
+			if(!tile->used)
+				tile->used = true;
+
+			int offset = ((y[i] % TILE_SIZE)*TILE_SIZE + (x[i] % TILE_SIZE))*4;
+
+			if(img->is_float) {
+				const float *p = (const float*)tile->pixels + offset;
+				texels[i] = make_float4(p[0], p[1], p[2], p[3]);
+			}
+			else {
+				const uchar *p = tile->pixels + offset;
+				float f = 1.0f/255.0f;
+				texels[i] = make_float4(p[0]*f, p[1]*f, p[2]*f, p[3]*f);
+			}
+		}
+
+		/* texels are copied, so tiles may be deleted while we load. this
+		 * keeps a long mip filter from holding back all evicted tiles */
+		TEXTURE_CACHE_BARRIER();
+		tdata->epoch = 0;
+
+		if(missing == -1)
+			return;
+
+		/* other threads keep sampling tiles that are in memory meanwhile */
+		load_tile(tdata, img, level, missing);
+	}
+}
+
+/* Loading */
+
+void TextureCache::load_tile(ThreadData *tdata, Image *img, int level, int index)
+{
+	if(img->levels[level].in_file)
+		load_file_tiles(img, level, index);
+	else
+		filter_tile(tdata, img, level, index);
+}
+
+template<typename T> static void texture_cache_copy_texels(T *dst, const T *src, int num, int components, T one)
+{
+	for(int i = 0; i < num; i++, dst += 4, src += components) {
+		if(components == 1) {
+			dst[0] = dst[1] = dst[2] = src[0];
+			dst[3] = one;
+		}
+		else if(components == 3) {
+			dst[0] = src[0];
+			dst[1] = src[1];
+			dst[2] = src[2];
+			dst[3] = one;
+		}
+		else {
+			dst[0] = src[0];
+			dst[1] = src[1];
+			dst[2] = src[2];
+			dst[3] = src[3];
+		}
+	}
+}
+
+void TextureCache::load_file_tiles(Image *img, int level, int index)
+{
+	/* scanline based files can't be read efficiently per tile, so we read
+	 * the full row of tiles, the ones that are not sampled get evicted */
+	const Level& lev = img->levels[level];
+	int ty = index/lev.tiles_x;
+	vector<Tile*> new_tiles;
+
+	{
+		thread_scoped_lock file_lock(img->file_mutex);
+
+		/* tile may have been loaded while we were waiting */
+		if(lev.tile(index))
+			return;
+
+		/* rows of the tiles, textures are stored bottom to top */
+		int y0 = ty*TILE_SIZE;
+		int y1 = min(y0 + TILE_SIZE, lev.height);
+		size_t typesize = (img->is_float)? sizeof(float): sizeof(uchar);
+		size_t scanlinesize = lev.width*img->components*typesize;
+		vector<uchar> scanlines(scanlinesize*(y1 - y0));
+		bool ok = true;
+
+		if(img->in_level != level) {
+			ImageSpec spec;
+			ok = img->in->seek_subimage(0, level, spec);
+			img->in_level = (ok)? level: -1;
+		}
+
+		if(ok) {
+			ok = img->in->read_scanlines(lev.height - y1, lev.height - y0, 0,
+				(img->is_float)? TypeDesc::FLOAT: TypeDesc::UINT8, &scanlines[0]);
+		}
+
+		for(int tx = 0; tx < lev.tiles_x; tx++) {
+			Tile *tile = tile_create(img, level, ty*lev.tiles_x + tx);
+			int x0 = tx*TILE_SIZE;
+			int x1 = min(x0 + TILE_SIZE, lev.width);
+
+			for(int y = y0; y < y1; y++) {
+				/* scanline of texture row y */
+				const uchar *src = &scanlines[(y1 - 1 - y)*scanlinesize + x0*img->components*typesize];
+				uchar *dst = tile->pixels + (y - y0)*TILE_SIZE*4*typesize;
+
+				if(!ok) {
+					/* on failure to read, we use the same pink as for missing images */
+					for(int x = x0; x < x1; x++, dst += 4*typesize) {
+						if(img->is_float) {
+							float *p = (float*)dst;
+							p[0] = 1.0f; p[1] = 0.0f; p[2] = 1.0f; p[3] = 1.0f;
+						}
+						else {
+							dst[0] = 255; dst[1] = 0; dst[2] = 255; dst[3] = 255;
+						}
+					}
+				}
+				else if(img->is_float)
+					texture_cache_copy_texels((float*)dst, (const float*)src, x1 - x0, img->components, 1.0f);
+				else
+					texture_cache_copy_texels(dst, src, x1 - x0, img->components, (uchar)255);
+			}
+
+			new_tiles.push_back(tile);
+		}
+	}
+
+	tiles_insert(new_tiles);
+}
+
+void TextureCache::filter_tile(ThreadData *tdata, Image *img, int level, int index)
+{
+	/* box filter 2x2 texels of the level below. for odd sizes the last row
+	 * or column of the level below is left out */
+	const Level& lev = img->levels[level];
+	int x0 = (index % lev.tiles_x)*TILE_SIZE;
+	int y0 = (index/lev.tiles_x)*TILE_SIZE;
+	int x1 = min(x0 + TILE_SIZE, lev.width);
+	int y1 = min(y0 + TILE_SIZE, lev.height);
+
+	Tile *tile = tile_create(img, level, index);
+
+	/* each quarter of the tile is filtered from a single tile of the level
+	 * below, so we go over the quarters one by one to keep fetches from
+	 * loading the same tiles over and over when memory is tight */
+	const int half = TILE_SIZE/2;
+
+	for(int q = 0; q < 4; q++) {
+		int qx0 = x0 + (q & 1)*half;
+		int qy0 = y0 + (q >> 1)*half;
+
+		for(int y = qy0; y < min(qy0 + half, y1); y++) {
+			for(int x = qx0; x < min(qx0 + half, x1); x++) {
+				filter_texel(tdata, img, level, tile, x - x0, y - y0, x, y);
+			}
+		}
+	}
+
+	tiles_insert(vector<Tile*>(1, tile));
+}
+
+void TextureCache::filter_texel(ThreadData *tdata, Image *img, int level, Tile *tile, int tx, int ty, int x, int y)
+{
+	const Level& below = img->levels[level - 1];
+	int bx = min(2*x + 1, below.width - 1);
+	int by = min(2*y + 1, below.height - 1);
+	int xs[4] = {2*x, bx, 2*x, bx};
+	int ys[4] = {2*y, 2*y, by, by};
+	float4 texels[4];
+
+	fetch_texels(tdata, img, level - 1, xs, ys, 4, texels);
+
+	float4 f = 0.25f*(texels[0] + texels[1] + texels[2] + texels[3]);
+	int offset = (ty*TILE_SIZE + tx)*4;
+
+	if(img->is_float) {
+		float *p = (float*)tile->pixels + offset;
+		p[0] = f.x; p[1] = f.y; p[2] = f.z; p[3] = f.w;
+	}
+	else {
+		uchar *p = tile->pixels + offset;
+		p[0] = (uchar)clamp(f.x*255.0f + 0.5f, 0.0f, 255.0f);
+		p[1] = (uchar)clamp(f.y*255.0f + 0.5f, 0.0f, 255.0f);
+		p[2] = (uchar)clamp(f.z*255.0f + 0.5f, 0.0f, 255.0f);
+		p[3] = (uchar)clamp(f.w*255.0f + 0.5f, 0.0f, 255.0f);
+	}
+}
+
+/* Tiles */
+
+TextureCache::Tile *TextureCache::tile_create(Image *img, int level, int index)
+{
+	Tile *tile = new Tile();
+
+	tile->image = img;
+	tile->level = level;
+	tile->index = index;
+	tile->used = true;
+	tile->pinned = false;
+	tile->retired_epoch = 0;
+	tile->memory_size = TILE_SIZE*TILE_SIZE*4*((img->is_float)? sizeof(float): sizeof(uchar));
+	tile->pixels = new uchar[tile->memory_size];
+
+	return tile;
+}
+
+void TextureCache::tile_free(Tile *tile)
+{
+	delete [] tile->pixels;
+	delete tile;
+}
+
+void TextureCache::tiles_insert(const vector<Tile*>& new_tiles)
+{
+	thread_scoped_lock cache_lock(cache_mutex);
+	vector<Tile*> inserted_tiles;
+
+	/* pixels must be written before lookups can see the tiles */
+	TEXTURE_CACHE_BARRIER();
+
+	foreach(Tile *tile, new_tiles) {
+		Tile *& slot = tile->image->levels[tile->level].tiles[tile->index];
+
+		/* another thread may have loaded the same tile */
+		if(!slot) {
+			*(Tile * volatile*)&slot = tile;
+			tile->pinned = true;
+			tiles.push_back(tile);
+			tiles_memory += tile->memory_size;
+			inserted_tiles.push_back(tile);
+		}
+		else
+			tile_free(tile);
+	}
+
+	tiles_evict();
+
+	foreach(Tile *tile, inserted_tiles)
+		tile->pinned = false;
+}
+
+void TextureCache::tiles_evict()
+{
+	/* cache mutex must be locked. we go over tiles in the order they were
+	 * loaded, and give tiles that were sampled since the last check a second
+	 * chance, which approximates least recently used order */
+	size_t num_checks = 2*tiles.size();
+	bool evicted = false;
+
+	while(memory_limit && tiles_memory > memory_limit && num_checks--) {
+		Tile *tile = tiles.front();
+
+		tiles.pop_front();
+
+		if(tile->pinned || tile->used) {
+			if(!tile->pinned)
+				tile->used = false;
+			tiles.push_back(tile);
+		}
+		else {
+			/* lookups may still be reading the tile, delete it later */
+			*(Tile * volatile*)&tile->image->levels[tile->level].tiles[tile->index] = NULL;
+			tile->retired_epoch = epoch;
+			retired_tiles.push_back(tile);
+			tiles_memory -= tile->memory_size;
+			evicted = true;
+		}
+	}
+
+	if(evicted) {
+		/* lookups that start from now on can't find the evicted tiles */
+		TEXTURE_CACHE_BARRIER();
+		epoch = (epoch + 1 == 0)? 1: epoch + 1;
+	}
+
+	tiles_reclaim();
+}
+
+void TextureCache::tiles_reclaim()
+{
+	/* cache mutex must be locked. a tile can be deleted once every thread
+	 * is not reading tiles, or started reading after the eviction */
+	if(retired_tiles.empty())
+		return;
+
+	TEXTURE_CACHE_FENCE();
+
+	uint oldest = epoch;
+
+	foreach(ThreadData *tdata, threads) {
+		uint thread_epoch = tdata->epoch;
+
+		if(thread_epoch != 0 && texture_cache_epoch_before(thread_epoch, oldest))
+			oldest = thread_epoch;
+	}
+
+	while(!retired_tiles.empty()) {
+		Tile *tile = retired_tiles.front();
+
+		if(!texture_cache_epoch_before(tile->retired_epoch, oldest))
+			break;
+
+		retired_tiles.pop_front();
+		tile_free(tile);
+	}
+}
+
+CCL_NAMESPACE_END
+
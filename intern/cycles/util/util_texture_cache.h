@@ -0,0 +1,114 @@
+/*
+ * Copyright 2013, Blender Foundation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __UTIL_TEXTURE_CACHE_H__
+#define __UTIL_TEXTURE_CACHE_H__
+
+#include "util_list.h"
+#include "util_string.h"
+#include "util_thread.h"
+#include "util_types.h"
+#include "util_vector.h"
+
+CCL_NAMESPACE_BEGIN
+
+/* Texture Cache
+ *
+ * Image textures for the CPU device, loaded on demand. Images are split into
+ * fixed size tiles that are read from file the first time they are sampled.
+ * Mip levels are read from the file if it has them, and otherwise filtered
+ * from the level below when needed. Once the memory limit is exceeded, tiles
+ * that were not sampled recently are freed, so memory usage depends on the
+ * texels actually sampled rather than on the size of the images.
+ *
+ * Lookups read tiles without locking. Evicted tiles are only deleted once no
+ * thread can be reading them anymore, which is why threads doing lookups have
+ * to be registered with thread_init. */
+
+class TextureCache {
+public:
+	TextureCache();
+	~TextureCache();
+
+	/* memory limit in bytes, 0 for no limit */
+	void set_memory_limit(size_t limit);
+	size_t memory_used();
+
+	/* add image for texture slot, only the file header is read here. returns
+	 * false if the file can't be used, in which case the caller should load
+	 * the image as usual */
+	bool add_image(int slot, const string& filename, bool is_float);
+	void remove_image(int slot);
+
+	bool has_image(int slot)
+	{
+		return (slot < (int)images.size() && images[slot] != NULL);
+	}
+
+	/* per thread state for lookups */
+	struct ThreadData;
+
+	ThreadData *thread_init();
+	void thread_free(ThreadData *tdata);
+
+	/* bilinear lookup with coordinates in 0..1 and periodic wrapping. the mip
+	 * level is chosen by the filter width in the same coordinates, blending
+	 * between the two nearest levels. a width of zero uses the full resolution */
+	float4 lookup(ThreadData *tdata, int slot, float x, float y, float width);
+
+protected:
+	enum { TILE_SIZE = 64 };
+
+	struct Tile;
+	struct Level;
+	struct Image;
+
+	vector<Image*> images;
+
+	/* tiles in memory, in the order they are checked for eviction */
+	list<Tile*> tiles;
+	size_t memory_limit;
+	size_t tiles_memory;
+	thread_mutex cache_mutex;
+
+	/* evicted tiles that lookups may still be reading, and the epoch
+	 * that is advanced after each eviction to tell when they are done */
+	list<Tile*> retired_tiles;
+	vector<ThreadData*> threads;
+	volatile uint epoch;
+
+	float4 sample_level(ThreadData *tdata, Image *img, int level, float x, float y);
+	void fetch_texels(ThreadData *tdata, Image *img, int level, const int *x, const int *y, int num, float4 *texels);
+
+	void load_tile(ThreadData *tdata, Image *img, int level, int index);
+	void load_file_tiles(Image *img, int level, int index);
+	void filter_tile(ThreadData *tdata, Image *img, int level, int index);
+	void filter_texel(ThreadData *tdata, Image *img, int level, Tile *tile, int tx, int ty, int x, int y);
+
+	Tile *tile_create(Image *img, int level, int index);
+	void tile_free(Tile *tile);
+	void tiles_insert(const vector<Tile*>& new_tiles);
+	void tiles_evict();
+	void tiles_reclaim();
+	void image_free(Image *img);
+};
+
+CCL_NAMESPACE_END
+
+#endif /* __UTIL_TEXTURE_CACHE_H__ */
+
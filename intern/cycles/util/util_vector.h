@@ -33,7 +33,10 @@ using std::vector;
  * Simplified version of vector, serving two purposes:
  * - somewhat faster in that it does not clear memory on resize/alloc,
  *   this was actually showing up in profiles quite significantly
- * - if this is used, we are not tempted to use inefficient operations */
+ * - if this is used, we are not tempted to use inefficient operations
+ *
+ * An array can also reference memory it does not own, for example a memory
+ * mapped file, it gets its own copy on the first resize. */
 
 template<typename T>
 class array
@@ -43,10 +46,13 @@ public:
 	{
 		data = NULL;
 		datasize = 0;
+		owned = true;
 	}
 
 	array(size_t newsize)
 	{
+		owned = true;
+
 		if(newsize == 0) {
 			data = NULL;
 			datasize = 0;
@@ -59,11 +65,18 @@ public:
 
 	array(const array& from)
 	{
+		data = NULL;
+		owned = true;
 		*this = from;
 	}
 
 	array& operator=(const array& from)
 	{
+		if(this == &from)
+			return *this;
+
+		free_data();
+
 		if(from.datasize == 0) {
 			data = NULL;
 			datasize = 0;
@@ -79,6 +92,7 @@ public:
 
 	array& operator=(const vector<T>& from)
 	{
+		free_data();
 		datasize = from.size();
 		data = NULL;
 
@@ -92,7 +106,16 @@ public:
 
 	~array()
 	{
-		delete [] data;
+		free_data();
+	}
+
+	/* use memory owned by someone else, which must stay valid */
+	void reference(T *newdata, size_t newsize)
+	{
+		free_data();
+		data = (newsize)? newdata: NULL;
+		datasize = newsize;
+		owned = false;
 	}
 
 	void resize(size_t newsize)
@@ -103,7 +126,7 @@ public:
 		else {
 			T *newdata = new T[newsize];
 			memcpy(newdata, data, ((datasize < newsize)? datasize: newsize)*sizeof(T));
-			delete [] data;
+			free_data();
 
 			data = newdata;
 			datasize = newsize;
@@ -112,7 +135,7 @@ public:
 
 	void clear()
 	{
-		delete [] data;
+		free_data();
 		data = NULL;
 		datasize = 0;
 	}
@@ -128,8 +151,16 @@ public:
 	}
 
 protected:
+	void free_data()
+	{
+		if(owned)
+			delete [] data;
+		owned = true;
+	}
+
 	T *data;
 	size_t datasize;
+	bool owned;
 };
 
 CCL_NAMESPACE_END
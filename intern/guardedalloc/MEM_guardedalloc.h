@@ -206,6 +206,42 @@ extern "C" {
 #endif
 	;
 
+	/** Number of buckets in the #MEM_AllocStats size histogram,
+	 * bucket N counts allocations of [2^(N+4), 2^(N+5)) bytes,
+	 * the first and last buckets are open-ended. */
+#define MEM_ALLOC_STATS_HISTOGRAM_SIZE 16
+
+	/** Per-name allocation statistics, gathered while enabled with
+	 * #MEM_set_alloc_stats. Blocks sharing the same name are merged. */
+	typedef struct MEM_AllocStats {
+		const char *name;
+		uintptr_t allocs;        /* number of malloc/calloc/mapalloc calls */
+		uintptr_t frees;         /* number of blocks freed */
+		uintptr_t reallocs;      /* number of realloc/recalloc calls, also counted in allocs/frees */
+		uintptr_t bytes_alloc;   /* total bytes allocated */
+		uintptr_t bytes_in_use;  /* bytes still allocated */
+		uintptr_t peak_in_use;   /* peak of bytes_in_use */
+		uintptr_t histogram[MEM_ALLOC_STATS_HISTOGRAM_SIZE];
+	} MEM_AllocStats;
+
+	/** Enable or disable gathering of per-name allocation statistics,
+	 * enabling also resets previously gathered statistics. */
+	void MEM_set_alloc_stats(int enable);
+
+	/** Returns true when per-name allocation statistics are gathered. */
+	int MEM_get_alloc_stats(void);
+
+	/** Clear all per-name allocation statistics, blocks allocated before the
+	 * reset are no longer accounted for, so stats can be gathered per frame. */
+	void MEM_reset_alloc_stats(void);
+
+	/** Print per-name allocation statistics, sorted by number of allocations */
+	void MEM_printmemlist_alloc_stats(void);
+
+	/** Calls the function for the statistics of every allocation name,
+	 * sorted by number of allocations. */
+	void MEM_callback_alloc_stats(void (*func)(const MEM_AllocStats *stats, void *userdata), void *userdata);
+
 #ifndef NDEBUG
 const char *MEM_name_ptr(void *vmemh);
 #endif
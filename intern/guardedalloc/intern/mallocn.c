@@ -100,7 +100,8 @@ typedef struct MemHead {
 	const char *name;
 	const char *nextname;
 	int tag2;
-	int mmap;  /* if true, memory was mmapped */
+	short mmap;  /* if true, memory was mmapped */
+	short stats_gen;  /* alloc_stats_generation this block was counted in, 0 if not counted */
 #ifdef DEBUG_MEMCOUNTER
 	int _count;
 #endif
@@ -136,6 +137,9 @@ static void remlink(volatile localListBase *listbase, void *vlink);
 static void rem_memblock(MemHead *memh);
 static void MemorY_ErroR(const char *block, const char *error);
 static const char *check_memlist(MemHead *memh);
+static void alloc_stats_add(MemHead *memh);
+static void alloc_stats_remove(MemHead *memh);
+static void alloc_stats_realloc(const char *name);
 
 /* --------------------------------------------------------------------- */
 /* locally used defines                                                  */
@@ -171,6 +175,15 @@ static void (*thread_unlock_callback)(void) = NULL;
 
 static int malloc_debug_memset = 0;
 
+/* per-name allocation statistics, open addressing hash keyed by name pointer,
+ * only accessed with the thread lock held. Note that names freed with
+ * DEBUG_MEMDUPLINAME leave dangling keys, don't combine both */
+static int alloc_stats_enabled = 0;
+static short alloc_stats_generation = 0;
+static MEM_AllocStats *alloc_stats_table = NULL;
+static unsigned int alloc_stats_size = 0;  /* always a power of two */
+static unsigned int alloc_stats_used = 0;
+
 #ifdef malloc
 #undef malloc
 #endif
@@ -315,6 +328,9 @@ void *MEM_reallocN(void *vmemh, size_t len)
 		MemHead *memh = vmemh;
 		memh--;
 
+		if (alloc_stats_enabled)
+			alloc_stats_realloc(memh->name);
+
 		newp = MEM_mallocN(len, memh->name);
 		if (newp) {
 			if (len < memh->len) {
@@ -341,6 +357,9 @@ void *MEM_recallocN(void *vmemh, size_t len)
 		MemHead *memh = vmemh;
 		memh--;
 
+		if (alloc_stats_enabled)
+			alloc_stats_realloc(memh->name);
+
 		newp = MEM_mallocN(len, memh->name);
 		if (newp) {
 			if (len < memh->len) {
@@ -373,6 +392,7 @@ static void make_memhead_header(MemHead *memh, size_t len, const char *str)
 	memh->nextname = NULL;
 	memh->len = len;
 	memh->mmap = 0;
+	memh->stats_gen = 0;
 	memh->tag2 = MEMTAG2;
 
 #ifdef DEBUG_MEMDUPLINAME
@@ -391,6 +411,9 @@ static void make_memhead_header(MemHead *memh, size_t len, const char *str)
 	mem_in_use += len;
 
 	peak_mem = mem_in_use > peak_mem ? mem_in_use : peak_mem;
+
+	if (alloc_stats_enabled)
+		alloc_stats_add(memh);
 }
 
 void *MEM_mallocN(size_t len, const char *str)
@@ -578,6 +601,271 @@ void MEM_printmemlist_stats(void)
 #endif
 }
 
+/* Allocation statistics */
+
+static unsigned int alloc_stats_hash(const char *name)
+{
+	uintptr_t key = (uintptr_t)name;
+	return (unsigned int)((key >> 3) ^ (key >> 17)) * 2654435761u;
+}
+
+/* rebuild the table with room for at least twice the used entries,
+ * uses system malloc so statistics never count themselves */
+static int alloc_stats_grow(void)
+{
+	MEM_AllocStats *old_table = alloc_stats_table;
+	unsigned int old_size = alloc_stats_size, a;
+	unsigned int size = old_size ? old_size * 2 : 512;
+
+	alloc_stats_table = calloc(size, sizeof(MEM_AllocStats));
+	if (alloc_stats_table == NULL) {
+		alloc_stats_table = old_table;
+		return 0;
+	}
+	alloc_stats_size = size;
+
+	for (a = 0; a < old_size; a++) {
+		if (old_table[a].name) {
+			unsigned int i = alloc_stats_hash(old_table[a].name) & (size - 1);
+			while (alloc_stats_table[i].name)
+				i = (i + 1) & (size - 1);
+			alloc_stats_table[i] = old_table[a];
+		}
+	}
+	free(old_table);
+
+	return 1;
+}
+
+static MEM_AllocStats *alloc_stats_lookup(const char *name, int create)
+{
+	unsigned int i;
+
+	/* when growing fails keep using the current table while it has room */
+	if (create && (alloc_stats_used + 1) * 2 > alloc_stats_size)
+		alloc_stats_grow();
+
+	if (alloc_stats_size == 0)
+		return NULL;
+
+	/* there is always at least one empty slot, so this terminates */
+	i = alloc_stats_hash(name) & (alloc_stats_size - 1);
+	while (alloc_stats_table[i].name) {
+		if (alloc_stats_table[i].name == name)
+			return &alloc_stats_table[i];
+		i = (i + 1) & (alloc_stats_size - 1);
+	}
+
+	if (!create || alloc_stats_used + 2 > alloc_stats_size)
+		return NULL;
+
+	alloc_stats_table[i].name = name;
+	alloc_stats_used++;
+	return &alloc_stats_table[i];
+}
+
+static int alloc_stats_bucket(size_t len)
+{
+	int bucket = 0;
+
+	len >>= 5;
+	while (len && bucket < MEM_ALLOC_STATS_HISTOGRAM_SIZE - 1) {
+		len >>= 1;
+		bucket++;
+	}
+
+	return bucket;
+}
+
+static void alloc_stats_add(MemHead *memh)
+{
+	MEM_AllocStats *stats = alloc_stats_lookup(memh->name, 1);
+
+	if (stats) {
+		memh->stats_gen = alloc_stats_generation;
+
+		stats->allocs++;
+		stats->bytes_alloc += memh->len;
+		stats->bytes_in_use += memh->len;
+		if (stats->bytes_in_use > stats->peak_in_use)
+			stats->peak_in_use = stats->bytes_in_use;
+		stats->histogram[alloc_stats_bucket(memh->len)]++;
+	}
+}
+
+static void alloc_stats_remove(MemHead *memh)
+{
+	MEM_AllocStats *stats = alloc_stats_lookup(memh->name, 0);
+
+	if (stats) {
+		stats->frees++;
+		stats->bytes_in_use -= memh->len;
+	}
+}
+
+static void alloc_stats_realloc(const char *name)
+{
+	MEM_AllocStats *stats;
+
+	mem_lock_thread();
+	if (alloc_stats_enabled) {
+		stats = alloc_stats_lookup(name, 1);
+		if (stats)
+			stats->reallocs++;
+	}
+	mem_unlock_thread();
+}
+
+static void alloc_stats_clear(void)
+{
+	/* blocks tagged with an older generation are ignored when freed */
+	alloc_stats_generation = (alloc_stats_generation < 0x7fff) ? alloc_stats_generation + 1 : 1;
+
+	if (alloc_stats_table)
+		memset(alloc_stats_table, 0, sizeof(MEM_AllocStats) * alloc_stats_size);
+	alloc_stats_used = 0;
+}
+
+void MEM_set_alloc_stats(int enable)
+{
+	mem_lock_thread();
+	if (enable && !alloc_stats_enabled)
+		alloc_stats_clear();
+	alloc_stats_enabled = (enable != 0);
+	mem_unlock_thread();
+}
+
+int MEM_get_alloc_stats(void)
+{
+	return alloc_stats_enabled;
+}
+
+void MEM_reset_alloc_stats(void)
+{
+	mem_lock_thread();
+	alloc_stats_clear();
+	mem_unlock_thread();
+}
+
+static int compare_alloc_stats_name(const void *p1, const void *p2)
+{
+	const MEM_AllocStats *st1 = (const MEM_AllocStats *)p1;
+	const MEM_AllocStats *st2 = (const MEM_AllocStats *)p2;
+
+	return strcmp(st1->name, st2->name);
+}
+
+static int compare_alloc_stats_allocs(const void *p1, const void *p2)
+{
+	const MEM_AllocStats *st1 = (const MEM_AllocStats *)p1;
+	const MEM_AllocStats *st2 = (const MEM_AllocStats *)p2;
+
+	if (st1->allocs < st2->allocs)
+		return 1;
+	else if (st1->allocs == st2->allocs)
+		return 0;
+	else
+		return -1;
+}
+
+/* copy the statistics into a new array, merging equal names which
+ * live at different addresses, and sort them by allocation count */
+static MEM_AllocStats *alloc_stats_collect(int *r_tot)
+{
+	MEM_AllocStats *array, *st;
+	unsigned int a;
+	int tot = 0, b, c, h;
+
+	mem_lock_thread();
+
+	array = malloc(sizeof(MEM_AllocStats) * (alloc_stats_used + 1));
+	if (array) {
+		for (a = 0; a < alloc_stats_size; a++) {
+			if (alloc_stats_table[a].name)
+				array[tot++] = alloc_stats_table[a];
+		}
+	}
+
+	mem_unlock_thread();
+
+	if (array == NULL) {
+		*r_tot = 0;
+		return NULL;
+	}
+
+	if (tot > 1) {
+		qsort(array, tot, sizeof(MEM_AllocStats), compare_alloc_stats_name);
+		for (b = 0, c = 1; c < tot; c++) {
+			if (strcmp(array[b].name, array[c].name) == 0) {
+				st = &array[b];
+				st->allocs += array[c].allocs;
+				st->frees += array[c].frees;
+				st->reallocs += array[c].reallocs;
+				st->bytes_alloc += array[c].bytes_alloc;
+				st->bytes_in_use += array[c].bytes_in_use;
+				st->peak_in_use += array[c].peak_in_use;
+				for (h = 0; h < MEM_ALLOC_STATS_HISTOGRAM_SIZE; h++)
+					st->histogram[h] += array[c].histogram[h];
+			}
+			else {
+				b++;
+				array[b] = array[c];
+			}
+		}
+		tot = b + 1;
+
+		qsort(array, tot, sizeof(MEM_AllocStats), compare_alloc_stats_allocs);
+	}
+
+	*r_tot = tot;
+	return array;
+}
+
+void MEM_callback_alloc_stats(void (*func)(const MEM_AllocStats *stats, void *userdata), void *userdata)
+{
+	MEM_AllocStats *array;
+	int tot, a;
+
+	/* callbacks run without the lock held, they may allocate themselves */
+	array = alloc_stats_collect(&tot);
+	for (a = 0; a < tot; a++)
+		func(&array[a], userdata);
+	free(array);
+}
+
+void MEM_printmemlist_alloc_stats(void)
+{
+	MEM_AllocStats *array, *st;
+	uintptr_t histogram[MEM_ALLOC_STATS_HISTOGRAM_SIZE] = {0};
+	int tot, a, h;
+
+	array = alloc_stats_collect(&tot);
+
+	printf("\nallocation statistics%s:\n", alloc_stats_enabled ? "" : " (disabled)");
+	printf("   ALLOCS    FREES REALLOCS  TOTAL-MiB   LIVE-MiB   PEAK-MiB TYPE\n");
+	for (a = 0, st = array; a < tot; a++, st++) {
+		printf("%9lu %8lu %8lu (%9.3f  %9.3f  %9.3f) %s\n",
+		       (unsigned long)st->allocs, (unsigned long)st->frees, (unsigned long)st->reallocs,
+		       (double)st->bytes_alloc / (double)(1024 * 1024),
+		       (double)st->bytes_in_use / (double)(1024 * 1024),
+		       (double)st->peak_in_use / (double)(1024 * 1024), st->name);
+
+		for (h = 0; h < MEM_ALLOC_STATS_HISTOGRAM_SIZE; h++)
+			histogram[h] += st->histogram[h];
+	}
+
+	printf("size histogram:\n");
+	for (h = 0; h < MEM_ALLOC_STATS_HISTOGRAM_SIZE; h++) {
+		if (histogram[h]) {
+			printf("  %s%9lu bytes: %lu\n",
+			       (h == 0) ? "<" : ((h == MEM_ALLOC_STATS_HISTOGRAM_SIZE - 1) ? ">=" : " "),
+			       (h == 0) ? 32ul : (16ul << h), (unsigned long)histogram[h]);
+		}
+	}
+
+	free(array);
+}
+
 static const char mem_printmemlist_pydict_script[] =
 "mb_userinfo = {}\n"
 "totmem = 0\n"
@@ -824,6 +1112,9 @@ static void rem_memblock(MemHead *memh)
 	totblock--;
 	mem_in_use -= memh->len;
 
+	if (alloc_stats_enabled && memh->stats_gen == alloc_stats_generation)
+		alloc_stats_remove(memh);
+
 #ifdef DEBUG_MEMDUPLINAME
 	if (memh->need_free_name)
 		free((char *) memh->name);
@@ -121,6 +121,16 @@ FLUID_3D::FLUID_3D(int *res, float dx, float dtdef, int init_heat, int init_fire
 		_obstacles[x]    = false;
 	}
 
+	initMultigrid();
+
+	// everything is active until the first step looks at the fields
+	_tileRes = Vec3Int((_xRes + TILE_SIZE - 1) >> TILE_SHIFT,
+					   (_yRes + TILE_SIZE - 1) >> TILE_SHIFT,
+					   (_zRes + TILE_SIZE - 1) >> TILE_SHIFT);
+	_tileActive = new unsigned char[_tileRes[0] * _tileRes[1] * _tileRes[2]];
+	_tileTemp = new unsigned char[_tileRes[0] * _tileRes[1] * _tileRes[2]];
+	memset(_tileActive, 1, _tileRes[0] * _tileRes[1] * _tileRes[2]);
+
 	/* heat */
 	_heat = _heatOld = _heatTemp = NULL;
 	if (init_heat) {
@@ -302,6 +312,11 @@ FLUID_3D::~FLUID_3D()
 	if (_color_bOld) delete[] _color_bOld;
 	if (_color_bTemp) delete[] _color_bTemp;
 
+	freeMultigrid();
+
+	if (_tileActive) delete[] _tileActive;
+	if (_tileTemp) delete[] _tileTemp;
+
     // printf("deleted fluid\n");
 }
 
@@ -346,6 +361,8 @@ void FLUID_3D::step(float dt, float gravity[3])
 	// set vorticity from RNA value
 	_vorticityEps = (*_vorticityRNA)/_constantScaling;
 
+	updateActiveTiles();
+
 #if PARALLEL==1
 	int threadval = 1;
 	threadval = omp_get_max_threads();
@@ -367,9 +384,7 @@ void FLUID_3D::step(float dt, float gravity[3])
 
 
 #if PARALLEL==1
-	#pragma omp parallel
-	{
-	#pragma omp for schedule(static,1)
+	#pragma omp parallel for schedule(static,1)
 	for (int i=0; i<stepParts; i++)
 	{
 		int zBegin = (int)((float)i*partSize + 0.5f);
@@ -383,10 +398,6 @@ void FLUID_3D::step(float dt, float gravity[3])
 
 #if PARALLEL==1
 	}	// end of parallel
-	#pragma omp barrier
-
-	#pragma omp single
-	{
 #endif
 	/*
 	* addForce() changed Temp values to preserve thread safety
@@ -398,35 +409,20 @@ void FLUID_3D::step(float dt, float gravity[3])
 	SWAP_POINTERS(_xVelocity, _xVelocityTemp);
 	SWAP_POINTERS(_yVelocity, _yVelocityTemp);
 	SWAP_POINTERS(_zVelocity, _zVelocityTemp);
-#if PARALLEL==1
-	}	// end of single
 
-	#pragma omp barrier
+	/*
+	* The pressure solve splits its work over z-slabs itself,
+	* so it runs outside of a parallel region.
+	*/
+	project();
 
-	#pragma omp for
-	for (int i=0; i<2; i++)
-	{
-		if (i==0)
-		{
-#endif
-			project();
-#if PARALLEL==1
-		}
-		else if (i==1)
-		{
-#endif
-			if (_heat) {
-				diffuseHeat();
-			}
-#if PARALLEL==1
-		}
+	if (_heat) {
+		diffuseHeat();
 	}
 
-	#pragma omp barrier
+	// the projection changed the velocities, look again before advecting
+	updateActiveTiles();
 
-	#pragma omp single
-	{
-#endif
 	/*
 	* For thread safety use "Old" to read
 	* "current" values but still allow changing values.
@@ -447,11 +443,8 @@ void FLUID_3D::step(float dt, float gravity[3])
 	advectMacCormackBegin(0, _zRes);
 
 #if PARALLEL==1
-	}	// end of single
-
-	#pragma omp barrier
-
-
+	#pragma omp parallel
+	{
 	#pragma omp for schedule(static,1)
 	for (int i=0; i<stepParts; i++)
 	{
@@ -925,12 +918,6 @@ void FLUID_3D::addForce(int zBegin, int zEnd)
 //////////////////////////////////////////////////////////////////////
 void FLUID_3D::project()
 {
-	int x, y, z;
-	size_t index;
-
-	float *_pressure = new float[_totalCells];
-	float *_divergence   = new float[_totalCells];
-
 	memset(_pressure, 0, sizeof(float)*_totalCells);
 	memset(_divergence, 0, sizeof(float)*_totalCells);
 	
@@ -948,10 +935,14 @@ void FLUID_3D::project()
 	else setZeroZ(_zVelocity, _res, 0, _zRes);
 
 	// calculate divergence
-	index = _slabSize + _xRes + 1;
-	for (z = 1; z < _zRes - 1; z++, index += 2 * _xRes)
-		for (y = 1; y < _yRes - 1; y++, index += 2)
-			for (x = 1; x < _xRes - 1; x++, index++)
+#if PARALLEL==1
+	#pragma omp parallel for schedule(static)
+#endif
+	for (int z = 1; z < _zRes - 1; z++)
+	{
+		size_t index = (size_t)z * _slabSize + _xRes + 1;
+		for (int y = 1; y < _yRes - 1; y++, index += 2)
+			for (int x = 1; x < _xRes - 1; x++, index++)
 			{
 				
 				if(_obstacles[index])
@@ -987,9 +978,10 @@ void FLUID_3D::project()
 						yup - ydown +
 						ztop - zbottom );
 
-				// Pressure is zero anyway since now a local array is used
+				// Pressure is zero anyway since it's cleared every step
 				_pressure[index] = 0.0f;
 			}
+	}
 
 
 	/*
@@ -1020,15 +1012,11 @@ void FLUID_3D::project()
 	*/
 
 	// solve Poisson equation
-	solvePressurePre(_pressure, _divergence, _obstacles);
+	solvePressureMG(_pressure, _divergence, _obstacles);
 
 	{
-		float maxvalue = 0;
 		for(unsigned int i = 0; i < _xRes * _yRes * _zRes; i++)
 		{
-			if(_pressure[i] > maxvalue)
-				maxvalue = _pressure[i];
-
 			/* HACK: Animated collision object sometimes result in a non converging solvePressurePre() */ 
 			if(_pressure[i] > _dx * _dt)
 				_pressure[i] = _dx * _dt;
@@ -1049,10 +1037,14 @@ void FLUID_3D::project()
 	// project out solution
 	// New idea for code from NVIDIA graphic gems 3 - DG
 	float invDx = 1.0f / _dx;
-	index = _slabSize + _xRes + 1;
-	for (z = 1; z < _zRes - 1; z++, index += 2 * _xRes)
-		for (y = 1; y < _yRes - 1; y++, index += 2)
-			for (x = 1; x < _xRes - 1; x++, index++)
+#if PARALLEL==1
+	#pragma omp parallel for schedule(static)
+#endif
+	for (int z = 1; z < _zRes - 1; z++)
+	{
+		size_t index = (size_t)z * _slabSize + _xRes + 1;
+		for (int y = 1; y < _yRes - 1; y++, index += 2)
+			for (int x = 1; x < _xRes - 1; x++, index++)
 			{
 				float vMask[3] = {1.0f, 1.0f, 1.0f}, vObst[3] = {0, 0, 0};
 				float vR = 0.0f, vL = 0.0f, vT = 0.0f, vB = 0.0f, vD = 0.0f, vU = 0.0f;
@@ -1090,12 +1082,10 @@ void FLUID_3D::project()
 					_zVelocity[index] = _zVelocityOb[index];
 				}
 			}
+	}
 
 	// DG: was enabled in original code but now we do this later
 	// setObstacleVelocity(0, _zRes);
-
-	if (_pressure) delete[] _pressure;
-	if (_divergence) delete[] _divergence;
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -1339,6 +1329,112 @@ void FLUID_3D::setObstacleBoundaries(float *_pressure, int zBegin, int zEnd)
 	}	// z-loop
 }
 
+//////////////////////////////////////////////////////////////////////
+// mark the tiles holding smoke, heat, fuel or color. The marks are
+// grown by the farthest distance anything moves in one step, so the
+// unmarked tiles can only advect in zeros and may be skipped.
+//////////////////////////////////////////////////////////////////////
+#define TILE_EPSILON 1e-6f
+
+void FLUID_3D::updateActiveTiles()
+{
+	const int txRes = _tileRes[0];
+	const int tyRes = _tileRes[1];
+	const int tzRes = _tileRes[2];
+	const int tileSlab = txRes * tyRes;
+	float *layerVel = new float[tzRes];
+
+#if PARALLEL==1
+	#pragma omp parallel for schedule(static)
+#endif
+	for (int tz = 0; tz < tzRes; tz++)
+	{
+		unsigned char *layer = _tileTemp + tz * tileSlab;
+		const int zEnd = ((tz + 1) << TILE_SHIFT < _zRes) ? (tz + 1) << TILE_SHIFT : _zRes;
+		float maxVel = 0.0f;
+
+		memset(layer, 0, tileSlab);
+
+		for (int z = tz << TILE_SHIFT; z < zEnd; z++)
+			for (int y = 0; y < _yRes; y++)
+			{
+				unsigned char *row = layer + (y >> TILE_SHIFT) * txRes;
+				int index = z * _slabSize + y * _xRes;
+
+				for (int x = 0; x < _xRes; x++, index++)
+				{
+					const float vel = fabsf(_xVelocity[index]) + fabsf(_yVelocity[index]) + fabsf(_zVelocity[index]);
+
+					if (vel > maxVel)
+						maxVel = vel;
+
+					if (row[x >> TILE_SHIFT])
+						continue;
+
+					bool active = _density[index] > TILE_EPSILON;
+
+					if (!active && _heat)
+						active = fabsf(_heat[index]) > TILE_EPSILON;
+					if (!active && _fuel)
+						active = _fuel[index] > TILE_EPSILON || _react[index] > TILE_EPSILON;
+					if (!active && _color_r)
+						active = _color_r[index] > TILE_EPSILON || _color_g[index] > TILE_EPSILON ||
+							_color_b[index] > TILE_EPSILON;
+
+					if (active)
+						row[x >> TILE_SHIFT] = 1;
+				}
+			}
+
+		layerVel[tz] = maxVel;
+	}
+
+	// cells traveled per step, plus the interpolation and clamping stencils
+	float maxStep = 0.0f;
+	for (int tz = 0; tz < tzRes; tz++)
+		if (layerVel[tz] > maxStep)
+			maxStep = layerVel[tz];
+	delete[] layerVel;
+	maxStep = maxStep * _dt / _dx + 2.0f;
+
+	const int reach = (maxStep < _maxRes) ? 1 + (int)(maxStep / TILE_SIZE) : _maxRes;
+
+	// grow the marks separately along x, y and z
+	for (int tz = 0; tz < tzRes; tz++)
+		for (int ty = 0; ty < tyRes; ty++)
+			for (int tx = 0; tx < txRes; tx++)
+			{
+				const int i = tx + ty * txRes + tz * tileSlab;
+				unsigned char active = 0;
+				for (int t = tx - reach; t <= tx + reach && !active; t++)
+					if (t >= 0 && t < txRes)
+						active = _tileTemp[i + t - tx];
+				_tileActive[i] = active;
+			}
+	for (int tz = 0; tz < tzRes; tz++)
+		for (int ty = 0; ty < tyRes; ty++)
+			for (int tx = 0; tx < txRes; tx++)
+			{
+				const int i = tx + ty * txRes + tz * tileSlab;
+				unsigned char active = 0;
+				for (int t = ty - reach; t <= ty + reach && !active; t++)
+					if (t >= 0 && t < tyRes)
+						active = _tileActive[i + (t - ty) * txRes];
+				_tileTemp[i] = active;
+			}
+	for (int tz = 0; tz < tzRes; tz++)
+		for (int ty = 0; ty < tyRes; ty++)
+			for (int tx = 0; tx < txRes; tx++)
+			{
+				const int i = tx + ty * txRes + tz * tileSlab;
+				unsigned char active = 0;
+				for (int t = tz - reach; t <= tz + reach && !active; t++)
+					if (t >= 0 && t < tzRes)
+						active = _tileTemp[i + (t - tz) * tileSlab];
+				_tileActive[i] = active;
+			}
+}
+
 //////////////////////////////////////////////////////////////////////
 // add buoyancy forces
 //////////////////////////////////////////////////////////////////////
@@ -1348,13 +1444,21 @@ void FLUID_3D::addBuoyancy(float *heat, float *density, float gravity[3], int zB
 
 	for (int z = zBegin; z < zEnd; z++)
 		for (int y = 0; y < _yRes; y++)
+		{
+			const unsigned char *row = tileRow(_tileActive, _res, y, z);
+
 			for (int x = 0; x < _xRes; x++, index++)
 			{
+				// no smoke or heat in inactive tiles
+				if (!row[x >> TILE_SHIFT])
+					continue;
+
 				float buoyancy = *_alpha * density[index] + (*_beta * (((heat) ? heat[index] : 0.0f) - _tempAmb));
 				_xForce[index] -= gravity[0] * buoyancy;
 				_yForce[index] -= gravity[1] * buoyancy;
 				_zForce[index] -= gravity[2] * buoyancy;
 			}
+		}
 }
 
 
@@ -1420,9 +1524,13 @@ void FLUID_3D::addVorticity(int zBegin, int zEnd)
 
 		for (int y = 1; y < _yRes - 1; y++, index += 2)
 		{
+			const unsigned char *row = tileRow(_tileActive, _res, y, z);
+
 			for (int x = 1; x < _xRes - 1; x++, index++)
 			{
-				if (!_obstacles[index])
+				// vorticity confinement only matters where there is smoke,
+				// it is left zero in inactive tiles
+				if (!_obstacles[index] && row[x >> TILE_SHIFT])
 				{
 					int obpos[6];
 
@@ -1483,11 +1591,13 @@ void FLUID_3D::addVorticity(int zBegin, int zEnd)
 
 		for (int y = 1; y < _yRes - 1; y++, index += 2)
 		{
+			const unsigned char *row = tileRow(_tileActive, _res, y, z);
+
 			for (int x = 1; x < _xRes - 1; x++, index++)
 			{
 				//
 
-				if (!_obstacles[index])
+				if (!_obstacles[index] && row[x >> TILE_SHIFT])
 				{
 					float N[3];
 
@@ -1560,19 +1670,20 @@ void FLUID_3D::advectMacCormackEnd1(int zBegin, int zEnd)
 
 	// advectFieldMacCormack1(dt, xVelocity, yVelocity, zVelocity, oldField, newField, res)
 
-	advectFieldMacCormack1(dt0, _xVelocityOld, _yVelocityOld, _zVelocityOld, _densityOld, _densityTemp, res, zBegin, zEnd);
+	advectFieldMacCormack1(dt0, _xVelocityOld, _yVelocityOld, _zVelocityOld, _densityOld, _densityTemp, res, zBegin, zEnd, _tileActive);
 	if (_heat) {
-		advectFieldMacCormack1(dt0, _xVelocityOld, _yVelocityOld, _zVelocityOld, _heatOld, _heatTemp, res, zBegin, zEnd);
+		advectFieldMacCormack1(dt0, _xVelocityOld, _yVelocityOld, _zVelocityOld, _heatOld, _heatTemp, res, zBegin, zEnd, _tileActive);
 	}
 	if (_fuel) {
-		advectFieldMacCormack1(dt0, _xVelocityOld, _yVelocityOld, _zVelocityOld, _fuelOld, _fuelTemp, res, zBegin, zEnd);
-		advectFieldMacCormack1(dt0, _xVelocityOld, _yVelocityOld, _zVelocityOld, _reactOld, _reactTemp, res, zBegin, zEnd);
+		advectFieldMacCormack1(dt0, _xVelocityOld, _yVelocityOld, _zVelocityOld, _fuelOld, _fuelTemp, res, zBegin, zEnd, _tileActive);
+		advectFieldMacCormack1(dt0, _xVelocityOld, _yVelocityOld, _zVelocityOld, _reactOld, _reactTemp, res, zBegin, zEnd, _tileActive);
 	}
 	if (_color_r) {
-		advectFieldMacCormack1(dt0, _xVelocityOld, _yVelocityOld, _zVelocityOld, _color_rOld, _color_rTemp, res, zBegin, zEnd);
-		advectFieldMacCormack1(dt0, _xVelocityOld, _yVelocityOld, _zVelocityOld, _color_gOld, _color_gTemp, res, zBegin, zEnd);
-		advectFieldMacCormack1(dt0, _xVelocityOld, _yVelocityOld, _zVelocityOld, _color_bOld, _color_bTemp, res, zBegin, zEnd);
+		advectFieldMacCormack1(dt0, _xVelocityOld, _yVelocityOld, _zVelocityOld, _color_rOld, _color_rTemp, res, zBegin, zEnd, _tileActive);
+		advectFieldMacCormack1(dt0, _xVelocityOld, _yVelocityOld, _zVelocityOld, _color_gOld, _color_gTemp, res, zBegin, zEnd, _tileActive);
+		advectFieldMacCormack1(dt0, _xVelocityOld, _yVelocityOld, _zVelocityOld, _color_bOld, _color_bTemp, res, zBegin, zEnd, _tileActive);
 	}
+	// the projection spreads motion over the whole domain, velocity is advected everywhere
 	advectFieldMacCormack1(dt0, _xVelocityOld, _yVelocityOld, _zVelocityOld, _xVelocityOld, _xVelocity, res, zBegin, zEnd);
 	advectFieldMacCormack1(dt0, _xVelocityOld, _yVelocityOld, _zVelocityOld, _yVelocityOld, _yVelocity, res, zBegin, zEnd);
 	advectFieldMacCormack1(dt0, _xVelocityOld, _yVelocityOld, _zVelocityOld, _zVelocityOld, _zVelocity, res, zBegin, zEnd);
@@ -1594,19 +1705,20 @@ void FLUID_3D::advectMacCormackEnd2(int zBegin, int zEnd)
 	// advectFieldMacCormack2(dt, xVelocity, yVelocity, zVelocity, oldField, newField, tempfield, temp, res, obstacles)
 
 	/* finish advection */
-	advectFieldMacCormack2(dt0, _xVelocityOld, _yVelocityOld, _zVelocityOld, _densityOld, _density, _densityTemp, t1, res, _obstacles, zBegin, zEnd);
+	advectFieldMacCormack2(dt0, _xVelocityOld, _yVelocityOld, _zVelocityOld, _densityOld, _density, _densityTemp, t1, res, _obstacles, zBegin, zEnd, _tileActive);
 	if (_heat) {
-		advectFieldMacCormack2(dt0, _xVelocityOld, _yVelocityOld, _zVelocityOld, _heatOld, _heat, _heatTemp, t1, res, _obstacles, zBegin, zEnd);
+		advectFieldMacCormack2(dt0, _xVelocityOld, _yVelocityOld, _zVelocityOld, _heatOld, _heat, _heatTemp, t1, res, _obstacles, zBegin, zEnd, _tileActive);
 	}
 	if (_fuel) {
-		advectFieldMacCormack2(dt0, _xVelocityOld, _yVelocityOld, _zVelocityOld, _fuelOld, _fuel, _fuelTemp, t1, res, _obstacles, zBegin, zEnd);
-		advectFieldMacCormack2(dt0, _xVelocityOld, _yVelocityOld, _zVelocityOld, _reactOld, _react, _reactTemp, t1, res, _obstacles, zBegin, zEnd);
+		advectFieldMacCormack2(dt0, _xVelocityOld, _yVelocityOld, _zVelocityOld, _fuelOld, _fuel, _fuelTemp, t1, res, _obstacles, zBegin, zEnd, _tileActive);
+		advectFieldMacCormack2(dt0, _xVelocityOld, _yVelocityOld, _zVelocityOld, _reactOld, _react, _reactTemp, t1, res, _obstacles, zBegin, zEnd, _tileActive);
 	}
 	if (_color_r) {
-		advectFieldMacCormack2(dt0, _xVelocityOld, _yVelocityOld, _zVelocityOld, _color_rOld, _color_r, _color_rTemp, t1, res, _obstacles, zBegin, zEnd);
-		advectFieldMacCormack2(dt0, _xVelocityOld, _yVelocityOld, _zVelocityOld, _color_gOld, _color_g, _color_gTemp, t1, res, _obstacles, zBegin, zEnd);
-		advectFieldMacCormack2(dt0, _xVelocityOld, _yVelocityOld, _zVelocityOld, _color_bOld, _color_b, _color_bTemp, t1, res, _obstacles, zBegin, zEnd);
+		advectFieldMacCormack2(dt0, _xVelocityOld, _yVelocityOld, _zVelocityOld, _color_rOld, _color_r, _color_rTemp, t1, res, _obstacles, zBegin, zEnd, _tileActive);
+		advectFieldMacCormack2(dt0, _xVelocityOld, _yVelocityOld, _zVelocityOld, _color_gOld, _color_g, _color_gTemp, t1, res, _obstacles, zBegin, zEnd, _tileActive);
+		advectFieldMacCormack2(dt0, _xVelocityOld, _yVelocityOld, _zVelocityOld, _color_bOld, _color_b, _color_bTemp, t1, res, _obstacles, zBegin, zEnd, _tileActive);
 	}
+	// velocity is advected everywhere, see advectMacCormackEnd1
 	advectFieldMacCormack2(dt0, _xVelocityOld, _yVelocityOld, _zVelocityOld, _xVelocityOld, _xVelocityTemp, _xVelocity, t1, res, _obstacles, zBegin, zEnd);
 	advectFieldMacCormack2(dt0, _xVelocityOld, _yVelocityOld, _zVelocityOld, _yVelocityOld, _yVelocityTemp, _yVelocity, t1, res, _obstacles, zBegin, zEnd);
 	advectFieldMacCormack2(dt0, _xVelocityOld, _yVelocityOld, _zVelocityOld, _zVelocityOld, _zVelocityTemp, _zVelocity, t1, res, _obstacles, zBegin, zEnd);
@@ -43,6 +43,23 @@ using namespace std;
 using namespace BasicVector;
 class WTURBULENCE;
 
+// the domain is split in tiles of 8x8x8 cells, advection and forces
+// skip tiles without smoke or motion
+#define TILE_SHIFT 3
+#define TILE_SIZE (1 << TILE_SHIFT)
+
+// one grid of the multigrid pressure preconditioner, every coarser
+// grid has half the resolution of the one before
+struct MG_LEVEL {
+	int xRes, yRes, zRes;
+	int slabSize;
+	size_t totalCells;
+	float invScale;			// coarse operators are scaled by 0.5 per level
+	unsigned char *type;	// fluid, solid or dirichlet cell
+	unsigned char *diag;	// number of neighbors that aren't solid
+	float *x, *b, *r;		// solution, right hand side, residual
+};
+
 class FLUID_3D  
 {
 	public:
@@ -144,6 +161,23 @@ class FLUID_3D
 		// CG fields
 		int _iterations;
 
+		// pressure solve, kept across steps
+		float *_pressure;
+		float *_divergence;
+		float *_residual;
+		float *_direction;
+		float *_q;
+		float *_h;
+		double *_slabSums;
+		MG_LEVEL *_mgLevels;
+		int _mgTotLevels;
+
+		// active tiles, recomputed every step
+		unsigned char *_tileActive;
+		unsigned char *_tileTemp;
+		Vec3Int _tileRes;
+		void updateActiveTiles();
+
 		// simulation constants
 		float _dt;
 		float *_dtFactor;
@@ -187,6 +221,11 @@ class FLUID_3D
 		void diffuseColor();
 		void solvePressure(float* field, float* b, unsigned char* skip);
 		void solvePressurePre(float* field, float* b, unsigned char* skip);
+		void solvePressureMG(float* field, float* b, unsigned char* skip);
+		void initMultigrid();
+		void freeMultigrid();
+		void buildMultigrid(unsigned char* skip);
+		void vCycleMultigrid();
 		void solveHeat(float* field, float* b, unsigned char* skip);
 		void solveDiffusion(float* field, float* b, float* factor);
 
@@ -231,12 +270,13 @@ class FLUID_3D
 		
 
 		// static advection functions, also used by WTURBULENCE
+		// tiles is the active tile mask, inactive cells keep their old value (NULL for all active)
 		static void advectFieldSemiLagrange(const float dt, const float* velx, const float* vely,  const float* velz,
-				float* oldField, float* newField, Vec3Int res, int zBegin, int zEnd);
+				float* oldField, float* newField, Vec3Int res, int zBegin, int zEnd, const unsigned char* tiles = NULL);
 		static void advectFieldMacCormack1(const float dt, const float* xVelocity, const float* yVelocity, const float* zVelocity, 
-				float* oldField, float* tempResult, Vec3Int res, int zBegin, int zEnd);
+				float* oldField, float* tempResult, Vec3Int res, int zBegin, int zEnd, const unsigned char* tiles = NULL);
 		static void advectFieldMacCormack2(const float dt, const float* xVelocity, const float* yVelocity, const float* zVelocity, 
-				float* oldField, float* newField, float* tempResult, float* temp1,Vec3Int res, const unsigned char* obstacles, int zBegin, int zEnd);
+				float* oldField, float* newField, float* tempResult, float* temp1,Vec3Int res, const unsigned char* obstacles, int zBegin, int zEnd, const unsigned char* tiles = NULL);
 
 
 		// temp ones for testing
@@ -247,9 +287,17 @@ class FLUID_3D
 
 		// maccormack helper functions
 		static void clampExtrema(const float dt, const float* xVelocity, const float* yVelocity,  const float* zVelocity,
-				float* oldField, float* newField, Vec3Int res, int zBegin, int zEnd);
+				float* oldField, float* newField, Vec3Int res, int zBegin, int zEnd, const unsigned char* tiles = NULL);
 		static void clampOutsideRays(const float dt, const float* xVelocity, const float* yVelocity,  const float* zVelocity,
-				float* oldField, float* newField, Vec3Int res, const unsigned char* obstacles, const float *oldAdvection, int zBegin, int zEnd);
+				float* oldField, float* newField, Vec3Int res, const unsigned char* obstacles, const float *oldAdvection, int zBegin, int zEnd, const unsigned char* tiles = NULL);
+
+		// row of the tile mask containing cells (y, z), NULL if tiles is NULL
+		static inline const unsigned char *tileRow(const unsigned char* tiles, Vec3Int res, int y, int z) {
+			if (!tiles) return NULL;
+			const int txRes = (res[0] + TILE_SIZE - 1) >> TILE_SHIFT;
+			const int tyRes = (res[1] + TILE_SIZE - 1) >> TILE_SHIFT;
+			return tiles + ((z >> TILE_SHIFT) * tyRes + (y >> TILE_SHIFT)) * txRes;
+		};
 
 
 
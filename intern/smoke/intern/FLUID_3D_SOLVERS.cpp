@@ -326,3 +326,560 @@ void FLUID_3D::solvePressurePre(float* field, float* b, unsigned char* skip)
 	if (_direction) delete[] _direction;
 	if (_q)       delete[] _q;
 }
+
+//////////////////////////////////////////////////////////////////////
+// Multigrid preconditioned CG for the pressure
+//
+// Same operator as solvePressurePre(), but preconditioned with one
+// V-cycle on a hierarchy of coarser grids, so the iteration count
+// stays about the same with growing resolution. Every grid has a ring
+// of border cells like the simulation grid, interior coarse cell i
+// covers the fine cells 2i-1 and 2i. Coarse cells touching a dirichlet
+// (open border) cell are dirichlet, else fluid if any child is fluid.
+// All loops are split over z-slabs, sums are done per slab and added
+// in order so the result doesn't depend on the number of threads.
+//////////////////////////////////////////////////////////////////////
+
+#define MG_CELL_SOLID		0
+#define MG_CELL_FLUID		1
+#define MG_CELL_DIRICHLET	2
+
+// stop coarsening when no dimension has more than this many interior cells
+#define MG_COARSEST_RES		4
+// red-black sweeps before and after the coarse correction
+#define MG_SMOOTH_SWEEPS	2
+#define MG_COARSEST_SWEEPS	32
+
+void FLUID_3D::initMultigrid()
+{
+	_pressure	= new float[_totalCells];
+	_divergence	= new float[_totalCells];
+	_residual	= new float[_totalCells];
+	_direction	= new float[_totalCells];
+	_q			= new float[_totalCells];
+	_h			= new float[_totalCells];
+	_slabSums	= new double[_zRes];
+
+	memset(_residual, 0, sizeof(float)*_totalCells);
+	memset(_direction, 0, sizeof(float)*_totalCells);
+	memset(_q, 0, sizeof(float)*_totalCells);
+	memset(_h, 0, sizeof(float)*_totalCells);
+
+	// count levels
+	int res[3] = {_xRes - 2, _yRes - 2, _zRes - 2};
+	_mgTotLevels = 1;
+	while (res[0] > MG_COARSEST_RES || res[1] > MG_COARSEST_RES || res[2] > MG_COARSEST_RES) {
+		for (int i = 0; i < 3; i++)
+			res[i] = (res[i] + 1) / 2;
+		_mgTotLevels++;
+	}
+
+	_mgLevels = new MG_LEVEL[_mgTotLevels];
+
+	for (int l = 0; l < _mgTotLevels; l++) {
+		MG_LEVEL *level = &_mgLevels[l];
+
+		if (l == 0) {
+			level->xRes = _xRes;
+			level->yRes = _yRes;
+			level->zRes = _zRes;
+			level->invScale = 1.0f;
+		}
+		else {
+			MG_LEVEL *fine = &_mgLevels[l - 1];
+			level->xRes = (fine->xRes - 2 + 1) / 2 + 2;
+			level->yRes = (fine->yRes - 2 + 1) / 2 + 2;
+			level->zRes = (fine->zRes - 2 + 1) / 2 + 2;
+			level->invScale = fine->invScale * 2.0f;
+		}
+		level->slabSize = level->xRes * level->yRes;
+		level->totalCells = (size_t)level->slabSize * level->zRes;
+
+		level->type = new unsigned char[level->totalCells];
+		level->diag = new unsigned char[level->totalCells];
+		memset(level->diag, 0, level->totalCells);
+
+		// the finest level works on the CG vectors directly
+		level->x = (l == 0) ? NULL : new float[level->totalCells];
+		level->b = (l == 0) ? NULL : new float[level->totalCells];
+		level->r = new float[level->totalCells];
+
+		if (l != 0) {
+			memset(level->x, 0, sizeof(float)*level->totalCells);
+			memset(level->b, 0, sizeof(float)*level->totalCells);
+		}
+		memset(level->r, 0, sizeof(float)*level->totalCells);
+	}
+}
+
+void FLUID_3D::freeMultigrid()
+{
+	if (_pressure) delete[] _pressure;
+	if (_divergence) delete[] _divergence;
+	if (_residual) delete[] _residual;
+	if (_direction) delete[] _direction;
+	if (_q) delete[] _q;
+	if (_h) delete[] _h;
+	if (_slabSums) delete[] _slabSums;
+
+	for (int l = 0; l < _mgTotLevels; l++) {
+		MG_LEVEL *level = &_mgLevels[l];
+
+		delete[] level->type;
+		delete[] level->diag;
+		delete[] level->r;
+
+		// the finest level points to the CG vectors
+		if (l != 0) {
+			delete[] level->x;
+			delete[] level->b;
+		}
+	}
+	delete[] _mgLevels;
+}
+
+// children of coarse cell i along one axis, fine resolution n (with border ring)
+static inline void mgChildren(int i, int coarseRes, int n, int *first, int *last)
+{
+	if (i == 0) {
+		*first = *last = 0;
+	}
+	else if (i == coarseRes - 1) {
+		*first = *last = n - 1;
+	}
+	else {
+		*first = 2 * i - 1;
+		*last = (2 * i < n - 1) ? 2 * i : 2 * i - 1;
+	}
+}
+
+// sets the number of non solid neighbors of the interior fluid cells
+static void mgBuildDiagonal(MG_LEVEL *level)
+{
+	const int xRes = level->xRes, slabSize = level->slabSize;
+	const unsigned char *type = level->type;
+
+#if PARALLEL==1
+	#pragma omp parallel for schedule(static)
+#endif
+	for (int z = 1; z < level->zRes - 1; z++)
+	{
+		size_t index = (size_t)z * slabSize + xRes + 1;
+		for (int y = 1; y < level->yRes - 1; y++, index += 2)
+			for (int x = 1; x < xRes - 1; x++, index++)
+			{
+				unsigned char diag = 0;
+
+				if (type[index] == MG_CELL_FLUID) {
+					if (type[index + 1] != MG_CELL_SOLID) diag++;
+					if (type[index - 1] != MG_CELL_SOLID) diag++;
+					if (type[index + xRes] != MG_CELL_SOLID) diag++;
+					if (type[index - xRes] != MG_CELL_SOLID) diag++;
+					if (type[index + slabSize] != MG_CELL_SOLID) diag++;
+					if (type[index - slabSize] != MG_CELL_SOLID) diag++;
+				}
+				level->diag[index] = diag;
+			}
+	}
+}
+
+// cell types of all levels from the obstacles, redone every step for moving obstacles
+void FLUID_3D::buildMultigrid(unsigned char* skip)
+{
+	MG_LEVEL *level = &_mgLevels[0];
+
+#if PARALLEL==1
+	#pragma omp parallel for schedule(static)
+#endif
+	for (int z = 0; z < _zRes; z++)
+	{
+		size_t index = (size_t)z * _slabSize;
+		for (int y = 0; y < _yRes; y++)
+			for (int x = 0; x < _xRes; x++, index++)
+			{
+				const bool border = (x == 0 || y == 0 || z == 0 || x == _xRes - 1 || y == _yRes - 1 || z == _zRes - 1);
+
+				if (skip[index])
+					level->type[index] = MG_CELL_SOLID;
+				else
+					level->type[index] = border ? MG_CELL_DIRICHLET : MG_CELL_FLUID;
+			}
+	}
+	mgBuildDiagonal(level);
+
+	for (int l = 1; l < _mgTotLevels; l++) {
+		MG_LEVEL *fine = &_mgLevels[l - 1];
+		level = &_mgLevels[l];
+
+#if PARALLEL==1
+		#pragma omp parallel for schedule(static)
+#endif
+		for (int z = 0; z < level->zRes; z++)
+		{
+			int z0, z1, y0, y1, x0, x1;
+			mgChildren(z, level->zRes, fine->zRes, &z0, &z1);
+
+			for (int y = 0; y < level->yRes; y++) {
+				mgChildren(y, level->yRes, fine->yRes, &y0, &y1);
+
+				for (int x = 0; x < level->xRes; x++) {
+					unsigned char type = MG_CELL_SOLID;
+					mgChildren(x, level->xRes, fine->xRes, &x0, &x1);
+
+					for (int k = z0; k <= z1; k++)
+						for (int j = y0; j <= y1; j++)
+							for (int i = x0; i <= x1; i++) {
+								unsigned char child = fine->type[(size_t)k * fine->slabSize + j * fine->xRes + i];
+
+								if (child == MG_CELL_DIRICHLET)
+									type = MG_CELL_DIRICHLET;
+								else if (child == MG_CELL_FLUID && type == MG_CELL_SOLID)
+									type = MG_CELL_FLUID;
+							}
+
+					level->type[(size_t)z * level->slabSize + y * level->xRes + x] = type;
+				}
+			}
+		}
+		mgBuildDiagonal(level);
+	}
+}
+
+// one red-black Gauss-Seidel half sweep, color is 0 (red) or 1 (black)
+static void mgSmooth(MG_LEVEL *level, float *x, const float *b, int color)
+{
+	const int xRes = level->xRes, slabSize = level->slabSize;
+	const unsigned char *type = level->type;
+
+#if PARALLEL==1
+	#pragma omp parallel for schedule(static)
+#endif
+	for (int z = 1; z < level->zRes - 1; z++)
+		for (int y = 1; y < level->yRes - 1; y++)
+		{
+			int i = 1 + ((1 + y + z + color) & 1);
+			size_t index = (size_t)z * slabSize + y * xRes + i;
+
+			for (; i < xRes - 1; i += 2, index += 2)
+			{
+				if (!level->diag[index])
+					continue;
+
+				// dirichlet neighbors are zero
+				float sum = b[index] * level->invScale;
+				if (type[index + 1] == MG_CELL_FLUID) sum += x[index + 1];
+				if (type[index - 1] == MG_CELL_FLUID) sum += x[index - 1];
+				if (type[index + xRes] == MG_CELL_FLUID) sum += x[index + xRes];
+				if (type[index - xRes] == MG_CELL_FLUID) sum += x[index - xRes];
+				if (type[index + slabSize] == MG_CELL_FLUID) sum += x[index + slabSize];
+				if (type[index - slabSize] == MG_CELL_FLUID) sum += x[index - slabSize];
+
+				x[index] = sum / (float)level->diag[index];
+			}
+		}
+}
+
+// r = b - Ax
+static void mgResidual(MG_LEVEL *level, const float *x, const float *b)
+{
+	const int xRes = level->xRes, slabSize = level->slabSize;
+	const unsigned char *type = level->type;
+	const float scale = 1.0f / level->invScale;
+
+#if PARALLEL==1
+	#pragma omp parallel for schedule(static)
+#endif
+	for (int z = 1; z < level->zRes - 1; z++)
+	{
+		size_t index = (size_t)z * slabSize + xRes + 1;
+		for (int y = 1; y < level->yRes - 1; y++, index += 2)
+			for (int i = 1; i < xRes - 1; i++, index++)
+			{
+				if (!level->diag[index]) {
+					level->r[index] = 0.0f;
+					continue;
+				}
+
+				float Ax = level->diag[index] * x[index];
+				if (type[index + 1] == MG_CELL_FLUID) Ax -= x[index + 1];
+				if (type[index - 1] == MG_CELL_FLUID) Ax -= x[index - 1];
+				if (type[index + xRes] == MG_CELL_FLUID) Ax -= x[index + xRes];
+				if (type[index - xRes] == MG_CELL_FLUID) Ax -= x[index - xRes];
+				if (type[index + slabSize] == MG_CELL_FLUID) Ax -= x[index + slabSize];
+				if (type[index - slabSize] == MG_CELL_FLUID) Ax -= x[index - slabSize];
+
+				level->r[index] = b[index] - scale * Ax;
+			}
+	}
+}
+
+// coarse right hand side is the average residual of the children
+static void mgRestrict(MG_LEVEL *fine, MG_LEVEL *coarse)
+{
+#if PARALLEL==1
+	#pragma omp parallel for schedule(static)
+#endif
+	for (int z = 1; z < coarse->zRes - 1; z++)
+	{
+		int z0, z1, y0, y1, x0, x1;
+		mgChildren(z, coarse->zRes, fine->zRes, &z0, &z1);
+
+		for (int y = 1; y < coarse->yRes - 1; y++) {
+			mgChildren(y, coarse->yRes, fine->yRes, &y0, &y1);
+
+			for (int x = 1; x < coarse->xRes - 1; x++) {
+				size_t index = (size_t)z * coarse->slabSize + y * coarse->xRes + x;
+				float sum = 0.0f;
+
+				mgChildren(x, coarse->xRes, fine->xRes, &x0, &x1);
+
+				if (coarse->diag[index]) {
+					for (int k = z0; k <= z1; k++)
+						for (int j = y0; j <= y1; j++)
+							for (int i = x0; i <= x1; i++)
+								sum += fine->r[(size_t)k * fine->slabSize + j * fine->xRes + i];
+				}
+
+				coarse->b[index] = 0.125f * sum;
+				coarse->x[index] = 0.0f;
+			}
+		}
+	}
+}
+
+// add the coarse correction to the fine fluid cells
+static void mgProlongate(MG_LEVEL *coarse, MG_LEVEL *fine, float *x)
+{
+#if PARALLEL==1
+	#pragma omp parallel for schedule(static)
+#endif
+	for (int z = 1; z < fine->zRes - 1; z++)
+	{
+		const size_t coarseZ = (size_t)((z + 1) / 2) * coarse->slabSize;
+		size_t index = (size_t)z * fine->slabSize + fine->xRes + 1;
+
+		for (int y = 1; y < fine->yRes - 1; y++, index += 2) {
+			const size_t coarseY = coarseZ + ((y + 1) / 2) * coarse->xRes;
+
+			for (int i = 1; i < fine->xRes - 1; i++, index++) {
+				if (fine->diag[index])
+					x[index] += coarse->x[coarseY + (i + 1) / 2];
+			}
+		}
+	}
+}
+
+// _h = M^-1 _residual with one V-cycle. Smoothing after the coarse
+// correction runs the colors in reverse order, which keeps the
+// preconditioner symmetric as CG needs it.
+void FLUID_3D::vCycleMultigrid()
+{
+	_mgLevels[0].x = _h;
+	_mgLevels[0].b = _residual;
+
+	memset(_h, 0, sizeof(float)*_totalCells);
+
+	for (int l = 0; l < _mgTotLevels - 1; l++) {
+		MG_LEVEL *level = &_mgLevels[l];
+
+		for (int s = 0; s < MG_SMOOTH_SWEEPS; s++) {
+			mgSmooth(level, level->x, level->b, 0);
+			mgSmooth(level, level->x, level->b, 1);
+		}
+		mgResidual(level, level->x, level->b);
+		mgRestrict(level, &_mgLevels[l + 1]);
+	}
+
+	MG_LEVEL *coarsest = &_mgLevels[_mgTotLevels - 1];
+	for (int s = 0; s < MG_COARSEST_SWEEPS; s++) {
+		mgSmooth(coarsest, coarsest->x, coarsest->b, 0);
+		mgSmooth(coarsest, coarsest->x, coarsest->b, 1);
+		mgSmooth(coarsest, coarsest->x, coarsest->b, 1);
+		mgSmooth(coarsest, coarsest->x, coarsest->b, 0);
+	}
+
+	for (int l = _mgTotLevels - 2; l >= 0; l--) {
+		MG_LEVEL *level = &_mgLevels[l];
+
+		mgProlongate(&_mgLevels[l + 1], level, level->x);
+
+		for (int s = 0; s < MG_SMOOTH_SWEEPS; s++) {
+			mgSmooth(level, level->x, level->b, 1);
+			mgSmooth(level, level->x, level->b, 0);
+		}
+	}
+}
+
+void FLUID_3D::solvePressureMG(float* field, float* b, unsigned char* skip)
+{
+	const MG_LEVEL *level = &_mgLevels[0];
+	const unsigned char *type = level->type;
+	const unsigned char *diag = level->diag;
+	const float eps = SOLVER_ACCURACY;
+	double deltaNew = 0.0;
+	float maxR = 0.0f;
+	int i = 0;
+
+	buildMultigrid(skip);
+
+	// r = b - Ax
+#if PARALLEL==1
+	#pragma omp parallel for schedule(static)
+#endif
+	for (int z = 1; z < _zRes - 1; z++)
+	{
+		size_t index = (size_t)z * _slabSize + _xRes + 1;
+		for (int y = 1; y < _yRes - 1; y++, index += 2)
+			for (int x = 1; x < _xRes - 1; x++, index++)
+			{
+				if (type[index] != MG_CELL_FLUID) {
+					_residual[index] = 0.0f;
+					continue;
+				}
+
+				// non solid border cells keep their value
+				float Ax = diag[index] * field[index];
+				if (!skip[index + 1]) Ax -= field[index + 1];
+				if (!skip[index - 1]) Ax -= field[index - 1];
+				if (!skip[index + _xRes]) Ax -= field[index + _xRes];
+				if (!skip[index - _xRes]) Ax -= field[index - _xRes];
+				if (!skip[index + _slabSize]) Ax -= field[index + _slabSize];
+				if (!skip[index - _slabSize]) Ax -= field[index - _slabSize];
+
+				_residual[index] = b[index] - Ax;
+			}
+	}
+
+	// p = M^-1 r
+	vCycleMultigrid();
+	memcpy(_direction, _h, sizeof(float)*_totalCells);
+
+	// deltaNew = r^T p, maxR measured like the jacobi preconditioned solver
+#if PARALLEL==1
+	#pragma omp parallel for schedule(static)
+#endif
+	for (int z = 1; z < _zRes - 1; z++)
+	{
+		size_t index = (size_t)z * _slabSize + _xRes + 1;
+		double sum = 0.0;
+		for (int y = 1; y < _yRes - 1; y++, index += 2)
+			for (int x = 1; x < _xRes - 1; x++, index++)
+				sum += _residual[index] * _h[index];
+		_slabSums[z] = sum;
+	}
+	for (int z = 1; z < _zRes - 1; z++)
+		deltaNew += _slabSums[z];
+
+	for (size_t index = 0; index < _totalCells; index++) {
+		if (diag[index]) {
+			float tmp = _residual[index] * _residual[index] / diag[index];
+			maxR = (tmp > maxR) ? tmp : maxR;
+		}
+	}
+
+	while ((i < _iterations) && (maxR > 0.001*eps))
+	{
+		double alpha = 0.0;
+
+		// q = Ad, alpha = d^T q
+#if PARALLEL==1
+		#pragma omp parallel for schedule(static)
+#endif
+		for (int z = 1; z < _zRes - 1; z++)
+		{
+			size_t index = (size_t)z * _slabSize + _xRes + 1;
+			double sum = 0.0;
+			for (int y = 1; y < _yRes - 1; y++, index += 2)
+				for (int x = 1; x < _xRes - 1; x++, index++)
+				{
+					if (type[index] != MG_CELL_FLUID) {
+						_q[index] = 0.0f;
+						continue;
+					}
+
+					float Ad = diag[index] * _direction[index];
+					if (type[index + 1] == MG_CELL_FLUID) Ad -= _direction[index + 1];
+					if (type[index - 1] == MG_CELL_FLUID) Ad -= _direction[index - 1];
+					if (type[index + _xRes] == MG_CELL_FLUID) Ad -= _direction[index + _xRes];
+					if (type[index - _xRes] == MG_CELL_FLUID) Ad -= _direction[index - _xRes];
+					if (type[index + _slabSize] == MG_CELL_FLUID) Ad -= _direction[index + _slabSize];
+					if (type[index - _slabSize] == MG_CELL_FLUID) Ad -= _direction[index - _slabSize];
+
+					_q[index] = Ad;
+					sum += _direction[index] * Ad;
+				}
+			_slabSums[z] = sum;
+		}
+		for (int z = 1; z < _zRes - 1; z++)
+			alpha += _slabSums[z];
+
+		if (fabs(alpha) > 0.0)
+			alpha = deltaNew / alpha;
+
+		// x = x + alpha * d, r = r - alpha * q
+#if PARALLEL==1
+		#pragma omp parallel for schedule(static)
+#endif
+		for (int z = 1; z < _zRes - 1; z++)
+		{
+			size_t index = (size_t)z * _slabSize + _xRes + 1;
+			float slabMax = 0.0f;
+			for (int y = 1; y < _yRes - 1; y++, index += 2)
+				for (int x = 1; x < _xRes - 1; x++, index++)
+				{
+					if (type[index] != MG_CELL_FLUID)
+						continue;
+
+					field[index] += (float)alpha * _direction[index];
+					_residual[index] -= (float)alpha * _q[index];
+
+					if (diag[index]) {
+						float tmp = _residual[index] * _residual[index] / diag[index];
+						slabMax = (tmp > slabMax) ? tmp : slabMax;
+					}
+				}
+			_slabSums[z] = slabMax;
+		}
+		maxR = 0.0f;
+		for (int z = 1; z < _zRes - 1; z++)
+			maxR = ((float)_slabSums[z] > maxR) ? (float)_slabSums[z] : maxR;
+
+		// h = M^-1 r
+		vCycleMultigrid();
+
+		double deltaOld = deltaNew;
+		deltaNew = 0.0;
+
+#if PARALLEL==1
+		#pragma omp parallel for schedule(static)
+#endif
+		for (int z = 1; z < _zRes - 1; z++)
+		{
+			size_t index = (size_t)z * _slabSize + _xRes + 1;
+			double sum = 0.0;
+			for (int y = 1; y < _yRes - 1; y++, index += 2)
+				for (int x = 1; x < _xRes - 1; x++, index++)
+					sum += _residual[index] * _h[index];
+			_slabSums[z] = sum;
+		}
+		for (int z = 1; z < _zRes - 1; z++)
+			deltaNew += _slabSums[z];
+
+		// d = h + beta * d
+		const float beta = (deltaOld != 0.0) ? (float)(deltaNew / deltaOld) : 0.0f;
+
+#if PARALLEL==1
+		#pragma omp parallel for schedule(static)
+#endif
+		for (int z = 1; z < _zRes - 1; z++)
+		{
+			size_t index = (size_t)z * _slabSize + _xRes + 1;
+			for (int y = 1; y < _yRes - 1; y++, index += 2)
+				for (int x = 1; x < _xRes - 1; x++, index++)
+					_direction[index] = _h[index] + beta * _direction[index];
+		}
+
+		i++;
+	}
+	// cout << i << " iterations converged to " << sqrt(maxR) << endl;
+}
@@ -45,6 +45,10 @@
 
 #include <MERSENNETWISTER.h>
 
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
 #ifdef WIN32
 #include <float.h>
 #define isnan _isnan
@@ -124,6 +128,9 @@ static void downsampleNeumann(const float *from, float *to, int n, int stride)
 	}
 }
 static void downsampleXNeumann(float* to, const float* from, int sx,int sy, int sz) {
+#if PARALLEL==1
+#pragma omp parallel for schedule(static)
+#endif
 	for (int iy = 0; iy < sy; iy++) 
 		for (int iz = 0; iz < sz; iz++) {
 			const int i = iy * sx + iz*sx*sy;
@@ -131,6 +138,9 @@ static void downsampleXNeumann(float* to, const float* from, int sx,int sy, int
 		}
 }
 static void downsampleYNeumann(float* to, const float* from, int sx,int sy, int sz) {
+#if PARALLEL==1
+#pragma omp parallel for schedule(static)
+#endif
 	for (int ix = 0; ix < sx; ix++) 
 		for (int iz = 0; iz < sz; iz++) {
 			const int i = ix + iz*sx*sy;
@@ -138,6 +148,9 @@ static void downsampleYNeumann(float* to, const float* from, int sx,int sy, int
     }
 }
 static void downsampleZNeumann(float* to, const float* from, int sx,int sy, int sz) {
+#if PARALLEL==1
+#pragma omp parallel for schedule(static)
+#endif
 	for (int ix = 0; ix < sx; ix++) 
 		for (int iy = 0; iy < sy; iy++) {
 			const int i = ix + iy*sx;
@@ -196,6 +209,9 @@ static void upsampleNeumann(const float *from, float *to, int n, int stride) {
 	}
 }
 static void upsampleXNeumann(float* to, const float* from, int sx, int sy, int sz) {
+#if PARALLEL==1
+#pragma omp parallel for schedule(static)
+#endif
 	for (int iy = 0; iy < sy; iy++) 
 		for (int iz = 0; iz < sz; iz++) {
 			const int i = iy * sx + iz*sx*sy;
@@ -203,6 +219,9 @@ static void upsampleXNeumann(float* to, const float* from, int sx, int sy, int s
 		}
 }
 static void upsampleYNeumann(float* to, const float* from, int sx, int sy, int sz) {
+#if PARALLEL==1
+#pragma omp parallel for schedule(static)
+#endif
 	for (int ix = 0; ix < sx; ix++) 
 		for (int iz = 0; iz < sz; iz++) {
 			const int i = ix + iz*sx*sy;
@@ -210,6 +229,9 @@ static void upsampleYNeumann(float* to, const float* from, int sx, int sy, int s
 		}
 }
 static void upsampleZNeumann(float* to, const float* from, int sx, int sy, int sz) {
+#if PARALLEL==1
+#pragma omp parallel for schedule(static)
+#endif
 	for (int ix = 0; ix < sx; ix++) 
 		for (int iy = 0; iy < sy; iy++) {
 			const int i = ix + iy*sx;
@@ -513,5 +535,83 @@ static inline float WNoiseDz(Vec3 p, float* data) {
   return result;
 }
 
+//////////////////////////////////////////////////////////////////////////////////////////
+// x, y and z derivatives of noise in one pass, they read the same
+// 27 samples and only differ in the weights
+//////////////////////////////////////////////////////////////////////////////////////////
+static inline void WNoiseGrad(Vec3 p, float* data, float grad[3]) { 
+  const int n = noiseTileSize;
+  int mid[3];
+  float w[3][3], d[3][3];
+
+  // quadratic b-spline weights and their derivatives
+  for (int i = 0; i < 3; i++) {
+    mid[i] = (int)ceil(p[i] - 0.5); 
+    const float t = mid[i] - (p[i] - 0.5);
+    w[i][0] = t * t / 2; 
+    w[i][2] = (1 - t) * (1 - t) / 2;
+    w[i][1] = 1 - w[i][0] - w[i][2];
+    d[i][0] = -t;
+    d[i][2] = (1.f - t);
+    d[i][1] = 2.0f * t - 1.0f;
+  }
+
+  const int c0[3] = { modFast128(mid[0] - 1), modFast128(mid[0]), modFast128(mid[0] + 1) };
+
+#ifdef __SSE__
+  // lanes hold the x, y and z derivative
+  const __m128 wx[3] = {
+    _mm_setr_ps(d[0][0], w[0][0], w[0][0], 0.0f),
+    _mm_setr_ps(d[0][1], w[0][1], w[0][1], 0.0f),
+    _mm_setr_ps(d[0][2], w[0][2], w[0][2], 0.0f) };
+  __m128 result = _mm_setzero_ps();
+
+  for (int z = 0; z < 3; z++) {
+    const float *slab = data + modFast128(mid[2] + z - 1) * n * n;
+    __m128 sumy = _mm_setzero_ps();
+
+    for (int y = 0; y < 3; y++) {
+      const float *row = slab + modFast128(mid[1] + y - 1) * n;
+      __m128 sumx = _mm_mul_ps(wx[0], _mm_set1_ps(row[c0[0]]));
+      sumx = _mm_add_ps(sumx, _mm_mul_ps(wx[1], _mm_set1_ps(row[c0[1]])));
+      sumx = _mm_add_ps(sumx, _mm_mul_ps(wx[2], _mm_set1_ps(row[c0[2]])));
+      sumy = _mm_add_ps(sumy, _mm_mul_ps(_mm_setr_ps(w[1][y], d[1][y], w[1][y], 0.0f), sumx));
+    }
+    result = _mm_add_ps(result, _mm_mul_ps(_mm_setr_ps(w[2][z], w[2][z], d[2][z], 0.0f), sumy));
+  }
+
+  float r[4];
+  _mm_storeu_ps(r, result);
+  grad[0] = r[0];
+  grad[1] = r[1];
+  grad[2] = r[2];
+#else
+  grad[0] = grad[1] = grad[2] = 0.0f;
+
+  for (int z = 0; z < 3; z++) {
+    const float *slab = data + modFast128(mid[2] + z - 1) * n * n;
+    float sumy[3] = { 0.0f, 0.0f, 0.0f };
+
+    for (int y = 0; y < 3; y++) {
+      const float *row = slab + modFast128(mid[1] + y - 1) * n;
+      float sumx[3] = { 0.0f, 0.0f, 0.0f };
+
+      for (int x = 0; x < 3; x++) {
+        const float value = row[c0[x]];
+        sumx[0] += d[0][x] * value;
+        sumx[1] += w[0][x] * value;
+        sumx[2] += w[0][x] * value;
+      }
+      sumy[0] += w[1][y] * sumx[0];
+      sumy[1] += d[1][y] * sumx[1];
+      sumy[2] += w[1][y] * sumx[2];
+    }
+    grad[0] += w[2][z] * sumy[0];
+    grad[1] += w[2][z] * sumy[1];
+    grad[2] += d[2][z] * sumy[2];
+  }
+#endif
+}
+
 #endif
 
@@ -351,6 +351,58 @@ static float minDz(int x, int y, int z, float* input, Vec3Int res)
   return finalD;
 }
 
+//////////////////////////////////////////////////////////////////////
+// MacCormack advection of one texture coordinate, split in z-slabs
+//////////////////////////////////////////////////////////////////////
+static void advectTextureCoordinate(float dtOrg, float* xvel, float* yvel, float* zvel,
+    float *oldField, float *newField, float *tempBig1, float *tempBig2, Vec3Int res)
+{
+  FLUID_3D::copyBorderX(oldField, res, 0 , res[2]);
+  FLUID_3D::copyBorderY(oldField, res, 0 , res[2]);
+  FLUID_3D::copyBorderZ(oldField, res, 0 , res[2]);
+
+#if PARALLEL==1
+  const int threadval = omp_get_max_threads();
+  int stepParts = threadval*2;
+  float partSize = (float)res[2]/stepParts;
+
+  if (partSize < 4) {stepParts = threadval;
+          partSize = (float)res[2]/stepParts;}
+  if (partSize < 4) {stepParts = (int)(ceil((float)res[2]/4.0f));
+          partSize = (float)res[2]/stepParts;}
+
+#pragma omp parallel
+  {
+#pragma omp for schedule(static,1)
+  for (int i=0; i<stepParts; i++)
+  {
+    int zBegin = (int)((float)i*partSize + 0.5f);
+    int zEnd = (int)((float)(i+1)*partSize + 0.5f);
+#else
+    int zBegin=0;
+    int zEnd=res[2];
+#endif
+    FLUID_3D::advectFieldMacCormack1(dtOrg, xvel, yvel, zvel, 
+        oldField, tempBig1, res, zBegin, zEnd);
+#if PARALLEL==1
+  }
+
+#pragma omp barrier
+
+#pragma omp for schedule(static,1)
+  for (int i=0; i<stepParts; i++)
+  {
+    int zBegin = (int)((float)i*partSize + 0.5f);
+    int zEnd = (int)((float)(i+1)*partSize + 0.5f);
+#endif
+    FLUID_3D::advectFieldMacCormack2(dtOrg, xvel, yvel, zvel, 
+        oldField, newField, tempBig1, tempBig2, res, NULL, zBegin, zEnd);
+#if PARALLEL==1
+  }
+  }
+#endif
+}
+
 //////////////////////////////////////////////////////////////////////
 // handle texture coordinates (advection, reset, eigenvalues), 
 // Beware -- uses big density maccormack as temporary arrays
@@ -359,42 +411,23 @@ void WTURBULENCE::advectTextureCoordinates (float dtOrg, float* xvel, float* yve
 
   // advection
   SWAP_POINTERS(_tcTemp, _tcU);
-  FLUID_3D::copyBorderX(_tcTemp, _resSm, 0 , _resSm[2]);
-  FLUID_3D::copyBorderY(_tcTemp, _resSm, 0 , _resSm[2]);
-  FLUID_3D::copyBorderZ(_tcTemp, _resSm, 0 , _resSm[2]);
-  FLUID_3D::advectFieldMacCormack1(dtOrg, xvel, yvel, zvel, 
-      _tcTemp, tempBig1, _resSm, 0 , _resSm[2]);
-  FLUID_3D::advectFieldMacCormack2(dtOrg, xvel, yvel, zvel, 
-      _tcTemp, _tcU, tempBig1, tempBig2, _resSm, NULL, 0 , _resSm[2]);
+  advectTextureCoordinate(dtOrg, xvel, yvel, zvel, _tcTemp, _tcU, tempBig1, tempBig2, _resSm);
 
   SWAP_POINTERS(_tcTemp, _tcV);
-  FLUID_3D::copyBorderX(_tcTemp, _resSm, 0 , _resSm[2]);
-  FLUID_3D::copyBorderY(_tcTemp, _resSm, 0 , _resSm[2]);
-  FLUID_3D::copyBorderZ(_tcTemp, _resSm, 0 , _resSm[2]);
-  FLUID_3D::advectFieldMacCormack1(dtOrg, xvel, yvel, zvel, 
-      _tcTemp, tempBig1, _resSm, 0 , _resSm[2]);
-  FLUID_3D::advectFieldMacCormack2(dtOrg, xvel, yvel, zvel, 
-      _tcTemp, _tcV, tempBig1, tempBig2, _resSm, NULL, 0 , _resSm[2]);
+  advectTextureCoordinate(dtOrg, xvel, yvel, zvel, _tcTemp, _tcV, tempBig1, tempBig2, _resSm);
 
   SWAP_POINTERS(_tcTemp, _tcW);
-  FLUID_3D::copyBorderX(_tcTemp, _resSm, 0 , _resSm[2]);
-  FLUID_3D::copyBorderY(_tcTemp, _resSm, 0 , _resSm[2]);
-  FLUID_3D::copyBorderZ(_tcTemp, _resSm, 0 , _resSm[2]);
-  FLUID_3D::advectFieldMacCormack1(dtOrg, xvel, yvel, zvel, 
-      _tcTemp, tempBig1, _resSm, 0 , _resSm[2]);
-  FLUID_3D::advectFieldMacCormack2(dtOrg, xvel, yvel, zvel, 
-      _tcTemp, _tcW, tempBig1, tempBig2, _resSm, NULL, 0 , _resSm[2]);
+  advectTextureCoordinate(dtOrg, xvel, yvel, zvel, _tcTemp, _tcW, tempBig1, tempBig2, _resSm);
 }
 
 //////////////////////////////////////////////////////////////////////
 // Compute the eigenvalues of the advected texture
 ////////////////////////////////////////////////////////////////////// 
 void WTURBULENCE::computeEigenvalues(float *_eigMin, float *_eigMax) {
-  // stats
-  float maxeig = -1.;
-  float mineig = 10.;
-
   // texture coordinate eigenvalues
+#if PARALLEL==1
+#pragma omp parallel for schedule(static)
+#endif
   for (int z = 1; z < _zResSm-1; z++) {
     for (int y = 1; y < _yResSm-1; y++) 
       for (int x = 1; x < _xResSm-1; x++)
@@ -419,8 +452,6 @@ void WTURBULENCE::computeEigenvalues(float *_eigMin, float *_eigMax) {
           computeEigenvalues3x3( &eigenvalues[0], jacobian);
           _eigMax[index] = MAX3V(eigenvalues);
           _eigMin[index] = MIN3V(eigenvalues);
-          maxeig = MAX(_eigMax[index],maxeig);
-          mineig = MIN(_eigMin[index],mineig);
         }
         else
         {
@@ -446,6 +477,9 @@ void WTURBULENCE::resetTextureCoordinates(float *_eigMin, float *_eigMax)
   const float dy = 1./(float)(_resSm[1]);
   const float dz = 1./(float)(_resSm[2]);
 
+#if PARALLEL==1
+#pragma omp parallel for schedule(static) reduction(+:resets)
+#endif
   for (int z = 1; z < _zResSm-1; z++)
     for (int y = 1; y < _yResSm-1; y++)
       for (int x = 1; x < _xResSm-1; x++)
@@ -484,9 +518,12 @@ void WTURBULENCE::decomposeEnergy(float *_energy, float *_highFreqEnergy)
 
   // subtract the down and upsampled field from the original field -- 
   // what should be left over is solely the high frequency component
-	int index = 0;
+#if PARALLEL==1
+#pragma omp parallel for schedule(static)
+#endif
   for (int z = 0; z < _zResSm; z++) 
     for (int y = 0; y < _yResSm; y++) {
+      int index = y * _xResSm + z * _slabSizeSm;
       for (int x = 0; x < _xResSm; x++, index++) {
         // brute force reset of boundaries
         if(z >= _zResSm - 1 || x >= _xResSm - 1 || y >= _yResSm - 1 || z <= 0 || y <= 0 || x <= 0) 
@@ -507,6 +544,9 @@ void WTURBULENCE::computeEnergy(float *_energy, float* xvel, float* yvel, float*
   memcpy(obstacles, origObstacles, sizeof(unsigned char) * _totalCellsSm);
 
   // compute everywhere
+#if PARALLEL==1
+#pragma omp parallel for schedule(static)
+#endif
   for (int x = 0; x < _totalCellsSm; x++) 
     _energy[x] = 0.5f * (xvel[x] * xvel[x] + yvel[x] * yvel[x] + zvel[x] * zvel[x]);
 
@@ -594,14 +634,19 @@ Vec3 WTURBULENCE::WVelocity(Vec3 orgPos)
   const Vec3 p2 = orgPos + Vec3(0,NOISE_TILE_SIZE/2.0,0);
   const Vec3 p3 = orgPos + Vec3(0,0,NOISE_TILE_SIZE/2.0);
 
-  const float f1y = WNoiseDy(p1, _noiseTile);
-  const float f1z = WNoiseDz(p1, _noiseTile);
+  float g1[3], g2[3], g3[3];
+  WNoiseGrad(p1, _noiseTile, g1);
+  WNoiseGrad(p2, _noiseTile, g2);
+  WNoiseGrad(p3, _noiseTile, g3);
+
+  const float f1y = g1[1];
+  const float f1z = g1[2];
 
-  const float f2x = WNoiseDx(p2, _noiseTile);
-  const float f2z = WNoiseDz(p2, _noiseTile);
+  const float f2x = g2[0];
+  const float f2z = g2[2];
 
-  const float f3x = WNoiseDx(p3, _noiseTile);
-  const float f3y = WNoiseDy(p3, _noiseTile);
+  const float f3x = g3[0];
+  const float f3y = g3[1];
 
   Vec3 ret = Vec3( 
       f3y - f2z,
@@ -621,23 +666,17 @@ Vec3 WTURBULENCE::WVelocityWithJacobian(Vec3 orgPos, float* xUnwarped, float* yU
   const Vec3 p3 = orgPos + Vec3(0,0,NOISE_TILE_SIZE/2.0);
 
   Vec3 final;
-  final[0] = WNoiseDx(p1, _noiseTile);
-  final[1] = WNoiseDy(p1, _noiseTile);
-  final[2] = WNoiseDz(p1, _noiseTile);
+  WNoiseGrad(p1, _noiseTile, &final[0]);
   // UNUSED const float f1x = xUnwarped[0] * final[0] + xUnwarped[1] * final[1] + xUnwarped[2] * final[2];
   const float f1y = yUnwarped[0] * final[0] + yUnwarped[1] * final[1] + yUnwarped[2] * final[2];
   const float f1z = zUnwarped[0] * final[0] + zUnwarped[1] * final[1] + zUnwarped[2] * final[2];
 
-  final[0] = WNoiseDx(p2, _noiseTile);
-  final[1] = WNoiseDy(p2, _noiseTile);
-  final[2] = WNoiseDz(p2, _noiseTile);
+  WNoiseGrad(p2, _noiseTile, &final[0]);
   const float f2x = xUnwarped[0] * final[0] + xUnwarped[1] * final[1] + xUnwarped[2] * final[2];
   // UNUSED const float f2y = yUnwarped[0] * final[0] + yUnwarped[1] * final[1] + yUnwarped[2] * final[2];
   const float f2z = zUnwarped[0] * final[0] + zUnwarped[1] * final[1] + zUnwarped[2] * final[2];
 
-  final[0] = WNoiseDx(p3, _noiseTile);
-  final[1] = WNoiseDy(p3, _noiseTile);
-  final[2] = WNoiseDz(p3, _noiseTile);
+  WNoiseGrad(p3, _noiseTile, &final[0]);
   const float f3x = xUnwarped[0] * final[0] + xUnwarped[1] * final[1] + xUnwarped[2] * final[2];
   const float f3y = yUnwarped[0] * final[0] + yUnwarped[1] * final[1] + yUnwarped[2] * final[2];
   // UNUSED const float f3z = zUnwarped[0] * final[0] + zUnwarped[1] * final[1] + zUnwarped[2] * final[2];
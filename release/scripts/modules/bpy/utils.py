@@ -36,6 +36,7 @@ __all__ = (
     "register_manual_map",
     "unregister_manual_map",
     "manual_map",
+    "memory_alloc_stats",
     "resource_path",
     "script_path_user",
     "script_path_pref",
@@ -48,6 +49,7 @@ __all__ = (
     )
 
 from _bpy import register_class, unregister_class, blend_paths, resource_path
+from _bpy import memory_alloc_stats
 from _bpy import script_paths as _bpy_script_paths
 from _bpy import user_resource as _user_resource
 
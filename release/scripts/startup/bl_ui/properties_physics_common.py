@@ -147,6 +147,7 @@ def point_cache_ui(self, context, cache, enabled, cachetype):
             col = split.column()
             col.active = cache.use_disk_cache
             col.prop(cache, "use_library_path", "Use Lib Path")
+            col.prop(cache, "use_disk_container")
 
             row = layout.row()
             row.enabled = enabled and bpy.data.is_saved
@@ -154,6 +155,15 @@ def point_cache_ui(self, context, cache, enabled, cachetype):
             row.label(text="Compression:")
             row.prop(cache, "compression", expand=True)
 
+            if cachetype == 'PSYS':
+                row = layout.row()
+                row.enabled = enabled and bpy.data.is_saved
+                row.active = cache.use_disk_cache
+                row.prop(cache, "use_quantize")
+                sub = row.row()
+                sub.active = cache.use_disk_cache and cache.use_quantize
+                sub.prop(cache, "quantize_tolerance")
+
         layout.separator()
 
         split = layout.split()
@@ -47,9 +47,13 @@ typedef struct BoidBrainData {
 	float goal_co[3];
 	float goal_nor[3];
 	float goal_priority;
+
+	/* BLI_thread_frand() generator, reseeded for every particle */
+	int thread;
 } BoidBrainData;
 
 void boids_precalc_rules(struct ParticleSettings *part, float cfra);
+int boids_rules_threadsafe(struct BoidSettings *boids);
 void boid_brain(BoidBrainData *bbd, int p, struct ParticleData *pa);
 void boid_body(BoidBrainData *bbd, struct ParticleData *pa);
 void boid_default_settings(BoidSettings *boids);
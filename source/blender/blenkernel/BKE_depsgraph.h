@@ -30,6 +30,8 @@
  *  \ingroup bke
  */
 
+#include "DNA_listBase.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -101,6 +103,19 @@ int    is_acyclic(struct DagForest *dag);
 /* (re)-create dependency graph for scene */
 void    DAG_scene_sort(struct Main *bmain, struct Scene *sce);
 
+/* objects of the scene that don't depend on each other, for parallel updates */
+typedef struct DagIsland {
+	struct DagIsland *next, *prev;
+	ListBase bases;     /* LinkData with Base pointers, in update order */
+	int flag;
+} DagIsland;
+
+/* DagIsland->flag */
+#define DAG_ISLAND_SKIP     1   /* don't update the objects of the island */
+
+int     DAG_scene_islands(struct Scene *sce, ListBase *r_islands);
+void    DAG_islands_free(ListBase *islands);
+
 /* flag all objects that need recalc because they're animated */
 void    DAG_scene_update_flags(struct Main *bmain, struct Scene *sce, unsigned int lay, const short do_time);
 /* flushes all recalc flags in objects down the dependency tree */
@@ -107,6 +107,7 @@ typedef struct EffectorCache {
 
 	float frame;
 	int flag;
+	unsigned int seed;  /* noise seed for the current frame */
 } EffectorCache;
 
 void            free_partdeflect(struct PartDeflect *pd);
@@ -58,9 +58,11 @@ struct LinkNode;
 struct KDTree;
 struct RNG;
 struct SurfaceModifierData;
+struct BVHTree;
 struct BVHTreeRay;
 struct BVHTreeRayHit; 
 struct EdgeHash;
+struct SPHSpringBuffer;
 
 #define PARTICLE_P              ParticleData * pa; int p
 #define LOOP_PARTICLES  for (p = 0, pa = psys->particles; p < psys->totpart; p++, pa++)
@@ -68,6 +70,8 @@ struct EdgeHash;
 #define LOOP_SHOWN_PARTICLES for (p = 0, pa = psys->particles; p < psys->totpart; p++, pa++) if (!(pa->flag & (PARS_UNEXIST | PARS_NO_DISP)))
 /* OpenMP: Can only advance one variable within loop definition. */
 #define LOOP_DYNAMIC_PARTICLES for (p = 0; p < psys->totpart; p++) if ((pa = psys->particles + p)->state.time > 0.0f)
+/* Same, but visits particles in the order given by an index array, needs an extra int i (private to OpenMP threads along with p) */
+#define LOOP_ORDERED_DYNAMIC_PARTICLES(order) for (i = 0; i < psys->totpart; i++) if ((pa = psys->particles + (p = (order)[i]))->state.time > 0.0f)
 
 #define PSYS_FRAND_COUNT    1024
 #define PSYS_FRAND(seed)    psys->frand[(seed) % PSYS_FRAND_COUNT]
@@ -101,11 +105,33 @@ typedef struct SPHData {
 	float element_size;
 	float flow[3];
 
+	/* Thread running the current particle, springs created by it are stored
+	 * in spring_buffers[thread] and added to the system after the loop. */
+	int thread;
+	struct SPHSpringBuffer *spring_buffers;
+
 	/* Integrator callbacks. This allows different SPH implementations. */
 	void (*force_cb) (void *sphdata_v, ParticleKey *state, float *force, float *impulse);
 	void (*density_cb) (void *rangedata_v, int index, float squared_dist);
 } SPHData;
 
+/* Particle state in structure of arrays layout. Newtonian physics integrate
+ * the particles from and into these arrays, the particle tree and hash grid
+ * builders and the point cache writer read them. ParticleData.state is updated
+ * from them as the view for the rest of blender, and the arrays are reloaded
+ * from ParticleData when the state is set elsewhere (cache reads, resets,
+ * emission, other physics types). */
+typedef struct ParticleStateArrays {
+	float (*co)[3];
+	float (*vel)[3];
+	float (*rot)[4];
+	float (*ave)[3];
+	char *alive;        /* alive and shown (not PARS_UNEXIST or PARS_NO_DISP) */
+	int totpart;
+	int valid;
+	float cfra;         /* time of the stored state */
+} ParticleStateArrays;
+
 typedef struct ParticleTexture {
 	float ivel;                           /* used in reset */
 	float time, life, exist, size;        /* used in init */
@@ -229,6 +255,8 @@ typedef struct ParticleCollision {
 	float acc[3], boid_z;
 
 	int boid;
+
+	int thread;  /* BLI_thread_frand() generator for random damping, friction and permeability */
 } ParticleCollision;
 
 typedef struct ParticleDrawData {
@@ -355,6 +383,9 @@ float psys_get_dietime_from_cache(struct PointCache *cache, int index);
 
 void psys_free_pdd(struct ParticleSystem *psys);
 
+struct ParticleStateArrays *psys_get_state_arrays(struct ParticleSystem *psys, float cfra);
+void psys_free_state_arrays(struct ParticleSystem *psys);
+
 float *psys_cache_vgroup(struct DerivedMesh *dm, struct ParticleSystem *psys, int vgroup);
 void psys_get_texture(struct ParticleSimulationData *sim, struct ParticleData *pa, struct ParticleTexture *ptex, int event, float cfra);
 void psys_interpolate_face(struct MVert *mvert, struct MFace *mface, struct MTFace *tface,
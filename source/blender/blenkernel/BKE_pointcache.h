@@ -53,6 +53,7 @@
 
 /* Add the blendfile name after blendcache_ */
 #define PTCACHE_EXT ".bphys"
+#define PTCACHE_CONTAINER_EXT ".bphc"
 #define PTCACHE_PATH "blendcache_"
 
 /* File open options, for BKE_ptcache_file_open */
@@ -71,6 +72,8 @@
 /* high bits reserved for flags that need to be stored in file */
 #define PTCACHE_TYPEFLAG_COMPRESS       (1 << 16)
 #define PTCACHE_TYPEFLAG_EXTRADATA      (1 << 17)
+#define PTCACHE_TYPEFLAG_ARRAYS         (1 << 18)  /* uncompressed data stored per type, not per point */
+#define PTCACHE_TYPEFLAG_QUANTIZED      (1 << 19)  /* lossy data, possibly relative to a key frame */
 
 #define PTCACHE_TYPEFLAG_TYPEMASK           0x0000FFFF
 #define PTCACHE_TYPEFLAG_FLAGMASK           0xFFFF0000
@@ -106,6 +109,12 @@ typedef struct PTCacheData {
 
 typedef struct PTCacheFile {
 	FILE *fp;
+	struct PTCacheWriteJob *job;	/* writes are recorded here instead of fp while baking */
+
+	/* frames of container caches are read from and written to memory */
+	unsigned char *mem;
+	size_t mem_len, mem_alloc, mem_pos;
+	struct PTCacheMap *map;	/* mapped container mem points into */
 
 	int frame, old_format;
 	unsigned int totpoint, type;
@@ -117,6 +126,9 @@ typedef struct PTCacheFile {
 
 #define PTCACHE_VEL_PER_SEC     1
 
+/* PTCacheMem->flag */
+#define PTCACHE_MEM_MAPPED      1	/* data points into a mapped container file, not owned */
+
 typedef struct PTCacheID {
 	struct PTCacheID *next, *prev;
 
@@ -311,7 +323,7 @@ struct PointCache *BKE_ptcache_copy_list(struct ListBase *ptcaches_new, struct L
 void BKE_ptcache_quick_cache_all(struct Main *bmain, struct Scene *scene);
 
 /* Bake cache or simulate to current frame with settings defined in the baker. */
-void BKE_ptcache_bake(struct PTCacheBaker *baker);
+int BKE_ptcache_bake(struct PTCacheBaker *baker);
 
 /* Convert disk cache to memory cache. */
 void BKE_ptcache_disk_to_mem(struct PTCacheID *pid);
@@ -322,6 +334,15 @@ void BKE_ptcache_mem_to_disk(struct PTCacheID *pid);
 /* Convert disk cache to memory cache and vice versa. Clears the cache that was converted. */
 void BKE_ptcache_toggle_disk_cache(struct PTCacheID *pid);
 
+/* Convert disk cache between files per frame and a single container file */
+void BKE_ptcache_toggle_disk_container(struct PTCacheID *pid);
+
+/* Free the cached indices of container files */
+void BKE_ptcache_free_containers(void);
+
+/* Stop reading disk cache frames ahead of playback and free them */
+void BKE_ptcache_prefetch_free(void);
+
 /* Rename all disk cache files with a new name. Doesn't touch the actual content of the files. */
 void BKE_ptcache_disk_cache_rename(struct PTCacheID *pid, const char *name_src, const char *name_dst);
 
@@ -40,6 +40,7 @@ extern "C" {
 struct AviCodecData;
 struct Base;
 struct bglMats;
+struct ListBase;
 struct Main;
 struct Object;
 struct QuicktimeCodecData;
@@ -101,6 +102,7 @@ float BKE_scene_frame_get_from_ctime(struct Scene *scene, const float frame);
 void BKE_scene_update_tagged(struct Main *bmain, struct Scene *sce);
 
 void BKE_scene_update_for_newframe(struct Main *bmain, struct Scene *sce, unsigned int lay);
+void BKE_scene_update_for_newframe_islands(struct Main *bmain, struct Scene *sce, unsigned int lay, struct ListBase *islands);
 
 struct SceneRenderLayer *BKE_scene_add_render_layer(struct Scene *sce, const char *name);
 int BKE_scene_remove_render_layer(struct Main *main, struct Scene *scene, struct SceneRenderLayer *srl);
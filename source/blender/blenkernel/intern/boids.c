@@ -234,9 +234,9 @@ static int rule_avoid_collision(BoidRule *rule, BoidBrainData *bbd, BoidValues *
 			if (dot_v3v3(col.pce.nor, pa->prev_state.ave) < -0.99f) {
 				/* don't know why, but uneven range [0.0, 1.0] */
 				/* works much better than even [-1.0, 1.0] */
-				bbd->wanted_co[0] = BLI_frand();
-				bbd->wanted_co[1] = BLI_frand();
-				bbd->wanted_co[2] = BLI_frand();
+				bbd->wanted_co[0] = BLI_thread_frand(bbd->thread);
+				bbd->wanted_co[1] = BLI_thread_frand(bbd->thread);
+				bbd->wanted_co[2] = BLI_thread_frand(bbd->thread);
 			}
 			else {
 				copy_v3_v3(bbd->wanted_co, col.pce.nor);
@@ -358,7 +358,7 @@ static int rule_separate(BoidRule *UNUSED(rule), BoidBrainData *bbd, BoidValues
 	int ret = 0;
 
 	if (neighbors > 1 && ptn[1].dist!=0.0f) {
-		sub_v3_v3v3(vec, pa->prev_state.co, bbd->sim->psys->particles[ptn[1].index].state.co);
+		sub_v3_v3v3(vec, pa->prev_state.co, bbd->sim->psys->particles[ptn[1].index].prev_state.co);
 		mul_v3_fl(vec, (2.0f * val->personal_space * pa->size - ptn[1].dist) / ptn[1].dist);
 		add_v3_v3(bbd->wanted_co, vec);
 		bbd->wanted_speed = val->max_speed;
@@ -558,9 +558,9 @@ static int rule_average_speed(BoidRule *rule, BoidBrainData *bbd, BoidValues *va
 
 	if (asbr->wander > 0.0f) {
 		/* abuse pa->r_ave for wandering */
-		bpa->wander[0] += asbr->wander * (-1.0f + 2.0f * BLI_frand());
-		bpa->wander[1] += asbr->wander * (-1.0f + 2.0f * BLI_frand());
-		bpa->wander[2] += asbr->wander * (-1.0f + 2.0f * BLI_frand());
+		bpa->wander[0] += asbr->wander * (-1.0f + 2.0f * BLI_thread_frand(bbd->thread));
+		bpa->wander[1] += asbr->wander * (-1.0f + 2.0f * BLI_thread_frand(bbd->thread));
+		bpa->wander[2] += asbr->wander * (-1.0f + 2.0f * BLI_thread_frand(bbd->thread));
 
 		normalize_v3(bpa->wander);
 
@@ -586,9 +586,9 @@ static int rule_average_speed(BoidRule *rule, BoidBrainData *bbd, BoidValues *va
 
 		/* may happen at birth */
 		if (dot_v2v2(bbd->wanted_co, bbd->wanted_co)==0.0f) {
-			bbd->wanted_co[0] = 2.0f*(0.5f - BLI_frand());
-			bbd->wanted_co[1] = 2.0f*(0.5f - BLI_frand());
-			bbd->wanted_co[2] = 2.0f*(0.5f - BLI_frand());
+			bbd->wanted_co[0] = 2.0f*(0.5f - BLI_thread_frand(bbd->thread));
+			bbd->wanted_co[1] = 2.0f*(0.5f - BLI_thread_frand(bbd->thread));
+			bbd->wanted_co[2] = 2.0f*(0.5f - BLI_thread_frand(bbd->thread));
 		}
 		
 		/* leveling */
@@ -663,7 +663,7 @@ static int rule_fight(BoidRule *rule, BoidBrainData *bbd, BoidValues *val, Parti
 
 		/* attack if in range */
 		if (closest_dist <= bbd->part->boids->range + pa->size + enemy_pa->size) {
-			float damage = BLI_frand();
+			float damage = BLI_thread_frand(bbd->thread);
 			float enemy_dir[3];
 
 			normalize_v3_v3(enemy_dir, bbd->wanted_co);
@@ -862,6 +862,26 @@ void boids_precalc_rules(ParticleSettings *part, float cfra)
 		}
 	}
 }
+/* Boids can be simulated in parallel as long as they only read the previous state of
+ * others. Fighting boids damage their enemies and landed boids change their own
+ * previous velocity when jumping, results of both depend on the order of evaluation. */
+int boids_rules_threadsafe(BoidSettings *boids)
+{
+	BoidState *state = boids->states.first;
+	BoidRule *rule;
+
+	if (boids->options & BOID_ALLOW_LAND)
+		return 0;
+
+	for (; state; state=state->next) {
+		for (rule = state->rules.first; rule; rule=rule->next) {
+			if (rule->type == eBoidRuleType_Fight)
+				return 0;
+		}
+	}
+
+	return 1;
+}
 static void boid_climb(BoidSettings *boids, ParticleData *pa, float *surface_co, float *surface_nor)
 {
 	BoidParticle *bpa = pa->boid;
@@ -1164,9 +1184,9 @@ void boid_body(BoidBrainData *bbd, ParticleData *pa)
 			/* choose random direction to turn if wanted velocity */
 			/* is directly behind regardless of z-coordinate */
 			if (dot_v2v2(old_dir2, wanted_dir2) < -0.99f) {
-				wanted_dir[0] = 2.0f*(0.5f - BLI_frand());
-				wanted_dir[1] = 2.0f*(0.5f - BLI_frand());
-				wanted_dir[2] = 2.0f*(0.5f - BLI_frand());
+				wanted_dir[0] = 2.0f*(0.5f - BLI_thread_frand(bbd->thread));
+				wanted_dir[1] = 2.0f*(0.5f - BLI_thread_frand(bbd->thread));
+				wanted_dir[2] = 2.0f*(0.5f - BLI_thread_frand(bbd->thread));
 				normalize_v3(wanted_dir);
 			}
 
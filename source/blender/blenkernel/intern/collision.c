@@ -50,6 +50,7 @@
 #include "BLI_ghash.h"
 #include "BLI_memarena.h"
 #include "BLI_rand.h"
+#include "BLI_threads.h"
 
 #include "BKE_DerivedMesh.h"
 #include "BKE_global.h"
@@ -69,6 +70,11 @@
 #include "eltopo-capi.h"
 #endif
 
+#ifdef _OPENMP
+#  include <omp.h>
+#  define COLLISION_OPENMP_LIMIT 256
+#endif
+
 
 /***********************************
 Collision modifier code start
@@ -119,15 +125,18 @@ BVHTree *bvhtree_build_from_mvert ( MFace *mfaces, unsigned int numfaces, MVert
 void bvhtree_update_from_mvert(BVHTree * bvhtree, MFace *faces, int numfaces, MVert *x, MVert *xnew, int UNUSED(numverts), int moving )
 {
 	int i;
-	MFace *mfaces = faces;
-	float co[12], co_moving[12];
-	int ret = 0;
 
 	if ( !bvhtree )
 		return;
 
 	if ( x ) {
-		for ( i = 0; i < numfaces; i++, mfaces++ ) {
+		/* leaf nodes are independent, faces beyond the tree size
+		 * are rejected by BLI_bvhtree_update_node */
+#pragma omp parallel for private(i) schedule(static) if (numfaces > COLLISION_OPENMP_LIMIT)
+		for ( i = 0; i < numfaces; i++ ) {
+			MFace *mfaces = faces + i;
+			float co[12], co_moving[12];
+
 			copy_v3_v3 ( &co[0*3], x[mfaces->v1].co );
 			copy_v3_v3 ( &co[1*3], x[mfaces->v2].co );
 			copy_v3_v3 ( &co[2*3], x[mfaces->v3].co );
@@ -143,15 +152,11 @@ void bvhtree_update_from_mvert(BVHTree * bvhtree, MFace *faces, int numfaces, MV
 				if ( mfaces->v4 )
 					copy_v3_v3 ( &co_moving[3*3], xnew[mfaces->v4].co );
 
-				ret = BLI_bvhtree_update_node ( bvhtree, i, co, co_moving, ( mfaces->v4 ? 4 : 3 ) );
+				BLI_bvhtree_update_node ( bvhtree, i, co, co_moving, ( mfaces->v4 ? 4 : 3 ) );
 			}
 			else {
-				ret = BLI_bvhtree_update_node ( bvhtree, i, co, NULL, ( mfaces->v4 ? 4 : 3 ) );
+				BLI_bvhtree_update_node ( bvhtree, i, co, NULL, ( mfaces->v4 ? 4 : 3 ) );
 			}
-
-			// check if tree is already full
-			if ( !ret )
-				break;
 		}
 
 		BLI_bvhtree_update_tree ( bvhtree );
@@ -211,7 +216,10 @@ DO_INLINE void collision_interpolateOnTriangle ( float to[3], float v1[3], float
 	VECADDMUL(to, v3, w3);
 }
 
-static int cloth_collision_response_static ( ClothModifierData *clmd, CollisionModifierData *collmd, CollPair *collpair, CollPair *collision_end )
+/* Computes the impulses of one collision pair on the three cloth vertices,
+ * returns 1 when the pair gives an impulse. Only reads the cloth, so pairs can
+ * be handled in parallel. */
+static int cloth_collision_impulse ( ClothModifierData *clmd, CollisionModifierData *collmd, CollPair *collpair, float i1[3], float i2[3], float i3[3] )
 {
 	int result = 0;
 	Cloth *cloth1;
@@ -222,154 +230,224 @@ static int cloth_collision_response_static ( ClothModifierData *clmd, CollisionM
 
 	cloth1 = clmd->clothObject;
 
-	for ( ; collpair != collision_end; collpair++ ) {
-		float i1[3], i2[3], i3[3];
+	zero_v3(i1);
+	zero_v3(i2);
+	zero_v3(i3);
 
-		zero_v3(i1);
-		zero_v3(i2);
-		zero_v3(i3);
+	/* only handle static collisions here */
+	if ( collpair->flag & COLLISION_IN_FUTURE )
+		return 0;
 
-		/* only handle static collisions here */
-		if ( collpair->flag & COLLISION_IN_FUTURE )
-			continue;
+	/* compute barycentric coordinates for both collision points */
+	collision_compute_barycentric ( collpair->pa,
+		cloth1->verts[collpair->ap1].txold,
+		cloth1->verts[collpair->ap2].txold,
+		cloth1->verts[collpair->ap3].txold,
+		&w1, &w2, &w3 );
 
-		/* compute barycentric coordinates for both collision points */
-		collision_compute_barycentric ( collpair->pa,
-			cloth1->verts[collpair->ap1].txold,
-			cloth1->verts[collpair->ap2].txold,
-			cloth1->verts[collpair->ap3].txold,
-			&w1, &w2, &w3 );
+	/* was: txold */
+	collision_compute_barycentric ( collpair->pb,
+		collmd->current_x[collpair->bp1].co,
+		collmd->current_x[collpair->bp2].co,
+		collmd->current_x[collpair->bp3].co,
+		&u1, &u2, &u3 );
 
-		/* was: txold */
-		collision_compute_barycentric ( collpair->pb,
-			collmd->current_x[collpair->bp1].co,
-			collmd->current_x[collpair->bp2].co,
-			collmd->current_x[collpair->bp3].co,
-			&u1, &u2, &u3 );
+	/* Calculate relative "velocity". */
+	collision_interpolateOnTriangle ( v1, cloth1->verts[collpair->ap1].tv, cloth1->verts[collpair->ap2].tv, cloth1->verts[collpair->ap3].tv, w1, w2, w3 );
 
-		/* Calculate relative "velocity". */
-		collision_interpolateOnTriangle ( v1, cloth1->verts[collpair->ap1].tv, cloth1->verts[collpair->ap2].tv, cloth1->verts[collpair->ap3].tv, w1, w2, w3 );
+	collision_interpolateOnTriangle ( v2, collmd->current_v[collpair->bp1].co, collmd->current_v[collpair->bp2].co, collmd->current_v[collpair->bp3].co, u1, u2, u3 );
 
-		collision_interpolateOnTriangle ( v2, collmd->current_v[collpair->bp1].co, collmd->current_v[collpair->bp2].co, collmd->current_v[collpair->bp3].co, u1, u2, u3 );
+	sub_v3_v3v3(relativeVelocity, v2, v1);
 
-		sub_v3_v3v3(relativeVelocity, v2, v1);
+	/* Calculate the normal component of the relative velocity (actually only the magnitude - the direction is stored in 'normal'). */
+	magrelVel = dot_v3v3(relativeVelocity, collpair->normal);
 
-		/* Calculate the normal component of the relative velocity (actually only the magnitude - the direction is stored in 'normal'). */
-		magrelVel = dot_v3v3(relativeVelocity, collpair->normal);
+	/* printf("magrelVel: %f\n", magrelVel); */
 
-		/* printf("magrelVel: %f\n", magrelVel); */
+	/* Calculate masses of points.
+	 * TODO */
 
-		/* Calculate masses of points.
-		 * TODO */
+	/* If v_n_mag < 0 the edges are approaching each other. */
+	if ( magrelVel > ALMOST_ZERO ) {
+		/* Calculate Impulse magnitude to stop all motion in normal direction. */
+		float magtangent = 0, repulse = 0, d = 0;
+		double impulse = 0.0;
+		float vrel_t_pre[3];
+		float temp[3], spf;
 
-		/* If v_n_mag < 0 the edges are approaching each other. */
-		if ( magrelVel > ALMOST_ZERO ) {
-			/* Calculate Impulse magnitude to stop all motion in normal direction. */
-			float magtangent = 0, repulse = 0, d = 0;
-			double impulse = 0.0;
-			float vrel_t_pre[3];
-			float temp[3], spf;
+		/* calculate tangential velocity */
+		copy_v3_v3 ( temp, collpair->normal );
+		mul_v3_fl(temp, magrelVel);
+		sub_v3_v3v3(vrel_t_pre, relativeVelocity, temp);
 
-			/* calculate tangential velocity */
-			copy_v3_v3 ( temp, collpair->normal );
-			mul_v3_fl(temp, magrelVel);
-			sub_v3_v3v3(vrel_t_pre, relativeVelocity, temp);
+		/* Decrease in magnitude of relative tangential velocity due to coulomb friction
+		 * in original formula "magrelVel" should be the "change of relative velocity in normal direction" */
+		magtangent = min_ff(clmd->coll_parms->friction * 0.01f * magrelVel, sqrtf(dot_v3v3(vrel_t_pre, vrel_t_pre)));
 
-			/* Decrease in magnitude of relative tangential velocity due to coulomb friction
-			 * in original formula "magrelVel" should be the "change of relative velocity in normal direction" */
-			magtangent = min_ff(clmd->coll_parms->friction * 0.01f * magrelVel, sqrtf(dot_v3v3(vrel_t_pre, vrel_t_pre)));
+		/* Apply friction impulse. */
+		if ( magtangent > ALMOST_ZERO ) {
+			normalize_v3(vrel_t_pre);
 
-			/* Apply friction impulse. */
-			if ( magtangent > ALMOST_ZERO ) {
-				normalize_v3(vrel_t_pre);
+			impulse = magtangent / ( 1.0f + w1*w1 + w2*w2 + w3*w3 ); /* 2.0 * */
+			VECADDMUL ( i1, vrel_t_pre, w1 * impulse );
+			VECADDMUL ( i2, vrel_t_pre, w2 * impulse );
+			VECADDMUL ( i3, vrel_t_pre, w3 * impulse );
+		}
 
-				impulse = magtangent / ( 1.0f + w1*w1 + w2*w2 + w3*w3 ); /* 2.0 * */
-				VECADDMUL ( i1, vrel_t_pre, w1 * impulse );
-				VECADDMUL ( i2, vrel_t_pre, w2 * impulse );
-				VECADDMUL ( i3, vrel_t_pre, w3 * impulse );
-			}
+		/* Apply velocity stopping impulse
+		 * I_c = m * v_N / 2.0
+		 * no 2.0 * magrelVel normally, but looks nicer DG */
+		impulse =  magrelVel / ( 1.0 + w1*w1 + w2*w2 + w3*w3 );
+
+		VECADDMUL ( i1, collpair->normal, w1 * impulse );
+		VECADDMUL ( i2, collpair->normal, w2 * impulse );
+		VECADDMUL ( i3, collpair->normal, w3 * impulse );
+
+		/* Apply repulse impulse if distance too short
+		 * I_r = -min(dt*kd, m(0, 1d/dt - v_n))
+		 * DG: this formula ineeds to be changed for this code since we apply impulses/repulses like this:
+		 * v += impulse; x_new = x + v;
+		 * We don't use dt!!
+		 * DG TODO: Fix usage of dt here! */
+		spf = (float)clmd->sim_parms->stepsPerFrame / clmd->sim_parms->timescale;
+
+		d = clmd->coll_parms->epsilon*8.0f/9.0f + epsilon2*8.0f/9.0f - collpair->distance;
+		if ( ( magrelVel < 0.1f*d*spf ) && ( d > ALMOST_ZERO ) ) {
+			repulse = MIN2 ( d*1.0f/spf, 0.1f*d*spf - magrelVel );
+
+			/* stay on the safe side and clamp repulse */
+			if ( impulse > ALMOST_ZERO )
+				repulse = min_ff( repulse, 5.0*impulse );
+			repulse = max_ff(impulse, repulse);
+
+			impulse = repulse / ( 1.0f + w1*w1 + w2*w2 + w3*w3 ); /* original 2.0 / 0.25 */
+			VECADDMUL ( i1, collpair->normal,  impulse );
+			VECADDMUL ( i2, collpair->normal,  impulse );
+			VECADDMUL ( i3, collpair->normal,  impulse );
+		}
 
-			/* Apply velocity stopping impulse
-			 * I_c = m * v_N / 2.0
-			 * no 2.0 * magrelVel normally, but looks nicer DG */
-			impulse =  magrelVel / ( 1.0 + w1*w1 + w2*w2 + w3*w3 );
-
-			VECADDMUL ( i1, collpair->normal, w1 * impulse );
-			cloth1->verts[collpair->ap1].impulse_count++;
-
-			VECADDMUL ( i2, collpair->normal, w2 * impulse );
-			cloth1->verts[collpair->ap2].impulse_count++;
-
-			VECADDMUL ( i3, collpair->normal, w3 * impulse );
-			cloth1->verts[collpair->ap3].impulse_count++;
-
-			/* Apply repulse impulse if distance too short
-			 * I_r = -min(dt*kd, m(0, 1d/dt - v_n))
-			 * DG: this formula ineeds to be changed for this code since we apply impulses/repulses like this:
-			 * v += impulse; x_new = x + v;
-			 * We don't use dt!!
-			 * DG TODO: Fix usage of dt here! */
-			spf = (float)clmd->sim_parms->stepsPerFrame / clmd->sim_parms->timescale;
-
-			d = clmd->coll_parms->epsilon*8.0f/9.0f + epsilon2*8.0f/9.0f - collpair->distance;
-			if ( ( magrelVel < 0.1f*d*spf ) && ( d > ALMOST_ZERO ) ) {
-				repulse = MIN2 ( d*1.0f/spf, 0.1f*d*spf - magrelVel );
-
-				/* stay on the safe side and clamp repulse */
-				if ( impulse > ALMOST_ZERO )
-					repulse = min_ff( repulse, 5.0*impulse );
-				repulse = max_ff(impulse, repulse);
-
-				impulse = repulse / ( 1.0f + w1*w1 + w2*w2 + w3*w3 ); /* original 2.0 / 0.25 */
-				VECADDMUL ( i1, collpair->normal,  impulse );
-				VECADDMUL ( i2, collpair->normal,  impulse );
-				VECADDMUL ( i3, collpair->normal,  impulse );
-			}
+		result = 1;
+	}
+	else {
+		/* Apply repulse impulse if distance too short
+		 * I_r = -min(dt*kd, max(0, 1d/dt - v_n))
+		 * DG: this formula ineeds to be changed for this code since we apply impulses/repulses like this:
+		 * v += impulse; x_new = x + v;
+		 * We don't use dt!! */
+		float spf = (float)clmd->sim_parms->stepsPerFrame / clmd->sim_parms->timescale;
+
+		float d = clmd->coll_parms->epsilon*8.0f/9.0f + epsilon2*8.0f/9.0f - (float)collpair->distance;
+		if ( d > ALMOST_ZERO) {
+			/* stay on the safe side and clamp repulse */
+			float repulse = d*1.0f/spf;
+
+			float impulse = repulse / ( 3.0f * ( 1.0f + w1*w1 + w2*w2 + w3*w3 )); /* original 2.0 / 0.25 */
+
+			VECADDMUL ( i1, collpair->normal,  impulse );
+			VECADDMUL ( i2, collpair->normal,  impulse );
+			VECADDMUL ( i3, collpair->normal,  impulse );
 
 			result = 1;
 		}
-		else {
-			/* Apply repulse impulse if distance too short
-			 * I_r = -min(dt*kd, max(0, 1d/dt - v_n))
-			 * DG: this formula ineeds to be changed for this code since we apply impulses/repulses like this:
-			 * v += impulse; x_new = x + v;
-			 * We don't use dt!! */
-			float spf = (float)clmd->sim_parms->stepsPerFrame / clmd->sim_parms->timescale;
-
-			float d = clmd->coll_parms->epsilon*8.0f/9.0f + epsilon2*8.0f/9.0f - (float)collpair->distance;
-			if ( d > ALMOST_ZERO) {
-				/* stay on the safe side and clamp repulse */
-				float repulse = d*1.0f/spf;
+	}
+	return result;
+}
 
-				float impulse = repulse / ( 3.0f * ( 1.0f + w1*w1 + w2*w2 + w3*w3 )); /* original 2.0 / 0.25 */
+/* keep the largest impulse per axis, the first one wins on equal size */
+BLI_INLINE void collision_impulse_max(float impulse[3], const float i1[3])
+{
+	int i;
 
-				VECADDMUL ( i1, collpair->normal,  impulse );
-				VECADDMUL ( i2, collpair->normal,  impulse );
-				VECADDMUL ( i3, collpair->normal,  impulse );
+	for (i = 0; i < 3; i++) {
+		if (ABS(impulse[i]) < ABS(i1[i]))
+			impulse[i] = i1[i];
+	}
+}
 
-				cloth1->verts[collpair->ap1].impulse_count++;
-				cloth1->verts[collpair->ap2].impulse_count++;
-				cloth1->verts[collpair->ap3].impulse_count++;
+#ifdef _OPENMP
+/* Impulses gathered by one thread. Every thread handles a contiguous range of
+ * the pairs and the buffers are merged in thread order, which gives the same
+ * impulses as handling all pairs in order. */
+typedef struct CollisionImpulse {
+	float impulse[3];
+	unsigned int count;
+} CollisionImpulse;
 
+static int cloth_collision_response_static_threaded ( ClothModifierData *clmd, CollisionModifierData *collmd, CollPair *collpair, CollPair *collision_end )
+{
+	ClothVertex *verts = clmd->clothObject->verts;
+	int numverts = clmd->clothObject->numverts;
+	int totpair = (int)(collision_end - collpair);
+	int totthread = omp_get_max_threads();
+	CollisionImpulse *impulses = MEM_callocN(sizeof(CollisionImpulse) * numverts * totthread, "CollisionImpulse");
+	int result = 0;
+	int v;
+
+#pragma omp parallel num_threads(totthread) reduction(|: result)
+	{
+		int thread = omp_get_thread_num(), numthread = omp_get_num_threads();
+		CollisionImpulse *thread_impulses = impulses + thread * numverts;
+		CollPair *pair = collpair + (totpair * thread) / numthread;
+		CollPair *pair_end = collpair + (totpair * (thread + 1)) / numthread;
+
+		for (; pair != pair_end; pair++) {
+			float i1[3], i2[3], i3[3];
+
+			if (cloth_collision_impulse(clmd, collmd, pair, i1, i2, i3)) {
+				thread_impulses[pair->ap1].count++;
+				thread_impulses[pair->ap2].count++;
+				thread_impulses[pair->ap3].count++;
+				collision_impulse_max(thread_impulses[pair->ap1].impulse, i1);
+				collision_impulse_max(thread_impulses[pair->ap2].impulse, i2);
+				collision_impulse_max(thread_impulses[pair->ap3].impulse, i3);
 				result = 1;
 			}
 		}
+	}
 
-		if (result) {
-			int i = 0;
-
-			for (i = 0; i < 3; i++) {
-				if (cloth1->verts[collpair->ap1].impulse_count > 0 && ABS(cloth1->verts[collpair->ap1].impulse[i]) < ABS(i1[i]))
-					cloth1->verts[collpair->ap1].impulse[i] = i1[i];
+#pragma omp parallel for private(v) schedule(static)
+	for (v = 0; v < numverts; v++) {
+		int t;
 
-				if (cloth1->verts[collpair->ap2].impulse_count > 0 && ABS(cloth1->verts[collpair->ap2].impulse[i]) < ABS(i2[i]))
-					cloth1->verts[collpair->ap2].impulse[i] = i2[i];
+		for (t = 0; t < totthread; t++) {
+			CollisionImpulse *imp = impulses + t * numverts + v;
 
-				if (cloth1->verts[collpair->ap3].impulse_count > 0 && ABS(cloth1->verts[collpair->ap3].impulse[i]) < ABS(i3[i]))
-					cloth1->verts[collpair->ap3].impulse[i] = i3[i];
+			if (imp->count) {
+				verts[v].impulse_count += imp->count;
+				collision_impulse_max(verts[v].impulse, imp->impulse);
 			}
 		}
 	}
+
+	MEM_freeN(impulses);
+
+	return result;
+}
+#endif
+
+static int cloth_collision_response_static ( ClothModifierData *clmd, CollisionModifierData *collmd, CollPair *collpair, CollPair *collision_end )
+{
+	ClothVertex *verts = clmd->clothObject->verts;
+	int result = 0;
+
+#ifdef _OPENMP
+	if ((collision_end - collpair) > COLLISION_OPENMP_LIMIT && omp_get_max_threads() > 1)
+		return cloth_collision_response_static_threaded(clmd, collmd, collpair, collision_end);
+#endif
+
+	for ( ; collpair != collision_end; collpair++ ) {
+		float i1[3], i2[3], i3[3];
+
+		if (cloth_collision_impulse(clmd, collmd, collpair, i1, i2, i3)) {
+			verts[collpair->ap1].impulse_count++;
+			verts[collpair->ap2].impulse_count++;
+			verts[collpair->ap3].impulse_count++;
+			collision_impulse_max(verts[collpair->ap1].impulse, i1);
+			collision_impulse_max(verts[collpair->ap2].impulse, i2);
+			collision_impulse_max(verts[collpair->ap3].impulse, i3);
+			result = 1;
+		}
+	}
 	return result;
 }
 
@@ -652,15 +730,34 @@ void free_collider_cache(ListBase **colliders)
 static void cloth_bvh_objcollisions_nearcheck ( ClothModifierData * clmd, CollisionModifierData *collmd,
 	CollPair **collisions, CollPair **collisions_index, int numresult, BVHTreeOverlap *overlap, double dt)
 {
+	CollPair *collpair;
+	int *totpair;
 	int i;
 	
-	*collisions = (CollPair *) MEM_mallocN(sizeof(CollPair) * numresult * 64, "collision array" ); //*4 since cloth_collision_static can return more than 1 collision
-	*collisions_index = *collisions;
+	/* every overlap gives at most 4 collisions (two quads), each overlap
+	 * gets its own slots so they can be checked in parallel */
+	*collisions = (CollPair *) MEM_mallocN(sizeof(CollPair) * numresult * 4, "collision array" );
+	totpair = MEM_mallocN(sizeof(int) * numresult, "collision count");
 
+#pragma omp parallel for private(i) schedule(static) if (numresult > COLLISION_OPENMP_LIMIT)
 	for ( i = 0; i < numresult; i++ ) {
-		*collisions_index = cloth_collision ( (ModifierData *)clmd, (ModifierData *)collmd,
-		                                      overlap+i, *collisions_index, dt );
+		CollPair *start = *collisions + 4 * i;
+
+		totpair[i] = (int)(cloth_collision ( (ModifierData *)clmd, (ModifierData *)collmd,
+		                                     overlap+i, start, dt ) - start);
 	}
+
+	/* pack the collisions in overlap order */
+	collpair = *collisions;
+	for ( i = 0; i < numresult; i++ ) {
+		if (totpair[i]) {
+			memmove(collpair, *collisions + 4 * i, sizeof(CollPair) * totpair[i]);
+			collpair += totpair[i];
+		}
+	}
+	*collisions_index = collpair;
+
+	MEM_freeN(totpair);
 }
 
 static int cloth_bvh_objcollisions_resolve ( ClothModifierData * clmd, CollisionModifierData *collmd, CollPair *collisions, CollPair *collisions_index)
@@ -684,6 +781,7 @@ static int cloth_bvh_objcollisions_resolve ( ClothModifierData * clmd, Collision
 
 			// apply impulses in parallel
 			if (result) {
+#pragma omp parallel for private(i) reduction(+: ret) schedule(static) if (numverts > COLLISION_OPENMP_LIMIT)
 				for (i = 0; i < numverts; i++) {
 					// calculate "velocities" (just xnew = xold + v; no dt in v)
 					if (verts[i].impulse_count) {
@@ -710,7 +808,7 @@ int cloth_bvh_objcollision(Object *ob, ClothModifierData * clmd, float step, flo
 {
 	Cloth *cloth= clmd->clothObject;
 	BVHTree *cloth_bvh= cloth->bvhtree;
-	unsigned int i=0, /* numfaces = 0, */ /* UNUSED */ numverts = 0, k, l, j;
+	unsigned int i=0, /* numfaces = 0, */ /* UNUSED */ numverts = 0, l;
 	int rounds = 0; // result counts applied collisions; ic is for debug output;
 	ClothVertex *verts = NULL;
 	int ret = 0, ret2 = 0;
@@ -751,15 +849,21 @@ int cloth_bvh_objcollision(Object *ob, ClothModifierData * clmd, float step, flo
 
 	do {
 		CollPair **collisions, **collisions_index;
+		int c;
 		
 		ret2 = 0;
 
 		collisions = MEM_callocN(sizeof(CollPair *) *numcollobj, "CollPair");
 		collisions_index = MEM_callocN(sizeof(CollPair *) *numcollobj, "CollPair");
 		
-		// check all collision objects
-		for (i = 0; i < numcollobj; i++) {
-			Object *collob= collobjs[i];
+		/* collision detection only reads the cloth positions, so all
+		 * collision objects can be checked at the same time */
+		if (numcollobj > 1)
+			BLI_begin_threaded_malloc();
+
+#pragma omp parallel for private(c) schedule(dynamic) if (numcollobj > 1)
+		for (c = 0; c < (int)numcollobj; c++) {
+			Object *collob= collobjs[c];
 			CollisionModifierData *collmd = (CollisionModifierData *)modifiers_findByType(collob, eModifierType_Collision);
 			BVHTreeOverlap *overlap = NULL;
 			unsigned int result = 0;
@@ -773,17 +877,28 @@ int cloth_bvh_objcollision(Object *ob, ClothModifierData * clmd, float step, flo
 			// go to next object if no overlap is there
 			if ( result && overlap ) {
 				/* check if collisions really happen (costly near check) */
-				cloth_bvh_objcollisions_nearcheck ( clmd, collmd, &collisions[i], 
-					&collisions_index[i], result, overlap, dt/(float)clmd->coll_parms->loop_count);
-			
-				// resolve nearby collisions
-				ret += cloth_bvh_objcollisions_resolve ( clmd, collmd, collisions[i],  collisions_index[i]);
-				ret2 += ret;
+				cloth_bvh_objcollisions_nearcheck ( clmd, collmd, &collisions[c], 
+					&collisions_index[c], result, overlap, dt/(float)clmd->coll_parms->loop_count);
 			}
 
 			if ( overlap )
 				MEM_freeN ( overlap );
 		}
+
+		if (numcollobj > 1)
+			BLI_end_threaded_malloc();
+
+		/* resolve in object order, the response depends on the velocities
+		 * changed by the objects before */
+		for (i = 0; i < numcollobj; i++) {
+			if (collisions[i]) {
+				CollisionModifierData *collmd = (CollisionModifierData *)modifiers_findByType(collobjs[i], eModifierType_Collision);
+
+				// resolve nearby collisions
+				ret += cloth_bvh_objcollisions_resolve ( clmd, collmd, collisions[i],  collisions_index[i]);
+				ret2 += ret;
+			}
+		}
 		rounds++;
 		
 		for (i = 0; i < numcollobj; i++) {
@@ -799,6 +914,7 @@ int cloth_bvh_objcollision(Object *ob, ClothModifierData * clmd, float step, flo
 		////////////////////////////////////////////////////////////
 
 		// verts come from clmd
+#pragma omp parallel for private(i) schedule(static) if (numverts > COLLISION_OPENMP_LIMIT)
 		for ( i = 0; i < numverts; i++ ) {
 			if ( clmd->sim_parms->flags & CLOTH_SIMSETTINGS_FLAG_GOAL ) {
 				if ( verts [i].flags & CLOTH_VERT_FLAG_PINNED ) {
@@ -832,65 +948,81 @@ int cloth_bvh_objcollision(Object *ob, ClothModifierData * clmd, float step, flo
 					// search for overlapping collision pairs
 					overlap = BLI_bvhtree_overlap ( cloth->bvhselftree, cloth->bvhselftree, &result );
 	
-	// #pragma omp parallel for private(k, i, j) schedule(static)
-					for ( k = 0; k < result; k++ ) {
-						float temp[3];
-						float length = 0;
-						float mindistance;
+					if ( overlap && result ) {
+						/* the corrections are computed from the positions at the start of
+						 * the round and applied in overlap order afterwards, so the pairs
+						 * can be checked in parallel with the same result every time */
+						float (*correction)[2][3] = MEM_mallocN(sizeof(*correction) * result, "cloth self collision");
+						int k, hits = 0;
+
+#pragma omp parallel for private(k) reduction(+: hits) schedule(static) if (result > COLLISION_OPENMP_LIMIT)
+						for ( k = 0; k < (int)result; k++ ) {
+							float temp[3];
+							float length = 0;
+							float mindistance;
+							unsigned int i = overlap[k].indexA, j = overlap[k].indexB;
+
+							zero_v3(correction[k][0]);
+							zero_v3(correction[k][1]);
 	
-						i = overlap[k].indexA;
-						j = overlap[k].indexB;
+							mindistance = clmd->coll_parms->selfepsilon* ( cloth->verts[i].avg_spring_len + cloth->verts[j].avg_spring_len );
 	
-						mindistance = clmd->coll_parms->selfepsilon* ( cloth->verts[i].avg_spring_len + cloth->verts[j].avg_spring_len );
-	
-						if ( clmd->sim_parms->flags & CLOTH_SIMSETTINGS_FLAG_GOAL ) {
-							if ( ( cloth->verts [i].flags & CLOTH_VERT_FLAG_PINNED ) &&
-							     ( cloth->verts [j].flags & CLOTH_VERT_FLAG_PINNED ) )
+							if ( clmd->sim_parms->flags & CLOTH_SIMSETTINGS_FLAG_GOAL ) {
+								if ( ( cloth->verts [i].flags & CLOTH_VERT_FLAG_PINNED ) &&
+								     ( cloth->verts [j].flags & CLOTH_VERT_FLAG_PINNED ) )
+								{
+									continue;
+								}
+							}
+
+							if ((cloth->verts[i].flags & CLOTH_VERT_FLAG_NOSELFCOLL) ||
+							    (cloth->verts[j].flags & CLOTH_VERT_FLAG_NOSELFCOLL))
 							{
 								continue;
 							}
-						}
-
-						if ((cloth->verts[i].flags & CLOTH_VERT_FLAG_NOSELFCOLL) ||
-						    (cloth->verts[j].flags & CLOTH_VERT_FLAG_NOSELFCOLL))
-						{
-							continue;
-						}
 	
-						sub_v3_v3v3(temp, verts[i].tx, verts[j].tx);
+							sub_v3_v3v3(temp, verts[i].tx, verts[j].tx);
 	
-						if ( ( ABS ( temp[0] ) > mindistance ) || ( ABS ( temp[1] ) > mindistance ) || ( ABS ( temp[2] ) > mindistance ) ) continue;
+							if ( ( ABS ( temp[0] ) > mindistance ) || ( ABS ( temp[1] ) > mindistance ) || ( ABS ( temp[2] ) > mindistance ) ) continue;
 	
-						// check for adjacent points (i must be smaller j)
-						if ( BLI_edgehash_haskey ( cloth->edgehash, MIN2(i, j), MAX2(i, j) ) ) {
-							continue;
-						}
+							// check for adjacent points (i must be smaller j)
+							if ( BLI_edgehash_haskey ( cloth->edgehash, MIN2(i, j), MAX2(i, j) ) ) {
+								continue;
+							}
 	
-						length = normalize_v3(temp );
+							length = normalize_v3(temp );
 	
-						if ( length < mindistance ) {
-							float correction = mindistance - length;
+							if ( length < mindistance ) {
+								float corr = mindistance - length;
 	
-							if ( cloth->verts [i].flags & CLOTH_VERT_FLAG_PINNED ) {
-								mul_v3_fl(temp, -correction);
-								VECADD ( verts[j].tx, verts[j].tx, temp );
-							}
-							else if ( cloth->verts [j].flags & CLOTH_VERT_FLAG_PINNED ) {
-								mul_v3_fl(temp, correction);
-								VECADD ( verts[i].tx, verts[i].tx, temp );
+								if ( cloth->verts [i].flags & CLOTH_VERT_FLAG_PINNED ) {
+									mul_v3_v3fl(correction[k][1], temp, -corr);
+								}
+								else if ( cloth->verts [j].flags & CLOTH_VERT_FLAG_PINNED ) {
+									mul_v3_v3fl(correction[k][0], temp, corr);
+								}
+								else {
+									mul_v3_v3fl(correction[k][1], temp, corr * -0.5f);
+									negate_v3_v3(correction[k][0], correction[k][1]);
+								}
+								hits++;
 							}
 							else {
-								mul_v3_fl(temp, correction * -0.5f);
-								VECADD ( verts[j].tx, verts[j].tx, temp );
-	
-								sub_v3_v3v3(verts[i].tx, verts[i].tx, temp);
+								// check for approximated time collisions
 							}
-							ret = 1;
-							ret2 += ret;
 						}
-						else {
-							// check for approximated time collisions
+
+						if ( hits ) {
+							for ( k = 0; k < (int)result; k++ ) {
+								add_v3_v3(verts[overlap[k].indexA].tx, correction[k][0]);
+								add_v3_v3(verts[overlap[k].indexB].tx, correction[k][1]);
+							}
+
+							ret = 1;
+							ret2 += hits;
 						}
+
+						MEM_freeN(correction);
 					}
 	
 					if ( overlap )
@@ -904,6 +1036,7 @@ int cloth_bvh_objcollision(Object *ob, ClothModifierData * clmd, float step, flo
 			// SELFCOLLISIONS: update velocities
 			////////////////////////////////////////////////////////////
 			if ( ret2 ) {
+#pragma omp parallel for private(i) schedule(static) if (cloth->numverts > COLLISION_OPENMP_LIMIT)
 				for ( i = 0; i < cloth->numverts; i++ ) {
 					if ( ! ( verts [i].flags & CLOTH_VERT_FLAG_PINNED ) ) {
 						sub_v3_v3v3(verts[i].tv, verts[i].tx, verts[i].txold);
@@ -44,15 +44,21 @@
 
 #include "DNA_anim_types.h"
 #include "DNA_camera_types.h"
+#include "DNA_cloth_types.h"
+#include "DNA_dynamicpaint_types.h"
 #include "DNA_group_types.h"
 #include "DNA_lamp_types.h"
 #include "DNA_lattice_types.h"
 #include "DNA_key_types.h"
 #include "DNA_material_types.h"
 #include "DNA_mesh_types.h"
+#include "DNA_modifier_types.h"
 #include "DNA_node_types.h"
+#include "DNA_object_force.h"
+#include "DNA_particle_types.h"
 #include "DNA_scene_types.h"
 #include "DNA_screen_types.h"
+#include "DNA_smoke_types.h"
 #include "DNA_windowmanager_types.h"
 #include "DNA_movieclip_types.h"
 #include "DNA_mask_types.h"
@@ -1937,6 +1943,264 @@ void DAG_scene_sort(Main *bmain, Scene *sce)
 	sce->recalc |= SCE_PRV_CHANGED; /* test for 3d preview */
 }
 
+static int dag_island_find(int *parent, int i)
+{
+	while (parent[i] != i) {
+		parent[i] = parent[parent[i]];
+		i = parent[i];
+	}
+
+	return i;
+}
+
+typedef struct DagIslandJoin {
+	Scene *scene;
+	GHash *index_hash;  /* object -> index in parent */
+	int *parent;
+} DagIslandJoin;
+
+static void dag_island_join(DagIslandJoin *join, Object *ob1, Object *ob2)
+{
+	void *a = BLI_ghash_lookup(join->index_hash, ob1);
+	void *b = BLI_ghash_lookup(join->index_hash, ob2);
+
+	/* group members outside of the scene are not in any island */
+	if (a && b) {
+		int *parent = join->parent;
+		parent[dag_island_find(parent, GET_INT_FROM_POINTER(a) - 1)] =
+		        dag_island_find(parent, GET_INT_FROM_POINTER(b) - 1);
+	}
+}
+
+static int dag_island_is_collider(Object *ob)
+{
+	return (ob->pd && ob->pd->deflect);
+}
+
+static int dag_island_is_effector(Object *ob)
+{
+	return ((ob->pd && ob->pd->forcefield) || ob->particlesystem.first);
+}
+
+static int dag_island_is_smoke(Object *ob)
+{
+	return (modifiers_findByType(ob, eModifierType_Smoke) != NULL);
+}
+
+static int dag_island_is_brush(Object *ob)
+{
+	DynamicPaintModifierData *pmd = (DynamicPaintModifierData *)modifiers_findByType(ob, eModifierType_DynamicPaint);
+
+	return (pmd && pmd->brush);
+}
+
+/* Joins ob with the objects of group, or of the scene bases on layers lay
+ * (all of them for 0), that pass test. The lookups also find the members
+ * of dupli groups, these are updated with the object that instances them. */
+static void dag_island_join_lookup(DagIslandJoin *join, Object *ob, Group *group, unsigned int lay,
+                                   int (*test)(Object *))
+{
+	GroupObject *go;
+	Base *base;
+
+	if (group) {
+		for (go = group->gobject.first; go; go = go->next) {
+			if (go->ob != ob && test(go->ob))
+				dag_island_join(join, ob, go->ob);
+		}
+		return;
+	}
+
+	for (base = join->scene->base.first; base; base = base->next) {
+		Object *ob2 = base->object;
+		int found = FALSE;
+
+		if (ob2 == ob || (lay && (base->lay & lay) == 0))
+			continue;
+
+		if (test(ob2)) {
+			found = TRUE;
+		}
+		else if (ob2->dup_group) {
+			for (go = ob2->dup_group->gobject.first; go && !found; go = go->next)
+				found = test(go->ob);
+		}
+
+		if (found)
+			dag_island_join(join, ob, ob2);
+	}
+}
+
+static void dag_island_join_effectors(DagIslandJoin *join, Object *ob, EffectorWeights *weights)
+{
+	dag_island_join_lookup(join, ob, weights ? weights->group : NULL, ob->lay, dag_island_is_effector);
+}
+
+/* Simulations find colliders, effectors, smoke flows and dynamic paint brushes
+ * by group or layer, without relations in the DAG. Their objects are read while
+ * the simulation runs, so they have to be updated in the same island. */
+static void dag_island_join_simulation(DagIslandJoin *join, Object *ob)
+{
+	Scene *scene = join->scene;
+	ParticleSystem *psys;
+	ModifierData *md;
+
+	/* effectors with visibility look for colliders themselves */
+	if (ob->pd && ob->pd->forcefield && (ob->pd->flag & PFIELD_VISIBILITY))
+		dag_island_join_lookup(join, ob, NULL, ob->lay, dag_island_is_collider);
+
+	for (psys = ob->particlesystem.first; psys; psys = psys->next) {
+		ParticleSettings *part = psys->part;
+
+		if (part == NULL)
+			continue;
+
+		dag_island_join_effectors(join, ob, part->effector_weights);
+		dag_island_join_lookup(join, ob, NULL, ob->lay, dag_island_is_collider);
+
+		/* hair velocity smoothing uses the colliders of all layers */
+		if (psys->clmd)
+			dag_island_join_lookup(join, ob, NULL, 0, dag_island_is_collider);
+
+		if ((part->pd && (part->pd->flag & PFIELD_VISIBILITY)) ||
+		    (part->pd2 && (part->pd2->flag & PFIELD_VISIBILITY)))
+		{
+			dag_island_join_lookup(join, ob, NULL, ob->lay, dag_island_is_collider);
+		}
+	}
+
+	if (ob->soft) {
+		dag_island_join_effectors(join, ob, ob->soft->effector_weights);
+		dag_island_join_lookup(join, ob, NULL, ob->lay, dag_island_is_collider);
+	}
+
+	for (md = ob->modifiers.first; md; md = md->next) {
+		if (md->type == eModifierType_Cloth) {
+			ClothModifierData *clmd = (ClothModifierData *)md;
+
+			dag_island_join_effectors(join, ob, clmd->sim_parms->effector_weights);
+			dag_island_join_lookup(join, ob, clmd->coll_parms->group, ob->lay | scene->lay, dag_island_is_collider);
+		}
+		else if (md->type == eModifierType_Smoke) {
+			SmokeModifierData *smd = (SmokeModifierData *)md;
+
+			if ((smd->type & MOD_SMOKE_TYPE_DOMAIN) && smd->domain) {
+				SmokeDomainSettings *sds = smd->domain;
+
+				dag_island_join_effectors(join, ob, sds->effector_weights);
+				dag_island_join_lookup(join, ob, sds->fluid_group, ob->lay | scene->lay, dag_island_is_smoke);
+				dag_island_join_lookup(join, ob, sds->coll_group, ob->lay | scene->lay, dag_island_is_smoke);
+			}
+		}
+		else if (md->type == eModifierType_DynamicPaint) {
+			DynamicPaintModifierData *pmd = (DynamicPaintModifierData *)md;
+
+			if (pmd->canvas) {
+				DynamicPaintSurface *surface;
+
+				for (surface = pmd->canvas->surfaces.first; surface; surface = surface->next) {
+					dag_island_join_effectors(join, ob, surface->effector_weights);
+					dag_island_join_lookup(join, ob, surface->brush_group, 0, dag_island_is_brush);
+				}
+			}
+		}
+	}
+}
+
+/* Splits the objects of the scene into islands that have no relations
+ * between each other, so they can be updated at the same time. Bases
+ * keep the order of sce->base, which is sorted by DAG_scene_sort.
+ * Objects that simulations look up by group or layer end up in the
+ * island of the simulation, so no island reads from another one. */
+int DAG_scene_islands(Scene *sce, ListBase *r_islands)
+{
+	DagForest *dag = sce->theDag;
+	DagIslandJoin join;
+	DagNode *node;
+	DagAdjList *itA;
+	DagIsland **island_of;
+	Base *base;
+	int a, i, totindex, totisland = 0;
+
+	r_islands->first = r_islands->last = NULL;
+
+	if (dag == NULL || dag->numNodes == 0)
+		return 0;
+
+	/* one index per node, and per base that is not sorted yet */
+	totindex = dag->numNodes + BLI_countlist(&sce->base);
+
+	join.scene = sce;
+	join.index_hash = BLI_ghash_ptr_new("DAG_scene_islands gh");
+	join.parent = MEM_mallocN(sizeof(int) * totindex, "DAG_scene_islands parent");
+	island_of = MEM_callocN(sizeof(DagIsland *) * totindex, "DAG_scene_islands island_of");
+
+	for (a = 0; a < totindex; a++)
+		join.parent[a] = a;
+
+	/* indices are stored plus one, so they can't be NULL */
+	for (node = dag->DagNode.first, a = 0; node; node = node->next, a++)
+		BLI_ghash_insert(join.index_hash, node->ob, SET_INT_IN_POINTER(a + 1));
+
+	for (base = sce->base.first; base; base = base->next, a++) {
+		if (!BLI_ghash_haskey(join.index_hash, base->object))
+			BLI_ghash_insert(join.index_hash, base->object, SET_INT_IN_POINTER(a + 1));
+	}
+
+	/* join everything that is related, except through the scene itself */
+	for (node = dag->DagNode.first, a = 0; node; node = node->next, a++) {
+		if (node->type == ID_SCE)
+			continue;
+
+		for (itA = node->child; itA; itA = itA->next) {
+			if (itA->node->type == ID_SCE)
+				continue;
+
+			i = GET_INT_FROM_POINTER(BLI_ghash_lookup(join.index_hash, itA->node->ob)) - 1;
+			join.parent[dag_island_find(join.parent, a)] = dag_island_find(join.parent, i);
+		}
+	}
+
+	for (base = sce->base.first; base; base = base->next)
+		dag_island_join_simulation(&join, base->object);
+
+	for (base = sce->base.first; base; base = base->next) {
+		DagIsland *island;
+		LinkData *link;
+
+		i = GET_INT_FROM_POINTER(BLI_ghash_lookup(join.index_hash, base->object)) - 1;
+		i = dag_island_find(join.parent, i);
+		island = island_of[i];
+
+		if (island == NULL) {
+			island = MEM_callocN(sizeof(DagIsland), "DagIsland");
+			BLI_addtail(r_islands, island);
+			island_of[i] = island;
+			totisland++;
+		}
+
+		link = MEM_callocN(sizeof(LinkData), "DagIsland base");
+		link->data = base;
+		BLI_addtail(&island->bases, link);
+	}
+
+	MEM_freeN(island_of);
+	MEM_freeN(join.parent);
+	BLI_ghash_free(join.index_hash, NULL, NULL);
+
+	return totisland;
+}
+
+void DAG_islands_free(ListBase *islands)
+{
+	DagIsland *island;
+
+	for (island = islands->first; island; island = island->next)
+		BLI_freelistN(&island->bases);
+
+	BLI_freelistN(islands);
+}
+
 static void lib_id_recalc_tag(Main *bmain, ID *id)
 {
 	id->flag |= LIB_ID_RECALC;
@@ -165,19 +165,13 @@ void free_partdeflect(PartDeflect *pd)
 	if (pd->tex)
 		pd->tex->id.us--;
 
-	if (pd->rng)
-		BLI_rng_free(pd->rng);
-
 	MEM_freeN(pd);
 }
 
 static void precalculate_effector(EffectorCache *eff)
 {
 	unsigned int cfra = (unsigned int)(eff->scene->r.cfra >= 0 ? eff->scene->r.cfra : -eff->scene->r.cfra);
-	if (!eff->pd->rng)
-		eff->pd->rng = BLI_rng_new(eff->pd->seed + cfra);
-	else
-		BLI_rng_srandom(eff->pd->rng, eff->pd->seed + cfra);
+	eff->seed = eff->pd->seed + cfra;
 
 	if (eff->pd->forcefield == PFIELD_GUIDE && eff->ob->type==OB_CURVE) {
 		Curve *cu= eff->ob->data;
@@ -453,10 +447,10 @@ static float eff_calc_visibility(ListBase *colliders, EffectorCache *eff, Effect
 }
 
 // noise function for wind e.g.
-static float wind_func(struct RNG *rng, float strength)
+static float wind_func(unsigned int seed, float strength)
 {
-	int random = (BLI_rng_get_int(rng)+1) % 128; // max 2357
-	float force = BLI_rng_get_float(rng) + 1.0f;
+	int random = (int)(BLI_hash_frand(seed) * 128.0f);
+	float force = BLI_hash_frand(seed + 1) + 1.0f;
 	float ret;
 	float sign = 0;
 	
@@ -646,7 +640,6 @@ int get_effector_data(EffectorCache *eff, EffectorData *efd, EffectedPoint *poin
 	else {
 		/* use center of object for distance calculus */
 		Object *ob = eff->ob;
-		Object obcopy = *ob;
 
 		/* use z-axis as normal*/
 		normalize_v3_v3(efd->nor, ob->obmat[2]);
@@ -669,8 +662,6 @@ int get_effector_data(EffectorCache *eff, EffectorData *efd, EffectedPoint *poin
 		if (real_velocity)
 			copy_v3_v3(efd->vel, eff->velocity);
 
-		*eff->ob = obcopy;
-
 		efd->size = 0.0f;
 
 		ret = 1;
@@ -827,7 +818,6 @@ static void do_texture_effector(EffectorCache *eff, EffectorData *efd, EffectedP
 static void do_physical_effector(EffectorCache *eff, EffectorData *efd, EffectedPoint *point, float *total_force)
 {
 	PartDeflect *pd = eff->pd;
-	RNG *rng = pd->rng;
 	float force[3] = {0, 0, 0};
 	float temp[3];
 	float fac;
@@ -836,10 +826,20 @@ static void do_physical_effector(EffectorCache *eff, EffectorData *efd, Effected
 	float noise_factor = pd->f_noise;
 
 	if (noise_factor > 0.0f) {
-		strength += wind_func(rng, noise_factor);
+		/* noise only depends on the effected point, not on evaluation order,
+		 * so points can be evaluated from multiple threads deterministically */
+		unsigned int seed = eff->seed + (unsigned int)point->index * 4u;
+		int i;
+
+		for (i = 0; i < 3; i++) {
+			union { float f; unsigned int u; } co = {point->loc[i]};
+			seed = seed * 31u + co.u;
+		}
+
+		strength += wind_func(seed, noise_factor);
 
 		if (ELEM(pd->forcefield, PFIELD_HARMONIC, PFIELD_DRAG))
-			damp += wind_func(rng, noise_factor);
+			damp += wind_func(seed + 2, noise_factor);
 	}
 
 	copy_v3_v3(force, efd->vec_to_point);
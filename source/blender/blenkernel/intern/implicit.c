@@ -52,6 +52,13 @@
 #  define CLOTH_OPENMP_LIMIT 512
 #endif
 
+#ifdef __SSE__
+#  include <xmmintrin.h>
+#endif
+
+/* dot products are summed in chunks of this many vertices */
+#define CLOTH_DOT_CHUNK 1024
+
 #if 0  /* debug timing */
 #ifdef _WIN32
 #include <windows.h>
@@ -222,9 +229,10 @@ DO_INLINE void zero_lfvector(float (*to)[3], unsigned int verts)
 /* multiply long vector with scalar*/
 DO_INLINE void mul_lfvectorS(float (*to)[3], float (*fLongVector)[3], float scalar, unsigned int verts)
 {
-	unsigned int i = 0;
+	int i = 0;
 
-	for (i = 0; i < verts; i++) {
+#pragma omp parallel for private(i) schedule(static) if (verts > CLOTH_OPENMP_LIMIT)
+	for (i = 0; i < (int)verts; i++) {
 		mul_fvector_S(to[i], fLongVector[i], scalar);
 	}
 }
@@ -237,27 +245,70 @@ DO_INLINE void submul_lfvectorS(float (*to)[3], float (*fLongVector)[3], float s
 		VECSUBMUL(to[i], fLongVector[i], scalar);
 	}
 }
-/* dot product for big vector */
-DO_INLINE float dot_lfvector(float (*fLongVectorA)[3], float (*fLongVectorB)[3], unsigned int verts)
-{
-	long i = 0;
-	float temp = 0.0;
-// XXX brecht, disabled this for now (first schedule line was already disabled),
-// due to non-commutative nature of floating point ops this makes the sim give
-// different results each time you run it!
-// schedule(guided, 2)
-//#pragma omp parallel for reduction(+: temp) if (verts > CLOTH_OPENMP_LIMIT)
-	for (i = 0; i < (long)verts; i++) {
+/* dot product for a part of big vectors */
+DO_INLINE float dot_lfvector_chunk(float (*fLongVectorA)[3], float (*fLongVectorB)[3], unsigned int verts)
+{
+	float temp = 0.0f;
+#ifdef __SSE__
+	const float *a = (const float *)fLongVectorA, *b = (const float *)fLongVectorB;
+	unsigned int i, n = 3 * verts;
+	float lanes[4];
+	__m128 sum = _mm_setzero_ps();
+
+	for (i = 0; i + 4 <= n; i += 4)
+		sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+
+	_mm_storeu_ps(lanes, sum);
+	temp = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+
+	for (; i < n; i++)
+		temp += a[i] * b[i];
+#else
+	unsigned int i;
+
+	for (i = 0; i < verts; i++) {
 		temp += dot_v3v3(fLongVectorA[i], fLongVectorB[i]);
 	}
+#endif
+	return temp;
+}
+/* dot product for big vector */
+/* floating point addition isn't associative, so a plain omp reduction gives
+ * different results each run. Instead chunks of fixed size are summed in
+ * parallel and the partial sums are added in order, which gives the same
+ * result for any number of threads. */
+static float dot_lfvector(float (*fLongVectorA)[3], float (*fLongVectorB)[3], unsigned int verts)
+{
+	int c, totchunk = (int)((verts + CLOTH_DOT_CHUNK - 1) / CLOTH_DOT_CHUNK);
+	float partial_stack[64], *partial;
+	float temp = 0.0f;
+
+	if (totchunk <= 1)
+		return dot_lfvector_chunk(fLongVectorA, fLongVectorB, verts);
+
+	partial = (totchunk <= 64) ? partial_stack : MEM_mallocN(sizeof(float) * totchunk, "cloth_implicit_dot");
+
+#pragma omp parallel for private(c) schedule(static) if (verts > CLOTH_OPENMP_LIMIT)
+	for (c = 0; c < totchunk; c++) {
+		unsigned int first = (unsigned int)c * CLOTH_DOT_CHUNK;
+		partial[c] = dot_lfvector_chunk(fLongVectorA + first, fLongVectorB + first, MIN2(CLOTH_DOT_CHUNK, verts - first));
+	}
+
+	for (c = 0; c < totchunk; c++)
+		temp += partial[c];
+
+	if (partial != partial_stack)
+		MEM_freeN(partial);
+
 	return temp;
 }
 /* A = B + C  --> for big vector */
 DO_INLINE void add_lfvector_lfvector(float (*to)[3], float (*fLongVectorA)[3], float (*fLongVectorB)[3], unsigned int verts)
 {
-	unsigned int i = 0;
+	int i = 0;
 
-	for (i = 0; i < verts; i++) {
+#pragma omp parallel for private(i) schedule(static) if (verts > CLOTH_OPENMP_LIMIT)
+	for (i = 0; i < (int)verts; i++) {
 		VECADD(to[i], fLongVectorA[i], fLongVectorB[i]);
 	}
 
@@ -265,37 +316,70 @@ DO_INLINE void add_lfvector_lfvector(float (*to)[3], float (*fLongVectorA)[3], f
 /* A = B + C * float --> for big vector */
 DO_INLINE void add_lfvector_lfvectorS(float (*to)[3], float (*fLongVectorA)[3], float (*fLongVectorB)[3], float bS, unsigned int verts)
 {
-	unsigned int i = 0;
+#ifdef __SSE__
+	/* the vectors are plain float arrays */
+	float *t = (float *)to;
+	const float *a = (const float *)fLongVectorA, *b = (const float *)fLongVectorB;
+	int i, n = 3 * (int)verts, n4 = n & ~3;
 
-	for (i = 0; i < verts; i++) {
+#pragma omp parallel for private(i) schedule(static) if (verts > CLOTH_OPENMP_LIMIT)
+	for (i = 0; i < n4; i += 4) {
+		_mm_storeu_ps(t + i, _mm_add_ps(_mm_loadu_ps(a + i), _mm_mul_ps(_mm_loadu_ps(b + i), _mm_set1_ps(bS))));
+	}
+
+	for (i = n4; i < n; i++)
+		t[i] = a[i] + b[i] * bS;
+#else
+	int i = 0;
+
+#pragma omp parallel for private(i) schedule(static) if (verts > CLOTH_OPENMP_LIMIT)
+	for (i = 0; i < (int)verts; i++) {
 		VECADDS(to[i], fLongVectorA[i], fLongVectorB[i], bS);
 
 	}
+#endif
 }
 /* A = B * float + C * float --> for big vector */
 DO_INLINE void add_lfvectorS_lfvectorS(float (*to)[3], float (*fLongVectorA)[3], float aS, float (*fLongVectorB)[3], float bS, unsigned int verts)
 {
-	unsigned int i = 0;
+	int i = 0;
 
-	for (i = 0; i < verts; i++) {
+#pragma omp parallel for private(i) schedule(static) if (verts > CLOTH_OPENMP_LIMIT)
+	for (i = 0; i < (int)verts; i++) {
 		VECADDSS(to[i], fLongVectorA[i], aS, fLongVectorB[i], bS);
 	}
 }
 /* A = B - C * float --> for big vector */
 DO_INLINE void sub_lfvector_lfvectorS(float (*to)[3], float (*fLongVectorA)[3], float (*fLongVectorB)[3], float bS, unsigned int verts)
 {
-	unsigned int i = 0;
-	for (i = 0; i < verts; i++) {
-		VECSUBS(to[i], fLongVectorA[i], fLongVectorB[i], bS);
+#ifdef __SSE__
+	float *t = (float *)to;
+	const float *a = (const float *)fLongVectorA, *b = (const float *)fLongVectorB;
+	int i, n = 3 * (int)verts, n4 = n & ~3;
+
+#pragma omp parallel for private(i) schedule(static) if (verts > CLOTH_OPENMP_LIMIT)
+	for (i = 0; i < n4; i += 4) {
+		_mm_storeu_ps(t + i, _mm_sub_ps(_mm_loadu_ps(a + i), _mm_mul_ps(_mm_loadu_ps(b + i), _mm_set1_ps(bS))));
 	}
 
+	for (i = n4; i < n; i++)
+		t[i] = a[i] - b[i] * bS;
+#else
+	int i = 0;
+
+#pragma omp parallel for private(i) schedule(static) if (verts > CLOTH_OPENMP_LIMIT)
+	for (i = 0; i < (int)verts; i++) {
+		VECSUBS(to[i], fLongVectorA[i], fLongVectorB[i], bS);
+	}
+#endif
 }
 /* A = B - C --> for big vector */
 DO_INLINE void sub_lfvector_lfvector(float (*to)[3], float (*fLongVectorA)[3], float (*fLongVectorB)[3], unsigned int verts)
 {
-	unsigned int i = 0;
+	int i = 0;
 
-	for (i = 0; i < verts; i++) {
+#pragma omp parallel for private(i) schedule(static) if (verts > CLOTH_OPENMP_LIMIT)
+	for (i = 0; i < (int)verts; i++) {
 		sub_v3_v3v3(to[i], fLongVectorA[i], fLongVectorB[i]);
 	}
 
@@ -573,45 +657,90 @@ DO_INLINE void mul_bfmatrix_S(fmatrix3x3 *matrix, float scalar)
 	}
 }
 
+/* Block rows of the big matrices, which all have the same structure.
+ * The blocks of row i are block[start[i]] to block[start[i + 1] - 1], to be
+ * multiplied with vertex col[]. Spring blocks are in the rows of both their
+ * vertices, so all rows can be multiplied at the same time. */
+typedef struct bfmatrixRows {
+	unsigned int vcount;
+	unsigned int *start, *col, *block;
+} bfmatrixRows;
+
+static bfmatrixRows *create_bfmatrix_rows(fmatrix3x3 *matrix)
+{
+	unsigned int vcount = matrix[0].vcount, scount = matrix[0].scount;
+	unsigned int i, *fill;
+	bfmatrixRows *rows = MEM_callocN(sizeof(bfmatrixRows), "cloth_implicit_rows");
+
+	rows->vcount = vcount;
+	rows->start = MEM_callocN(sizeof(unsigned int) * (vcount + 1), "cloth_implicit_rows start");
+	rows->col = MEM_mallocN(sizeof(unsigned int) * MAX2(vcount + 2 * scount, 1), "cloth_implicit_rows col");
+	rows->block = MEM_mallocN(sizeof(unsigned int) * MAX2(vcount + 2 * scount, 1), "cloth_implicit_rows block");
+
+	/* one diagonal block per row, every spring in two rows */
+	for (i = 0; i < vcount; i++)
+		rows->start[i + 1]++;
+	for (i = vcount; i < vcount + scount; i++) {
+		rows->start[matrix[i].r + 1]++;
+		rows->start[matrix[i].c + 1]++;
+	}
+	for (i = 0; i < vcount; i++)
+		rows->start[i + 1] += rows->start[i];
+
+	fill = MEM_mallocN(sizeof(unsigned int) * MAX2(vcount, 1), "cloth_implicit_rows fill");
+	memcpy(fill, rows->start, sizeof(unsigned int) * vcount);
+
+	for (i = 0; i < vcount; i++) {
+		rows->col[fill[i]] = i;
+		rows->block[fill[i]++] = i;
+	}
+	for (i = vcount; i < vcount + scount; i++) {
+		rows->col[fill[matrix[i].r]] = matrix[i].c;
+		rows->block[fill[matrix[i].r]++] = i;
+		rows->col[fill[matrix[i].c]] = matrix[i].r;
+		rows->block[fill[matrix[i].c]++] = i;
+	}
+
+	MEM_freeN(fill);
+
+	return rows;
+}
+static void del_bfmatrix_rows(bfmatrixRows *rows)
+{
+	if (rows != NULL) {
+		MEM_freeN(rows->start);
+		MEM_freeN(rows->col);
+		MEM_freeN(rows->block);
+		MEM_freeN(rows);
+	}
+}
+
 /* SPARSE SYMMETRIC multiply big matrix with long vector*/
 /* STATUS: verified */
-DO_INLINE void mul_bfmatrix_lfvector( float (*to)[3], fmatrix3x3 *from, lfVector *fLongVector)
+static void mul_bfmatrix_lfvector( float (*to)[3], fmatrix3x3 *from, bfmatrixRows *rows, lfVector *fLongVector)
 {
-	unsigned int i = 0;
-	unsigned int vcount = from[0].vcount;
-	lfVector *temp = create_lfvector(vcount);
-	
-	zero_lfvector(to, vcount);
+	int i = 0;
 
-#pragma omp parallel sections private(i) if (vcount > CLOTH_OPENMP_LIMIT)
-	{
-#pragma omp section
-		{
-			for (i = from[0].vcount; i < from[0].vcount+from[0].scount; i++) {
-				muladd_fmatrix_fvector(to[from[i].c], from[i].m, fLongVector[from[i].r]);
-			}
-		}
-#pragma omp section
-		{
-			for (i = 0; i < from[0].vcount+from[0].scount; i++) {
-				muladd_fmatrix_fvector(temp[from[i].r], from[i].m, fLongVector[from[i].c]);
-			}
-		}
+#pragma omp parallel for private(i) schedule(static) if (rows->vcount > CLOTH_OPENMP_LIMIT)
+	for (i = 0; i < (int)rows->vcount; i++) {
+		float sum[3] = {0.0f, 0.0f, 0.0f};
+		unsigned int j;
+
+		for (j = rows->start[i]; j < rows->start[i + 1]; j++)
+			muladd_fmatrix_fvector(sum, from[rows->block[j]].m, fLongVector[rows->col[j]]);
+
+		copy_v3_v3(to[i], sum);
 	}
-	add_lfvector_lfvector(to, to, temp, from[0].vcount);
-	
-	del_lfvector(temp);
-	
-	
 }
 
 /* SPARSE SYMMETRIC multiply big matrix with long vector (for diagonal preconditioner) */
 /* STATUS: verified */
 DO_INLINE void mul_prevfmatrix_lfvector( float (*to)[3], fmatrix3x3 *from, lfVector *fLongVector)
 {
-	unsigned int i = 0;
+	int i = 0;
 	
-	for (i = 0; i < from[0].vcount; i++) {
+#pragma omp parallel for private(i) schedule(static) if (from[0].vcount > CLOTH_OPENMP_LIMIT)
+	for (i = 0; i < (int)from[0].vcount; i++) {
 		mul_fmatrix_fvector(to[from[i].r], from[i].m, fLongVector[from[i].c]);
 	}
 }
@@ -702,6 +831,7 @@ DO_INLINE void subadd_bfmatrixS_bfmatrixS( fmatrix3x3 *to, fmatrix3x3 *from, flo
 typedef struct Implicit_Data  {
 	lfVector *X, *V, *Xnew, *Vnew, *olddV, *F, *B, *dV, *z;
 	fmatrix3x3 *A, *dFdV, *dFdX, *S, *P, *Pinv, *bigI, *M; 
+	bfmatrixRows *rows; /* structure of all big matrices except S */
 } Implicit_Data;
 
 /* Init constraint matrix */
@@ -799,6 +929,8 @@ int implicit_init(Object *UNUSED(ob), ClothModifierData *clmd)
 	
 	initdiag_bfmatrix(id->bigI, I);
 
+	id->rows = create_bfmatrix_rows(id->A);
+
 	for (i = 0; i < cloth->numverts; i++) {
 		copy_v3_v3(id->X[i], verts[i].x);
 	}
@@ -824,6 +956,7 @@ int	implicit_free(ClothModifierData *clmd)
 			del_bfmatrix(id->Pinv);
 			del_bfmatrix(id->bigI);
 			del_bfmatrix(id->M);
+			del_bfmatrix_rows(id->rows);
 
 			del_lfvector(id->X);
 			del_lfvector(id->Xnew);
@@ -889,7 +1022,7 @@ DO_INLINE void filter(lfVector *V, fmatrix3x3 *S)
 	}
 }
 
-static int  cg_filtered(lfVector *ldV, fmatrix3x3 *lA, lfVector *lB, lfVector *z, fmatrix3x3 *S)
+static int UNUSED_FUNCTION(cg_filtered)(lfVector *ldV, fmatrix3x3 *lA, bfmatrixRows *rows, lfVector *lB, lfVector *z, fmatrix3x3 *S)
 {
 	// Solves for unknown X in equation AX=B
 	unsigned int conjgrad_loopcount=0, conjgrad_looplimit=100;
@@ -909,7 +1042,7 @@ static int  cg_filtered(lfVector *ldV, fmatrix3x3 *lA, lfVector *lB, lfVector *z
 
 	// r = B - Mul(tmp, A, X);    // just use B if X known to be zero
 	cp_lfvector(r, lB, numverts);
-	mul_bfmatrix_lfvector(tmp, lA, ldV);
+	mul_bfmatrix_lfvector(tmp, lA, rows, ldV);
 	sub_lfvector_lfvector(r, r, tmp, numverts);
 
 	filter(r, S);
@@ -921,7 +1054,7 @@ static int  cg_filtered(lfVector *ldV, fmatrix3x3 *lA, lfVector *lB, lfVector *z
 
 	while (s>starget && conjgrad_loopcount < conjgrad_looplimit) {
 		// Mul(q, A, d); // q = A*d;
-		mul_bfmatrix_lfvector(q, lA, d);
+		mul_bfmatrix_lfvector(q, lA, rows, d);
 
 		filter(q, S);
 
@@ -957,15 +1090,19 @@ static int  cg_filtered(lfVector *ldV, fmatrix3x3 *lA, lfVector *lB, lfVector *z
 // block diagonalizer
 DO_INLINE void BuildPPinv(fmatrix3x3 *lA, fmatrix3x3 *P, fmatrix3x3 *Pinv)
 {
-	unsigned int i = 0;
+	int i = 0;
 	
 	// Take only the diagonal blocks of A
-// #pragma omp parallel for private(i) if (lA[0].vcount > CLOTH_OPENMP_LIMIT)
-	for (i = 0; i<lA[0].vcount; i++) {
+#pragma omp parallel for private(i) schedule(static) if (lA[0].vcount > CLOTH_OPENMP_LIMIT)
+	for (i = 0; i < (int)lA[0].vcount; i++) {
 		// block diagonalizer
 		cp_fmatrix(P[i].m, lA[i].m);
-		inverse_fmatrix(Pinv[i].m, P[i].m);
-		
+
+		/* singular blocks are left unpreconditioned */
+		if (det_fmatrix(P[i].m) != 0.0f)
+			inverse_fmatrix(Pinv[i].m, P[i].m);
+		else
+			cp_fmatrix(Pinv[i].m, I);
 	}
 }
 #if 0
@@ -1038,34 +1175,28 @@ static int cg_filtered_pre(lfVector *dv, fmatrix3x3 *lA, lfVector *lB, lfVector
 	return iterations<conjgrad_looplimit;
 }
 */
+#endif
 // version 1.4
-static int cg_filtered_pre(lfVector *dv, fmatrix3x3 *lA, lfVector *lB, lfVector *z, fmatrix3x3 *S, fmatrix3x3 *P, fmatrix3x3 *Pinv, fmatrix3x3 *bigI)
+/* block jacobi preconditioned conjugate gradient, it stops at the same
+ * residual reduction as cg_filtered, measured in the preconditioned norm */
+static int cg_filtered_pre(lfVector *dv, fmatrix3x3 *lA, bfmatrixRows *rows, lfVector *lB, lfVector *z, fmatrix3x3 *S, fmatrix3x3 *P, fmatrix3x3 *Pinv, fmatrix3x3 *UNUSED(bigI))
 {
 	unsigned int numverts = lA[0].vcount, iterations = 0, conjgrad_looplimit=100;
-	float delta0 = 0, deltaNew = 0, deltaOld = 0, alpha = 0, tol = 0;
+	float conjgrad_epsilon=0.0001f;
+	float delta0 = 0, deltaNew = 0, deltaOld = 0, alpha = 0;
 	lfVector *r = create_lfvector(numverts);
 	lfVector *p = create_lfvector(numverts);
 	lfVector *s = create_lfvector(numverts);
 	lfVector *h = create_lfvector(numverts);
-	lfVector *bhat = create_lfvector(numverts);
-	lfVector *btemp = create_lfvector(numverts);
 	
 	BuildPPinv(lA, P, Pinv);
 	
-	initdiag_bfmatrix(bigI, I);
-	sub_bfmatrix_Smatrix(bigI, bigI, S);
-	
 	// x = Sx_0+(I-S)z
 	filter(dv, S);
 	add_lfvector_lfvector(dv, dv, z, numverts);
 	
-	// b_hat = S(b-A(I-S)z)
-	mul_bfmatrix_lfvector(r, lA, z);
-	mul_bfmatrix_lfvector(bhat, bigI, r);
-	sub_lfvector_lfvector(bhat, lB, bhat, numverts);
-	
 	// r = S(b-Ax)
-	mul_bfmatrix_lfvector(r, lA, dv);
+	mul_bfmatrix_lfvector(r, lA, rows, dv);
 	sub_lfvector_lfvector(r, lB, r, numverts);
 	filter(r, S);
 	
@@ -1073,38 +1204,19 @@ static int cg_filtered_pre(lfVector *dv, fmatrix3x3 *lA, lfVector *lB, lfVector
 	mul_prevfmatrix_lfvector(p, Pinv, r);
 	filter(p, S);
 	
-	// delta0 = bhat^TP^-1bhat
-	mul_prevfmatrix_lfvector(btemp, Pinv, bhat);
-	delta0 = dot_lfvector(bhat, btemp, numverts);
-	
-	// deltaNew = r^TP
+	// deltaNew = r^TSP^-1r
 	deltaNew = dot_lfvector(r, p, numverts);
 	
-	/*
-	filter(dv, S);
-	add_lfvector_lfvector(dv, dv, z, numverts);
-	
-	mul_bfmatrix_lfvector(r, lA, dv);
-	sub_lfvector_lfvector(r, lB, r, numverts);
-	filter(r, S);
-	
-	mul_prevfmatrix_lfvector(p, Pinv, r);
-	filter(p, S);
-	
-	deltaNew = dot_lfvector(r, p, numverts);
-	
-	delta0 = deltaNew * sqrt(conjgrad_epsilon);
-	*/
+	// same stop criterion as cg_filtered: s > s_0 * sqrt(epsilon)
+	delta0 = deltaNew * sqrtf(conjgrad_epsilon);
 	
 	// itstart();
 	
-	tol = (0.01*0.2);
-	
-	while ((deltaNew > delta0*tol*tol) && (iterations < conjgrad_looplimit))
+	while ((deltaNew > delta0) && (iterations < conjgrad_looplimit))
 	{
 		iterations++;
 		
-		mul_bfmatrix_lfvector(s, lA, p);
+		mul_bfmatrix_lfvector(s, lA, rows, p);
 		filter(s, S);
 		
 		alpha = deltaNew / dot_lfvector(p, s, numverts);
@@ -1129,8 +1241,6 @@ static int cg_filtered_pre(lfVector *dv, fmatrix3x3 *lA, lfVector *lB, lfVector
 	// itend();
 	// printf("cg_filtered_pre time: %f\n", (float)itval());
 	
-	del_lfvector(btemp);
-	del_lfvector(bhat);
 	del_lfvector(h);
 	del_lfvector(s);
 	del_lfvector(p);
@@ -1140,7 +1250,6 @@ static int cg_filtered_pre(lfVector *dv, fmatrix3x3 *lA, lfVector *lB, lfVector
 	
 	return iterations<conjgrad_looplimit;
 }
-#endif
 
 // outer product is NOT cross product!!!
 DO_INLINE void dfdx_spring_type1(float to[3][3], float extent[3], float length, float L, float dot, float k)
@@ -1680,7 +1789,7 @@ static void cloth_calc_force(ClothModifierData *clmd, float UNUSED(frame), lfVec
 	// printf("\n");
 }
 
-static void simulate_implicit_euler(lfVector *Vnew, lfVector *UNUSED(lX), lfVector *lV, lfVector *lF, fmatrix3x3 *dFdV, fmatrix3x3 *dFdX, float dt, fmatrix3x3 *A, lfVector *B, lfVector *dV, fmatrix3x3 *S, lfVector *z, lfVector *olddV, fmatrix3x3 *UNUSED(P), fmatrix3x3 *UNUSED(Pinv), fmatrix3x3 *M, fmatrix3x3 *UNUSED(bigI))
+static void simulate_implicit_euler(lfVector *Vnew, lfVector *UNUSED(lX), lfVector *lV, lfVector *lF, fmatrix3x3 *dFdV, fmatrix3x3 *dFdX, float dt, fmatrix3x3 *A, lfVector *B, lfVector *dV, fmatrix3x3 *S, lfVector *z, lfVector *olddV, fmatrix3x3 *P, fmatrix3x3 *Pinv, fmatrix3x3 *M, fmatrix3x3 *bigI, bfmatrixRows *rows)
 {
 	unsigned int numverts = dFdV[0].vcount;
 
@@ -1691,14 +1800,14 @@ static void simulate_implicit_euler(lfVector *Vnew, lfVector *UNUSED(lX), lfVect
 	
 	subadd_bfmatrixS_bfmatrixS(A, dFdV, dt, dFdX, (dt*dt));
 
-	mul_bfmatrix_lfvector(dFdXmV, dFdX, lV);
+	mul_bfmatrix_lfvector(dFdXmV, dFdX, rows, lV);
 
 	add_lfvectorS_lfvectorS(B, lF, dt, dFdXmV, (dt*dt), numverts);
 
 	// itstart();
 
-	cg_filtered(dV, A, B, z, S); /* conjugate gradient algorithm to solve Ax=b */
-	// cg_filtered_pre(dV, A, B, z, S, P, Pinv, bigI);
+	// cg_filtered(dV, A, rows, B, z, S); /* conjugate gradient algorithm to solve Ax=b */
+	cg_filtered_pre(dV, A, rows, B, z, S, P, Pinv, bigI);
 
 	// itend();
 	// printf("cg_filtered calc time: %f\n", (float)itval());
@@ -1825,7 +1934,7 @@ int implicit_solver(Object *ob, float frame, ClothModifierData *clmd, ListBase *
 		cloth_calc_force(clmd, frame, id->F, id->X, id->V, id->dFdV, id->dFdX, effectors, step, id->M);
 		
 		// calculate new velocity
-		simulate_implicit_euler(id->Vnew, id->X, id->V, id->F, id->dFdV, id->dFdX, dt, id->A, id->B, id->dV, id->S, id->z, id->olddV, id->P, id->Pinv, id->M, id->bigI);
+		simulate_implicit_euler(id->Vnew, id->X, id->V, id->F, id->dFdV, id->dFdX, dt, id->A, id->B, id->dV, id->S, id->z, id->olddV, id->P, id->Pinv, id->M, id->bigI, id->rows);
 		
 		// advance positions
 		add_lfvector_lfvectorS(id->Xnew, id->X, id->Vnew, dt, numverts);
@@ -1899,7 +2008,7 @@ int implicit_solver(Object *ob, float frame, ClothModifierData *clmd, ListBase *
 				// calculate 
 				cloth_calc_force(clmd, frame, id->F, id->X, id->V, id->dFdV, id->dFdX, effectors, step+dt, id->M);
 				
-				simulate_implicit_euler(id->Vnew, id->X, id->V, id->F, id->dFdV, id->dFdX, dt / 2.0f, id->A, id->B, id->dV, id->S, id->z, id->olddV, id->P, id->Pinv, id->M, id->bigI);
+				simulate_implicit_euler(id->Vnew, id->X, id->V, id->F, id->dFdV, id->dFdX, dt / 2.0f, id->A, id->B, id->dV, id->S, id->z, id->olddV, id->P, id->Pinv, id->M, id->bigI, id->rows);
 			}
 		}
 		else {
@@ -63,6 +63,7 @@
 #include "BLI_math.h"
 #include "BLI_utildefines.h"
 #include "BLI_linklist.h"
+#include "BLI_threads.h"
 
 #include "BKE_pbvh.h"
 #include "BKE_main.h"
@@ -1072,6 +1073,9 @@ static ParticleSystem *copy_particlesystem(ParticleSystem *psys)
 	psysn->frand = NULL;
 	psysn->pdd = NULL;
 	psysn->effectors = NULL;
+	psysn->tree = NULL;
+	psysn->hashgrid = NULL;
+	psysn->state_arrays = NULL;
 	
 	psysn->pathcachebufs.first = psysn->pathcachebufs.last = NULL;
 	psysn->childcachebufs.first = psysn->childcachebufs.last = NULL;
@@ -1277,8 +1281,6 @@ static Object *object_copy_do(Object *ob, int copy_caches)
 		obn->pd = MEM_dupallocN(ob->pd);
 		if (obn->pd->tex)
 			id_us_plus(&(obn->pd->tex->id));
-		if (obn->pd->rng)
-			obn->pd->rng = MEM_dupallocN(ob->pd->rng);
 	}
 	obn->soft = copy_softbody(ob->soft, copy_caches);
 	obn->bsoft = copy_bulletsoftbody(ob->bsoft);
@@ -2728,6 +2730,9 @@ void BKE_object_handle_update(Scene *scene, Object *ob)
 			 * However, not doing anything (or trying to hack around this lack) is not an option 
 			 * anymore, especially due to Cycles [#31834] 
 			 */
+			/* materials and lamps can be shared by objects updated in threads */
+			BLI_lock_thread(LOCK_DRIVERS);
+
 			if (ob->totcol) {
 				int a;
 				
@@ -2742,6 +2747,8 @@ void BKE_object_handle_update(Scene *scene, Object *ob)
 			}
 			else if (ob->type == OB_LAMP)
 				lamp_drivers_update(scene, ob->data, ctime);
+
+			BLI_unlock_thread(LOCK_DRIVERS);
 			
 			/* particles */
 			if (ob->particlesystem.first) {
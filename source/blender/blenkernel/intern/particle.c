@@ -52,6 +52,7 @@
 #include "BLI_math.h"
 #include "BLI_utildefines.h"
 #include "BLI_kdtree.h"
+#include "BLI_hashgrid.h"
 #include "BLI_rand.h"
 #include "BLI_threads.h"
 #include "BLI_linklist.h"
@@ -500,6 +501,8 @@ void psys_free_particles(ParticleSystem *psys)
 		psys->particles = NULL;
 		psys->totpart = 0;
 	}
+
+	psys_free_state_arrays(psys);
 }
 void psys_free_pdd(ParticleSystem *psys)
 {
@@ -524,6 +527,30 @@ void psys_free_pdd(ParticleSystem *psys)
 		psys->pdd->tot_vec_size = 0;
 	}
 }
+/* Returns the state arrays if they hold the state at cfra, NULL otherwise. */
+ParticleStateArrays *psys_get_state_arrays(ParticleSystem *psys, float cfra)
+{
+	ParticleStateArrays *soa = psys->state_arrays;
+
+	if (soa && soa->valid && soa->cfra == cfra && soa->totpart == psys->totpart)
+		return soa;
+
+	return NULL;
+}
+void psys_free_state_arrays(ParticleSystem *psys)
+{
+	ParticleStateArrays *soa = psys->state_arrays;
+
+	if (soa) {
+		MEM_freeN(soa->co);
+		MEM_freeN(soa->vel);
+		MEM_freeN(soa->rot);
+		MEM_freeN(soa->ave);
+		MEM_freeN(soa->alive);
+		MEM_freeN(soa);
+		psys->state_arrays = NULL;
+	}
+}
 /* free everything */
 void psys_free(Object *ob, ParticleSystem *psys)
 {	
@@ -569,7 +596,7 @@ void psys_free(Object *ob, ParticleSystem *psys)
 		
 		BLI_freelistN(&psys->targets);
 
-		BLI_bvhtree_free(psys->bvhtree);
+		BLI_hashgrid_free(psys->hashgrid);
 		BLI_kdtree_free(psys->tree);
  
 		if (psys->fluid_springs)
@@ -44,6 +44,15 @@
 #include <omp.h>
 #endif
 
+/* Threaded particle loops use the per thread random generators of BLI_rand,
+ * reseeded for every particle so results don't depend on the thread count. */
+#ifdef _OPENMP
+#  define PSYS_OMP_THREADS MIN2(omp_get_max_threads(), BLENDER_MAX_THREADS)
+#  define PSYS_THREAD_NUM omp_get_thread_num()
+#else
+#  define PSYS_THREAD_NUM 0
+#endif
+
 #include "MEM_guardedalloc.h"
 
 #include "DNA_anim_types.h"
@@ -69,6 +78,7 @@
 #include "BLI_blenlib.h"
 #include "BLI_kdtree.h"
 #include "BLI_kdopbvh.h"
+#include "BLI_hashgrid.h"
 #include "BLI_threads.h"
 #include "BLI_utildefines.h"
 #include "BLI_linklist.h"
@@ -189,6 +199,8 @@ void psys_reset(ParticleSystem *psys, int mode)
 	/* reset point cache */
 	BKE_ptcache_invalidate(psys->pointcache);
 
+	psys_free_state_arrays(psys);
+
 	if (psys->fluid_springs) {
 		MEM_freeN(psys->fluid_springs);
 		psys->fluid_springs = NULL;
@@ -2076,34 +2088,82 @@ void psys_get_pointcache_start_end(Scene *scene, ParticleSystem *psys, int *sfra
 /************************************************/
 /*			Effectors							*/
 /************************************************/
-static void psys_update_particle_bvhtree(ParticleSystem *psys, float cfra)
+/* State arrays holding the particle positions at the start of the step to cfra,
+ * if the system hasn't been stepped to cfra yet and nothing changed since the
+ * last step. Otherwise positions come from prev_state or state, see below. */
+static ParticleStateArrays *psys_tree_state_arrays(ParticleSystem *psys, float cfra)
+{
+	return (psys->cfra != cfra) ? psys_get_state_arrays(psys, psys->cfra) : NULL;
+}
+static void psys_update_particle_hashgrid(ParticleSystem *psys, float cfra, float cellsize)
 {
 	if (psys) {
 		PARTICLE_P;
 		int totpart = 0;
 
-		if (!psys->bvhtree || psys->bvhtree_frame != cfra) {
-			LOOP_SHOWN_PARTICLES {
-				totpart++;
+		if (!psys->hashgrid || psys->hashgrid_frame != cfra) {
+			ParticleStateArrays *soa = psys_tree_state_arrays(psys, cfra);
+
+			if (soa) {
+				for (p = 0; p < soa->totpart; p++)
+					totpart += soa->alive[p];
+			}
+			else {
+				LOOP_SHOWN_PARTICLES {
+					totpart++;
+				}
 			}
 			
-			BLI_bvhtree_free(psys->bvhtree);
-			psys->bvhtree = BLI_bvhtree_new(totpart, 0.0, 4, 6);
+			BLI_hashgrid_free(psys->hashgrid);
+			psys->hashgrid = BLI_hashgrid_new(totpart, MAX2(cellsize, 0.0001f));
 
-			LOOP_SHOWN_PARTICLES {
-				if (pa->alive == PARS_ALIVE) {
-					if (pa->state.time == cfra)
-						BLI_bvhtree_insert(psys->bvhtree, p, pa->prev_state.co, 1);
-					else
-						BLI_bvhtree_insert(psys->bvhtree, p, pa->state.co, 1);
+			if (soa) {
+				for (p = 0; p < soa->totpart; p++) {
+					if (soa->alive[p])
+						BLI_hashgrid_insert(psys->hashgrid, p, soa->co[p]);
+				}
+			}
+			else {
+				LOOP_SHOWN_PARTICLES {
+					if (pa->alive == PARS_ALIVE) {
+						if (pa->state.time == cfra)
+							BLI_hashgrid_insert(psys->hashgrid, p, pa->prev_state.co);
+						else
+							BLI_hashgrid_insert(psys->hashgrid, p, pa->state.co);
+					}
 				}
 			}
-			BLI_bvhtree_balance(psys->bvhtree);
+			BLI_hashgrid_balance(psys->hashgrid);
 
-			psys->bvhtree_frame = cfra;
+			psys->hashgrid_frame = cfra;
 		}
 	}
 }
+/* Dynamic particle indices in hash grid order, so particles that are close in
+ * space are also handled close in time, followed by the ones not in the grid. */
+static int *psys_hashgrid_particle_order(ParticleSystem *psys)
+{
+	int *order = MEM_mallocN(sizeof(int) * MAX2(psys->totpart, 1), "psys_hashgrid_particle_order");
+	char *done = MEM_callocN(sizeof(char) * MAX2(psys->totpart, 1), "psys_hashgrid_particle_order done");
+	int i, p, tot = 0;
+
+	if (psys->hashgrid) {
+		for (i = 0; i < BLI_hashgrid_size(psys->hashgrid); i++) {
+			p = BLI_hashgrid_index(psys->hashgrid, i);
+			order[tot++] = p;
+			done[p] = 1;
+		}
+	}
+
+	for (p = 0; p < psys->totpart; p++) {
+		if (!done[p])
+			order[tot++] = p;
+	}
+
+	MEM_freeN(done);
+
+	return order;
+}
 void psys_update_particle_tree(ParticleSystem *psys, float cfra)
 {
 	if (psys) {
@@ -2111,19 +2171,35 @@ void psys_update_particle_tree(ParticleSystem *psys, float cfra)
 		int totpart = 0;
 
 		if (!psys->tree || psys->tree_frame != cfra) {
-			LOOP_SHOWN_PARTICLES {
-				totpart++;
+			ParticleStateArrays *soa = psys_tree_state_arrays(psys, cfra);
+
+			if (soa) {
+				for (p = 0; p < soa->totpart; p++)
+					totpart += soa->alive[p];
+			}
+			else {
+				LOOP_SHOWN_PARTICLES {
+					totpart++;
+				}
 			}
 
 			BLI_kdtree_free(psys->tree);
-			psys->tree = BLI_kdtree_new(psys->totpart);
+			psys->tree = BLI_kdtree_new(totpart);
 
-			LOOP_SHOWN_PARTICLES {
-				if (pa->alive == PARS_ALIVE) {
-					if (pa->state.time == cfra)
-						BLI_kdtree_insert(psys->tree, p, pa->prev_state.co, NULL);
-					else
-						BLI_kdtree_insert(psys->tree, p, pa->state.co, NULL);
+			if (soa) {
+				for (p = 0; p < soa->totpart; p++) {
+					if (soa->alive[p])
+						BLI_kdtree_insert(psys->tree, p, soa->co[p], NULL);
+				}
+			}
+			else {
+				LOOP_SHOWN_PARTICLES {
+					if (pa->alive == PARS_ALIVE) {
+						if (pa->state.time == cfra)
+							BLI_kdtree_insert(psys->tree, p, pa->prev_state.co, NULL);
+						else
+							BLI_kdtree_insert(psys->tree, p, pa->state.co, NULL);
+					}
 				}
 			}
 			BLI_kdtree_balance(psys->tree);
@@ -2133,6 +2209,67 @@ void psys_update_particle_tree(ParticleSystem *psys, float cfra)
 	}
 }
 
+static void psys_alloc_state_arrays(ParticleSystem *psys)
+{
+	ParticleStateArrays *soa = psys->state_arrays;
+	int totpart = psys->totpart;
+
+	if (soa && soa->totpart != totpart)
+		psys_free_state_arrays(psys);
+
+	if (!psys->state_arrays) {
+		soa = psys->state_arrays = MEM_callocN(sizeof(ParticleStateArrays), "ParticleStateArrays");
+		soa->co = MEM_mallocN(sizeof(float) * 3 * MAX2(totpart, 1), "ParticleStateArrays co");
+		soa->vel = MEM_mallocN(sizeof(float) * 3 * MAX2(totpart, 1), "ParticleStateArrays vel");
+		soa->rot = MEM_mallocN(sizeof(float) * 4 * MAX2(totpart, 1), "ParticleStateArrays rot");
+		soa->ave = MEM_mallocN(sizeof(float) * 3 * MAX2(totpart, 1), "ParticleStateArrays ave");
+		soa->alive = MEM_mallocN(sizeof(char) * MAX2(totpart, 1), "ParticleStateArrays alive");
+		soa->totpart = totpart;
+	}
+}
+/* Load the state arrays from ParticleData, after the particle state was set
+ * somewhere else (cache reads, resets, emission or non newtonian physics) */
+static void psys_state_arrays_from_particles(ParticleSystem *psys, float cfra)
+{
+	ParticleStateArrays *soa;
+	int p, totpart = psys->totpart;
+
+	psys_alloc_state_arrays(psys);
+	soa = psys->state_arrays;
+
+	#pragma omp parallel for private (p) schedule(static) num_threads(PSYS_OMP_THREADS) if (totpart > 10000)
+	for (p = 0; p < totpart; p++) {
+		ParticleData *pa = psys->particles + p;
+
+		copy_v3_v3(soa->co[p], pa->state.co);
+		copy_v3_v3(soa->vel[p], pa->state.vel);
+		copy_qt_qt(soa->rot[p], pa->state.rot);
+		copy_v3_v3(soa->ave[p], pa->state.ave);
+		soa->alive[p] = (pa->alive == PARS_ALIVE && !(pa->flag & (PARS_UNEXIST|PARS_NO_DISP)));
+	}
+
+	soa->cfra = cfra;
+	soa->valid = TRUE;
+}
+static void state_arrays_get_key(ParticleStateArrays *soa, int p, ParticleKey *key)
+{
+	copy_v3_v3(key->co, soa->co[p]);
+	copy_v3_v3(key->vel, soa->vel[p]);
+	copy_qt_qt(key->rot, soa->rot[p]);
+	copy_v3_v3(key->ave, soa->ave[p]);
+}
+static void state_arrays_set_key(ParticleStateArrays *soa, int p, ParticleKey *key)
+{
+	copy_v3_v3(soa->co[p], key->co);
+	copy_v3_v3(soa->vel[p], key->vel);
+	copy_qt_qt(soa->rot[p], key->rot);
+	copy_v3_v3(soa->ave[p], key->ave);
+}
+static void psys_invalidate_state_arrays(ParticleSystem *psys)
+{
+	if (psys->state_arrays)
+		psys->state_arrays->valid = FALSE;
+}
 static void psys_update_effectors(ParticleSimulationData *sim)
 {
 	pdEndEffectors(&sim->psys->effectors);
@@ -2140,7 +2277,8 @@ static void psys_update_effectors(ParticleSimulationData *sim)
 	precalc_guides(sim, sim->psys->effectors);
 }
 
-static void integrate_particle(ParticleSettings *part, ParticleData *pa, float dtime, float *external_acceleration,
+static void integrate_particle(ParticleSettings *part, ParticleData *pa, ParticleKey *state, ParticleKey *prev_state,
+                               float dtime, float *external_acceleration,
                                void (*force_func)(void *forcedata, ParticleKey *state, float *force, float *impulse),
                                void *forcedata)
 {
@@ -2154,10 +2292,10 @@ static void integrate_particle(ParticleSettings *part, ParticleData *pa, float d
 
 #undef ZERO_F43
 
-	copy_v3_v3(oldpos, pa->state.co);
+	copy_v3_v3(oldpos, state->co);
 
 	/* Verlet integration behaves strangely with moving emitters, so do first step with euler. */
-	if (pa->prev_state.time < 0.f && integrator == PART_INT_VERLET)
+	if (prev_state->time < 0.f && integrator == PART_INT_VERLET)
 		integrator = PART_INT_EULER;
 
 	switch (integrator) {
@@ -2176,7 +2314,7 @@ static void integrate_particle(ParticleSettings *part, ParticleData *pa, float d
 	}
 
 	for (i=0; i<steps; i++) {
-		copy_particle_key(states + i, &pa->state, 1);
+		copy_particle_key(states + i, state, 1);
 	}
 
 	states->time = 0.f;
@@ -2198,8 +2336,8 @@ static void integrate_particle(ParticleSettings *part, ParticleData *pa, float d
 
 		switch (integrator) {
 			case PART_INT_EULER:
-				madd_v3_v3v3fl(pa->state.co, states->co, states->vel, dtime);
-				madd_v3_v3v3fl(pa->state.vel, states->vel, acceleration, dtime);
+				madd_v3_v3v3fl(state->co, states->co, states->vel, dtime);
+				madd_v3_v3v3fl(state->vel, states->vel, acceleration, dtime);
 				break;
 			case PART_INT_MIDPOINT:
 				if (i==0) {
@@ -2209,8 +2347,8 @@ static void integrate_particle(ParticleSettings *part, ParticleData *pa, float d
 					/*fra=sim->psys->cfra+0.5f*dfra;*/
 				}
 				else {
-					madd_v3_v3v3fl(pa->state.co, states->co, states[1].vel, dtime);
-					madd_v3_v3v3fl(pa->state.vel, states->vel, acceleration, dtime);
+					madd_v3_v3v3fl(state->co, states->co, states[1].vel, dtime);
+					madd_v3_v3v3fl(state->vel, states->vel, acceleration, dtime);
 				}
 				break;
 			case PART_INT_RK4:
@@ -2253,23 +2391,23 @@ static void integrate_particle(ParticleSettings *part, ParticleData *pa, float d
 						copy_v3_v3(dv[3], acceleration);
 						mul_v3_fl(dv[3], dtime);
 
-						madd_v3_v3v3fl(pa->state.co, states->co, dx[0], 1.0f/6.0f);
-						madd_v3_v3fl(pa->state.co, dx[1], 1.0f/3.0f);
-						madd_v3_v3fl(pa->state.co, dx[2], 1.0f/3.0f);
-						madd_v3_v3fl(pa->state.co, dx[3], 1.0f/6.0f);
+						madd_v3_v3v3fl(state->co, states->co, dx[0], 1.0f/6.0f);
+						madd_v3_v3fl(state->co, dx[1], 1.0f/3.0f);
+						madd_v3_v3fl(state->co, dx[2], 1.0f/3.0f);
+						madd_v3_v3fl(state->co, dx[3], 1.0f/6.0f);
 
-						madd_v3_v3v3fl(pa->state.vel, states->vel, dv[0], 1.0f/6.0f);
-						madd_v3_v3fl(pa->state.vel, dv[1], 1.0f/3.0f);
-						madd_v3_v3fl(pa->state.vel, dv[2], 1.0f/3.0f);
-						madd_v3_v3fl(pa->state.vel, dv[3], 1.0f/6.0f);
+						madd_v3_v3v3fl(state->vel, states->vel, dv[0], 1.0f/6.0f);
+						madd_v3_v3fl(state->vel, dv[1], 1.0f/3.0f);
+						madd_v3_v3fl(state->vel, dv[2], 1.0f/3.0f);
+						madd_v3_v3fl(state->vel, dv[3], 1.0f/6.0f);
 				}
 				break;
 			case PART_INT_VERLET:   /* Verlet integration */
-				madd_v3_v3v3fl(pa->state.vel, pa->prev_state.vel, acceleration, dtime);
-				madd_v3_v3v3fl(pa->state.co, pa->prev_state.co, pa->state.vel, dtime);
+				madd_v3_v3v3fl(state->vel, prev_state->vel, acceleration, dtime);
+				madd_v3_v3v3fl(state->co, prev_state->co, state->vel, dtime);
 
-				sub_v3_v3v3(pa->state.vel, pa->state.co, oldpos);
-				mul_v3_fl(pa->state.vel, 1.0f/dtime);
+				sub_v3_v3v3(state->vel, state->co, oldpos);
+				mul_v3_fl(state->vel, 1.0f/dtime);
 				break;
 		}
 	}
@@ -2308,6 +2446,55 @@ static ParticleSpring *sph_spring_add(ParticleSystem *psys, ParticleSpring *spri
 
 	return psys->fluid_springs + psys->tot_fluidsprings - 1;
 }
+/* Springs created by one thread during a step, see sph_spring_buffers_merge() */
+typedef struct SPHSpringBuffer {
+	ParticleSpring *springs;
+	int tot, alloc;
+} SPHSpringBuffer;
+
+static void sph_spring_buffer_add(SPHSpringBuffer *buf, ParticleSpring *spring)
+{
+	if (buf->springs == NULL) {
+		buf->alloc = PSYS_FLUID_SPRINGS_INITIAL_SIZE;
+		buf->springs = MEM_mallocN(buf->alloc * sizeof(ParticleSpring), "SPH spring buffer");
+	}
+	else if (buf->tot == buf->alloc) {
+		buf->alloc *= 2;
+		buf->springs = MEM_reallocN(buf->springs, buf->alloc * sizeof(ParticleSpring));
+	}
+
+	buf->springs[buf->tot++] = *spring;
+}
+static int sph_spring_cmp(const void *a, const void *b)
+{
+	const ParticleSpring *s1 = a, *s2 = b;
+
+	if (s1->particle_index[0] != s2->particle_index[0])
+		return (s1->particle_index[0] < s2->particle_index[0]) ? -1 : 1;
+	if (s1->particle_index[1] != s2->particle_index[1])
+		return (s1->particle_index[1] < s2->particle_index[1]) ? -1 : 1;
+	return 0;
+}
+/* Add the springs created by all threads to the particle system. They are
+ * sorted so the result doesn't depend on which thread handled which particle. */
+static void sph_spring_buffers_merge(ParticleSystem *psys, SPHData *sphdata)
+{
+	SPHSpringBuffer *buf;
+	int i, j, first = psys->tot_fluidsprings;
+
+	if (!sphdata->spring_buffers)
+		return;
+
+	for (i = 0, buf = sphdata->spring_buffers; i < BLENDER_MAX_THREADS; i++, buf++) {
+		for (j = 0; j < buf->tot; j++)
+			sph_spring_add(psys, buf->springs + j);
+
+		buf->tot = 0;
+	}
+
+	if (psys->tot_fluidsprings - first > 1)
+		qsort(psys->fluid_springs + first, psys->tot_fluidsprings - first, sizeof(ParticleSpring), sph_spring_cmp);
+}
 static void sph_spring_delete(ParticleSystem *psys, int j)
 {
 	if (j != psys->tot_fluidsprings - 1)
@@ -2416,8 +2603,8 @@ static void sph_evaluate_func(BVHTree *tree, ParticleSystem **psys, float co[3],
 			BLI_bvhtree_range_query(tree, co, interaction_radius, callback, pfr);
 			break;
 		}
-		else {
-			BLI_bvhtree_range_query(psys[i]->bvhtree, co, interaction_radius, callback, pfr);
+		else if (psys[i]->hashgrid) {
+			BLI_hashgrid_range_query(psys[i]->hashgrid, co, interaction_radius, callback, pfr);
 		}
 	}
 }
@@ -2585,9 +2772,12 @@ static void sph_force_cb(void *sphdata_v, ParticleKey *state, float *force, floa
 					temp_spring.rest_length = (fluid->flag & SPH_CURRENT_REST_LENGTH) ? rij : rest_length;
 					temp_spring.delete_flag = 0;
 
-					/* sph_spring_add is not thread-safe. - z0r */
-					#pragma omp critical
-					sph_spring_add(psys[0], &temp_spring);
+					/* psys[0]->fluid_springs is read by other threads, so
+					 * collect new springs per thread until the loop is done */
+					if (sphdata->spring_buffers)
+						sph_spring_buffer_add(&sphdata->spring_buffers[sphdata->thread], &temp_spring);
+					else
+						sph_spring_add(psys[0], &temp_spring);
 				}
 			}
 			else {/* PART_SPRING_HOOKES - Hooke's spring force */
@@ -2820,6 +3010,12 @@ void psys_sph_init(ParticleSimulationData *sim, SPHData *sphdata)
 	sphdata->pa = NULL;
 	sphdata->mass = 1.0f;
 
+	sphdata->thread = 0;
+	if (sim->psys->part->fluid->flag & SPH_VISCOELASTIC_SPRINGS)
+		sphdata->spring_buffers = MEM_callocN(sizeof(SPHSpringBuffer) * BLENDER_MAX_THREADS, "SPH spring buffers");
+	else
+		sphdata->spring_buffers = NULL;
+
 	if (sim->psys->part->fluid->solver == SPH_SOLVER_DDR) {
 		sphdata->force_cb = sph_force_cb;
 		sphdata->density_cb = sph_density_accum_cb;
@@ -2840,6 +3036,19 @@ void psys_sph_finalise(SPHData *sphdata)
 		BLI_edgehash_free(sphdata->eh, NULL);
 		sphdata->eh = NULL;
 	}
+
+	if (sphdata->spring_buffers) {
+		int i;
+
+		sph_spring_buffers_merge(sphdata->psys[0], sphdata);
+
+		for (i = 0; i < BLENDER_MAX_THREADS; i++) {
+			if (sphdata->spring_buffers[i].springs)
+				MEM_freeN(sphdata->spring_buffers[i].springs);
+		}
+		MEM_freeN(sphdata->spring_buffers);
+		sphdata->spring_buffers = NULL;
+	}
 }
 /* Sample the density field at a point in space. */
 void psys_sph_density(BVHTree *tree, SPHData *sphdata, float co[3], float vars[2])
@@ -2882,7 +3091,7 @@ static void sph_integrate(ParticleSimulationData *sim, ParticleData *pa, float d
 
 	copy_particle_key(&pa->state, &pa->prev_state, 0);
 
-	integrate_particle(part, pa, dtime, effector_acceleration, sphdata->force_cb, sphdata);
+	integrate_particle(part, pa, &pa->state, &pa->prev_state, dtime, effector_acceleration, sphdata->force_cb, sphdata);
 }
 
 /************************************************/
@@ -2892,6 +3101,8 @@ typedef struct EfData {
 	ParticleTexture ptex;
 	ParticleSimulationData *sim;
 	ParticleData *pa;
+	ParticleKey *state;
+	int thread;
 } EfData;
 static void basic_force_cb(void *efdata_v, ParticleKey *state, float *force, float *impulse)
 {
@@ -2915,16 +3126,22 @@ static void basic_force_cb(void *efdata_v, ParticleKey *state, float *force, flo
 
 	/* brownian force */
 	if (part->brownfac != 0.0f) {
-		force[0] += (BLI_frand()-0.5f) * part->brownfac;
-		force[1] += (BLI_frand()-0.5f) * part->brownfac;
-		force[2] += (BLI_frand()-0.5f) * part->brownfac;
+		force[0] += (BLI_thread_frand(efdata->thread)-0.5f) * part->brownfac;
+		force[1] += (BLI_thread_frand(efdata->thread)-0.5f) * part->brownfac;
+		force[2] += (BLI_thread_frand(efdata->thread)-0.5f) * part->brownfac;
 	}
 
 	if (part->flag & PART_ROT_DYN && epoint.ave)
-		copy_v3_v3(pa->state.ave, epoint.ave);
+		copy_v3_v3(efdata->state->ave, epoint.ave);
+}
+/* random seed for particle p in the step ending at cfra */
+static unsigned int psys_step_seed(ParticleSystem *psys, int p, float cfra)
+{
+	return 31415926u + (unsigned int)psys->seed + (unsigned int)(cfra * 1024.0f) + (unsigned int)p * 4099u;
 }
-/* gathers all forces that effect particles and calculates a new state for the particle */
-static void basic_integrate(ParticleSimulationData *sim, int p, float dfra, float cfra)
+/* gathers all forces that effect particles and calculates a new state for the particle,
+ * state and prev_state are the particle's keys, which don't have to be in ParticleData */
+static void basic_integrate(ParticleSimulationData *sim, int p, ParticleKey *state, ParticleKey *prev_state, float dfra, float cfra)
 {
 	ParticleSettings *part = sim->psys->part;
 	ParticleData *pa = sim->psys->particles + p;
@@ -2936,7 +3153,13 @@ static void basic_integrate(ParticleSimulationData *sim, int p, float dfra, floa
 	psys_get_texture(sim, pa, &efdata.ptex, PAMAP_PHYSICS, cfra);
 
 	efdata.pa = pa;
+	efdata.state = state;
 	efdata.sim = sim;
+	efdata.thread = PSYS_THREAD_NUM;
+
+	/* seed brownian motion per particle and step, independent of thread scheduling */
+	if (part->brownfac != 0.0f)
+		BLI_thread_srandom(efdata.thread, psys_step_seed(sim->psys, p, cfra));
 
 	/* add global acceleration (gravitation) */
 	if (psys_uses_gravity(sim) &&
@@ -2949,13 +3172,13 @@ static void basic_integrate(ParticleSimulationData *sim, int p, float dfra, floa
 	}
 
 	/* maintain angular velocity */
-	copy_v3_v3(pa->state.ave, pa->prev_state.ave);
+	copy_v3_v3(state->ave, prev_state->ave);
 
-	integrate_particle(part, pa, dtime, gravity, basic_force_cb, &efdata);
+	integrate_particle(part, pa, state, prev_state, dtime, gravity, basic_force_cb, &efdata);
 
 	/* damp affects final velocity */
 	if (part->dampfac != 0.f)
-		mul_v3_fl(pa->state.vel, 1.f - part->dampfac * efdata.ptex.damp * 25.f * dtime);
+		mul_v3_fl(state->vel, 1.f - part->dampfac * efdata.ptex.damp * 25.f * dtime);
 
 	//copy_v3_v3(pa->state.ave, states->ave);
 
@@ -2963,31 +3186,31 @@ static void basic_integrate(ParticleSimulationData *sim, int p, float dfra, floa
 	time=(cfra-pa->time)/pa->lifetime;
 	CLAMP(time, 0.0f, 1.0f);
 
-	copy_v3_v3(tkey.co,pa->state.co);
-	copy_v3_v3(tkey.vel,pa->state.vel);
-	tkey.time=pa->state.time;
+	copy_v3_v3(tkey.co,state->co);
+	copy_v3_v3(tkey.vel,state->vel);
+	tkey.time=state->time;
 
 	if (part->type != PART_HAIR) {
 		if (do_guides(sim->psys->effectors, &tkey, p, time)) {
-			copy_v3_v3(pa->state.co,tkey.co);
+			copy_v3_v3(state->co,tkey.co);
 			/* guides don't produce valid velocity */
-			sub_v3_v3v3(pa->state.vel, tkey.co, pa->prev_state.co);
-			mul_v3_fl(pa->state.vel,1.0f/dtime);
-			pa->state.time=tkey.time;
+			sub_v3_v3v3(state->vel, tkey.co, prev_state->co);
+			mul_v3_fl(state->vel,1.0f/dtime);
+			state->time=tkey.time;
 		}
 	}
 }
-static void basic_rotate(ParticleSettings *part, ParticleData *pa, float dfra, float timestep)
+static void basic_rotate(ParticleSettings *part, ParticleKey *state, ParticleKey *prev_state, float dfra, float timestep)
 {
 	float rotfac, rot1[4], rot2[4] = {1.0,0.0,0.0,0.0}, dtime=dfra*timestep, extrotfac;
 
 	if ((part->flag & PART_ROTATIONS) == 0) {
-		unit_qt(pa->state.rot);
+		unit_qt(state->rot);
 		return;
 	}
 
 	if (part->flag & PART_ROT_DYN) {
-		extrotfac = len_v3(pa->state.ave);
+		extrotfac = len_v3(state->ave);
 	}
 	else {
 		extrotfac = 0.0f;
@@ -2995,36 +3218,36 @@ static void basic_rotate(ParticleSettings *part, ParticleData *pa, float dfra, f
 
 	if ((part->flag & PART_ROT_DYN) && ELEM3(part->avemode, PART_AVE_VELOCITY, PART_AVE_HORIZONTAL, PART_AVE_VERTICAL)) {
 		float angle;
-		float len1 = len_v3(pa->prev_state.vel);
-		float len2 = len_v3(pa->state.vel);
+		float len1 = len_v3(prev_state->vel);
+		float len2 = len_v3(state->vel);
 		float vec[3];
 
 		if (len1 == 0.0f || len2 == 0.0f) {
-			zero_v3(pa->state.ave);
+			zero_v3(state->ave);
 		}
 		else {
-			cross_v3_v3v3(pa->state.ave, pa->prev_state.vel, pa->state.vel);
-			normalize_v3(pa->state.ave);
-			angle = dot_v3v3(pa->prev_state.vel, pa->state.vel) / (len1 * len2);
-			mul_v3_fl(pa->state.ave, saacos(angle) / dtime);
+			cross_v3_v3v3(state->ave, prev_state->vel, state->vel);
+			normalize_v3(state->ave);
+			angle = dot_v3v3(prev_state->vel, state->vel) / (len1 * len2);
+			mul_v3_fl(state->ave, saacos(angle) / dtime);
 		}
 
-		get_angular_velocity_vector(part->avemode, &pa->state, vec);
+		get_angular_velocity_vector(part->avemode, state, vec);
 		axis_angle_to_quat(rot2, vec, dtime*part->avefac);
 	}
 
-	rotfac = len_v3(pa->state.ave);
+	rotfac = len_v3(state->ave);
 	if (rotfac == 0.0f || (part->flag & PART_ROT_DYN)==0 || extrotfac == 0.0f) {
 		unit_qt(rot1);
 	}
 	else {
-		axis_angle_to_quat(rot1,pa->state.ave,rotfac*dtime);
+		axis_angle_to_quat(rot1,state->ave,rotfac*dtime);
 	}
-	mul_qt_qtqt(pa->state.rot,rot1,pa->prev_state.rot);
-	mul_qt_qtqt(pa->state.rot,rot2,pa->state.rot);
+	mul_qt_qtqt(state->rot,rot1,prev_state->rot);
+	mul_qt_qtqt(state->rot,rot2,state->rot);
 
 	/* keep rotation quat in good health */
-	normalize_qt(pa->state.rot);
+	normalize_qt(state->rot);
 }
 
 /************************************************/
@@ -3473,7 +3696,7 @@ static int collision_detect(ParticleData *pa, ParticleCollision *col, BVHTreeRay
 
 	return hit->index >= 0;
 }
-static int collision_response(ParticleData *pa, ParticleCollision *col, BVHTreeRayHit *hit, int kill, int dynamic_rotation)
+static int collision_response(ParticleData *pa, ParticleKey *state, ParticleKey *prev_state, ParticleCollision *col, BVHTreeRayHit *hit, int kill, int dynamic_rotation)
 {
 	ParticleCollisionElement *pce = &col->pce;
 	PartDeflect *pd = col->hit->pd;
@@ -3482,7 +3705,7 @@ static int collision_response(ParticleData *pa, ParticleCollision *col, BVHTreeR
 	float f = col->f + x * (1.0f - col->f);				/* time factor of collision between timestep */
 	float dt1 = (f - col->f) * col->total_time;			/* time since previous collision (in seconds) */
 	float dt2 = (1.0f - f) * col->total_time;			/* time left after collision (in seconds) */
-	int through = (BLI_frand() < pd->pdef_perm) ? 1 : 0; /* did particle pass through the collision surface? */
+	int through = (BLI_thread_frand(col->thread) < pd->pdef_perm) ? 1 : 0; /* did particle pass through the collision surface? */
 
 	/* calculate exact collision location */
 	interp_v3_v3v3(co, col->co1, col->co2, x);
@@ -3492,10 +3715,10 @@ static int collision_response(ParticleData *pa, ParticleCollision *col, BVHTreeR
 		pa->alive = PARS_DYING;
 		pa->dietime = col->old_cfra + (col->cfra - col->old_cfra) * f;
 
-		copy_v3_v3(pa->state.co, co);
-		interp_v3_v3v3(pa->state.vel, pa->prev_state.vel, pa->state.vel, f);
-		interp_qt_qtqt(pa->state.rot, pa->prev_state.rot, pa->state.rot, f);
-		interp_v3_v3v3(pa->state.ave, pa->prev_state.ave, pa->state.ave, f);
+		copy_v3_v3(state->co, co);
+		interp_v3_v3v3(state->vel, prev_state->vel, state->vel, f);
+		interp_qt_qtqt(state->rot, prev_state->rot, state->rot, f);
+		interp_v3_v3v3(state->ave, prev_state->ave, state->ave, f);
 
 		/* particle is dead so we don't need to calculate further */
 		return 0;
@@ -3507,8 +3730,8 @@ static int collision_response(ParticleData *pa, ParticleCollision *col, BVHTreeR
 		float v0_tan[3];/* tangential component of v0 */
 		float vc_tan[3];/* tangential component of collision surface velocity */
 		float v0_dot, vc_dot;
-		float damp = pd->pdef_damp + pd->pdef_rdamp * 2 * (BLI_frand() - 0.5f);
-		float frict = pd->pdef_frict + pd->pdef_rfrict * 2 * (BLI_frand() - 0.5f);
+		float damp = pd->pdef_damp + pd->pdef_rdamp * 2 * (BLI_thread_frand(col->thread) - 0.5f);
+		float frict = pd->pdef_frict + pd->pdef_rfrict * 2 * (BLI_thread_frand(col->thread) - 0.5f);
 		float distance, nor[3], dot;
 
 		CLAMP(damp,0.0f, 1.0f);
@@ -3535,7 +3758,7 @@ static int collision_response(ParticleData *pa, ParticleCollision *col, BVHTreeR
 				float vr_tan[3], v1_tan[3], ave[3];
 					
 				/* linear velocity of particle surface */
-				cross_v3_v3v3(vr_tan, pce->nor, pa->state.ave);
+				cross_v3_v3v3(vr_tan, pce->nor, state->ave);
 				mul_v3_fl(vr_tan, pa->size);
 
 				/* change to coordinates that move with the collision plane */
@@ -3562,7 +3785,7 @@ static int collision_response(ParticleData *pa, ParticleCollision *col, BVHTreeR
 				mul_v3_fl(ave, 1.0f/MAX2(pa->size, 0.001f));
 
 				/* only friction will cause change in linear & angular velocity */
-				interp_v3_v3v3(pa->state.ave, pa->state.ave, ave, frict);
+				interp_v3_v3v3(state->ave, state->ave, ave, frict);
 				interp_v3_v3v3(v0_tan, v0_tan, v1_tan, frict);
 			}
 			else {
@@ -3605,9 +3828,9 @@ static int collision_response(ParticleData *pa, ParticleCollision *col, BVHTreeR
 		}
 		
 		/* re-apply acceleration to final location and velocity */
-		madd_v3_v3v3fl(pa->state.co, co, v0, dt2);
-		madd_v3_v3fl(pa->state.co, col->acc, 0.5f*dt2*dt2);
-		madd_v3_v3v3fl(pa->state.vel, v0, col->acc, dt2);
+		madd_v3_v3v3fl(state->co, co, v0, dt2);
+		madd_v3_v3fl(state->co, col->acc, 0.5f*dt2*dt2);
+		madd_v3_v3v3fl(state->vel, v0, col->acc, dt2);
 
 		/* make sure particle stays on the right side of the surface */
 		if (!through) {
@@ -3620,25 +3843,25 @@ static int collision_response(ParticleData *pa, ParticleCollision *col, BVHTreeR
 			if (dot < 0.f)
 				madd_v3_v3fl(v0, nor, -dot);
 
-			distance = collision_point_distance_with_normal(pa->state.co, pce, 1.f, col, nor);
+			distance = collision_point_distance_with_normal(state->co, pce, 1.f, col, nor);
 
 			if (distance < col->radius + COLLISION_MIN_DISTANCE)
-				madd_v3_v3fl(pa->state.co, nor, col->radius + COLLISION_MIN_DISTANCE - distance);
+				madd_v3_v3fl(state->co, nor, col->radius + COLLISION_MIN_DISTANCE - distance);
 
-			dot = dot_v3v3(nor, pa->state.vel);
+			dot = dot_v3v3(nor, state->vel);
 			if (dot < 0.f)
-				madd_v3_v3fl(pa->state.vel, nor, -dot);
+				madd_v3_v3fl(state->vel, nor, -dot);
 		}
 
 		/* add stickiness to surface */
-		madd_v3_v3fl(pa->state.vel, pce->nor, -pd->pdef_stickness);
+		madd_v3_v3fl(state->vel, pce->nor, -pd->pdef_stickness);
 
 		/* set coordinates for next iteration */
 		copy_v3_v3(col->co1, co);
-		copy_v3_v3(col->co2, pa->state.co);
+		copy_v3_v3(col->co2, state->co);
 
 		copy_v3_v3(col->ve1, v0);
-		copy_v3_v3(col->ve2, pa->state.vel);
+		copy_v3_v3(col->ve2, state->vel);
 
 		col->f = f;
 	}
@@ -3648,13 +3871,13 @@ static int collision_response(ParticleData *pa, ParticleCollision *col, BVHTreeR
 
 	return 1;
 }
-static void collision_fail(ParticleData *pa, ParticleCollision *col)
+static void collision_fail(ParticleKey *state, ParticleCollision *col)
 {
 	/* final chance to prevent total failure, so stick to the surface and hope for the best */
-	collision_point_on_surface(col->co1, &col->pce, 1.f, col, pa->state.co);
+	collision_point_on_surface(col->co1, &col->pce, 1.f, col, state->co);
 
-	copy_v3_v3(pa->state.vel, col->pce.vel);
-	mul_v3_fl(pa->state.vel, col->inv_timestep);
+	copy_v3_v3(state->vel, col->pce.vel);
+	mul_v3_fl(state->vel, col->inv_timestep);
 
 
 	/* printf("max iterations\n"); */
@@ -3669,7 +3892,7 @@ static void collision_fail(ParticleData *pa, ParticleCollision *col)
  * -uses Newton-Rhapson iteration to find the collisions
  * -handles spherical particles and (nearly) point like particles
  */
-static void collision_check(ParticleSimulationData *sim, int p, float dfra, float cfra)
+static void collision_check(ParticleSimulationData *sim, int p, ParticleKey *state, ParticleKey *prev_state, float dfra, float cfra)
 {
 	ParticleSettings *part = sim->psys->part;
 	ParticleData *pa = sim->psys->particles + p;
@@ -3687,15 +3910,19 @@ static void collision_check(ParticleSimulationData *sim, int p, float dfra, floa
 	col.cfra = cfra;
 	col.old_cfra = sim->psys->cfra;
 
+	/* seeded per particle and step like brownian motion, collisions are checked in threads */
+	col.thread = PSYS_THREAD_NUM;
+	BLI_thread_srandom(col.thread, psys_step_seed(sim->psys, p, cfra) ^ 0x5bd1e995u);
+
 	/* get acceleration (from gravity, forcefields etc. to be re-applied in collision response) */
-	sub_v3_v3v3(col.acc, pa->state.vel, pa->prev_state.vel);
+	sub_v3_v3v3(col.acc, state->vel, prev_state->vel);
 	mul_v3_fl(col.acc, 1.f/col.total_time);
 
 	/* set values for first iteration */
-	copy_v3_v3(col.co1, pa->prev_state.co);
-	copy_v3_v3(col.co2, pa->state.co);
-	copy_v3_v3(col.ve1, pa->prev_state.vel);
-	copy_v3_v3(col.ve2, pa->state.vel);
+	copy_v3_v3(col.co1, prev_state->co);
+	copy_v3_v3(col.co2, state->co);
+	copy_v3_v3(col.ve1, prev_state->vel);
+	copy_v3_v3(col.ve2, state->vel);
 	col.f = 0.0f;
 
 	col.radius = ((part->flag & PART_SIZE_DEFL) || (part->phystype == PART_PHYS_BOIDS)) ? pa->size : COLLISION_MIN_RADIUS;
@@ -3703,7 +3930,7 @@ static void collision_check(ParticleSimulationData *sim, int p, float dfra, floa
 	/* override for boids */
 	if (part->phystype == PART_PHYS_BOIDS && part->boids->options & BOID_ALLOW_LAND) {
 		col.boid = 1;
-		col.boid_z = pa->state.co[2];
+		col.boid_z = state->co[2];
 		col.skip = pa->boid->ground;
 	}
 
@@ -3714,8 +3941,8 @@ static void collision_check(ParticleSimulationData *sim, int p, float dfra, floa
 			collision_count++;
 
 			if (collision_count == COLLISION_MAX_COLLISIONS)
-				collision_fail(pa, &col);
-			else if (collision_response(pa, &col, &hit, part->flag & PART_DIE_ON_COL, part->flag & PART_ROT_DYN)==0)
+				collision_fail(state, &col);
+			else if (collision_response(pa, state, prev_state, &col, &hit, part->flag & PART_DIE_ON_COL, part->flag & PART_ROT_DYN)==0)
 				return;
 		}
 		else
@@ -4021,7 +4248,7 @@ static const float TIMESTEP_EXPANSION_TOLERANCE = 1.5f;
  * simulation. This should be called once per particle during a simulation
  * step, after the velocity has been updated. element_size defines the scale of
  * the simulation, and is typically the distance to neighboring particles. */
-static void update_courant_num(ParticleSimulationData *sim, ParticleData *pa,
+static void update_courant_num(float *courant_num, ParticleData *pa,
                                float dtime, SPHData *sphdata)
 {
 	float relative_vel[3];
@@ -4029,8 +4256,18 @@ static void update_courant_num(ParticleSimulationData *sim, ParticleData *pa,
 
 	sub_v3_v3v3(relative_vel, pa->prev_state.vel, sphdata->flow);
 	speed = len_v3(relative_vel);
-	if (sim->courant_num < speed * dtime / sphdata->element_size)
-		sim->courant_num = speed * dtime / sphdata->element_size;
+	if (*courant_num < speed * dtime / sphdata->element_size)
+		*courant_num = speed * dtime / sphdata->element_size;
+}
+/* Combine the per thread maxima collected by update_courant_num(). */
+static void merge_courant_num(ParticleSimulationData *sim, const float courant_num[BLENDER_MAX_THREADS])
+{
+	int i;
+
+	for (i = 0; i < BLENDER_MAX_THREADS; i++) {
+		if (sim->courant_num < courant_num[i])
+			sim->courant_num = courant_num[i];
+	}
 }
 static float get_base_time_step(ParticleSettings *part)
 {
@@ -4075,6 +4312,7 @@ static void dynamics_step(ParticleSimulationData *sim, float cfra)
 {
 	ParticleSystem *psys = sim->psys;
 	ParticleSettings *part=psys->part;
+	ParticleStateArrays *soa;
 	BoidBrainData bbd;
 	ParticleTexture ptex;
 	PARTICLE_P;
@@ -4090,6 +4328,8 @@ static void dynamics_step(ParticleSimulationData *sim, float cfra)
 	dtime= dfra*timestep;
 
 	if (dfra < 0.0f) {
+		psys_invalidate_state_arrays(psys);
+
 		LOOP_EXISTING_PARTICLES {
 			psys_get_texture(sim, pa, &ptex, PAMAP_SIZE, cfra);
 			pa->size = part->size*ptex.size;
@@ -4103,6 +4343,14 @@ static void dynamics_step(ParticleSimulationData *sim, float cfra)
 
 	BLI_srandom(31415926 + (int)cfra + psys->seed);
 
+	/* the state arrays only need loading when the state was set outside of
+	 * the dynamics, by cache reads, resets or emission */
+	soa = psys_get_state_arrays(psys, psys->cfra);
+	if (!soa) {
+		psys_state_arrays_from_particles(psys, psys->cfra);
+		soa = psys->state_arrays;
+	}
+
 	psys_update_effectors(sim);
 
 	if (part->type != PART_HAIR)
@@ -4132,17 +4380,23 @@ static void dynamics_step(ParticleSimulationData *sim, float cfra)
 		case PART_PHYS_FLUID:
 		{
 			ParticleTarget *pt = psys->targets.first;
-			psys_update_particle_bvhtree(psys, cfra);
+			SPHFluidSettings *fluid = part->fluid;
+			/* queries are done with this system's interaction radius, so use it as cell size */
+			float interaction_radius = fluid->radius * (fluid->flag & SPH_FAC_RADIUS ? 4.0f * part->size : 1.0f);
+
+			psys_update_particle_hashgrid(psys, cfra, interaction_radius);
 			
-			for (; pt; pt=pt->next) {  /* Updating others systems particle tree for fluid-fluid interaction */
+			for (; pt; pt=pt->next) {  /* Updating others systems particle grid for fluid-fluid interaction */
 				if (pt->ob)
-					psys_update_particle_bvhtree(BLI_findlink(&pt->ob->particlesystem, pt->psys-1), cfra);
+					psys_update_particle_hashgrid(BLI_findlink(&pt->ob->particlesystem, pt->psys-1), cfra, interaction_radius);
 			}
 			break;
 		}
 	}
 	/* initialize all particles for dynamics */
 	LOOP_SHOWN_PARTICLES {
+		int reset = FALSE;
+
 		copy_particle_key(&pa->prev_state,&pa->state,1);
 
 		psys_get_texture(sim, pa, &ptex, PAMAP_SIZE, cfra);
@@ -4167,6 +4421,7 @@ static void dynamics_step(ParticleSimulationData *sim, float cfra)
 			reset_particle(sim, pa, dfra*timestep, cfra);
 			pa->alive = PARS_ALIVE;
 			pa->state.time = cfra - birthtime;
+			reset = TRUE;
 		}
 		else if (dietime < cfra) {
 			/* nothing to be done when particle is dead */
@@ -4175,36 +4430,76 @@ static void dynamics_step(ParticleSimulationData *sim, float cfra)
 		/* only reset unborn particles if they're shown or if the particle is born soon*/
 		if (pa->alive==PARS_UNBORN && (part->flag & PART_UNBORN || (cfra + psys->pointcache->step > pa->time))) {
 			reset_particle(sim, pa, dtime, cfra);
+			reset = TRUE;
 		}
 		else if (part->phystype == PART_PHYS_NO) {
 			reset_particle(sim, pa, dtime, cfra);
+			reset = TRUE;
 		}
 
 		if (ELEM(pa->alive, PARS_ALIVE, PARS_DYING)==0 || (pa->flag & (PARS_UNEXIST|PARS_NO_DISP)))
 			pa->state.time = -1.f;
+
+		/* reset_particle() sets the state in ParticleData */
+		if (reset)
+			state_arrays_set_key(soa, p, &pa->state);
+
+		soa->alive[p] = (pa->alive == PARS_ALIVE);
 	}
 
 	switch (part->phystype) {
 		case PART_PHYS_NEWTON:
 		{
+			/* particles only read shared data, effectors, colliders and
+			 * textures, so they can be integrated independently, unless
+			 * the system is its own effector and reads the state of
+			 * particles other threads are integrating */
+			const int threaded = !(part->flag & PART_SELF_EFFECT);
+
+			BLI_begin_threaded_malloc();
+
+			#pragma omp parallel for private (pa) schedule(dynamic,5) num_threads(PSYS_OMP_THREADS) if (threaded)
 			LOOP_DYNAMIC_PARTICLES {
+				ParticleKey state;
+
+				/* the state arrays hold the particle state, ParticleData
+				 * holds the previous state and the time step */
+				state_arrays_get_key(soa, p, &state);
+				state.time = pa->state.time;
+
 				/* do global forces & effectors */
-				basic_integrate(sim, p, pa->state.time, cfra);
+				basic_integrate(sim, p, &state, &pa->prev_state, state.time, cfra);
 	
 				/* deflection */
 				if (sim->colliders)
-					collision_check(sim, p, pa->state.time, cfra);
+					collision_check(sim, p, &state, &pa->prev_state, state.time, cfra);
 
 				/* rotations */
-				basic_rotate(part, pa, pa->state.time, timestep);
+				basic_rotate(part, &state, &pa->prev_state, state.time, timestep);
+
+				state_arrays_set_key(soa, p, &state);
+
+				/* ParticleData is the view of the state for the rest of blender */
+				copy_particle_key(&pa->state, &state, 1);
 			}
+
+			BLI_end_threaded_malloc();
 			break;
 		}
 		case PART_PHYS_BOIDS:
 		{
+			/* neighbor lookups only read the previous state, unless some rule
+			 * makes boids modify each other */
+			const int threaded = boids_rules_threadsafe(part->boids);
+
+			BLI_begin_threaded_malloc();
+
+			#pragma omp parallel for firstprivate (bbd) private (pa) schedule(dynamic,5) num_threads(PSYS_OMP_THREADS) if (threaded)
 			LOOP_DYNAMIC_PARTICLES {
 				bbd.goal_ob = NULL;
-				
+				bbd.thread = PSYS_THREAD_NUM;
+				BLI_thread_srandom(bbd.thread, psys_step_seed(psys, p, cfra));
+
 				boid_brain(&bbd, p, pa);
 
 				if (pa->alive != PARS_DYING) {
@@ -4212,40 +4507,49 @@ static void dynamics_step(ParticleSimulationData *sim, float cfra)
 
 					/* deflection */
 					if (sim->colliders)
-						collision_check(sim, p, pa->state.time, cfra);
+						collision_check(sim, p, &pa->state, &pa->prev_state, pa->state.time, cfra);
 				}
 			}
+
+			BLI_end_threaded_malloc();
 			break;
 		}
 		case PART_PHYS_FLUID:
 		{
 			SPHData sphdata;
 			ParticleSettings *part = sim->psys->part;
+			int *order = psys_hashgrid_particle_order(psys);
+			/* per thread maximum, so threads don't have to sync for every particle */
+			float courant_num[BLENDER_MAX_THREADS] = {0.0f};
+			int i;
 			psys_sph_init(sim, &sphdata);
 
 			if (part->fluid->flag & SPH_SOLVER_DDR) {
 				/* Apply SPH forces using double-density relaxation algorithm
 				 * (Clavat et. al.) */
-				#pragma omp parallel for firstprivate (sphdata) private (pa) schedule(dynamic,5)
-				LOOP_DYNAMIC_PARTICLES {
+				#pragma omp parallel for firstprivate (sphdata) private (pa, p) schedule(dynamic,5) num_threads(PSYS_OMP_THREADS)
+				LOOP_ORDERED_DYNAMIC_PARTICLES(order) {
+					sphdata.thread = PSYS_THREAD_NUM;
+
 					/* do global forces & effectors */
-					basic_integrate(sim, p, pa->state.time, cfra);
+					basic_integrate(sim, p, &pa->state, &pa->prev_state, pa->state.time, cfra);
 
 					/* actual fluids calculations */
 					sph_integrate(sim, pa, pa->state.time, &sphdata);
 
 					if (sim->colliders)
-						collision_check(sim, p, pa->state.time, cfra);
+						collision_check(sim, p, &pa->state, &pa->prev_state, pa->state.time, cfra);
 
 					/* SPH particles are not physical particles, just interpolation
 					 * particles,  thus rotation has not a direct sense for them */
-					basic_rotate(part, pa, pa->state.time, timestep);
+					basic_rotate(part, &pa->state, &pa->prev_state, pa->state.time, timestep);
 
-					#pragma omp critical
 					if (part->time_flag & PART_TIME_AUTOSF)
-						update_courant_num(sim, pa, dtime, &sphdata);
+						update_courant_num(&courant_num[sphdata.thread], pa, dtime, &sphdata);
 				}
 
+				merge_courant_num(sim, courant_num);
+				sph_spring_buffers_merge(psys, &sphdata);
 				sph_springs_modify(psys, timestep);
 
 			}
@@ -4255,36 +4559,40 @@ static void dynamics_step(ParticleSimulationData *sim, float cfra)
 				 * and Monaghan). Note that, unlike double-density relaxation,
 				 * this algorthim is separated into distinct loops. */
 
-				#pragma omp parallel for firstprivate (sphdata) private (pa) schedule(dynamic,5)
-				LOOP_DYNAMIC_PARTICLES {
-					basic_integrate(sim, p, pa->state.time, cfra);
+				#pragma omp parallel for firstprivate (sphdata) private (pa, p) schedule(dynamic,5) num_threads(PSYS_OMP_THREADS)
+				LOOP_ORDERED_DYNAMIC_PARTICLES(order) {
+					basic_integrate(sim, p, &pa->state, &pa->prev_state, pa->state.time, cfra);
 				}
 
 				/* calculate summation density */
-				#pragma omp parallel for firstprivate (sphdata) private (pa) schedule(dynamic,5)
-				LOOP_DYNAMIC_PARTICLES {
+				#pragma omp parallel for firstprivate (sphdata) private (pa, p) schedule(dynamic,5) num_threads(PSYS_OMP_THREADS)
+				LOOP_ORDERED_DYNAMIC_PARTICLES(order) {
 					sphclassical_calc_dens(pa, pa->state.time, &sphdata);
 				}
 
 				/* do global forces & effectors */
-				#pragma omp parallel for firstprivate (sphdata) private (pa) schedule(dynamic,5)
-				LOOP_DYNAMIC_PARTICLES {
+				#pragma omp parallel for firstprivate (sphdata) private (pa, p) schedule(dynamic,5) num_threads(PSYS_OMP_THREADS)
+				LOOP_ORDERED_DYNAMIC_PARTICLES(order) {
+					sphdata.thread = PSYS_THREAD_NUM;
+
 					/* actual fluids calculations */
 					sph_integrate(sim, pa, pa->state.time, &sphdata);
 
 					if (sim->colliders)
-						collision_check(sim, p, pa->state.time, cfra);
+						collision_check(sim, p, &pa->state, &pa->prev_state, pa->state.time, cfra);
 				
 					/* SPH particles are not physical particles, just interpolation
 					 * particles,  thus rotation has not a direct sense for them */
-					basic_rotate(part, pa, pa->state.time, timestep);
+					basic_rotate(part, &pa->state, &pa->prev_state, pa->state.time, timestep);
 
-					#pragma omp critical
 					if (part->time_flag & PART_TIME_AUTOSF)
-						update_courant_num(sim, pa, dtime, &sphdata);
+						update_courant_num(&courant_num[sphdata.thread], pa, dtime, &sphdata);
 				}
+
+				merge_courant_num(sim, courant_num);
 			}
 
+			MEM_freeN(order);
 			psys_sph_finalise(&sphdata);
 			break;
 		}
@@ -4295,11 +4603,19 @@ static void dynamics_step(ParticleSimulationData *sim, float cfra)
 		if (pa->alive == PARS_DYING) {
 			pa->alive=PARS_DEAD;
 			pa->state.time=pa->dietime;
+			soa->alive[p] = FALSE;
 		}
 		else
 			pa->state.time=cfra;
 	}
 
+	/* newtonian particles were integrated in the state arrays, the other
+	 * physics types still work on ParticleData */
+	if (part->phystype == PART_PHYS_NEWTON)
+		soa->cfra = cfra;
+	else
+		psys_state_arrays_from_particles(psys, cfra);
+
 	free_collider_cache(&sim->colliders);
 }
 static void update_children(ParticleSimulationData *sim)
@@ -4327,6 +4643,9 @@ static void cached_step(ParticleSimulationData *sim, float cfra)
 	float disp, dietime;
 
 	psys_update_effectors(sim);
+
+	/* particle state comes from the cache now */
+	psys_invalidate_state_arrays(psys);
 	
 	disp= (float)psys_get_current_display_percentage(psys)/100.0f;
 
@@ -4494,6 +4813,7 @@ static void system_step(ParticleSimulationData *sim, float cfra)
 	ParticleSettings *part = psys->part;
 	PointCache *cache = psys->pointcache;
 	PTCacheID ptcacheid, *pid = NULL;
+	ParticleStateArrays *soa;
 	PARTICLE_P;
 	float disp, cache_cfra = cfra; /*, *vg_vel= 0, *vg_tan= 0, *vg_rot= 0, *vg_size= 0; */
 	int startframe = 0, endframe = 100, oldtotpart = 0;
@@ -4528,6 +4848,7 @@ static void system_step(ParticleSimulationData *sim, float cfra)
 		initialize_all_particles(sim);
 		/* reset only just created particles (on startframe all particles are recreated) */
 		reset_all_particles(sim, 0.0, cfra, oldtotpart);
+		psys_invalidate_state_arrays(psys);
 
 		if (psys->fluid_springs) {
 			MEM_freeN(psys->fluid_springs);
@@ -4579,11 +4900,17 @@ static void system_step(ParticleSimulationData *sim, float cfra)
 	/* set particles to be not calculated TODO: can't work with pointcache */
 	disp= (float)psys_get_current_display_percentage(psys)/100.0f;
 
+	soa = (psys->state_arrays && psys->state_arrays->totpart == psys->totpart) ? psys->state_arrays : NULL;
+
 	LOOP_PARTICLES {
 		if (PSYS_FRAND(p) > disp)
 			pa->flag |= PARS_NO_DISP;
 		else
 			pa->flag &= ~PARS_NO_DISP;
+
+		/* display percentage may have changed which particles are shown */
+		if (soa)
+			soa->alive[p] = (pa->alive == PARS_ALIVE && !(pa->flag & (PARS_UNEXIST|PARS_NO_DISP)));
 	}
 
 	if (psys->totpart) {
@@ -90,12 +90,18 @@
 
 /* needed for directory lookup */
 /* untitled blend's need getpid for a unique name */
+/* container files are mapped for reading */
+#include <fcntl.h>
 #ifndef WIN32
 #  include <dirent.h>
 #  include <unistd.h>
+#  include <sys/mman.h>
 #else
 #  include <process.h>
+#  include <io.h>
 #  include "BLI_winstuff.h"
+#  include "mmap_win.h"
+#  define close _close
 #endif
 
 #define PTCACHE_DATA_FROM(data, type, from)  \
@@ -132,6 +138,11 @@ static int ptcache_file_compressed_read(PTCacheFile *pf, unsigned char *result,
 static int ptcache_file_compressed_write(PTCacheFile *pf, unsigned char *in, unsigned int in_len, unsigned char *out, int mode);
 static int ptcache_file_write(PTCacheFile *pf, const void *f, unsigned int tot, unsigned int size);
 static int ptcache_file_read(PTCacheFile *pf, void *f, unsigned int tot, unsigned int size);
+static void ptcache_data_free(PTCacheMem *pm);
+static void ptcache_extra_free(PTCacheMem *pm);
+static void ptcache_prefetch_invalidate(PointCache *cache);
+static void ptcache_prefetch_invalidate_frame(PointCache *cache, int frame);
+static PTCacheMem *ptcache_disk_frame_to_mem(PTCacheID *pid, int cfra, struct PTCacheMap **r_map);
 
 /* Common functions */
 static int ptcache_basic_header_read(PTCacheFile *pf)
@@ -139,10 +150,10 @@ static int ptcache_basic_header_read(PTCacheFile *pf)
 	int error=0;
 
 	/* Custom functions should read these basic elements too! */
-	if (!error && !fread(&pf->totpoint, sizeof(unsigned int), 1, pf->fp))
+	if (!error && !ptcache_file_read(pf, &pf->totpoint, 1, sizeof(unsigned int)))
 		error = 1;
 	
-	if (!error && !fread(&pf->data_types, sizeof(unsigned int), 1, pf->fp))
+	if (!error && !ptcache_file_read(pf, &pf->data_types, 1, sizeof(unsigned int)))
 		error = 1;
 
 	return !error;
@@ -150,10 +161,10 @@ static int ptcache_basic_header_read(PTCacheFile *pf)
 static int ptcache_basic_header_write(PTCacheFile *pf)
 {
 	/* Custom functions should write these basic elements too! */
-	if (!fwrite(&pf->totpoint, sizeof(unsigned int), 1, pf->fp))
+	if (!ptcache_file_write(pf, &pf->totpoint, 1, sizeof(unsigned int)))
 		return 0;
 	
-	if (!fwrite(&pf->data_types, sizeof(unsigned int), 1, pf->fp))
+	if (!ptcache_file_write(pf, &pf->data_types, 1, sizeof(unsigned int)))
 		return 0;
 
 	return 1;
@@ -242,6 +253,7 @@ static int  ptcache_particle_write(int index, void *psys_v, void **data, int cfr
 	ParticleSystem *psys= psys_v;
 	ParticleData *pa = psys->particles + index;
 	BoidParticle *boid = (psys->part->phystype == PART_PHYS_BOIDS) ? pa->boid : NULL;
+	ParticleStateArrays *soa = psys_get_state_arrays(psys, (float)cfra);
 	float times[3];
 	int step = psys->pointcache->step;
 
@@ -254,10 +266,19 @@ static int  ptcache_particle_write(int index, void *psys_v, void **data, int cfr
 	times[2] = pa->lifetime;
 
 	PTCACHE_DATA_FROM(data, BPHYS_DATA_INDEX, &index);
-	PTCACHE_DATA_FROM(data, BPHYS_DATA_LOCATION, pa->state.co);
-	PTCACHE_DATA_FROM(data, BPHYS_DATA_VELOCITY, pa->state.vel);
-	PTCACHE_DATA_FROM(data, BPHYS_DATA_ROTATION, pa->state.rot);
-	PTCACHE_DATA_FROM(data, BPHYS_DATA_AVELOCITY, pa->state.ave);
+	if (soa) {
+		/* state of the step just done, in cache friendly layout */
+		PTCACHE_DATA_FROM(data, BPHYS_DATA_LOCATION, soa->co[index]);
+		PTCACHE_DATA_FROM(data, BPHYS_DATA_VELOCITY, soa->vel[index]);
+		PTCACHE_DATA_FROM(data, BPHYS_DATA_ROTATION, soa->rot[index]);
+		PTCACHE_DATA_FROM(data, BPHYS_DATA_AVELOCITY, soa->ave[index]);
+	}
+	else {
+		PTCACHE_DATA_FROM(data, BPHYS_DATA_LOCATION, pa->state.co);
+		PTCACHE_DATA_FROM(data, BPHYS_DATA_VELOCITY, pa->state.vel);
+		PTCACHE_DATA_FROM(data, BPHYS_DATA_ROTATION, pa->state.rot);
+		PTCACHE_DATA_FROM(data, BPHYS_DATA_AVELOCITY, pa->state.ave);
+	}
 	PTCACHE_DATA_FROM(data, BPHYS_DATA_SIZE, &pa->size);
 	PTCACHE_DATA_FROM(data, BPHYS_DATA_TIMES, times);
 
@@ -1253,504 +1274,2695 @@ static int ptcache_filename(PTCacheID *pid, char *filename, int cfra, short do_p
 	return len; /* make sure the above string is always 16 chars */
 }
 
-/* youll need to close yourself after! */
-static PTCacheFile *ptcache_file_open(PTCacheID *pid, int mode, int cfra)
+/* ************** Container disk cache ************** */
+
+/* With PTCACHE_DISK_CONTAINER all frames of a disk cache are stored in a
+ * single file instead of a file per frame. The file starts with a header,
+ * followed by frame chunks aligned to PTCACHE_CONTAINER_ALIGN. A chunk holds
+ * the same data as a .bphys file would. The frame index is an array of
+ * entries somewhere in the file with room to append to, once full it's
+ * copied to the end of the file with twice the room. Entries appended later
+ * replace earlier ones for the same frame, space of replaced chunks isn't
+ * reused.
+ *
+ * Containers are mapped into memory for reading, the index is kept in
+ * memory. Lookups only stat the file, when its modification time or size
+ * don't match the last read or write anymore the index is read again. */
+
+#define PTCACHE_CONTAINER_VERSION   1
+#define PTCACHE_CONTAINER_ALIGN     4096
+#define PTCACHE_CONTAINER_MIN_INDEX 256
+
+/* chunk data is aligned to this for PTCACHE_TYPEFLAG_ARRAYS */
+#define PTCACHE_ARRAY_ALIGN         16
+
+typedef struct PTCacheContainerHeader {
+	char magic[8];              /* "BPHCACHE" */
+	unsigned int version;
+	unsigned int totentry;      /* used entries of the index */
+	uint64_t index_offset;
+	unsigned int index_size;    /* room for entries at index_offset */
+	unsigned int pad;
+} PTCacheContainerHeader;
+
+typedef struct PTCacheIndexEntry {
+	int frame;
+	unsigned int pad;
+	uint64_t offset, size;
+} PTCacheIndexEntry;
+
+/* A mapped container file or a prefetched frame, shared by reference counting */
+typedef struct PTCacheMap {
+	unsigned char *data;
+	size_t len;
+	int users;
+	int mapped;                 /* data is mmap'ed, otherwise allocated */
+	struct PTCacheMem *pm;      /* prefetched point cache frame */
+} PTCacheMap;
+
+typedef struct PTCacheContainer {
+	struct PTCacheContainer *next, *prev;
+	char filename[MAX_PTCACHE_FILE];
+	const PointCache *cache;    /* owner, only used as key */
+
+	/* file as of the last index read or write, 0 size if it doesn't exist */
+	time_t mtime;
+	uint64_t filesize;
+
+	PTCacheIndexEntry *frames;  /* sorted by frame, one per frame */
+	unsigned int totframe, allocframe;
+
+	PTCacheContainerHeader header;  /* as on disk */
+	PTCacheMap *map;
+} PTCacheContainer;
+
+static pthread_mutex_t ptcache_container_lock = PTHREAD_MUTEX_INITIALIZER;
+static ListBase ptcache_containers = {NULL, NULL};
+
+static int ptcache_container_filename(PTCacheID *pid, char *filename)
 {
-	PTCacheFile *pf;
-	FILE *fp = NULL;
-	char filename[FILE_MAX * 2];
+	int len = ptcache_filename(pid, filename, 0, 1, 0);
 
-#ifndef DURIAN_POINTCACHE_LIB_OK
-	/* don't allow writing for linked objects */
-	if (pid->ob->id.lib && mode == PTCACHE_FILE_WRITE)
-		return NULL;
-#endif
-	if (!G.relbase_valid && (pid->cache->flag & PTCACHE_EXTERNAL)==0) return NULL; /* save blend file before using disk pointcache */
-	
-	ptcache_filename(pid, filename, cfra, 1, 1);
+	if (len == 0)
+		return 0;
 
-	if (mode==PTCACHE_FILE_READ) {
-		if (!BLI_exists(filename)) {
-			return NULL;
+	if (pid->cache->index < 0 && (pid->cache->flag & PTCACHE_EXTERNAL) == 0)
+		pid->cache->index = pid->stack_index = BKE_object_insert_ptcache(pid->ob);
+
+	BLI_snprintf(filename + len, MAX_PTCACHE_FILE - len, "_%02u"PTCACHE_CONTAINER_EXT, pid->stack_index);
+
+	return len + 8;
+}
+
+static void ptcache_map_unref(PTCacheMap *map)
+{
+	if (map && --map->users == 0) {
+		if (map->pm) {
+			ptcache_data_free(map->pm);
+			ptcache_extra_free(map->pm);
+			MEM_freeN(map->pm);
 		}
-		fp = BLI_fopen(filename, "rb");
-	}
-	else if (mode==PTCACHE_FILE_WRITE) {
-		BLI_make_existing_file(filename); /* will create the dir if needs be, same as //textures is created */
-		fp = BLI_fopen(filename, "wb");
-	}
-	else if (mode==PTCACHE_FILE_UPDATE) {
-		BLI_make_existing_file(filename);
-		fp = BLI_fopen(filename, "rb+");
+		else if (map->mapped)
+			munmap(map->data, map->len);
+		else if (map->data)
+			MEM_freeN(map->data);
+
+		MEM_freeN(map);
 	}
+}
+static void ptcache_map_release(PTCacheMap *map)
+{
+	pthread_mutex_lock(&ptcache_container_lock);
+	ptcache_map_unref(map);
+	pthread_mutex_unlock(&ptcache_container_lock);
+}
+static PTCacheMap *ptcache_map_file(const char *filename)
+{
+	PTCacheMap *map = NULL;
+	unsigned char *data;
+	size_t size;
+	int file = BLI_open(filename, O_BINARY | O_RDONLY, 0);
 
-	if (!fp)
+	if (file < 0)
 		return NULL;
 
-	pf= MEM_mallocN(sizeof(PTCacheFile), "PTCacheFile");
-	pf->fp= fp;
-	pf->old_format = 0;
-	pf->frame = cfra;
+	size = BLI_file_descriptor_size(file);
 
-	return pf;
+	if (size > 0 && size != (size_t)-1) {
+		data = mmap(NULL, size, PROT_READ, MAP_SHARED, file, 0);
+
+		if (data != (unsigned char *) MAP_FAILED) {
+			map = MEM_callocN(sizeof(PTCacheMap), "PTCacheMap");
+			map->data = data;
+			map->len = size;
+			map->users = 1;
+			map->mapped = TRUE;
+		}
+	}
+
+	close(file);
+
+	return map;
 }
-static void ptcache_file_close(PTCacheFile *pf)
+
+static int ptcache_index_entry_cmp(const void *a_v, const void *b_v)
 {
-	if (pf) {
-		fclose(pf->fp);
-		MEM_freeN(pf);
-	}
+	const PTCacheIndexEntry *a = a_v, *b = b_v;
+
+	if (a->frame != b->frame)
+		return (a->frame < b->frame) ? -1 : 1;
+
+	/* newer chunks are further in the file */
+	if (a->offset != b->offset)
+		return (a->offset < b->offset) ? -1 : 1;
+
+	return 0;
 }
+static PTCacheIndexEntry *ptcache_container_lookup(PTCacheContainer *cont, int frame, unsigned int *r_pos)
+{
+	unsigned int lo = 0, hi = cont->totframe;
 
-static int ptcache_file_compressed_read(PTCacheFile *pf, unsigned char *result, unsigned int len)
+	while (lo < hi) {
+		unsigned int mid = (lo + hi) / 2;
+
+		if (cont->frames[mid].frame < frame)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (r_pos)
+		*r_pos = lo;
+
+	return (lo < cont->totframe && cont->frames[lo].frame == frame) ? cont->frames + lo : NULL;
+}
+static void ptcache_container_stamp(PTCacheContainer *cont)
 {
-	int r = 0;
-	unsigned char compressed = 0;
-	size_t in_len;
-#ifdef WITH_LZO
-	size_t out_len = len;
-#endif
-	unsigned char *in;
-	unsigned char *props = MEM_callocN(16 * sizeof(char), "tmp");
+	struct stat st;
 
-	ptcache_file_read(pf, &compressed, 1, sizeof(unsigned char));
-	if (compressed) {
-		unsigned int size;
-		ptcache_file_read(pf, &size, 1, sizeof(unsigned int));
-		in_len = (size_t)size;
-		if (in_len==0) {
-			/* do nothing */
-		}
-		else {
-			in = (unsigned char *)MEM_callocN(sizeof(unsigned char)*in_len, "pointcache_compressed_buffer");
-			ptcache_file_read(pf, in, in_len, sizeof(unsigned char));
-#ifdef WITH_LZO
-			if (compressed == 1)
-				r = lzo1x_decompress_safe(in, (lzo_uint)in_len, result, (lzo_uint *)&out_len, NULL);
-#endif
-#ifdef WITH_LZMA
-			if (compressed == 2) {
-				size_t sizeOfIt;
-				size_t leni = in_len, leno = len;
-				ptcache_file_read(pf, &size, 1, sizeof(unsigned int));
-				sizeOfIt = (size_t)size;
-				ptcache_file_read(pf, props, sizeOfIt, sizeof(unsigned char));
-				r = LzmaUncompress(result, &leno, in, &leni, props, sizeOfIt);
-			}
-#endif
-			MEM_freeN(in);
-		}
+	if (BLI_stat(cont->filename, &st) == 0) {
+		cont->mtime = st.st_mtime;
+		cont->filesize = (uint64_t)st.st_size;
 	}
 	else {
-		ptcache_file_read(pf, result, len, sizeof(unsigned char));
+		cont->mtime = 0;
+		cont->filesize = 0;
 	}
+}
+/* was the file changed, replaced or removed by something else? */
+static int ptcache_container_changed(PTCacheContainer *cont)
+{
+	struct stat st;
 
-	MEM_freeN(props);
+	if (BLI_stat(cont->filename, &st) != 0)
+		return (cont->filesize != 0);
 
-	return r;
+	return (cont->mtime != st.st_mtime || cont->filesize != (uint64_t)st.st_size);
 }
-static int ptcache_file_compressed_write(PTCacheFile *pf, unsigned char *in, unsigned int in_len, unsigned char *out, int mode)
+static void ptcache_container_read_index(PTCacheContainer *cont)
 {
-	int r = 0;
-	unsigned char compressed = 0;
-	size_t out_len= 0;
-	unsigned char *props = MEM_callocN(16 * sizeof(char), "tmp");
-	size_t sizeOfIt = 5;
+	PTCacheContainerHeader *header = &cont->header;
+	FILE *fp;
+	unsigned int a, b;
 
-	(void)mode; /* unused when building w/o compression */
+	ptcache_container_stamp(cont);
 
-#ifdef WITH_LZO
-	out_len= LZO_OUT_LEN(in_len);
-	if (mode == 1) {
-		LZO_HEAP_ALLOC(wrkmem, LZO1X_MEM_COMPRESS);
-		
-		r = lzo1x_1_compress(in, (lzo_uint)in_len, out, (lzo_uint *)&out_len, wrkmem);
-		if (!(r == LZO_E_OK) || (out_len >= in_len))
-			compressed = 0;
-		else
-			compressed = 1;
-	}
-#endif
-#ifdef WITH_LZMA
-	if (mode == 2) {
-		
-		r = LzmaCompress(out, &out_len, in, in_len, //assume sizeof(char)==1....
-						props, &sizeOfIt, 5, 1 << 24, 3, 0, 2, 32, 2);
+	fp = BLI_fopen(cont->filename, "rb");
 
-		if (!(r == SZ_OK) || (out_len >= in_len))
-			compressed = 0;
-		else
-			compressed = 2;
-	}
-#endif
-	
-	ptcache_file_write(pf, &compressed, 1, sizeof(unsigned char));
-	if (compressed) {
-		unsigned int size = out_len;
-		ptcache_file_write(pf, &size, 1, sizeof(unsigned int));
-		ptcache_file_write(pf, out, out_len, sizeof(unsigned char));
+	if (fp == NULL)
+		return;
+
+	if (fread(header, sizeof(PTCacheContainerHeader), 1, fp) != 1 ||
+	    strncmp(header->magic, "BPHCACHE", 8) != 0 ||
+	    header->version != PTCACHE_CONTAINER_VERSION ||
+	    header->totentry > header->index_size)
+	{
+		if (G.debug & G_DEBUG)
+			printf("Error reading disk cache container %s\n", cont->filename);
+
+		memset(header, 0, sizeof(PTCacheContainerHeader));
+		fclose(fp);
+		return;
 	}
-	else
-		ptcache_file_write(pf, in, in_len, sizeof(unsigned char));
 
-	if (compressed == 2) {
-		unsigned int size = sizeOfIt;
-		ptcache_file_write(pf, &sizeOfIt, 1, sizeof(unsigned int));
-		ptcache_file_write(pf, props, size, sizeof(unsigned char));
+	cont->allocframe = MAX2(header->totentry, 1);
+	cont->frames = MEM_mallocN(sizeof(PTCacheIndexEntry) * cont->allocframe, "PTCacheIndexEntry");
+
+	if (fseek(fp, header->index_offset, SEEK_SET) != 0 ||
+	    fread(cont->frames, sizeof(PTCacheIndexEntry), header->totentry, fp) != header->totentry)
+	{
+		header->totentry = 0;
 	}
 
-	MEM_freeN(props);
+	fclose(fp);
 
-	return r;
-}
-static int ptcache_file_read(PTCacheFile *pf, void *f, unsigned int tot, unsigned int size)
-{
-	return (fread(f, size, tot, pf->fp) == tot);
+	/* keep only the last entry of each frame */
+	qsort(cont->frames, header->totentry, sizeof(PTCacheIndexEntry), ptcache_index_entry_cmp);
+
+	for (a = 0, b = 0; a < header->totentry; a++) {
+		if (a + 1 < header->totentry && cont->frames[a + 1].frame == cont->frames[a].frame)
+			continue;
+		cont->frames[b++] = cont->frames[a];
+	}
+
+	cont->totframe = b;
 }
-static int ptcache_file_write(PTCacheFile *pf, const void *f, unsigned int tot, unsigned int size)
+static void ptcache_container_free(PTCacheContainer *cont)
 {
-	return (fwrite(f, size, tot, pf->fp) == tot);
+	BLI_remlink(&ptcache_containers, cont);
+	ptcache_map_unref(cont->map);
+	if (cont->frames)
+		MEM_freeN(cont->frames);
+	MEM_freeN(cont);
 }
-static int ptcache_file_data_read(PTCacheFile *pf)
+/* Returns the cached container for filename, reading it when it's not cached
+ * yet or the file changed since. Must be called with ptcache_container_lock held. */
+static PTCacheContainer *ptcache_container_get(const PointCache *cache, const char *filename)
 {
-	int i;
+	PTCacheContainer *cont;
+
+	for (cont = ptcache_containers.first; cont; cont = cont->next) {
+		if (strcmp(cont->filename, filename) == 0) {
+			if (!ptcache_container_changed(cont)) {
+				if (cache)
+					cont->cache = cache;
+				return cont;
+			}
 
-	for (i=0; i<BPHYS_TOT_DATA; i++) {
-		if ((pf->data_types & (1<<i)) && !ptcache_file_read(pf, pf->cur[i], 1, ptcache_data_size[i]))
-			return 0;
+			ptcache_container_free(cont);
+			break;
+		}
 	}
-	
-	return 1;
-}
-static int ptcache_file_data_write(PTCacheFile *pf)
-{		
-	int i;
 
-	for (i=0; i<BPHYS_TOT_DATA; i++) {
-		if ((pf->data_types & (1<<i)) && !ptcache_file_write(pf, pf->cur[i], 1, ptcache_data_size[i]))
-			return 0;
-	}
-	
-	return 1;
+	cont = MEM_callocN(sizeof(PTCacheContainer), "PTCacheContainer");
+	BLI_strncpy(cont->filename, filename, sizeof(cont->filename));
+	cont->cache = cache;
+	ptcache_container_read_index(cont);
+	BLI_addtail(&ptcache_containers, cont);
+
+	return cont;
 }
-static int ptcache_file_header_begin_read(PTCacheFile *pf)
+static void ptcache_container_set_frame(PTCacheContainer *cont, const PTCacheIndexEntry *entry)
 {
-	unsigned int typeflag=0;
-	int error=0;
-	char bphysics[8];
-	
-	pf->data_types = 0;
-	
-	if (fread(bphysics, sizeof(char), 8, pf->fp) != 8)
-		error = 1;
-	
-	if (!error && strncmp(bphysics, "BPHYSICS", 8))
-		error = 1;
+	PTCacheIndexEntry *existing;
+	unsigned int pos;
 
-	if (!error && !fread(&typeflag, sizeof(unsigned int), 1, pf->fp))
-		error = 1;
+	existing = ptcache_container_lookup(cont, entry->frame, &pos);
 
-	pf->type = (typeflag & PTCACHE_TYPEFLAG_TYPEMASK);
-	pf->flag = (typeflag & PTCACHE_TYPEFLAG_FLAGMASK);
-	
-	/* if there was an error set file as it was */
-	if (error)
-		fseek(pf->fp, 0, SEEK_SET);
+	if (existing) {
+		*existing = *entry;
+		return;
+	}
 
-	return !error;
+	if (cont->totframe == cont->allocframe) {
+		cont->allocframe = MAX2(cont->allocframe * 2, PTCACHE_CONTAINER_MIN_INDEX);
+		if (cont->frames)
+			cont->frames = MEM_reallocN(cont->frames, sizeof(PTCacheIndexEntry) * cont->allocframe);
+		else
+			cont->frames = MEM_mallocN(sizeof(PTCacheIndexEntry) * cont->allocframe, "PTCacheIndexEntry");
+	}
+
+	memmove(cont->frames + pos + 1, cont->frames + pos, sizeof(PTCacheIndexEntry) * (cont->totframe - pos));
+	cont->frames[pos] = *entry;
+	cont->totframe++;
 }
-static int ptcache_file_header_begin_write(PTCacheFile *pf)
+/* Writes all frames as the index at offset, with room for index_size entries. */
+static int ptcache_container_write_index(PTCacheContainer *cont, FILE *fp, uint64_t offset, unsigned int index_size)
 {
-	const char *bphysics = "BPHYSICS";
-	unsigned int typeflag = pf->type + pf->flag;
-	
-	if (fwrite(bphysics, sizeof(char), 8, pf->fp) != 8)
-		return 0;
+	PTCacheContainerHeader *header = &cont->header;
+	PTCacheIndexEntry empty = {0};
+	unsigned int a;
+
+	BLI_assert(cont->totframe <= index_size);
 
-	if (!fwrite(&typeflag, sizeof(unsigned int), 1, pf->fp))
+	if (fseek(fp, offset, SEEK_SET) != 0 ||
+	    fwrite(cont->frames, sizeof(PTCacheIndexEntry), cont->totframe, fp) != cont->totframe)
+	{
 		return 0;
-	
+	}
+
+	for (a = cont->totframe; a < index_size; a++) {
+		if (fwrite(&empty, sizeof(PTCacheIndexEntry), 1, fp) != 1)
+			return 0;
+	}
+
+	header->index_offset = offset;
+	header->index_size = index_size;
+	header->totentry = cont->totframe;
+
 	return 1;
 }
-
-/* Data pointer handling */
-int BKE_ptcache_data_size(int data_type)
+static int ptcache_container_write_header(PTCacheContainer *cont, FILE *fp)
 {
-	return ptcache_data_size[data_type];
+	/* written last, so an interrupted write leaves the old index in use */
+	return (fflush(fp) == 0 &&
+	        fseek(fp, 0, SEEK_SET) == 0 &&
+	        fwrite(&cont->header, sizeof(PTCacheContainerHeader), 1, fp) == 1);
 }
-
-static void ptcache_file_pointers_init(PTCacheFile *pf)
+/* Appends a frame chunk to the container, replacing the frame if it was written before. */
+static int ptcache_container_write_frame(const PointCache *cache, const char *filename, int frame, const unsigned char *data, size_t len)
 {
-	int data_types = pf->data_types;
+	PTCacheContainer *cont;
+	PTCacheContainerHeader *header;
+	PTCacheIndexEntry entry = {0};
+	FILE *fp;
+	uint64_t end;
+	int error = 0;
 
-	pf->cur[BPHYS_DATA_INDEX] =		(data_types & (1<<BPHYS_DATA_INDEX))	?		&pf->data.index	: NULL;
-	pf->cur[BPHYS_DATA_LOCATION] =	(data_types & (1<<BPHYS_DATA_LOCATION)) ?		&pf->data.loc	: NULL;
-	pf->cur[BPHYS_DATA_VELOCITY] =	(data_types & (1<<BPHYS_DATA_VELOCITY)) ?		&pf->data.vel	: NULL;
-	pf->cur[BPHYS_DATA_ROTATION] =	(data_types & (1<<BPHYS_DATA_ROTATION)) ?		&pf->data.rot	: NULL;
-	pf->cur[BPHYS_DATA_AVELOCITY] =	(data_types & (1<<BPHYS_DATA_AVELOCITY))?		&pf->data.ave	: NULL;
-	pf->cur[BPHYS_DATA_SIZE] =		(data_types & (1<<BPHYS_DATA_SIZE))		?		&pf->data.size	: NULL;
-	pf->cur[BPHYS_DATA_TIMES] =		(data_types & (1<<BPHYS_DATA_TIMES))	?		&pf->data.times	: NULL;
-	pf->cur[BPHYS_DATA_BOIDS] =		(data_types & (1<<BPHYS_DATA_BOIDS))	?		&pf->data.boids	: NULL;
-}
+	pthread_mutex_lock(&ptcache_container_lock);
 
-/* Check to see if point number "index" is in pm, uses binary search for index data. */
-int BKE_ptcache_mem_index_find(PTCacheMem *pm, unsigned int index)
-{
-	if (pm->data[BPHYS_DATA_INDEX]) {
-		unsigned int *data = pm->data[BPHYS_DATA_INDEX];
-		unsigned int mid, low = 0, high = pm->totpoint - 1;
+	cont = ptcache_container_get(cache, filename);
+	header = &cont->header;
 
-		if (index < *data || index > *(data+high))
-			return -1;
+	fp = (header->version) ? BLI_fopen(filename, "rb+") : NULL;
 
-		/* check simple case for continuous indexes first */
-		if (index-*data < high && data[index-*data] == index)
-			return index-*data;
+	if (fp == NULL) {
+		/* new or unreadable container, start over */
+		BLI_make_existing_file(filename);
+		fp = BLI_fopen(filename, "wb+");
 
-		while (low <= high) {
-			mid= (low + high)/2;
+		if (fp == NULL) {
+			pthread_mutex_unlock(&ptcache_container_lock);
+			return 0;
+		}
 
-			if (data[mid] > index)
-				high = mid - 1;
-			else if (data[mid] < index)
-				low = mid + 1;
-			else
-				return mid;
-		}
+		memset(header, 0, sizeof(PTCacheContainerHeader));
+		memcpy(header->magic, "BPHCACHE", 8);
+		header->version = PTCACHE_CONTAINER_VERSION;
+		cont->totframe = 0;
 
-		return -1;
+		if (!ptcache_container_write_index(cont, fp, sizeof(PTCacheContainerHeader), PTCACHE_CONTAINER_MIN_INDEX))
+			error = 1;
 	}
-	else {
-		return (index < pm->totpoint ? index : -1);
+
+	if (!error && fseek(fp, 0, SEEK_END) != 0)
+		error = 1;
+
+	if (!error) {
+		end = (uint64_t)ftell(fp);
+
+		entry.frame = frame;
+		entry.offset = (end + PTCACHE_CONTAINER_ALIGN - 1) & ~(uint64_t)(PTCACHE_CONTAINER_ALIGN - 1);
+		entry.size = len;
+
+		if (fseek(fp, entry.offset, SEEK_SET) != 0 || fwrite(data, 1, len, fp) != len)
+			error = 1;
+	}
+
+	if (!error) {
+		ptcache_container_set_frame(cont, &entry);
+
+		if (header->totentry < header->index_size) {
+			/* append to the index */
+			if (fseek(fp, header->index_offset + sizeof(PTCacheIndexEntry) * header->totentry, SEEK_SET) != 0 ||
+			    fwrite(&entry, sizeof(PTCacheIndexEntry), 1, fp) != 1)
+			{
+				error = 1;
+			}
+			header->totentry++;
+		}
+		else {
+			/* move the index to the end with more room */
+			if (!ptcache_container_write_index(cont, fp, entry.offset + len, MAX2(cont->totframe * 2, PTCACHE_CONTAINER_MIN_INDEX)))
+				error = 1;
+		}
+	}
+
+	if (!error && !ptcache_container_write_header(cont, fp))
+		error = 1;
+
+	fclose(fp);
+
+	if (error) {
+		/* don't trust the cached index anymore */
+		ptcache_container_free(cont);
 	}
+	else
+		ptcache_container_stamp(cont);
+
+	pthread_mutex_unlock(&ptcache_container_lock);
+
+	return error == 0;
 }
+/* Removes frames from the index, mode is PTCACHE_CLEAR_FRAME, _BEFORE or _AFTER. */
+static void ptcache_container_remove_frames(const PointCache *cache, const char *filename, int mode, int cfra)
+{
+	PTCacheContainer *cont;
+	unsigned int a, b;
+	FILE *fp;
 
-void BKE_ptcache_mem_pointers_init(PTCacheMem *pm)
+	pthread_mutex_lock(&ptcache_container_lock);
+
+	cont = ptcache_container_get(cache, filename);
+
+	for (a = 0, b = 0; a < cont->totframe; a++) {
+		int frame = cont->frames[a].frame;
+
+		if ((mode == PTCACHE_CLEAR_FRAME && frame == cfra) ||
+		    (mode == PTCACHE_CLEAR_BEFORE && frame < cfra) ||
+		    (mode == PTCACHE_CLEAR_AFTER && frame > cfra))
+		{
+			continue;
+		}
+
+		cont->frames[b++] = cont->frames[a];
+	}
+
+	if (b != cont->totframe) {
+		cont->totframe = b;
+
+		fp = BLI_fopen(filename, "rb+");
+
+		if (fp == NULL ||
+		    !ptcache_container_write_index(cont, fp, cont->header.index_offset, cont->header.index_size) ||
+		    !ptcache_container_write_header(cont, fp))
+		{
+			if (G.debug & G_DEBUG)
+				printf("Error writing disk cache container %s\n", filename);
+		}
+
+		if (fp)
+			fclose(fp);
+
+		ptcache_container_stamp(cont);
+	}
+
+	pthread_mutex_unlock(&ptcache_container_lock);
+}
+/* Drops the cached container, must be called with ptcache_container_lock held. */
+static void ptcache_container_drop(const char *filename)
 {
-	int data_types = pm->data_types;
-	int i;
+	PTCacheContainer *cont;
 
-	for (i=0; i<BPHYS_TOT_DATA; i++)
-		pm->cur[i] = ((data_types & (1<<i)) ? pm->data[i] : NULL);
+	for (cont = ptcache_containers.first; cont; cont = cont->next) {
+		if (strcmp(cont->filename, filename) == 0) {
+			ptcache_container_free(cont);
+			break;
+		}
+	}
 }
+static void ptcache_container_delete(const char *filename)
+{
+	pthread_mutex_lock(&ptcache_container_lock);
+	ptcache_container_drop(filename);
+	BLI_delete(filename, 0, 0);
+	pthread_mutex_unlock(&ptcache_container_lock);
+}
+static void ptcache_container_rename(const char *from, const char *to)
+{
+	pthread_mutex_lock(&ptcache_container_lock);
+	ptcache_container_drop(from);
+	ptcache_container_drop(to);
+	if (BLI_exists(from))
+		BLI_rename(from, to);
+	pthread_mutex_unlock(&ptcache_container_lock);
+}
+static int ptcache_container_has_frame(const PointCache *cache, const char *filename, int frame)
+{
+	int found;
 
-void BKE_ptcache_mem_pointers_incr(PTCacheMem *pm)
+	pthread_mutex_lock(&ptcache_container_lock);
+	found = (ptcache_container_lookup(ptcache_container_get(cache, filename), frame, NULL) != NULL);
+	pthread_mutex_unlock(&ptcache_container_lock);
+
+	return found;
+}
+/* Points pf to the mapped chunk of frame, the map is released when pf is closed. */
+static int ptcache_container_read_frame(const PointCache *cache, const char *filename, int frame, PTCacheFile *pf)
 {
-	int i;
+	PTCacheContainer *cont;
+	PTCacheIndexEntry *entry;
+	int found = 0;
 
-	for (i=0; i<BPHYS_TOT_DATA; i++) {
-		if (pm->cur[i])
-			pm->cur[i] = (char *)pm->cur[i] + ptcache_data_size[i];
+	pthread_mutex_lock(&ptcache_container_lock);
+
+	cont = ptcache_container_get(cache, filename);
+	entry = ptcache_container_lookup(cont, frame, NULL);
+
+	if (entry) {
+		/* the file grew since it was mapped */
+		if (cont->map == NULL || entry->offset + entry->size > cont->map->len) {
+			ptcache_map_unref(cont->map);
+			cont->map = ptcache_map_file(filename);
+		}
+
+		if (cont->map && entry->offset + entry->size <= cont->map->len) {
+			pf->map = cont->map;
+			pf->map->users++;
+			pf->mem = cont->map->data + entry->offset;
+			pf->mem_len = entry->size;
+			pf->mem_pos = 0;
+			found = 1;
+		}
 	}
+
+	pthread_mutex_unlock(&ptcache_container_lock);
+
+	return found;
 }
-int  BKE_ptcache_mem_pointers_seek(int point_index, PTCacheMem *pm)
+/* Range of stored frames, frame 0 is the info frame and not part of the range. */
+static int ptcache_container_frame_range(const PointCache *cache, const char *filename, int *r_start, int *r_end, int *r_info)
 {
-	int data_types = pm->data_types;
-	int i, index = BKE_ptcache_mem_index_find(pm, point_index);
+	PTCacheContainer *cont;
+	unsigned int a;
+	int found = 0;
 
-	if (index < 0) {
-		/* Can't give proper location without reallocation, so don't give any location.
-		 * Some points will be cached improperly, but this only happens with simulation
-		 * steps bigger than cache->step, so the cache has to be recalculated anyways
-		 * at some point.
-		 */
-		return 0;
+	pthread_mutex_lock(&ptcache_container_lock);
+
+	cont = ptcache_container_get(cache, filename);
+
+	*r_info = 0;
+	for (a = 0; a < cont->totframe; a++) {
+		int frame = cont->frames[a].frame;
+
+		if (frame) {
+			if (!found) {
+				*r_start = frame;
+				found = 1;
+			}
+			*r_end = frame;
+		}
+		else
+			*r_info = 1;
 	}
 
-	for (i=0; i<BPHYS_TOT_DATA; i++)
-		pm->cur[i] = data_types & (1<<i) ? (char *)pm->data[i] + index * ptcache_data_size[i] : NULL;
+	pthread_mutex_unlock(&ptcache_container_lock);
 
-	return 1;
+	return found;
 }
-static void ptcache_data_alloc(PTCacheMem *pm)
+/* Drops the cached containers of a point cache that is freed. */
+static void ptcache_container_free_cache(const PointCache *cache)
 {
-	int data_types = pm->data_types;
-	int totpoint = pm->totpoint;
-	int i;
+	PTCacheContainer *cont, *next;
 
-	for (i=0; i<BPHYS_TOT_DATA; i++) {
-		if (data_types & (1<<i))
-			pm->data[i] = MEM_callocN(totpoint * ptcache_data_size[i], "PTCache Data");
+	pthread_mutex_lock(&ptcache_container_lock);
+
+	for (cont = ptcache_containers.first; cont; cont = next) {
+		next = cont->next;
+
+		if (cont->cache == cache)
+			ptcache_container_free(cont);
 	}
+
+	pthread_mutex_unlock(&ptcache_container_lock);
 }
-static void ptcache_data_free(PTCacheMem *pm)
+/* Frees the cached container indices and maps, the files aren't touched. */
+void BKE_ptcache_free_containers(void)
 {
-	void **data = pm->data;
-	int i;
+	pthread_mutex_lock(&ptcache_container_lock);
 
-	for (i=0; i<BPHYS_TOT_DATA; i++) {
-		if (data[i])
-			MEM_freeN(data[i]);
-	}
+	while (ptcache_containers.first)
+		ptcache_container_free(ptcache_containers.first);
+
+	pthread_mutex_unlock(&ptcache_container_lock);
 }
-static void ptcache_data_copy(void *from[], void *to[])
+
+/* ************** Write-behind disk writer ************** */
+
+/* While baking, disk cache files aren't written by the simulation thread.
+ * ptcache_file_open() returns a PTCacheFile that records everything written
+ * to it, compressed blocks are stored uncompressed. On close the recording is
+ * queued and worker threads compress and write it to disk. The queue is
+ * bounded, so a slow disk makes the simulation wait instead of eating memory.
+ * Frames that are still queued count as existing, reading or deleting them
+ * waits for the write to finish.
+ *
+ * Container frames are always recorded, without the writer the recording is
+ * written when the file is closed.
+ *
+ * Frames that fail to be written are kept in a list, the baker collects them
+ * when it's done and marks the frames as not cached. */
+
+#define PTCACHE_WRITER_MAX_THREADS  4
+#define PTCACHE_WRITER_MAX_JOBS     16
+#define PTCACHE_WRITER_MAX_SIZE     (256 * 1024 * 1024)
+
+typedef struct PTCacheWriteSegment {
+	struct PTCacheWriteSegment *next, *prev;
+	unsigned char *data;
+	unsigned int len, alloc;
+	int compress;           /* compression mode for ptcache_file_compressed_write, 0 for plain data */
+} PTCacheWriteSegment;
+
+typedef struct PTCacheWriteJob {
+	struct PTCacheWriteJob *next, *prev;
+	struct PointCache *cache;
+	char filename[FILE_MAX * 2];
+	int frame;
+	int container;          /* append to the container filename instead of writing a file */
+	ListBase segments;
+	size_t size;
+} PTCacheWriteJob;
+
+typedef struct PTCacheWriteError {
+	struct PTCacheWriteError *next, *prev;
+	struct PointCache *cache;
+	int frame;
+} PTCacheWriteError;
+
+static pthread_mutex_t ptcache_writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ptcache_writer_cond = PTHREAD_COND_INITIALIZER;  /* broadcast on any change */
+
+static struct {
+	pthread_t threads[PTCACHE_WRITER_MAX_THREADS];
+	int totthread;
+	int users, stop;
+	ListBase queue;         /* jobs waiting for a worker */
+	ListBase active;        /* jobs being written */
+	int totqueue;
+	size_t size;            /* memory used by queued and active jobs */
+	ListBase failed;        /* PTCacheWriteError for frames that couldn't be written */
+} ptcache_writer = {{0}};
+
+static PTCacheWriteJob *ptcache_writer_find(const char *filename, int frame)
 {
-	int i;
-	for (i=0; i<BPHYS_TOT_DATA; i++) {
-	/* note, durian file 03.4b_comp crashes if to[i] is not tested
-	 * its NULL, not sure if this should be fixed elsewhere but for now its needed */
-		if (from[i] && to[i])
-			memcpy(to[i], from[i], ptcache_data_size[i]);
-	}
+	PTCacheWriteJob *job;
+
+	for (job = ptcache_writer.queue.first; job; job = job->next)
+		if (job->frame == frame && strcmp(job->filename, filename) == 0)
+			return job;
+
+	for (job = ptcache_writer.active.first; job; job = job->next)
+		if (job->frame == frame && strcmp(job->filename, filename) == 0)
+			return job;
+
+	return NULL;
 }
+static int ptcache_writer_pending(const char *filename, int frame)
+{
+	int pending;
 
-static void ptcache_extra_free(PTCacheMem *pm)
+	if (ptcache_writer.users == 0)
+		return 0;
+
+	pthread_mutex_lock(&ptcache_writer_lock);
+	pending = (ptcache_writer_find(filename, frame) != NULL);
+	pthread_mutex_unlock(&ptcache_writer_lock);
+
+	return pending;
+}
+/* wait until frame of filename is on disk */
+static void ptcache_writer_flush_file(const char *filename, int frame)
 {
-	PTCacheExtra *extra = pm->extradata.first;
+	if (ptcache_writer.users == 0)
+		return;
 
-	if (extra) {
-		for (; extra; extra=extra->next) {
-			if (extra->data)
-				MEM_freeN(extra->data);
-		}
+	pthread_mutex_lock(&ptcache_writer_lock);
+	while (ptcache_writer_find(filename, frame))
+		pthread_cond_wait(&ptcache_writer_cond, &ptcache_writer_lock);
+	pthread_mutex_unlock(&ptcache_writer_lock);
+}
+/* wait until all queued files are on disk */
+static void ptcache_writer_flush(void)
+{
+	if (ptcache_writer.users == 0)
+		return;
 
-		BLI_freelistN(&pm->extradata);
+	pthread_mutex_lock(&ptcache_writer_lock);
+	while (ptcache_writer.queue.first || ptcache_writer.active.first)
+		pthread_cond_wait(&ptcache_writer_cond, &ptcache_writer_lock);
+	pthread_mutex_unlock(&ptcache_writer_lock);
+}
+static void ptcache_writer_push(PTCacheWriteJob *job)
+{
+	pthread_mutex_lock(&ptcache_writer_lock);
+
+	/* keep writes to the same frame in order */
+	while (ptcache_writer_find(job->filename, job->frame))
+		pthread_cond_wait(&ptcache_writer_cond, &ptcache_writer_lock);
+
+	/* back-pressure, but always accept a job into an empty queue */
+	while (ptcache_writer.queue.first &&
+	       (ptcache_writer.totqueue >= PTCACHE_WRITER_MAX_JOBS ||
+	        ptcache_writer.size + job->size > PTCACHE_WRITER_MAX_SIZE))
+	{
+		pthread_cond_wait(&ptcache_writer_cond, &ptcache_writer_lock);
 	}
+
+	BLI_addtail(&ptcache_writer.queue, job);
+	ptcache_writer.totqueue++;
+	ptcache_writer.size += job->size;
+
+	pthread_cond_broadcast(&ptcache_writer_cond);
+	pthread_mutex_unlock(&ptcache_writer_lock);
 }
-static int ptcache_old_elemsize(PTCacheID *pid)
+static PTCacheWriteJob *ptcache_write_job_new(PointCache *cache, const char *filename, int frame, int container)
 {
-	if (pid->type==PTCACHE_TYPE_SOFTBODY)
-		return 6 * sizeof(float);
-	else if (pid->type==PTCACHE_TYPE_PARTICLES)
-		return sizeof(ParticleKey);
-	else if (pid->type==PTCACHE_TYPE_CLOTH)
-		return 9 * sizeof(float);
+	PTCacheWriteJob *job = MEM_callocN(sizeof(PTCacheWriteJob), "PTCacheWriteJob");
 
-	return 0;
+	job->cache = cache;
+	BLI_strncpy(job->filename, filename, sizeof(job->filename));
+	job->frame = frame;
+	job->container = container;
+
+	return job;
 }
+static void ptcache_write_job_append(PTCacheWriteJob *job, const void *data, unsigned int len)
+{
+	PTCacheWriteSegment *seg = job->segments.last;
 
-static void ptcache_find_frames_around(PTCacheID *pid, unsigned int frame, int *fra1, int *fra2)
+	if (seg == NULL || seg->compress) {
+		seg = MEM_callocN(sizeof(PTCacheWriteSegment), "PTCacheWriteSegment");
+		seg->alloc = MAX2(len, 4096);
+		seg->data = MEM_mallocN(seg->alloc, "PTCacheWriteSegment data");
+		BLI_addtail(&job->segments, seg);
+	}
+	else if (seg->len + len > seg->alloc) {
+		seg->alloc = MAX2(seg->alloc * 2, seg->len + len);
+		seg->data = MEM_reallocN(seg->data, seg->alloc);
+	}
+
+	memcpy(seg->data + seg->len, data, len);
+	seg->len += len;
+	job->size += len;
+}
+static void ptcache_write_job_append_compressed(PTCacheWriteJob *job, const unsigned char *data, unsigned int len, int mode)
 {
-	if (pid->cache->flag & PTCACHE_DISK_CACHE) {
-		int cfra1=frame, cfra2=frame+1;
+	PTCacheWriteSegment *seg = MEM_callocN(sizeof(PTCacheWriteSegment), "PTCacheWriteSegment");
 
-		while (cfra1 >= pid->cache->startframe && !BKE_ptcache_id_exist(pid, cfra1))
-			cfra1--;
+	seg->data = MEM_mallocN(MAX2(len, 1), "PTCacheWriteSegment data");
+	memcpy(seg->data, data, len);
+	seg->len = seg->alloc = len;
+	seg->compress = mode;
+	BLI_addtail(&job->segments, seg);
 
-		if (cfra1 < pid->cache->startframe)
-			cfra1 = 0;
+	job->size += len;
+}
+static void ptcache_write_job_free(PTCacheWriteJob *job)
+{
+	PTCacheWriteSegment *seg;
 
-		while (cfra2 <= pid->cache->endframe && !BKE_ptcache_id_exist(pid, cfra2))
-			cfra2++;
+	for (seg = job->segments.first; seg; seg = seg->next)
+		MEM_freeN(seg->data);
 
-		if (cfra2 > pid->cache->endframe)
-			cfra2 = 0;
+	BLI_freelistN(&job->segments);
+	MEM_freeN(job);
+}
+/* returns 0 if the frame couldn't be written */
+static int ptcache_write_job_exec(PTCacheWriteJob *job)
+{
+	PTCacheWriteSegment *seg;
+	PTCacheFile pf = {NULL};
+	int error = 0;
 
-		if (cfra1 && !cfra2) {
-			*fra1 = 0;
-			*fra2 = cfra1;
+	if (job->container) {
+		/* assemble the chunk in memory */
+		pf.mem_alloc = job->size + 1024;
+		pf.mem = MEM_mallocN(pf.mem_alloc, "PTCacheFile mem");
+	}
+	else {
+		BLI_make_existing_file(job->filename);
+		pf.fp = BLI_fopen(job->filename, "wb");
+	}
+
+	if (pf.fp == NULL && pf.mem == NULL) {
+		printf("Error opening disk cache file for writing: %s\n", job->filename);
+		return 0;
+	}
+
+	for (seg = job->segments.first; seg; seg = seg->next) {
+		if (seg->compress) {
+			unsigned char *out = MEM_callocN(LZO_OUT_LEN(seg->len) * 4, "pointcache_lzo_buffer");
+			ptcache_file_compressed_write(&pf, seg->data, seg->len, out, seg->compress);
+			MEM_freeN(out);
 		}
-		else {
-			*fra1 = cfra1;
-			*fra2 = cfra2;
+		else if (!ptcache_file_write(&pf, seg->data, seg->len, sizeof(unsigned char))) {
+			error = 1;
+			break;
 		}
 	}
-	else if (pid->cache->mem_cache.first) {
-		PTCacheMem *pm = pid->cache->mem_cache.first;
-		PTCacheMem *pm2 = pid->cache->mem_cache.last;
 
-		while (pm->next && pm->next->frame <= frame)
-			pm= pm->next;
+	if (job->container) {
+		if (!error && !ptcache_container_write_frame(job->cache, job->filename, job->frame, pf.mem, pf.mem_len))
+			error = 1;
+		MEM_freeN(pf.mem);
+	}
+	else {
+		/* compressed segments don't report failed writes, check the stream */
+		if (ferror(pf.fp))
+			error = 1;
+		if (fclose(pf.fp) != 0)
+			error = 1;
+	}
 
-		if (pm2->frame < frame) {
-			pm2 = NULL;
-		}
-		else {
-			while (pm2->prev && pm2->prev->frame > frame) {
-				pm2= pm2->prev;
+	if (error)
+		printf("Error writing to disk cache: %s, frame %d\n", job->filename, job->frame);
+
+	return !error;
+}
+static void *ptcache_writer_thread(void *UNUSED(arg))
+{
+	PTCacheWriteJob *job;
+
+	pthread_mutex_lock(&ptcache_writer_lock);
+
+	while (1) {
+		job = ptcache_writer.queue.first;
+
+		if (job) {
+			BLI_remlink(&ptcache_writer.queue, job);
+			BLI_addtail(&ptcache_writer.active, job);
+			ptcache_writer.totqueue--;
+			pthread_cond_broadcast(&ptcache_writer_cond);
+			pthread_mutex_unlock(&ptcache_writer_lock);
+
+			if (!ptcache_write_job_exec(job)) {
+				PTCacheWriteError *err = MEM_callocN(sizeof(PTCacheWriteError), "PTCacheWriteError");
+
+				err->cache = job->cache;
+				err->frame = job->frame;
+
+				pthread_mutex_lock(&ptcache_writer_lock);
+				BLI_addtail(&ptcache_writer.failed, err);
+				pthread_mutex_unlock(&ptcache_writer_lock);
 			}
-		}
 
-		if (!pm2) {
-			*fra1 = 0;
-			*fra2 = pm->frame;
+			pthread_mutex_lock(&ptcache_writer_lock);
+			BLI_remlink(&ptcache_writer.active, job);
+			ptcache_writer.size -= job->size;
+			pthread_cond_broadcast(&ptcache_writer_cond);
+			pthread_mutex_unlock(&ptcache_writer_lock);
+
+			ptcache_write_job_free(job);
+
+			pthread_mutex_lock(&ptcache_writer_lock);
+		}
+		else if (ptcache_writer.stop) {
+			break;
 		}
 		else {
-			*fra1 = pm->frame;
-			*fra2 = pm2->frame;
+			pthread_cond_wait(&ptcache_writer_cond, &ptcache_writer_lock);
 		}
 	}
-}
 
-static PTCacheMem *ptcache_disk_frame_to_mem(PTCacheID *pid, int cfra)
+	pthread_mutex_unlock(&ptcache_writer_lock);
+
+	return NULL;
+}
+/* Start writing disk cache files in the background, calls can be nested. */
+static void ptcache_writer_begin(void)
+{
+	if (ptcache_writer.users++ == 0) {
+		int a;
+
+		BLI_begin_threaded_malloc();
+
+		ptcache_writer.stop = FALSE;
+		ptcache_writer.totthread = BLI_system_thread_count() / 2;
+		CLAMP(ptcache_writer.totthread, 1, PTCACHE_WRITER_MAX_THREADS);
+
+		for (a = 0; a < ptcache_writer.totthread; a++)
+			pthread_create(&ptcache_writer.threads[a], NULL, ptcache_writer_thread, NULL);
+	}
+}
+/* Write all queued files and stop the workers when the last user ends. */
+static void ptcache_writer_end(void)
+{
+	if (--ptcache_writer.users == 0) {
+		int a;
+
+		pthread_mutex_lock(&ptcache_writer_lock);
+		ptcache_writer.stop = TRUE;
+		pthread_cond_broadcast(&ptcache_writer_cond);
+		pthread_mutex_unlock(&ptcache_writer_lock);
+
+		for (a = 0; a < ptcache_writer.totthread; a++)
+			pthread_join(ptcache_writer.threads[a], NULL);
+
+		ptcache_writer.totthread = 0;
+
+		BLI_end_threaded_malloc();
+	}
+}
+/* Wait for queued files and mark frames that failed to be written in the
+ * background as not cached. Returns the number of failed frames. */
+static int ptcache_writer_collect_errors(void)
+{
+	PTCacheWriteError *err;
+	int totfailed = 0;
+
+	ptcache_writer_flush();
+
+	pthread_mutex_lock(&ptcache_writer_lock);
+
+	for (err = ptcache_writer.failed.first; err; err = err->next) {
+		PointCache *cache = err->cache;
+
+		if (cache->cached_frames && err->frame >= cache->startframe && err->frame <= cache->endframe)
+			cache->cached_frames[err->frame - cache->startframe] = 0;
+
+		/* continue simulating from before the missing frame */
+		cache->last_exact = MIN2(cache->last_exact, err->frame - 1);
+		cache->flag &= ~PTCACHE_BAKED;
+		cache->flag |= PTCACHE_OUTDATED;
+
+		totfailed++;
+	}
+
+	BLI_freelistN(&ptcache_writer.failed);
+
+	pthread_mutex_unlock(&ptcache_writer_lock);
+
+	return totfailed;
+}
+
+/* opens a frame for reading, also used by the prefetch thread */
+static PTCacheFile *ptcache_file_open_read(const PointCache *cache, const char *filename, int container, int cfra)
+{
+	PTCacheFile *pf;
+	FILE *fp;
+
+	ptcache_writer_flush_file(filename, cfra);
+
+	if (container) {
+		pf= MEM_callocN(sizeof(PTCacheFile), "PTCacheFile");
+		pf->frame = cfra;
+
+		if (!ptcache_container_read_frame(cache, filename, cfra, pf)) {
+			MEM_freeN(pf);
+			return NULL;
+		}
+
+		return pf;
+	}
+
+	if (!BLI_exists(filename))
+		return NULL;
+
+	fp = BLI_fopen(filename, "rb");
+
+	if (!fp)
+		return NULL;
+
+	pf= MEM_callocN(sizeof(PTCacheFile), "PTCacheFile");
+	pf->fp= fp;
+	pf->frame = cfra;
+
+	return pf;
+}
+/* youll need to close yourself after! */
+static PTCacheFile *ptcache_file_open(PTCacheID *pid, int mode, int cfra)
+{
+	PTCacheFile *pf;
+	FILE *fp = NULL;
+	char filename[FILE_MAX * 2];
+	int container = (pid->cache->flag & PTCACHE_DISK_CONTAINER);
+
+#ifndef DURIAN_POINTCACHE_LIB_OK
+	/* don't allow writing for linked objects */
+	if (pid->ob->id.lib && mode == PTCACHE_FILE_WRITE)
+		return NULL;
+#endif
+	if (!G.relbase_valid && (pid->cache->flag & PTCACHE_EXTERNAL)==0) return NULL; /* save blend file before using disk pointcache */
+	
+	if (container)
+		ptcache_container_filename(pid, filename);
+	else
+		ptcache_filename(pid, filename, cfra, 1, 1);
+
+	if (mode==PTCACHE_FILE_READ)
+		return ptcache_file_open_read(pid->cache, filename, container, cfra);
+
+	/* prefetched data of the frame is outdated now */
+	ptcache_prefetch_invalidate_frame(pid->cache, cfra);
+
+	if (mode==PTCACHE_FILE_WRITE && (container || ptcache_writer.users)) {
+		pf= MEM_callocN(sizeof(PTCacheFile), "PTCacheFile");
+		pf->job= ptcache_write_job_new(pid->cache, filename, cfra, container);
+		pf->frame = cfra;
+
+		return pf;
+	}
+
+	if (mode==PTCACHE_FILE_WRITE) {
+		BLI_make_existing_file(filename); /* will create the dir if needs be, same as //textures is created */
+		fp = BLI_fopen(filename, "wb");
+	}
+	else if (mode==PTCACHE_FILE_UPDATE && !container) {
+		/* container chunks can't be changed in place */
+		BLI_make_existing_file(filename);
+		fp = BLI_fopen(filename, "rb+");
+	}
+
+	if (!fp)
+		return NULL;
+
+	pf= MEM_callocN(sizeof(PTCacheFile), "PTCacheFile");
+	pf->fp= fp;
+	pf->frame = cfra;
+
+	return pf;
+}
+/* returns 0 if writing the file failed, failures of background writes are
+ * collected by the baker instead */
+static int ptcache_file_close(PTCacheFile *pf)
+{
+	int ok = 1;
+
+	if (pf) {
+		if (pf->job) {
+			if (ptcache_writer.users) {
+				ptcache_writer_push(pf->job);
+			}
+			else {
+				ok = ptcache_write_job_exec(pf->job);
+				ptcache_write_job_free(pf->job);
+			}
+		}
+		else if (pf->fp)
+			ok = (fclose(pf->fp) == 0);
+		else if (pf->map)
+			ptcache_map_release(pf->map);
+		MEM_freeN(pf);
+	}
+
+	return ok;
+}
+
+static int ptcache_file_compressed_read(PTCacheFile *pf, unsigned char *result, unsigned int len)
+{
+	int r = 0;
+	unsigned char compressed = 0;
+	size_t in_len;
+#ifdef WITH_LZO
+	size_t out_len = len;
+#endif
+	unsigned char *in;
+	unsigned char *props = MEM_callocN(16 * sizeof(char), "tmp");
+
+	ptcache_file_read(pf, &compressed, 1, sizeof(unsigned char));
+	if (compressed) {
+		unsigned int size;
+		ptcache_file_read(pf, &size, 1, sizeof(unsigned int));
+		in_len = (size_t)size;
+		if (in_len==0) {
+			/* do nothing */
+		}
+		else {
+			in = (unsigned char *)MEM_callocN(sizeof(unsigned char)*in_len, "pointcache_compressed_buffer");
+			ptcache_file_read(pf, in, in_len, sizeof(unsigned char));
+#ifdef WITH_LZO
+			if (compressed == 1)
+				r = lzo1x_decompress_safe(in, (lzo_uint)in_len, result, (lzo_uint *)&out_len, NULL);
+#endif
+#ifdef WITH_LZMA
+			if (compressed == 2) {
+				size_t sizeOfIt;
+				size_t leni = in_len, leno = len;
+				ptcache_file_read(pf, &size, 1, sizeof(unsigned int));
+				sizeOfIt = (size_t)size;
+				ptcache_file_read(pf, props, sizeOfIt, sizeof(unsigned char));
+				r = LzmaUncompress(result, &leno, in, &leni, props, sizeOfIt);
+			}
+#endif
+			MEM_freeN(in);
+		}
+	}
+	else {
+		ptcache_file_read(pf, result, len, sizeof(unsigned char));
+	}
+
+	MEM_freeN(props);
+
+	return r;
+}
+static int ptcache_file_compressed_write(PTCacheFile *pf, unsigned char *in, unsigned int in_len, unsigned char *out, int mode)
+{
+	int r = 0;
+	unsigned char compressed = 0;
+	size_t out_len= 0;
+	unsigned char *props = MEM_callocN(16 * sizeof(char), "tmp");
+	size_t sizeOfIt = 5;
+
+	(void)mode; /* unused when building w/o compression */
+
+	if (pf->job && mode) {
+		/* compress on the writer thread */
+		ptcache_write_job_append_compressed(pf->job, in, in_len, mode);
+		MEM_freeN(props);
+		return 0;
+	}
+
+#ifdef WITH_LZO
+	out_len= LZO_OUT_LEN(in_len);
+	if (mode == 1) {
+		LZO_HEAP_ALLOC(wrkmem, LZO1X_MEM_COMPRESS);
+		
+		r = lzo1x_1_compress(in, (lzo_uint)in_len, out, (lzo_uint *)&out_len, wrkmem);
+		if (!(r == LZO_E_OK) || (out_len >= in_len))
+			compressed = 0;
+		else
+			compressed = 1;
+	}
+#endif
+#ifdef WITH_LZMA
+	if (mode == 2) {
+		
+		r = LzmaCompress(out, &out_len, in, in_len, //assume sizeof(char)==1....
+						props, &sizeOfIt, 5, 1 << 24, 3, 0, 2, 32, 2);
+
+		if (!(r == SZ_OK) || (out_len >= in_len))
+			compressed = 0;
+		else
+			compressed = 2;
+	}
+#endif
+	
+	ptcache_file_write(pf, &compressed, 1, sizeof(unsigned char));
+	if (compressed) {
+		unsigned int size = out_len;
+		ptcache_file_write(pf, &size, 1, sizeof(unsigned int));
+		ptcache_file_write(pf, out, out_len, sizeof(unsigned char));
+	}
+	else
+		ptcache_file_write(pf, in, in_len, sizeof(unsigned char));
+
+	if (compressed == 2) {
+		unsigned int size = sizeOfIt;
+		ptcache_file_write(pf, &sizeOfIt, 1, sizeof(unsigned int));
+		ptcache_file_write(pf, props, size, sizeof(unsigned char));
+	}
+
+	MEM_freeN(props);
+
+	return r;
+}
+static int ptcache_file_read(PTCacheFile *pf, void *f, unsigned int tot, unsigned int size)
+{
+	if (pf->fp == NULL) {
+		size_t len = (size_t)tot * size;
+
+		if (pf->mem_pos + len > pf->mem_len)
+			return 0;
+
+		memcpy(f, pf->mem + pf->mem_pos, len);
+		pf->mem_pos += len;
+		return 1;
+	}
+
+	return (fread(f, size, tot, pf->fp) == tot);
+}
+static int ptcache_file_write(PTCacheFile *pf, const void *f, unsigned int tot, unsigned int size)
+{
+	if (pf->job) {
+		ptcache_write_job_append(pf->job, f, tot * size);
+		return 1;
+	}
+	else if (pf->fp == NULL) {
+		size_t len = (size_t)tot * size;
+
+		if (pf->mem_len + len > pf->mem_alloc) {
+			pf->mem_alloc = MAX2(pf->mem_alloc * 2, pf->mem_len + len);
+			pf->mem = MEM_reallocN(pf->mem, pf->mem_alloc);
+		}
+
+		memcpy(pf->mem + pf->mem_len, f, len);
+		pf->mem_len += len;
+		return 1;
+	}
+
+	return (fwrite(f, size, tot, pf->fp) == tot);
+}
+/* offset from the start of the frame, for recorded files only valid without compression */
+static size_t ptcache_file_tell(PTCacheFile *pf)
+{
+	if (pf->job)
+		return pf->job->size;
+	else if (pf->fp)
+		return (size_t)ftell(pf->fp);
+	else if (pf->map)
+		return pf->mem_pos;
+	else
+		return pf->mem_len;
+}
+/* pad or skip to the next PTCACHE_ARRAY_ALIGN boundary */
+static int ptcache_file_write_align(PTCacheFile *pf)
+{
+	const char zero[PTCACHE_ARRAY_ALIGN] = {0};
+	unsigned int pad = (PTCACHE_ARRAY_ALIGN - ptcache_file_tell(pf) % PTCACHE_ARRAY_ALIGN) % PTCACHE_ARRAY_ALIGN;
+
+	return (pad == 0 || ptcache_file_write(pf, zero, pad, sizeof(char)));
+}
+static int ptcache_file_read_align(PTCacheFile *pf)
+{
+	char pad_data[PTCACHE_ARRAY_ALIGN];
+	unsigned int pad = (PTCACHE_ARRAY_ALIGN - ptcache_file_tell(pf) % PTCACHE_ARRAY_ALIGN) % PTCACHE_ARRAY_ALIGN;
+
+	return (pad == 0 || ptcache_file_read(pf, pad_data, pad, sizeof(char)));
+}
+static int ptcache_file_data_read(PTCacheFile *pf)
+{
+	int i;
+
+	for (i=0; i<BPHYS_TOT_DATA; i++) {
+		if ((pf->data_types & (1<<i)) && !ptcache_file_read(pf, pf->cur[i], 1, ptcache_data_size[i]))
+			return 0;
+	}
+	
+	return 1;
+}
+static int ptcache_file_data_write(PTCacheFile *pf)
+{		
+	int i;
+
+	for (i=0; i<BPHYS_TOT_DATA; i++) {
+		if ((pf->data_types & (1<<i)) && !ptcache_file_write(pf, pf->cur[i], 1, ptcache_data_size[i]))
+			return 0;
+	}
+	
+	return 1;
+}
+static int ptcache_file_header_begin_read(PTCacheFile *pf)
+{
+	unsigned int typeflag=0;
+	int error=0;
+	char bphysics[8];
+	
+	pf->data_types = 0;
+	
+	if (!ptcache_file_read(pf, bphysics, 8, sizeof(char)))
+		error = 1;
+	
+	if (!error && strncmp(bphysics, "BPHYSICS", 8))
+		error = 1;
+
+	if (!error && !ptcache_file_read(pf, &typeflag, 1, sizeof(unsigned int)))
+		error = 1;
+
+	pf->type = (typeflag & PTCACHE_TYPEFLAG_TYPEMASK);
+	pf->flag = (typeflag & PTCACHE_TYPEFLAG_FLAGMASK);
+	
+	/* if there was an error set file as it was */
+	if (error) {
+		if (pf->fp)
+			fseek(pf->fp, 0, SEEK_SET);
+		else
+			pf->mem_pos = 0;
+	}
+
+	return !error;
+}
+static int ptcache_file_header_begin_write(PTCacheFile *pf)
+{
+	const char *bphysics = "BPHYSICS";
+	unsigned int typeflag = pf->type + pf->flag;
+	
+	if (!ptcache_file_write(pf, bphysics, 8, sizeof(char)))
+		return 0;
+
+	if (!ptcache_file_write(pf, &typeflag, 1, sizeof(unsigned int)))
+		return 0;
+	
+	return 1;
+}
+
+/* Data pointer handling */
+int BKE_ptcache_data_size(int data_type)
+{
+	return ptcache_data_size[data_type];
+}
+
+static void ptcache_file_pointers_init(PTCacheFile *pf)
+{
+	int data_types = pf->data_types;
+
+	pf->cur[BPHYS_DATA_INDEX] =		(data_types & (1<<BPHYS_DATA_INDEX))	?		&pf->data.index	: NULL;
+	pf->cur[BPHYS_DATA_LOCATION] =	(data_types & (1<<BPHYS_DATA_LOCATION)) ?		&pf->data.loc	: NULL;
+	pf->cur[BPHYS_DATA_VELOCITY] =	(data_types & (1<<BPHYS_DATA_VELOCITY)) ?		&pf->data.vel	: NULL;
+	pf->cur[BPHYS_DATA_ROTATION] =	(data_types & (1<<BPHYS_DATA_ROTATION)) ?		&pf->data.rot	: NULL;
+	pf->cur[BPHYS_DATA_AVELOCITY] =	(data_types & (1<<BPHYS_DATA_AVELOCITY))?		&pf->data.ave	: NULL;
+	pf->cur[BPHYS_DATA_SIZE] =		(data_types & (1<<BPHYS_DATA_SIZE))		?		&pf->data.size	: NULL;
+	pf->cur[BPHYS_DATA_TIMES] =		(data_types & (1<<BPHYS_DATA_TIMES))	?		&pf->data.times	: NULL;
+	pf->cur[BPHYS_DATA_BOIDS] =		(data_types & (1<<BPHYS_DATA_BOIDS))	?		&pf->data.boids	: NULL;
+}
+
+/* Check to see if point number "index" is in pm, uses binary search for index data. */
+int BKE_ptcache_mem_index_find(PTCacheMem *pm, unsigned int index)
+{
+	if (pm->data[BPHYS_DATA_INDEX]) {
+		unsigned int *data = pm->data[BPHYS_DATA_INDEX];
+		unsigned int mid, low = 0, high = pm->totpoint - 1;
+
+		if (index < *data || index > *(data+high))
+			return -1;
+
+		/* check simple case for continuous indexes first */
+		if (index-*data < high && data[index-*data] == index)
+			return index-*data;
+
+		while (low <= high) {
+			mid= (low + high)/2;
+
+			if (data[mid] > index)
+				high = mid - 1;
+			else if (data[mid] < index)
+				low = mid + 1;
+			else
+				return mid;
+		}
+
+		return -1;
+	}
+	else {
+		return (index < pm->totpoint ? index : -1);
+	}
+}
+
+void BKE_ptcache_mem_pointers_init(PTCacheMem *pm)
+{
+	int data_types = pm->data_types;
+	int i;
+
+	for (i=0; i<BPHYS_TOT_DATA; i++)
+		pm->cur[i] = ((data_types & (1<<i)) ? pm->data[i] : NULL);
+}
+
+void BKE_ptcache_mem_pointers_incr(PTCacheMem *pm)
+{
+	int i;
+
+	for (i=0; i<BPHYS_TOT_DATA; i++) {
+		if (pm->cur[i])
+			pm->cur[i] = (char *)pm->cur[i] + ptcache_data_size[i];
+	}
+}
+int  BKE_ptcache_mem_pointers_seek(int point_index, PTCacheMem *pm)
+{
+	int data_types = pm->data_types;
+	int i, index = BKE_ptcache_mem_index_find(pm, point_index);
+
+	if (index < 0) {
+		/* Can't give proper location without reallocation, so don't give any location.
+		 * Some points will be cached improperly, but this only happens with simulation
+		 * steps bigger than cache->step, so the cache has to be recalculated anyways
+		 * at some point.
+		 */
+		return 0;
+	}
+
+	for (i=0; i<BPHYS_TOT_DATA; i++)
+		pm->cur[i] = data_types & (1<<i) ? (char *)pm->data[i] + index * ptcache_data_size[i] : NULL;
+
+	return 1;
+}
+static void ptcache_data_alloc(PTCacheMem *pm)
+{
+	int data_types = pm->data_types;
+	int totpoint = pm->totpoint;
+	int i;
+
+	for (i=0; i<BPHYS_TOT_DATA; i++) {
+		if (data_types & (1<<i))
+			pm->data[i] = MEM_callocN(totpoint * ptcache_data_size[i], "PTCache Data");
+	}
+}
+static void ptcache_data_free(PTCacheMem *pm)
+{
+	void **data = pm->data;
+	int i;
+
+	/* owned by the container map */
+	if (pm->flag & PTCACHE_MEM_MAPPED)
+		return;
+
+	for (i=0; i<BPHYS_TOT_DATA; i++) {
+		if (data[i])
+			MEM_freeN(data[i]);
+	}
+}
+static void ptcache_data_copy(void *from[], void *to[])
+{
+	int i;
+	for (i=0; i<BPHYS_TOT_DATA; i++) {
+	/* note, durian file 03.4b_comp crashes if to[i] is not tested
+	 * its NULL, not sure if this should be fixed elsewhere but for now its needed */
+		if (from[i] && to[i])
+			memcpy(to[i], from[i], ptcache_data_size[i]);
+	}
+}
+
+static void ptcache_extra_free(PTCacheMem *pm)
+{
+	PTCacheExtra *extra = pm->extradata.first;
+
+	/* shared with a prefetched frame */
+	if (pm->flag & PTCACHE_MEM_MAPPED)
+		return;
+
+	if (extra) {
+		for (; extra; extra=extra->next) {
+			if (extra->data)
+				MEM_freeN(extra->data);
+		}
+
+		BLI_freelistN(&pm->extradata);
+	}
+}
+static int ptcache_old_elemsize(PTCacheID *pid)
+{
+	if (pid->type==PTCACHE_TYPE_SOFTBODY)
+		return 6 * sizeof(float);
+	else if (pid->type==PTCACHE_TYPE_PARTICLES)
+		return sizeof(ParticleKey);
+	else if (pid->type==PTCACHE_TYPE_CLOTH)
+		return 9 * sizeof(float);
+
+	return 0;
+}
+
+static void ptcache_find_frames_around(PTCacheID *pid, unsigned int frame, int *fra1, int *fra2)
+{
+	if (pid->cache->flag & PTCACHE_DISK_CACHE) {
+		int cfra1=frame, cfra2=frame+1;
+
+		while (cfra1 >= pid->cache->startframe && !BKE_ptcache_id_exist(pid, cfra1))
+			cfra1--;
+
+		if (cfra1 < pid->cache->startframe)
+			cfra1 = 0;
+
+		while (cfra2 <= pid->cache->endframe && !BKE_ptcache_id_exist(pid, cfra2))
+			cfra2++;
+
+		if (cfra2 > pid->cache->endframe)
+			cfra2 = 0;
+
+		if (cfra1 && !cfra2) {
+			*fra1 = 0;
+			*fra2 = cfra1;
+		}
+		else {
+			*fra1 = cfra1;
+			*fra2 = cfra2;
+		}
+	}
+	else if (pid->cache->mem_cache.first) {
+		PTCacheMem *pm = pid->cache->mem_cache.first;
+		PTCacheMem *pm2 = pid->cache->mem_cache.last;
+
+		while (pm->next && pm->next->frame <= frame)
+			pm= pm->next;
+
+		if (pm2->frame < frame) {
+			pm2 = NULL;
+		}
+		else {
+			while (pm2->prev && pm2->prev->frame > frame) {
+				pm2= pm2->prev;
+			}
+		}
+
+		if (!pm2) {
+			*fra1 = 0;
+			*fra2 = pm->frame;
+		}
+		else {
+			*fra1 = pm->frame;
+			*fra2 = pm2->frame;
+		}
+	}
+}
+
+/* ************** Quantized particle cache frames ************** */
+
+/* With PTCACHE_QUANTIZE particle cache frames on disk are stored lossy:
+ * locations are rounded to a grid with cells of twice the tolerance,
+ * velocities, rotations and sizes are stored as half floats. Every few
+ * frames a key frame is stored, the frames in between only store the
+ * difference of each value to the same particle in the key frame. The
+ * values are written as variable length integers before compression, so
+ * particles that don't change much take very little space.
+ *
+ * Decoded key frames are kept around, so reading a frame only has to read
+ * its key frame when moving to the next group of frames. */
+
+#define PTCACHE_QUANTIZE_KEY_INTERVAL   8
+#define PTCACHE_QUANTIZE_MAX_KEYS       8
+#define PTCACHE_QUANTIZE_TOLERANCE      0.001f  /* for files without a tolerance */
+
+/* how each data type is coded */
+#define PTCACHE_QUANT_RAW       0   /* bytes, no delta */
+#define PTCACHE_QUANT_INDEX     1   /* difference to the previous index in the frame */
+#define PTCACHE_QUANT_GRID      2   /* floats on a grid */
+#define PTCACHE_QUANT_HALF      3   /* half floats */
+#define PTCACHE_QUANT_BITS      4   /* floats as they are */
+
+static int ptcache_quantize_coding[] = {
+	PTCACHE_QUANT_INDEX,    /* BPHYS_DATA_INDEX */
+	PTCACHE_QUANT_GRID,     /* BPHYS_DATA_LOCATION */
+	PTCACHE_QUANT_HALF,     /* BPHYS_DATA_VELOCITY */
+	PTCACHE_QUANT_HALF,     /* BPHYS_DATA_ROTATION */
+	PTCACHE_QUANT_HALF,     /* BPHYS_DATA_AVELOCITY */
+	PTCACHE_QUANT_HALF,     /* BPHYS_DATA_SIZE */
+	PTCACHE_QUANT_BITS,     /* BPHYS_DATA_TIMES */
+	PTCACHE_QUANT_RAW       /* BPHYS_DATA_BOIDS */
+};
+
+/* quantized values of a key frame, per data type totpoint * components codes */
+typedef struct PTCacheQuantFrame {
+	struct PTCacheQuantFrame *next, *prev;
+	PointCache *cache;          /* only used as key */
+	int frame, users;
+
+	unsigned int totpoint, data_types;
+	float origin[3], cell;
+	unsigned int *codes[BPHYS_TOT_DATA];
+} PTCacheQuantFrame;
+
+/* what the encoder last wrote for a cache */
+typedef struct PTCacheQuantEncoder {
+	struct PTCacheQuantEncoder *next, *prev;
+	PointCache *cache;
+	int key_frame, last_frame;
+} PTCacheQuantEncoder;
+
+static pthread_mutex_t ptcache_quantize_lock = PTHREAD_MUTEX_INITIALIZER;
+static ListBase ptcache_quantize_keys = {NULL, NULL};       /* least recently used first */
+static ListBase ptcache_quantize_encoders = {NULL, NULL};
+
+static int ptcache_quantize_components(int type)
+{
+	return (ptcache_quantize_coding[type] == PTCACHE_QUANT_RAW) ? 0 : ptcache_data_size[type] / 4;
+}
+
+static unsigned short ptcache_float_to_half(float f)
+{
+	union { float f; unsigned int u; } v;
+	unsigned int sign, mant;
+	int exp;
+
+	v.f = f;
+	sign = (v.u >> 16) & 0x8000;
+	exp = (int)((v.u >> 23) & 0xff) - 127 + 15;
+	mant = v.u & 0x7fffff;
+
+	if (((v.u >> 23) & 0xff) == 0xff)       /* inf or nan */
+		return (unsigned short)(sign | 0x7c00 | (mant ? 0x200 : 0));
+	if (exp >= 31)                          /* too large */
+		return (unsigned short)(sign | 0x7c00);
+	if (exp <= 0) {                         /* denormal or zero */
+		if (exp < -10)
+			return (unsigned short)sign;
+		mant |= 0x800000;
+		return (unsigned short)(sign | ((mant + (1u << (13 - exp))) >> (14 - exp)));
+	}
+
+	/* round to nearest, may carry into the exponent */
+	return (unsigned short)(sign | (((unsigned int)exp << 10) + ((mant + 0x1000) >> 13)));
+}
+static float ptcache_half_to_float(unsigned short h)
+{
+	union { float f; unsigned int u; } v;
+	unsigned int sign = (unsigned int)(h & 0x8000) << 16;
+	unsigned int exp = (h >> 10) & 0x1f;
+	unsigned int mant = h & 0x3ff;
+
+	if (exp == 0) {
+		if (mant == 0) {
+			v.u = sign;
+		}
+		else {
+			/* denormal, normalize */
+			exp = 127 - 14;
+			while ((mant & 0x400) == 0) {
+				mant <<= 1;
+				exp--;
+			}
+			v.u = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+		}
+	}
+	else if (exp == 31)
+		v.u = sign | 0x7f800000 | (mant << 13);
+	else
+		v.u = sign | ((exp - 15 + 127) << 23) | (mant << 13);
+
+	return v.f;
+}
+
+typedef struct PTCacheQuantBuffer {
+	unsigned char *data;
+	unsigned int len, alloc, pos;
+} PTCacheQuantBuffer;
+
+static void ptcache_quantize_put(PTCacheQuantBuffer *buf, unsigned int value)
+{
+	if (buf->len + 5 > buf->alloc) {
+		buf->alloc = MAX2(buf->alloc * 2, 4096);
+		buf->data = buf->data ? MEM_reallocN(buf->data, buf->alloc) : MEM_mallocN(buf->alloc, "PTCacheQuantBuffer");
+	}
+
+	while (value >= 0x80) {
+		buf->data[buf->len++] = (unsigned char)(value | 0x80);
+		value >>= 7;
+	}
+	buf->data[buf->len++] = (unsigned char)value;
+}
+static int ptcache_quantize_get(PTCacheQuantBuffer *buf, unsigned int *r_value)
+{
+	unsigned int value = 0;
+	int shift = 0;
+
+	while (buf->pos < buf->len && shift < 35) {
+		unsigned char byte = buf->data[buf->pos++];
+
+		value |= (unsigned int)(byte & 0x7f) << shift;
+
+		if ((byte & 0x80) == 0) {
+			*r_value = value;
+			return 1;
+		}
+
+		shift += 7;
+	}
+
+	return 0;
+}
+/* signed differences with small magnitude give small unsigned values */
+BLI_INLINE unsigned int ptcache_zigzag(unsigned int delta)
+{
+	return (delta << 1) ^ (unsigned int)(-(int)(delta >> 31));
+}
+BLI_INLINE unsigned int ptcache_unzigzag(unsigned int value)
+{
+	return (value >> 1) ^ (unsigned int)(-(int)(value & 1));
+}
+
+static void ptcache_quant_frame_free(PTCacheQuantFrame *qf)
+{
+	int i;
+
+	for (i=0; i<BPHYS_TOT_DATA; i++) {
+		if (qf->codes[i])
+			MEM_freeN(qf->codes[i]);
+	}
+
+	MEM_freeN(qf);
+}
+static PTCacheQuantFrame *ptcache_quant_frame_new(unsigned int totpoint, unsigned int data_types)
+{
+	PTCacheQuantFrame *qf = MEM_callocN(sizeof(PTCacheQuantFrame), "PTCacheQuantFrame");
+	int i;
+
+	qf->totpoint = totpoint;
+	qf->data_types = data_types;
+
+	for (i=0; i<BPHYS_TOT_DATA; i++) {
+		int comps = ptcache_quantize_components(i);
+
+		if ((data_types & (1<<i)) && comps)
+			qf->codes[i] = MEM_mallocN(sizeof(unsigned int) * comps * MAX2(totpoint, 1), "PTCacheQuantFrame codes");
+	}
+
+	return qf;
+}
+/* takes a reference to a key frame */
+static PTCacheQuantFrame *ptcache_quantize_key_get(PointCache *cache, int frame)
+{
+	PTCacheQuantFrame *qf;
+
+	pthread_mutex_lock(&ptcache_quantize_lock);
+
+	for (qf = ptcache_quantize_keys.first; qf; qf = qf->next) {
+		if (qf->cache == cache && qf->frame == frame) {
+			qf->users++;
+			BLI_remlink(&ptcache_quantize_keys, qf);
+			BLI_addtail(&ptcache_quantize_keys, qf);
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&ptcache_quantize_lock);
+
+	return qf;
+}
+/* must be called with ptcache_quantize_lock held */
+static void ptcache_quantize_key_unref(PTCacheQuantFrame *qf)
+{
+	/* removed frames are freed by the last user */
+	if (--qf->users == 0 && (qf->cache == NULL || BLI_findindex(&ptcache_quantize_keys, qf) == -1))
+		ptcache_quant_frame_free(qf);
+}
+static void ptcache_quantize_key_release(PTCacheQuantFrame *qf)
+{
+	pthread_mutex_lock(&ptcache_quantize_lock);
+	ptcache_quantize_key_unref(qf);
+	pthread_mutex_unlock(&ptcache_quantize_lock);
+}
+/* must be called with ptcache_quantize_lock held */
+static void ptcache_quantize_key_remove(PTCacheQuantFrame *qf)
+{
+	BLI_remlink(&ptcache_quantize_keys, qf);
+	qf->cache = NULL;
+
+	if (qf->users == 0)
+		ptcache_quant_frame_free(qf);
+}
+static void ptcache_quantize_key_add(PTCacheQuantFrame *qf)
+{
+	PTCacheQuantFrame *old, *old_next;
+	int totkey = 0;
+
+	pthread_mutex_lock(&ptcache_quantize_lock);
+
+	for (old = ptcache_quantize_keys.first; old; old = old_next) {
+		old_next = old->next;
+
+		if (old->cache == qf->cache && old->frame == qf->frame)
+			ptcache_quantize_key_remove(old);
+		else
+			totkey++;
+	}
+
+	for (old = ptcache_quantize_keys.first; old && totkey >= PTCACHE_QUANTIZE_MAX_KEYS; old = old_next) {
+		old_next = old->next;
+		ptcache_quantize_key_remove(old);
+		totkey--;
+	}
+
+	BLI_addtail(&ptcache_quantize_keys, qf);
+
+	pthread_mutex_unlock(&ptcache_quantize_lock);
+}
+/* Drops key frames and encoder state of cache, for all or only frame. */
+static void ptcache_quantize_invalidate(PointCache *cache, int frame, int all)
+{
+	PTCacheQuantFrame *qf, *qf_next;
+	PTCacheQuantEncoder *enc;
+
+	if (ptcache_quantize_keys.first == NULL && ptcache_quantize_encoders.first == NULL)
+		return;
+
+	pthread_mutex_lock(&ptcache_quantize_lock);
+
+	for (qf = ptcache_quantize_keys.first; qf; qf = qf_next) {
+		qf_next = qf->next;
+
+		if (qf->cache == cache && (all || qf->frame == frame))
+			ptcache_quantize_key_remove(qf);
+	}
+
+	if (all) {
+		for (enc = ptcache_quantize_encoders.first; enc; enc = enc->next) {
+			if (enc->cache == cache) {
+				BLI_freelinkN(&ptcache_quantize_encoders, enc);
+				break;
+			}
+		}
+	}
+
+	pthread_mutex_unlock(&ptcache_quantize_lock);
+}
+static void ptcache_quantize_free(void)
+{
+	pthread_mutex_lock(&ptcache_quantize_lock);
+
+	while (ptcache_quantize_keys.first)
+		ptcache_quantize_key_remove(ptcache_quantize_keys.first);
+
+	BLI_freelistN(&ptcache_quantize_encoders);
+
+	pthread_mutex_unlock(&ptcache_quantize_lock);
+}
+
+/* For each point of qf the point with the same index in ref, or -1. */
+static int *ptcache_quantize_match(PTCacheQuantFrame *qf, PTCacheQuantFrame *ref)
+{
+	int *match = MEM_mallocN(sizeof(int) * MAX2(qf->totpoint, 1), "PTCache quantize match");
+	unsigned int a, b = 0;
+
+	if (qf->codes[BPHYS_DATA_INDEX] && ref->codes[BPHYS_DATA_INDEX]) {
+		/* indices are written in increasing order */
+		for (a = 0; a < qf->totpoint; a++) {
+			unsigned int index = qf->codes[BPHYS_DATA_INDEX][a];
+
+			while (b < ref->totpoint && ref->codes[BPHYS_DATA_INDEX][b] < index)
+				b++;
+
+			match[a] = (b < ref->totpoint && ref->codes[BPHYS_DATA_INDEX][b] == index) ? (int)b : -1;
+		}
+	}
+	else {
+		for (a = 0; a < qf->totpoint; a++)
+			match[a] = (a < ref->totpoint) ? (int)a : -1;
+	}
+
+	return match;
+}
+
+static int ptcache_quantize_enabled(PTCacheID *pid, PTCacheMem *pm)
+{
+	/* frame 0 is the info frame */
+	return (pid->type == PTCACHE_TYPE_PARTICLES && pid->cache->flag & PTCACHE_QUANTIZE && pm->frame != 0);
+}
+static int ptcache_quantize_write(PTCacheID *pid, PTCacheFile *pf, PTCacheMem *pm)
+{
+	PointCache *cache = pid->cache;
+	PTCacheQuantEncoder *enc;
+	PTCacheQuantFrame *qf, *ref = NULL;
+	PTCacheQuantBuffer buf = {NULL};
+	int frame = (int)pm->frame, step = MAX2(cache->step, 1);
+	int *match = NULL;
+	unsigned char *out;
+	unsigned int a;
+	int i, c, error = 0;
+
+	/* find out what the encoder wrote last */
+	pthread_mutex_lock(&ptcache_quantize_lock);
+
+	for (enc = ptcache_quantize_encoders.first; enc; enc = enc->next) {
+		if (enc->cache == cache)
+			break;
+	}
+
+	if (enc == NULL) {
+		enc = MEM_callocN(sizeof(PTCacheQuantEncoder), "PTCacheQuantEncoder");
+		enc->cache = cache;
+		enc->key_frame = enc->last_frame = INT_MIN;
+		BLI_addtail(&ptcache_quantize_encoders, enc);
+	}
+
+	pthread_mutex_unlock(&ptcache_quantize_lock);
+
+	if (enc->last_frame != INT_MIN && enc->last_frame < frame &&
+	    frame - enc->key_frame < PTCACHE_QUANTIZE_KEY_INTERVAL * step)
+	{
+		ref = ptcache_quantize_key_get(cache, enc->key_frame);
+	}
+
+	qf = ptcache_quant_frame_new(pm->totpoint, pm->data_types);
+	qf->cache = cache;
+	qf->frame = frame;
+	qf->users = 1;
+
+	if (ref) {
+		copy_v3_v3(qf->origin, ref->origin);
+		qf->cell = ref->cell;
+	}
+	else {
+		float tolerance = (cache->quantize_tolerance > 0.0f) ? cache->quantize_tolerance : PTCACHE_QUANTIZE_TOLERANCE;
+		float *co = pm->data[BPHYS_DATA_LOCATION];
+
+		qf->cell = 2.0f * tolerance;
+
+		/* grid origin at the lower corner of the points */
+		if (co && pm->totpoint) {
+			copy_v3_v3(qf->origin, co);
+			for (a = 1; a < pm->totpoint; a++) {
+				for (c = 0; c < 3; c++)
+					qf->origin[c] = MIN2(qf->origin[c], co[3 * a + c]);
+			}
+		}
+	}
+
+	/* quantize */
+	for (i=0; i<BPHYS_TOT_DATA; i++) {
+		int comps = ptcache_quantize_components(i);
+		unsigned int *codes = qf->codes[i];
+
+		if (codes == NULL)
+			continue;
+
+		for (a = 0; a < pm->totpoint; a++) {
+			for (c = 0; c < comps; c++) {
+				float f = ((float *)pm->data[i])[a * comps + c];
+				unsigned int code;
+
+				switch (ptcache_quantize_coding[i]) {
+					case PTCACHE_QUANT_GRID:
+					{
+						float q = floorf((f - qf->origin[c]) / qf->cell + 0.5f);
+						CLAMP(q, -1073741824.0f, 1073741824.0f);
+						code = (unsigned int)(int)q;
+						break;
+					}
+					case PTCACHE_QUANT_HALF:
+						code = ptcache_float_to_half(f);
+						break;
+					default:
+						/* index or bits, stored as they are */
+						code = ((unsigned int *)pm->data[i])[a * comps + c];
+						break;
+				}
+
+				codes[a * comps + c] = code;
+			}
+		}
+	}
+
+	if (ref)
+		match = ptcache_quantize_match(qf, ref);
+
+	/* code the differences */
+	for (i=0; i<BPHYS_TOT_DATA; i++) {
+		int comps = ptcache_quantize_components(i);
+		unsigned int *codes = qf->codes[i];
+
+		if ((pm->data_types & (1<<i)) == 0)
+			continue;
+
+		if (codes == NULL) {
+			/* raw data, a byte per value */
+			unsigned char *data = pm->data[i];
+
+			for (a = 0; a < pm->totpoint * ptcache_data_size[i]; a++)
+				ptcache_quantize_put(&buf, data[a]);
+			continue;
+		}
+
+		for (a = 0; a < pm->totpoint; a++) {
+			for (c = 0; c < comps; c++) {
+				unsigned int prev = 0;
+
+				if (ptcache_quantize_coding[i] == PTCACHE_QUANT_INDEX)
+					prev = (a > 0) ? codes[(a - 1) * comps + c] : 0;
+				else if (match && match[a] != -1 && ref->codes[i])
+					prev = ref->codes[i][match[a] * comps + c];
+
+				ptcache_quantize_put(&buf, ptcache_zigzag(codes[a * comps + c] - prev));
+			}
+		}
+	}
+
+	/* ref frame, same as the frame for key frames */
+	a = ref ? (unsigned int)ref->frame : (unsigned int)frame;
+	if (!ptcache_file_write(pf, &a, 1, sizeof(unsigned int)) ||
+	    !ptcache_file_write(pf, qf->origin, 3, sizeof(float)) ||
+	    !ptcache_file_write(pf, &qf->cell, 1, sizeof(float)) ||
+	    !ptcache_file_write(pf, &buf.len, 1, sizeof(unsigned int)))
+	{
+		error = 1;
+	}
+
+	if (!error && buf.len) {
+		out = MEM_callocN(LZO_OUT_LEN(buf.len) * 4, "pointcache_lzo_buffer");
+		ptcache_file_compressed_write(pf, buf.data, buf.len, out, cache->compression);
+		MEM_freeN(out);
+	}
+
+	if (buf.data)
+		MEM_freeN(buf.data);
+	if (match)
+		MEM_freeN(match);
+
+	pthread_mutex_lock(&ptcache_quantize_lock);
+	enc->last_frame = frame;
+	if (ref == NULL)
+		enc->key_frame = frame;
+	pthread_mutex_unlock(&ptcache_quantize_lock);
+
+	if (ref) {
+		ptcache_quantize_key_release(ref);
+		ptcache_quantize_key_release(qf);
+	}
+	else {
+		/* keep it for the following frames */
+		qf->users = 0;
+		ptcache_quantize_key_add(qf);
+	}
+
+	return error == 0;
+}
+/* Decodes the point data of a quantized frame into pm. pid->ob is NULL when
+ * called from the prefetch thread, then key frames can't be read if needed. */
+static int ptcache_quantize_read(PTCacheID *pid, PTCacheFile *pf, PTCacheMem *pm)
+{
+	PTCacheQuantFrame *qf, *ref = NULL;
+	PTCacheQuantBuffer buf = {NULL};
+	unsigned int ref_frame, a, value;
+	int *match = NULL;
+	int i, c, error = 0;
+
+	qf = ptcache_quant_frame_new(pm->totpoint, pm->data_types);
+	qf->cache = pid->cache;
+	qf->frame = (int)pm->frame;
+	qf->users = 1;
+
+	if (!ptcache_file_read(pf, &ref_frame, 1, sizeof(unsigned int)) ||
+	    !ptcache_file_read(pf, qf->origin, 3, sizeof(float)) ||
+	    !ptcache_file_read(pf, &qf->cell, 1, sizeof(float)) ||
+	    !ptcache_file_read(pf, &buf.len, 1, sizeof(unsigned int)))
+	{
+		error = 1;
+	}
+
+	if (!error && buf.len) {
+		buf.data = MEM_mallocN(buf.len, "PTCacheQuantBuffer");
+		ptcache_file_compressed_read(pf, buf.data, buf.len);
+	}
+
+	if (!error && (int)ref_frame != qf->frame) {
+		ref = ptcache_quantize_key_get(pid->cache, (int)ref_frame);
+
+		if (ref == NULL && pid->ob) {
+			/* read the key frame, decoding it makes it available */
+			PTCacheMem *pm_ref = ptcache_disk_frame_to_mem(pid, (int)ref_frame, NULL);
+
+			if (pm_ref) {
+				ptcache_data_free(pm_ref);
+				ptcache_extra_free(pm_ref);
+				MEM_freeN(pm_ref);
+			}
+
+			ref = ptcache_quantize_key_get(pid->cache, (int)ref_frame);
+		}
+
+		if (ref == NULL)
+			error = 1;
+	}
+
+	for (i=0; i<BPHYS_TOT_DATA && !error; i++) {
+		int comps = ptcache_quantize_components(i);
+		unsigned int *codes = qf->codes[i];
+
+		if ((pm->data_types & (1<<i)) == 0)
+			continue;
+
+		if (codes == NULL) {
+			unsigned char *data = pm->data[i];
+
+			for (a = 0; a < pm->totpoint * ptcache_data_size[i] && !error; a++) {
+				if (ptcache_quantize_get(&buf, &value))
+					data[a] = (unsigned char)value;
+				else
+					error = 1;
+			}
+			continue;
+		}
+
+		/* the index comes first, needed to match points */
+		if (ref && i > BPHYS_DATA_INDEX && match == NULL)
+			match = ptcache_quantize_match(qf, ref);
+
+		for (a = 0; a < pm->totpoint && !error; a++) {
+			for (c = 0; c < comps; c++) {
+				unsigned int prev = 0;
+				unsigned int code;
+
+				if (!ptcache_quantize_get(&buf, &value)) {
+					error = 1;
+					break;
+				}
+
+				if (ptcache_quantize_coding[i] == PTCACHE_QUANT_INDEX)
+					prev = (a > 0) ? codes[(a - 1) * comps + c] : 0;
+				else if (match && match[a] != -1 && ref->codes[i])
+					prev = ref->codes[i][match[a] * comps + c];
+
+				code = codes[a * comps + c] = ptcache_unzigzag(value) + prev;
+
+				switch (ptcache_quantize_coding[i]) {
+					case PTCACHE_QUANT_GRID:
+						((float *)pm->data[i])[a * comps + c] = qf->origin[c] + (float)(int)code * qf->cell;
+						break;
+					case PTCACHE_QUANT_HALF:
+						((float *)pm->data[i])[a * comps + c] = ptcache_half_to_float((unsigned short)code);
+						break;
+					default:
+						((unsigned int *)pm->data[i])[a * comps + c] = code;
+						break;
+				}
+			}
+		}
+	}
+
+	if (buf.data)
+		MEM_freeN(buf.data);
+	if (match)
+		MEM_freeN(match);
+	if (ref)
+		ptcache_quantize_key_release(ref);
+
+	if (!error && ref == NULL) {
+		/* a key frame, keep it for the following frames */
+		qf->users = 0;
+		ptcache_quantize_key_add(qf);
+	}
+	else
+		ptcache_quantize_key_release(qf);
+
+	return error == 0;
+}
+
+/* Reads a frame from pf, only pid->type and pid->read_header are used.
+ * With allow_mapped the data of container frames can point into the map of pf. */
+static PTCacheMem *ptcache_file_to_mem(PTCacheID *pid, PTCacheFile *pf, int allow_mapped)
+{
+	PTCacheMem *pm = NULL;
+	unsigned int i, error = 0;
+
+	if (!ptcache_file_header_begin_read(pf))
+		error = 1;
+
+	if (!error && (pf->type != pid->type || !pid->read_header(pf)))
+		error = 1;
+
+	if (!error) {
+		pm = MEM_callocN(sizeof(PTCacheMem), "Pointcache mem");
+
+		pm->totpoint = pf->totpoint;
+		pm->data_types = pf->data_types;
+		pm->frame = pf->frame;
+
+		if (pf->flag & PTCACHE_TYPEFLAG_ARRAYS && (pf->flag & PTCACHE_TYPEFLAG_EXTRADATA) == 0 && allow_mapped && pf->map) {
+			/* zero copy, use the arrays straight from the mapped container */
+			for (i=0; i<BPHYS_TOT_DATA; i++) {
+				size_t len = pm->totpoint*ptcache_data_size[i];
+
+				if ((pf->data_types & (1<<i)) == 0)
+					continue;
+
+				if (!ptcache_file_read_align(pf) || pf->mem_pos + len > pf->mem_len) {
+					error = 1;
+					break;
+				}
+
+				pm->data[i] = pf->mem + pf->mem_pos;
+				pf->mem_pos += len;
+			}
+
+			pm->flag |= PTCACHE_MEM_MAPPED;
+		}
+		else
+			ptcache_data_alloc(pm);
+
+		if (error || pm->flag & PTCACHE_MEM_MAPPED) {
+			/* pass */
+		}
+		else if (pf->flag & PTCACHE_TYPEFLAG_QUANTIZED) {
+			if (!ptcache_quantize_read(pid, pf, pm))
+				error = 1;
+		}
+		else if (pf->flag & PTCACHE_TYPEFLAG_ARRAYS) {
+			for (i=0; i<BPHYS_TOT_DATA; i++) {
+				if ((pf->data_types & (1<<i)) &&
+				    (!ptcache_file_read_align(pf) || !ptcache_file_read(pf, pm->data[i], pm->totpoint, ptcache_data_size[i])))
+				{
+					error = 1;
+					break;
+				}
+			}
+		}
+		else if (pf->flag & PTCACHE_TYPEFLAG_COMPRESS) {
+			for (i=0; i<BPHYS_TOT_DATA; i++) {
+				unsigned int out_len = pm->totpoint*ptcache_data_size[i];
+				if (pf->data_types & (1<<i))
+					ptcache_file_compressed_read(pf, (unsigned char *)(pm->data[i]), out_len);
+			}
+		}
+		else {
+			BKE_ptcache_mem_pointers_init(pm);
+			ptcache_file_pointers_init(pf);
+
+			for (i=0; i<pm->totpoint; i++) {
+				if (!ptcache_file_data_read(pf)) {
+					error = 1;
+					break;
+				}
+				ptcache_data_copy(pf->cur, pm->cur);
+				BKE_ptcache_mem_pointers_incr(pm);
+			}
+		}
+	}
+
+	if (!error && pf->flag & PTCACHE_TYPEFLAG_EXTRADATA) {
+		unsigned int extratype = 0;
+
+		while (ptcache_file_read(pf, &extratype, 1, sizeof(unsigned int))) {
+			PTCacheExtra *extra = MEM_callocN(sizeof(PTCacheExtra), "Pointcache extradata");
+
+			extra->type = extratype;
+
+			ptcache_file_read(pf, &extra->totdata, 1, sizeof(unsigned int));
+
+			extra->data = MEM_callocN(extra->totdata * ptcache_extra_datasize[extra->type], "Pointcache extradata->data");
+
+			if (pf->flag & PTCACHE_TYPEFLAG_COMPRESS)
+				ptcache_file_compressed_read(pf, (unsigned char *)(extra->data), extra->totdata*ptcache_extra_datasize[extra->type]);
+			else
+				ptcache_file_read(pf, extra->data, extra->totdata, ptcache_extra_datasize[extra->type]);
+
+			BLI_addtail(&pm->extradata, extra);
+		}
+	}
+
+	if (error && pm) {
+		ptcache_data_free(pm);
+		ptcache_extra_free(pm);
+		MEM_freeN(pm);
+		pm = NULL;
+	}
+
+	if (error && G.debug & G_DEBUG)
+		printf("Error reading from disk cache\n");
+	
+	return pm;
+}
+
+/* ************** Playback prefetching ************** */
+
+/* While playing back a disk cache, a thread reads the next frames in the
+ * playback direction ahead of time. Point caches are decoded into a
+ * PTCacheMem, stream caches (smoke, dynamic paint) are read into memory.
+ * Prefetched frames are kept in a bounded LRU, readers get them without
+ * waiting; a frame that isn't ready yet is read the normal way. The thread
+ * only runs while there is something to prefetch. */
+
+#define PTCACHE_PREFETCH_FRAMES     8
+#define PTCACHE_PREFETCH_MAX_FRAMES 64
+#define PTCACHE_PREFETCH_MAX_SIZE   (512 * 1024 * 1024)
+
+/* PTCachePrefetchFrame->state */
+#define PTCACHE_PREFETCH_QUEUED     0
+#define PTCACHE_PREFETCH_LOADING    1
+#define PTCACHE_PREFETCH_READY      2
+
+typedef struct PTCachePrefetchFrame {
+	struct PTCachePrefetchFrame *next, *prev;
+	PointCache *cache;          /* only used as key */
+	int frame;
+	int state;
+	PTCacheMap *data;           /* the frame once ready */
+	size_t size;
+
+	/* what the thread needs to read the frame */
+	char filename[MAX_PTCACHE_FILE];
+	int container, stream;
+	unsigned int type;
+	int (*read_header)(PTCacheFile *pf);
+} PTCachePrefetchFrame;
+
+typedef struct PTCachePrefetchCache {
+	struct PTCachePrefetchCache *next, *prev;
+	PointCache *cache;
+	int last_frame, dir;
+} PTCachePrefetchCache;
+
+static pthread_mutex_t ptcache_prefetch_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct {
+	pthread_t thread;
+	int running, done, stop;
+	ListBase frames;            /* least recently used first */
+	ListBase caches;            /* playback direction per cache */
+	int totframe;
+	size_t size;
+} ptcache_prefetch = {0};
+
+static PTCachePrefetchFrame *ptcache_prefetch_find(PointCache *cache, int frame)
+{
+	PTCachePrefetchFrame *pfr;
+
+	for (pfr = ptcache_prefetch.frames.first; pfr; pfr = pfr->next) {
+		if (pfr->cache == cache && pfr->frame == frame)
+			return pfr;
+	}
+
+	return NULL;
+}
+/* must be called with ptcache_prefetch_lock held */
+static void ptcache_prefetch_remove(PTCachePrefetchFrame *pfr)
+{
+	if (pfr->state == PTCACHE_PREFETCH_LOADING) {
+		/* the thread frees it when done */
+		pfr->cache = NULL;
+		return;
+	}
+
+	BLI_remlink(&ptcache_prefetch.frames, pfr);
+	ptcache_prefetch.totframe--;
+	ptcache_prefetch.size -= pfr->size;
+
+	if (pfr->data)
+		ptcache_map_release(pfr->data);
+	MEM_freeN(pfr);
+}
+/* Removes prefetched frames of cache, with all also the playback direction. */
+static void ptcache_prefetch_remove_frames(PointCache *cache, int frame, int all)
+{
+	PTCachePrefetchFrame *pfr, *pfr_next;
+	PTCachePrefetchCache *pcache;
+
+	ptcache_quantize_invalidate(cache, frame, all);
+
+	if (ptcache_prefetch.frames.first == NULL && ptcache_prefetch.caches.first == NULL)
+		return;
+
+	pthread_mutex_lock(&ptcache_prefetch_lock);
+
+	for (pfr = ptcache_prefetch.frames.first; pfr; pfr = pfr_next) {
+		pfr_next = pfr->next;
+
+		if (pfr->cache == cache && (all || pfr->frame == frame))
+			ptcache_prefetch_remove(pfr);
+	}
+
+	if (all) {
+		for (pcache = ptcache_prefetch.caches.first; pcache; pcache = pcache->next) {
+			if (pcache->cache == cache) {
+				BLI_freelinkN(&ptcache_prefetch.caches, pcache);
+				break;
+			}
+		}
+	}
+
+	pthread_mutex_unlock(&ptcache_prefetch_lock);
+}
+static void ptcache_prefetch_invalidate(PointCache *cache)
+{
+	ptcache_prefetch_remove_frames(cache, 0, TRUE);
+}
+static void ptcache_prefetch_invalidate_frame(PointCache *cache, int frame)
+{
+	ptcache_prefetch_remove_frames(cache, frame, FALSE);
+}
+static void ptcache_prefetch_load(PTCachePrefetchFrame *pfr)
+{
+	PTCacheFile *pf = ptcache_file_open_read(pfr->cache, pfr->filename, pfr->container, pfr->frame);
+	PTCacheMap *data = NULL;
+
+	if (pf == NULL)
+		return;
+
+	if (pfr->stream) {
+		/* stream caches are decoded straight into the simulation, only read them */
+		data = MEM_callocN(sizeof(PTCacheMap), "PTCacheMap");
+		data->users = 1;
+
+		if (pf->fp) {
+			fseek(pf->fp, 0, SEEK_END);
+			data->len = (size_t)ftell(pf->fp);
+			fseek(pf->fp, 0, SEEK_SET);
+		}
+		else
+			data->len = pf->mem_len;
+
+		data->data = MEM_mallocN(MAX2(data->len, 1), "PTCache prefetch");
+
+		if (!ptcache_file_read(pf, data->data, data->len, sizeof(unsigned char))) {
+			MEM_freeN(data->data);
+			MEM_freeN(data);
+			data = NULL;
+		}
+		else
+			pfr->size = data->len;
+	}
+	else {
+		PTCacheID pid = {NULL};
+		PTCacheMem *pm;
+
+		pid.type = pfr->type;
+		pid.read_header = pfr->read_header;
+
+		pm = ptcache_file_to_mem(&pid, pf, FALSE);
+
+		if (pm) {
+			int i;
+
+			data = MEM_callocN(sizeof(PTCacheMap), "PTCacheMap");
+			data->pm = pm;
+			data->users = 1;
+
+			for (i=0; i<BPHYS_TOT_DATA; i++) {
+				if (pm->data[i])
+					pfr->size += pm->totpoint * ptcache_data_size[i];
+			}
+		}
+	}
+
+	ptcache_file_close(pf);
+
+	pfr->data = data;
+}
+/* must be called with ptcache_prefetch_lock held */
+static void ptcache_prefetch_evict(void)
+{
+	PTCachePrefetchFrame *pfr, *pfr_next;
+
+	for (pfr = ptcache_prefetch.frames.first; pfr; pfr = pfr_next) {
+		pfr_next = pfr->next;
+
+		if (ptcache_prefetch.totframe <= PTCACHE_PREFETCH_MAX_FRAMES &&
+		    ptcache_prefetch.size <= PTCACHE_PREFETCH_MAX_SIZE)
+		{
+			break;
+		}
+
+		if (pfr->state == PTCACHE_PREFETCH_READY)
+			ptcache_prefetch_remove(pfr);
+	}
+}
+static void *ptcache_prefetch_thread(void *UNUSED(arg))
+{
+	PTCachePrefetchFrame *pfr;
+
+	pthread_mutex_lock(&ptcache_prefetch_lock);
+
+	while (!ptcache_prefetch.stop) {
+		/* frames are queued in the order they're needed */
+		for (pfr = ptcache_prefetch.frames.first; pfr; pfr = pfr->next) {
+			if (pfr->state == PTCACHE_PREFETCH_QUEUED)
+				break;
+		}
+
+		if (pfr == NULL)
+			break;
+
+		pfr->state = PTCACHE_PREFETCH_LOADING;
+		pthread_mutex_unlock(&ptcache_prefetch_lock);
+
+		ptcache_prefetch_load(pfr);
+
+		pthread_mutex_lock(&ptcache_prefetch_lock);
+
+		pfr->state = PTCACHE_PREFETCH_READY;
+		ptcache_prefetch.size += pfr->size;
+
+		if (pfr->cache == NULL || pfr->data == NULL) {
+			/* invalidated while loading, or nothing to read */
+			ptcache_prefetch_remove(pfr);
+		}
+
+		ptcache_prefetch_evict();
+	}
+
+	ptcache_prefetch.done = TRUE;
+	pthread_mutex_unlock(&ptcache_prefetch_lock);
+
+	return NULL;
+}
+/* must be called with ptcache_prefetch_lock held */
+static void ptcache_prefetch_join(void)
+{
+	if (ptcache_prefetch.running && ptcache_prefetch.done) {
+		pthread_join(ptcache_prefetch.thread, NULL);
+		ptcache_prefetch.running = FALSE;
+		BLI_end_threaded_malloc();
+	}
+}
+/* Queues the frames after cfra in playback direction. */
+static void ptcache_prefetch_schedule(PTCacheID *pid, int cfra)
+{
+	PointCache *cache = pid->cache;
+	PTCachePrefetchCache *pcache;
+	PTCachePrefetchFrame *pfr;
+	int frame, step, tot = 0, queued = 0;
+
+	/* only on playback of disk caches, not while baking or rendering */
+	if ((cache->flag & PTCACHE_DISK_CACHE) == 0 || ptcache_writer.users || G.is_rendering)
+		return;
+
+	if (!G.relbase_valid && (cache->flag & PTCACHE_EXTERNAL) == 0)
+		return;
+
+	pthread_mutex_lock(&ptcache_prefetch_lock);
+
+	ptcache_prefetch_join();
+
+	for (pcache = ptcache_prefetch.caches.first; pcache; pcache = pcache->next) {
+		if (pcache->cache == cache)
+			break;
+	}
+
+	if (pcache == NULL) {
+		pcache = MEM_callocN(sizeof(PTCachePrefetchCache), "PTCachePrefetchCache");
+		pcache->cache = cache;
+		pcache->last_frame = cfra;
+		pcache->dir = 1;
+		BLI_addtail(&ptcache_prefetch.caches, pcache);
+	}
+	else if (cfra != pcache->last_frame) {
+		pcache->dir = (cfra > pcache->last_frame) ? 1 : -1;
+
+		/* a jump, not playback */
+		if (ABS(cfra - pcache->last_frame) > MAX2(cache->step, 1) * PTCACHE_PREFETCH_FRAMES) {
+			pcache->last_frame = cfra;
+			pthread_mutex_unlock(&ptcache_prefetch_lock);
+			return;
+		}
+
+		pcache->last_frame = cfra;
+	}
+
+	step = MAX2(cache->step, 1);
+
+	for (frame = cfra + pcache->dir;
+	     tot < PTCACHE_PREFETCH_FRAMES && ABS(frame - cfra) <= step * PTCACHE_PREFETCH_FRAMES;
+	     frame += pcache->dir)
+	{
+		if (frame < cache->startframe || frame > cache->endframe)
+			break;
+
+		/* the frames known to be cached, see BKE_ptcache_id_time */
+		if (cache->cached_frames && cache->cached_frames[frame - cache->startframe] == 0)
+			continue;
+
+		tot++;
+
+		pfr = ptcache_prefetch_find(cache, frame);
+
+		if (pfr) {
+			/* keep frames needed soon */
+			BLI_remlink(&ptcache_prefetch.frames, pfr);
+			BLI_addtail(&ptcache_prefetch.frames, pfr);
+			continue;
+		}
+
+		pfr = MEM_callocN(sizeof(PTCachePrefetchFrame), "PTCachePrefetchFrame");
+		pfr->cache = cache;
+		pfr->frame = frame;
+		pfr->container = (cache->flag & PTCACHE_DISK_CONTAINER) != 0;
+		pfr->stream = (pid->read_stream != NULL);
+		pfr->type = pid->type;
+		pfr->read_header = pid->read_header;
+
+		if (pfr->container)
+			ptcache_container_filename(pid, pfr->filename);
+		else
+			ptcache_filename(pid, pfr->filename, frame, 1, 1);
+
+		BLI_addtail(&ptcache_prefetch.frames, pfr);
+		ptcache_prefetch.totframe++;
+		queued++;
+	}
+
+	if (queued && !ptcache_prefetch.running) {
+		BLI_begin_threaded_malloc();
+		ptcache_prefetch.running = TRUE;
+		ptcache_prefetch.done = FALSE;
+		ptcache_prefetch.stop = FALSE;
+		pthread_create(&ptcache_prefetch.thread, NULL, ptcache_prefetch_thread, NULL);
+	}
+
+	pthread_mutex_unlock(&ptcache_prefetch_lock);
+}
+/* Takes a reference to a prefetched frame if it's ready. */
+static PTCacheMap *ptcache_prefetch_get(PointCache *cache, int frame)
+{
+	PTCachePrefetchFrame *pfr;
+	PTCacheMap *data = NULL;
+
+	if (ptcache_prefetch.frames.first == NULL)
+		return NULL;
+
+	pthread_mutex_lock(&ptcache_prefetch_lock);
+
+	pfr = ptcache_prefetch_find(cache, frame);
+
+	if (pfr && pfr->state == PTCACHE_PREFETCH_READY) {
+		data = pfr->data;
+
+		pthread_mutex_lock(&ptcache_container_lock);
+		data->users++;
+		pthread_mutex_unlock(&ptcache_container_lock);
+
+		BLI_remlink(&ptcache_prefetch.frames, pfr);
+		BLI_addtail(&ptcache_prefetch.frames, pfr);
+	}
+
+	pthread_mutex_unlock(&ptcache_prefetch_lock);
+
+	return data;
+}
+/* Prefetched point cache frame, the returned PTCacheMem shares the data. */
+static PTCacheMem *ptcache_prefetch_get_mem(PointCache *cache, int frame, PTCacheMap **r_map)
 {
-	PTCacheFile *pf = ptcache_file_open(pid, PTCACHE_FILE_READ, cfra);
-	PTCacheMem *pm = NULL;
-	unsigned int i, error = 0;
+	PTCacheMap *data = ptcache_prefetch_get(cache, frame);
+	PTCacheMem *pm;
 
-	if (pf == NULL)
+	if (data == NULL)
 		return NULL;
 
-	if (!ptcache_file_header_begin_read(pf))
-		error = 1;
+	if (data->pm == NULL) {
+		ptcache_map_release(data);
+		return NULL;
+	}
 
-	if (!error && (pf->type != pid->type || !pid->read_header(pf)))
-		error = 1;
+	pm = MEM_dupallocN(data->pm);
+	pm->next = pm->prev = NULL;
+	pm->flag |= PTCACHE_MEM_MAPPED;
 
-	if (!error) {
-		pm = MEM_callocN(sizeof(PTCacheMem), "Pointcache mem");
+	*r_map = data;
 
-		pm->totpoint = pf->totpoint;
-		pm->data_types = pf->data_types;
-		pm->frame = pf->frame;
+	return pm;
+}
+/* Prefetched stream cache frame, as a file read from memory. */
+static PTCacheFile *ptcache_prefetch_get_file(PointCache *cache, int frame)
+{
+	PTCacheMap *data = ptcache_prefetch_get(cache, frame);
+	PTCacheFile *pf;
 
-		ptcache_data_alloc(pm);
+	if (data == NULL)
+		return NULL;
 
-		if (pf->flag & PTCACHE_TYPEFLAG_COMPRESS) {
-			for (i=0; i<BPHYS_TOT_DATA; i++) {
-				unsigned int out_len = pm->totpoint*ptcache_data_size[i];
-				if (pf->data_types & (1<<i))
-					ptcache_file_compressed_read(pf, (unsigned char *)(pm->data[i]), out_len);
-			}
-		}
-		else {
-			BKE_ptcache_mem_pointers_init(pm);
-			ptcache_file_pointers_init(pf);
+	if (data->pm) {
+		ptcache_map_release(data);
+		return NULL;
+	}
 
-			for (i=0; i<pm->totpoint; i++) {
-				if (!ptcache_file_data_read(pf)) {
-					error = 1;
-					break;
-				}
-				ptcache_data_copy(pf->cur, pm->cur);
-				BKE_ptcache_mem_pointers_incr(pm);
-			}
-		}
+	pf = MEM_callocN(sizeof(PTCacheFile), "PTCacheFile");
+	pf->mem = data->data;
+	pf->mem_len = data->len;
+	pf->map = data;
+	pf->frame = frame;
+
+	return pf;
+}
+/* Stops prefetching and frees all prefetched frames. */
+void BKE_ptcache_prefetch_free(void)
+{
+	pthread_mutex_lock(&ptcache_prefetch_lock);
+	ptcache_prefetch.stop = TRUE;
+	pthread_mutex_unlock(&ptcache_prefetch_lock);
+
+	if (ptcache_prefetch.running) {
+		pthread_join(ptcache_prefetch.thread, NULL);
+		ptcache_prefetch.running = FALSE;
+		BLI_end_threaded_malloc();
 	}
 
-	if (!error && pf->flag & PTCACHE_TYPEFLAG_EXTRADATA) {
-		unsigned int extratype = 0;
+	pthread_mutex_lock(&ptcache_prefetch_lock);
 
-		while (ptcache_file_read(pf, &extratype, 1, sizeof(unsigned int))) {
-			PTCacheExtra *extra = MEM_callocN(sizeof(PTCacheExtra), "Pointcache extradata");
+	while (ptcache_prefetch.frames.first)
+		ptcache_prefetch_remove(ptcache_prefetch.frames.first);
 
-			extra->type = extratype;
+	BLI_freelistN(&ptcache_prefetch.caches);
 
-			ptcache_file_read(pf, &extra->totdata, 1, sizeof(unsigned int));
+	pthread_mutex_unlock(&ptcache_prefetch_lock);
 
-			extra->data = MEM_callocN(extra->totdata * ptcache_extra_datasize[extra->type], "Pointcache extradata->data");
+	ptcache_quantize_free();
+}
 
-			if (pf->flag & PTCACHE_TYPEFLAG_COMPRESS)
-				ptcache_file_compressed_read(pf, (unsigned char *)(extra->data), extra->totdata*ptcache_extra_datasize[extra->type]);
-			else
-				ptcache_file_read(pf, extra->data, extra->totdata, ptcache_extra_datasize[extra->type]);
+/* With r_map the data can be shared with a mapped container or a prefetched
+ * frame, release *r_map after freeing the returned PTCacheMem. */
+static PTCacheMem *ptcache_disk_frame_to_mem(PTCacheID *pid, int cfra, PTCacheMap **r_map)
+{
+	PTCacheFile *pf;
+	PTCacheMem *pm;
 
-			BLI_addtail(&pm->extradata, extra);
-		}
+	if (r_map) {
+		*r_map = NULL;
+
+		pm = ptcache_prefetch_get_mem(pid->cache, cfra, r_map);
+
+		if (pm)
+			return pm;
 	}
 
-	if (error && pm) {
-		ptcache_data_free(pm);
-		ptcache_extra_free(pm);
-		MEM_freeN(pm);
-		pm = NULL;
+	pf = ptcache_file_open(pid, PTCACHE_FILE_READ, cfra);
+
+	if (pf == NULL)
+		return NULL;
+
+	pm = ptcache_file_to_mem(pid, pf, r_map != NULL);
+
+	/* keep the map alive for pm */
+	if (pm && pm->flag & PTCACHE_MEM_MAPPED) {
+		*r_map = pf->map;
+		pf->map = NULL;
 	}
 
 	ptcache_file_close(pf);
 
-	if (error && G.debug & G_DEBUG)
-		printf("Error reading from disk cache\n");
-	
 	return pm;
 }
 static int ptcache_mem_frame_to_disk(PTCacheID *pid, PTCacheMem *pm)
@@ -1758,7 +3970,9 @@ static int ptcache_mem_frame_to_disk(PTCacheID *pid, PTCacheMem *pm)
 	PTCacheFile *pf = NULL;
 	unsigned int i, error = 0;
 	
-	BKE_ptcache_id_clear(pid, PTCACHE_CLEAR_FRAME, pm->frame);
+	/* appending to a container replaces the frame */
+	if ((pid->cache->flag & PTCACHE_DISK_CONTAINER) == 0)
+		BKE_ptcache_id_clear(pid, PTCACHE_CLEAR_FRAME, pm->frame);
 
 	pf = ptcache_file_open(pid, PTCACHE_FILE_WRITE, pm->frame);
 
@@ -1776,14 +3990,22 @@ static int ptcache_mem_frame_to_disk(PTCacheID *pid, PTCacheMem *pm)
 	if (pm->extradata.first)
 		pf->flag |= PTCACHE_TYPEFLAG_EXTRADATA;
 	
-	if (pid->cache->compression)
+	if (ptcache_quantize_enabled(pid, pm))
+		pf->flag |= PTCACHE_TYPEFLAG_QUANTIZED;
+	else if (pid->cache->compression)
 		pf->flag |= PTCACHE_TYPEFLAG_COMPRESS;
+	else if (pid->cache->flag & PTCACHE_DISK_CONTAINER)
+		pf->flag |= PTCACHE_TYPEFLAG_ARRAYS;
 
 	if (!ptcache_file_header_begin_write(pf) || !pid->write_header(pf))
 		error = 1;
 
 	if (!error) {
-		if (pid->cache->compression) {
+		if (pf->flag & PTCACHE_TYPEFLAG_QUANTIZED) {
+			if (!ptcache_quantize_write(pid, pf, pm))
+				error = 1;
+		}
+		else if (pf->flag & PTCACHE_TYPEFLAG_COMPRESS) {
 			for (i=0; i<BPHYS_TOT_DATA; i++) {
 				if (pm->data[i]) {
 					unsigned int in_len = pm->totpoint*ptcache_data_size[i];
@@ -1793,6 +4015,16 @@ static int ptcache_mem_frame_to_disk(PTCacheID *pid, PTCacheMem *pm)
 				}
 			}
 		}
+		else if (pf->flag & PTCACHE_TYPEFLAG_ARRAYS) {
+			for (i=0; i<BPHYS_TOT_DATA; i++) {
+				if ((pm->data_types & (1<<i)) &&
+				    (!ptcache_file_write_align(pf) || !ptcache_file_write(pf, pm->data[i], pm->totpoint, ptcache_data_size[i])))
+				{
+					error = 1;
+					break;
+				}
+			}
+		}
 		else {
 			BKE_ptcache_mem_pointers_init(pm);
 			ptcache_file_pointers_init(pf);
@@ -1818,7 +4050,7 @@ static int ptcache_mem_frame_to_disk(PTCacheID *pid, PTCacheMem *pm)
 			ptcache_file_write(pf, &extra->type, 1, sizeof(unsigned int));
 			ptcache_file_write(pf, &extra->totdata, 1, sizeof(unsigned int));
 
-			if (pid->cache->compression) {
+			if (pf->flag & PTCACHE_TYPEFLAG_COMPRESS) {
 				unsigned int in_len = extra->totdata * ptcache_extra_datasize[extra->type];
 				unsigned char *out = (unsigned char *)MEM_callocN(LZO_OUT_LEN(in_len) * 4, "pointcache_lzo_buffer");
 				ptcache_file_compressed_write(pf, (unsigned char *)(extra->data), in_len, out, pid->cache->compression);
@@ -1830,7 +4062,8 @@ static int ptcache_mem_frame_to_disk(PTCacheID *pid, PTCacheMem *pm)
 		}
 	}
 
-	ptcache_file_close(pf);
+	if (!ptcache_file_close(pf))
+		error = 1;
 	
 	if (error && G.debug & G_DEBUG)
 		printf("Error writing to disk cache\n");
@@ -1840,12 +4073,17 @@ static int ptcache_mem_frame_to_disk(PTCacheID *pid, PTCacheMem *pm)
 
 static int ptcache_read_stream(PTCacheID *pid, int cfra)
 {
-	PTCacheFile *pf = ptcache_file_open(pid, PTCACHE_FILE_READ, cfra);
+	PTCacheFile *pf;
 	int error = 0;
 
 	if (pid->read_stream == NULL)
 		return 0;
 
+	pf = ptcache_prefetch_get_file(pid->cache, cfra);
+
+	if (pf == NULL)
+		pf = ptcache_file_open(pid, PTCACHE_FILE_READ, cfra);
+
 	if (pf == NULL) {
 		if (G.debug & G_DEBUG)
 			printf("Error opening disk cache file for reading\n");
@@ -1876,12 +4114,13 @@ static int ptcache_read_stream(PTCacheID *pid, int cfra)
 static int ptcache_read(PTCacheID *pid, int cfra)
 {
 	PTCacheMem *pm = NULL;
+	PTCacheMap *map = NULL;
 	int i;
 	int *index = &i;
 
 	/* get a memory cache to read from */
 	if (pid->cache->flag & PTCACHE_DISK_CACHE) {
-		pm = ptcache_disk_frame_to_mem(pid, cfra);
+		pm = ptcache_disk_frame_to_mem(pid, cfra, &map);
 	}
 	else {
 		pm = pid->cache->mem_cache.first;
@@ -1916,6 +4155,9 @@ static int ptcache_read(PTCacheID *pid, int cfra)
 			ptcache_data_free(pm);
 			ptcache_extra_free(pm);
 			MEM_freeN(pm);
+
+			if (map)
+				ptcache_map_release(map);
 		}
 	}
 
@@ -1924,12 +4166,13 @@ static int ptcache_read(PTCacheID *pid, int cfra)
 static int ptcache_interpolate(PTCacheID *pid, float cfra, int cfra1, int cfra2)
 {
 	PTCacheMem *pm = NULL;
+	PTCacheMap *map = NULL;
 	int i;
 	int *index = &i;
 
 	/* get a memory cache to read from */
 	if (pid->cache->flag & PTCACHE_DISK_CACHE) {
-		pm = ptcache_disk_frame_to_mem(pid, cfra2);
+		pm = ptcache_disk_frame_to_mem(pid, cfra2, &map);
 	}
 	else {
 		pm = pid->cache->mem_cache.first;
@@ -1963,6 +4206,9 @@ static int ptcache_interpolate(PTCacheID *pid, float cfra, int cfra1, int cfra2)
 			ptcache_data_free(pm);
 			ptcache_extra_free(pm);
 			MEM_freeN(pm);
+
+			if (map)
+				ptcache_map_release(map);
 		}
 	}
 
@@ -2032,6 +4278,10 @@ int BKE_ptcache_read(PTCacheID *pid, float cfra)
 		pid->cache->simframe = cfra2;
 	}
 
+	/* read the next frames in the background */
+	if (ret == PTCACHE_READ_EXACT || ret == PTCACHE_READ_INTERPOLATED)
+		ptcache_prefetch_schedule(pid, cfrai);
+
 	cfrai = (int)cfra;
 	/* clear invalid cache frames so that better stuff can be simulated */
 	if (pid->cache->flag & PTCACHE_OUTDATED) {
@@ -2051,7 +4301,9 @@ static int ptcache_write_stream(PTCacheID *pid, int cfra, int totpoint)
 	PTCacheFile *pf = NULL;
 	int error = 0;
 	
-	BKE_ptcache_id_clear(pid, PTCACHE_CLEAR_FRAME, cfra);
+	/* appending to a container replaces the frame */
+	if ((pid->cache->flag & PTCACHE_DISK_CONTAINER) == 0)
+		BKE_ptcache_id_clear(pid, PTCACHE_CLEAR_FRAME, cfra);
 
 	pf = ptcache_file_open(pid, PTCACHE_FILE_WRITE, cfra);
 
@@ -2072,7 +4324,8 @@ static int ptcache_write_stream(PTCacheID *pid, int cfra, int totpoint)
 	if (!error && pid->write_stream)
 		pid->write_stream(pf, pid->calldata);
 
-	ptcache_file_close(pf);
+	if (!ptcache_file_close(pf))
+		error = 1;
 
 	if (error && G.debug & G_DEBUG)
 		printf("Error writing to disk cache\n");
@@ -2101,7 +4354,7 @@ static int ptcache_write(PTCacheID *pid, int cfra, int overwrite)
 			while (fra >= cache->startframe && !BKE_ptcache_id_exist(pid, fra))
 				fra--;
 			
-			pm2 = ptcache_disk_frame_to_mem(pid, fra);
+			pm2 = ptcache_disk_frame_to_mem(pid, fra, NULL);
 		}
 		else
 			pm2 = cache->mem_cache.last;
@@ -2126,6 +4379,14 @@ static int ptcache_write(PTCacheID *pid, int cfra, int overwrite)
 	pm->frame = cfra;
 
 	if (cache->flag & PTCACHE_DISK_CACHE) {
+		/* previous frame first, quantized frames can be stored relative to it */
+		if (pm2) {
+			error += !ptcache_mem_frame_to_disk(pid, pm2);
+			ptcache_data_free(pm2);
+			ptcache_extra_free(pm2);
+			MEM_freeN(pm2);
+		}
+
 		error += !ptcache_mem_frame_to_disk(pid, pm);
 
 		// if (pm) /* pm is always set */
@@ -2134,13 +4395,6 @@ static int ptcache_write(PTCacheID *pid, int cfra, int overwrite)
 			ptcache_extra_free(pm);
 			MEM_freeN(pm);
 		}
-
-		if (pm2) {
-			error += !ptcache_mem_frame_to_disk(pid, pm2);
-			ptcache_data_free(pm2);
-			ptcache_extra_free(pm2);
-			MEM_freeN(pm2);
-		}
 	}
 	else {
 		BLI_addtail(&cache->mem_cache, pm);
@@ -2211,7 +4465,7 @@ int BKE_ptcache_write(PTCacheID *pid, unsigned int cfra)
 		return 0;
 
 	if (pid->write_stream) {
-		ptcache_write_stream(pid, cfra, totpoint);
+		error += !ptcache_write_stream(pid, cfra, totpoint);
 	}
 	else if (pid->write_point) {
 		error += ptcache_write(pid, cfra, overwrite);
@@ -2227,7 +4481,7 @@ int BKE_ptcache_write(PTCacheID *pid, unsigned int cfra)
 		cache->flag |= PTCACHE_FRAMES_SKIPPED;
 
 	/* Update timeline cache display */
-	if (cfra && cache->cached_frames)
+	if (cfra && cache->cached_frames && !error)
 		cache->cached_frames[cfra-cache->startframe] = 1;
 
 	BKE_ptcache_update_info(pid);
@@ -2258,6 +4512,12 @@ void BKE_ptcache_id_clear(PTCacheID *pid, int mode, unsigned int cfra)
 	if (pid->cache->flag & PTCACHE_IGNORE_CLEAR)
 		return;
 
+	/* single frames are cleared before every write while baking */
+	if (mode == PTCACHE_CLEAR_FRAME)
+		ptcache_prefetch_invalidate_frame(pid->cache, cfra);
+	else
+		ptcache_prefetch_invalidate(pid->cache);
+
 	sta = pid->cache->startframe;
 	end = pid->cache->endframe;
 
@@ -2274,7 +4534,38 @@ void BKE_ptcache_id_clear(PTCacheID *pid, int mode, unsigned int cfra)
 	case PTCACHE_CLEAR_ALL:
 	case PTCACHE_CLEAR_BEFORE:
 	case PTCACHE_CLEAR_AFTER:
-		if (pid->cache->flag & PTCACHE_DISK_CACHE) {
+		if (pid->cache->flag & PTCACHE_DISK_CACHE && pid->cache->flag & PTCACHE_DISK_CONTAINER) {
+			ptcache_writer_flush();
+
+			if (!ptcache_container_filename(pid, filename))
+				return;
+
+			if (mode == PTCACHE_CLEAR_ALL) {
+				pid->cache->last_exact = MIN2(pid->cache->startframe, 0);
+				ptcache_container_delete(filename);
+
+				if (pid->cache->cached_frames)
+					memset(pid->cache->cached_frames, 0, MEM_allocN_len(pid->cache->cached_frames));
+			}
+			else {
+				unsigned int frame;
+
+				ptcache_container_remove_frames(pid->cache, filename, mode, cfra);
+
+				if (pid->cache->cached_frames) {
+					for (frame = sta; frame <= end; frame++) {
+						if ((mode == PTCACHE_CLEAR_BEFORE && frame < cfra) ||
+						    (mode == PTCACHE_CLEAR_AFTER && frame > cfra))
+						{
+							pid->cache->cached_frames[frame-sta] = 0;
+						}
+					}
+				}
+			}
+		}
+		else if (pid->cache->flag & PTCACHE_DISK_CACHE) {
+			ptcache_writer_flush();
+
 			ptcache_path(pid, path);
 			
 			len = ptcache_filename(pid, filename, cfra, 0, 0); /* no path */
@@ -2360,8 +4651,16 @@ void BKE_ptcache_id_clear(PTCacheID *pid, int mode, unsigned int cfra)
 	case PTCACHE_CLEAR_FRAME:
 		if (pid->cache->flag & PTCACHE_DISK_CACHE) {
 			if (BKE_ptcache_id_exist(pid, cfra)) {
-				ptcache_filename(pid, filename, cfra, 1, 1); /* no path */
-				BLI_delete(filename, 0, 0);
+				if (pid->cache->flag & PTCACHE_DISK_CONTAINER) {
+					ptcache_container_filename(pid, filename);
+					ptcache_writer_flush_file(filename, cfra);
+					ptcache_container_remove_frames(pid->cache, filename, PTCACHE_CLEAR_FRAME, cfra);
+				}
+				else {
+					ptcache_filename(pid, filename, cfra, 1, 1); /* no path */
+					ptcache_writer_flush_file(filename, cfra);
+					BLI_delete(filename, 0, 0);
+				}
 			}
 		}
 		else {
@@ -2397,9 +4696,16 @@ int  BKE_ptcache_id_exist(PTCacheID *pid, int cfra)
 	if (pid->cache->flag & PTCACHE_DISK_CACHE) {
 		char filename[MAX_PTCACHE_FILE];
 		
+		if (pid->cache->flag & PTCACHE_DISK_CONTAINER) {
+			if (!ptcache_container_filename(pid, filename))
+				return 0;
+
+			return ptcache_writer_pending(filename, cfra) || ptcache_container_has_frame(pid->cache, filename, cfra);
+		}
+
 		ptcache_filename(pid, filename, cfra, 1, 1);
 
-		return BLI_exists(filename);
+		return BLI_exists(filename) || ptcache_writer_pending(filename, cfra);
 	}
 	else {
 		PTCacheMem *pm = pid->cache->mem_cache.first;
@@ -2674,7 +4980,7 @@ void BKE_ptcache_remove(void)
 			if ( strcmp(de->d_name, ".")==0 || strcmp(de->d_name, "..")==0) {
 				/* do nothing */
 			}
-			else if (strstr(de->d_name, PTCACHE_EXT)) { /* do we have the right extension?*/
+			else if (strstr(de->d_name, PTCACHE_EXT) || strstr(de->d_name, PTCACHE_CONTAINER_EXT)) { /* do we have the right extension?*/
 				BLI_join_dirfile(path_full, sizeof(path_full), path, de->d_name);
 				BLI_delete(path_full, 0, 0);
 			}
@@ -2729,6 +5035,7 @@ PointCache *BKE_ptcache_add(ListBase *ptcaches)
 	cache->endframe= 250;
 	cache->step= 10;
 	cache->index = -1;
+	cache->quantize_tolerance = 0.001f;
 
 	BLI_addtail(ptcaches, cache);
 
@@ -2750,6 +5057,8 @@ void BKE_ptcache_free_mem(ListBase *mem_cache)
 }
 void BKE_ptcache_free(PointCache *cache)
 {
+	ptcache_prefetch_invalidate(cache);
+	ptcache_container_free_cache(cache);
 	BKE_ptcache_free_mem(&cache->mem_cache);
 	if (cache->edit && cache->free_edit)
 		cache->free_edit(cache->edit);
@@ -2860,6 +5169,12 @@ typedef struct {
 	int *cfra_ptr;
 	Main *main;
 	Scene *scene;
+
+	/* independent parts of the scene, baked at the same time */
+	ListBase islands;
+	int totisland;
+	int *island_startframe, *island_endframe;
+	int *island_progress;
 } ptcache_bake_data;
 
 static void ptcache_dt_to_str(char *str, double dtime)
@@ -2874,6 +5189,104 @@ static void ptcache_dt_to_str(char *str, double dtime)
 		sprintf(str, "%is", ((int)dtime) % 60);
 }
 
+/* Finds the islands of the scene and the frames their caches are baked for.
+ * Islands without caches to bake are updated every frame, they can have
+ * animated emitters or colliders. */
+static void ptcache_bake_islands_init(ptcache_bake_data *data, int startframe)
+{
+	Scene *scene = data->scene;
+	DagIsland *island;
+	ListBase pidlist;
+	PTCacheID *pid;
+	int a;
+
+	if (scene->theDag == NULL)
+		DAG_scene_sort(data->main, scene);
+
+	data->totisland = DAG_scene_islands(scene, &data->islands);
+
+	if (data->totisland < 2)
+		return;
+
+	data->island_startframe = MEM_mallocN(sizeof(int) * data->totisland, "ptcache bake island start");
+	data->island_endframe = MEM_mallocN(sizeof(int) * data->totisland, "ptcache bake island end");
+	data->island_progress = MEM_callocN(sizeof(int) * data->totisland, "ptcache bake island progress");
+
+	for (island = data->islands.first, a = 0; island; island = island->next, a++) {
+		LinkData *link;
+
+		data->island_startframe[a] = MAXFRAME;
+		data->island_endframe[a] = startframe - 1;
+
+		for (link = island->bases.first; link; link = link->next) {
+			BKE_ptcache_ids_from_object(&pidlist, ((Base *)link->data)->object, scene, MAX_DUPLI_RECUR);
+
+			for (pid = pidlist.first; pid; pid = pid->next) {
+				if (pid->cache->flag & PTCACHE_BAKING) {
+					data->island_startframe[a] = MIN2(data->island_startframe[a], pid->cache->startframe);
+					data->island_endframe[a] = MAX2(data->island_endframe[a], pid->cache->endframe);
+				}
+			}
+
+			BLI_freelistN(&pidlist);
+		}
+
+		data->island_startframe[a] = MAX2(MIN2(data->island_startframe[a], data->island_endframe[a]), startframe);
+	}
+}
+static void ptcache_bake_islands_free(ptcache_bake_data *data)
+{
+	DAG_islands_free(&data->islands);
+
+	if (data->island_startframe) {
+		MEM_freeN(data->island_startframe);
+		MEM_freeN(data->island_endframe);
+		MEM_freeN(data->island_progress);
+	}
+}
+/* Skips the islands with caches that are done and updates their progress.
+ * Nothing reads from a skipped island, DAG_scene_islands puts everything
+ * that simulations look up in the island of the simulation. */
+static void ptcache_bake_islands_update(ptcache_bake_data *data)
+{
+	DagIsland *island;
+	int a, cfra = *data->cfra_ptr;
+
+	for (island = data->islands.first, a = 0; island; island = island->next, a++) {
+		int sfra = data->island_startframe[a], efra = data->island_endframe[a];
+
+		/* islands without caches */
+		if (efra < sfra)
+			continue;
+
+		if (cfra > efra) {
+			if ((island->flag & DAG_ISLAND_SKIP) == 0 && G.background)
+				printf("bake: island %d/%d done at frame %d\n", a + 1, data->totisland, efra);
+
+			island->flag |= DAG_ISLAND_SKIP;
+			data->island_progress[a] = 100;
+		}
+		else if (efra > sfra) {
+			data->island_progress[a] = (int)(100.0f * (float)MAX2(cfra - sfra, 0) / (float)(efra - sfra));
+		}
+	}
+}
+/* Overall progress, islands that are done earlier count as done. */
+static int ptcache_bake_islands_progress(ptcache_bake_data *data)
+{
+	int a, progress = 0, tot = 0;
+
+	for (a = 0; a < data->totisland; a++) {
+		/* islands without caches */
+		if (data->island_endframe[a] < data->island_startframe[a])
+			continue;
+
+		progress += data->island_progress[a];
+		tot++;
+	}
+
+	return tot ? progress / tot : 0;
+}
 static void *ptcache_bake_thread(void *ptr)
 {
 	int use_timer = FALSE, sfra, efra;
@@ -2887,7 +5300,13 @@ static void *ptcache_bake_thread(void *ptr)
 	efra = data->endframe;
 
 	for (; (*data->cfra_ptr <= data->endframe) && !data->break_operation; *data->cfra_ptr+=data->step) {
-		BKE_scene_update_for_newframe(data->main, data->scene, data->scene->lay);
+		if (data->totisland > 1) {
+			ptcache_bake_islands_update(data);
+			BKE_scene_update_for_newframe_islands(data->main, data->scene, data->scene->lay, &data->islands);
+		}
+		else
+			BKE_scene_update_for_newframe(data->main, data->scene, data->scene->lay);
+
 		if (G.background) {
 			printf("bake: frame %d :: %d\n", (int)*data->cfra_ptr, data->endframe);
 		}
@@ -2918,8 +5337,9 @@ static void *ptcache_bake_thread(void *ptr)
 	return NULL;
 }
 
-/* if bake is not given run simulations to current frame */
-void BKE_ptcache_bake(PTCacheBaker* baker)
+/* if bake is not given run simulations to current frame,
+ * returns the number of disk cache frames that could not be written */
+int BKE_ptcache_bake(PTCacheBaker* baker)
 {
 	Main *bmain = baker->main;
 	Scene *scene = baker->scene;
@@ -2936,12 +5356,16 @@ void BKE_ptcache_bake(PTCacheBaker* baker)
 	ListBase threads;
 	ptcache_bake_data thread_data;
 	int progress, old_progress;
+	int totfailed;
 	
 	thread_data.endframe = baker->anim_init ? scene->r.sfra : CFRA;
 	thread_data.step = baker->quick_step;
 	thread_data.cfra_ptr = &CFRA;
 	thread_data.scene = baker->scene;
 	thread_data.main = baker->main;
+	thread_data.islands.first = thread_data.islands.last = NULL;
+	thread_data.totisland = 0;
+	thread_data.island_startframe = thread_data.island_endframe = thread_data.island_progress = NULL;
 
 	G.is_break = FALSE;
 
@@ -3039,7 +5463,14 @@ void BKE_ptcache_bake(PTCacheBaker* baker)
 	thread_data.thread_ended = FALSE;
 	old_progress = -1;
 
+	/* baking everything, unrelated simulations can be updated at the same time */
+	if (pid == NULL && bake)
+		ptcache_bake_islands_init(&thread_data, startframe);
+
 	WM_cursor_wait(1);
+
+	/* compress and write disk cache frames while the next ones are simulated */
+	ptcache_writer_begin();
 	
 	if (G.background) {
 		ptcache_bake_thread((void*)&thread_data);
@@ -3050,7 +5481,9 @@ void BKE_ptcache_bake(PTCacheBaker* baker)
 
 		while (thread_data.thread_ended == FALSE) {
 
-			if (bake)
+			if (thread_data.totisland > 1)
+				progress = ptcache_bake_islands_progress(&thread_data);
+			else if (bake)
 				progress = (int)(100.0f * (float)(CFRA - startframe)/(float)(thread_data.endframe-startframe));
 			else
 				progress = CFRA;
@@ -3114,6 +5547,12 @@ void BKE_ptcache_bake(PTCacheBaker* baker)
 		}
 	}
 
+	/* also after a cancel, so the baked frames are complete on disk */
+	totfailed = ptcache_writer_collect_errors();
+	ptcache_writer_end();
+
+	ptcache_bake_islands_free(&thread_data);
+
 	scene->r.framelen = frameleno;
 	CFRA = cfrao;
 	
@@ -3128,6 +5567,8 @@ void BKE_ptcache_bake(PTCacheBaker* baker)
 	WM_cursor_wait(0);
 
 	/* TODO: call redraw all windows somehow */
+
+	return totfailed;
 }
 /* Helpers */
 void BKE_ptcache_disk_to_mem(PTCacheID *pid)
@@ -3147,7 +5588,7 @@ void BKE_ptcache_disk_to_mem(PTCacheID *pid)
 	cache->flag |= baked;
 
 	for (cfra=sfra; cfra <= efra; cfra++) {
-		pm = ptcache_disk_frame_to_mem(pid, cfra);
+		pm = ptcache_disk_frame_to_mem(pid, cfra, NULL);
 
 		if (pm)
 			BLI_addtail(&pid->cache->mem_cache, pm);
@@ -3211,6 +5652,46 @@ void BKE_ptcache_toggle_disk_cache(PTCacheID *pid)
 
 	BKE_ptcache_update_info(pid);
 }
+/* Moves the frames of a disk cache to the other disk format, the
+ * PTCACHE_DISK_CONTAINER flag is already set to the new format. */
+void BKE_ptcache_toggle_disk_container(PTCacheID *pid)
+{
+	PointCache *cache = pid->cache;
+	int last_exact = cache->last_exact;
+	int baked = cache->flag & PTCACHE_BAKED;
+
+	if ((cache->flag & PTCACHE_DISK_CACHE) == 0)
+		return;
+
+	if (cache->cached_frames) {
+		MEM_freeN(cache->cached_frames);
+		cache->cached_frames=NULL;
+	}
+
+	/* read the frames from the old format */
+	cache->flag ^= PTCACHE_DISK_CONTAINER;
+	cache->flag &= ~PTCACHE_DISK_CACHE;
+	BKE_ptcache_disk_to_mem(pid);
+
+	cache->flag |= PTCACHE_DISK_CACHE;
+	cache->flag &= ~PTCACHE_BAKED;
+	BKE_ptcache_id_clear(pid, PTCACHE_CLEAR_ALL, 0);
+	cache->flag |= baked;
+
+	/* and write them in the new one */
+	cache->flag ^= PTCACHE_DISK_CONTAINER;
+	BKE_ptcache_mem_to_disk(pid);
+
+	cache->flag &= ~(PTCACHE_DISK_CACHE|PTCACHE_BAKED);
+	BKE_ptcache_id_clear(pid, PTCACHE_CLEAR_ALL, 0);
+	cache->flag |= PTCACHE_DISK_CACHE|baked;
+
+	cache->last_exact = last_exact;
+
+	BKE_ptcache_id_time(pid, NULL, 0.0f, NULL, NULL, NULL);
+
+	BKE_ptcache_update_info(pid);
+}
 
 void BKE_ptcache_disk_cache_rename(PTCacheID *pid, const char *name_src, const char *name_dst)
 {
@@ -3231,6 +5712,17 @@ void BKE_ptcache_disk_cache_rename(PTCacheID *pid, const char *name_src, const c
 	/* get "from" filename */
 	BLI_strncpy(pid->cache->name, name_src, sizeof(pid->cache->name));
 
+	if (pid->cache->flag & PTCACHE_DISK_CONTAINER) {
+		ptcache_container_filename(pid, old_path_full);
+		BLI_strncpy(pid->cache->name, name_dst, sizeof(pid->cache->name));
+		ptcache_container_filename(pid, new_path_full);
+
+		ptcache_container_rename(old_path_full, new_path_full);
+
+		BLI_strncpy(pid->cache->name, old_name, sizeof(pid->cache->name));
+		return;
+	}
+
 	len = ptcache_filename(pid, old_filename, 0, 0, 0); /* no path */
 
 	ptcache_path(pid, path);
@@ -3287,41 +5779,53 @@ void BKE_ptcache_load_external(PTCacheID *pid)
 	if (!cache)
 		return;
 
-	ptcache_path(pid, path);
-	
-	len = ptcache_filename(pid, filename, 1, 0, 0); /* no path */
-	
-	dir = opendir(path);
-	if (dir==NULL)
-		return;
+	ptcache_container_filename(pid, filename);
 
-	if (cache->index >= 0)
-		BLI_snprintf(ext, sizeof(ext), "_%02d"PTCACHE_EXT, cache->index);
-	else
-		BLI_strncpy(ext, PTCACHE_EXT, sizeof(ext));
-	
-	while ((de = readdir(dir)) != NULL) {
-		if (strstr(de->d_name, ext)) { /* do we have the right extension?*/
-			if (strncmp(filename, de->d_name, len ) == 0) { /* do we have the right prefix */
-				/* read the number of the file */
-				int frame, len2 = (int)strlen(de->d_name);
-				char num[7];
+	if (BLI_exists(filename)) {
+		cache->flag |= PTCACHE_DISK_CONTAINER;
 
-				if (len2 > 15) { /* could crash if trying to copy a string out of this range*/
-					BLI_strncpy(num, de->d_name + (strlen(de->d_name) - 15), sizeof(num));
-					frame = atoi(num);
+		if (!ptcache_container_frame_range(pid->cache, filename, &start, &end, &info))
+			start = MAXFRAME;
+	}
+	else {
+		cache->flag &= ~PTCACHE_DISK_CONTAINER;
+
+		ptcache_path(pid, path);
+		
+		len = ptcache_filename(pid, filename, 1, 0, 0); /* no path */
+		
+		dir = opendir(path);
+		if (dir==NULL)
+			return;
 
-					if (frame) {
-						start = MIN2(start, frame);
-						end = MAX2(end, frame);
+		if (cache->index >= 0)
+			BLI_snprintf(ext, sizeof(ext), "_%02d"PTCACHE_EXT, cache->index);
+		else
+			BLI_strncpy(ext, PTCACHE_EXT, sizeof(ext));
+		
+		while ((de = readdir(dir)) != NULL) {
+			if (strstr(de->d_name, ext)) { /* do we have the right extension?*/
+				if (strncmp(filename, de->d_name, len ) == 0) { /* do we have the right prefix */
+					/* read the number of the file */
+					int frame, len2 = (int)strlen(de->d_name);
+					char num[7];
+
+					if (len2 > 15) { /* could crash if trying to copy a string out of this range*/
+						BLI_strncpy(num, de->d_name + (strlen(de->d_name) - 15), sizeof(num));
+						frame = atoi(num);
+
+						if (frame) {
+							start = MIN2(start, frame);
+							end = MAX2(end, frame);
+						}
+						else
+							info = 1;
 					}
-					else
-						info = 1;
 				}
 			}
 		}
+		closedir(dir);
 	}
-	closedir(dir);
 
 	if (start != MAXFRAME) {
 		PTCacheFile *pf;
@@ -55,6 +55,7 @@
 #include "BLI_utildefines.h"
 #include "BLI_callbacks.h"
 #include "BLI_string.h"
+#include "BLI_threads.h"
 
 #include "BKE_anim.h"
 #include "BKE_animsys.h"
@@ -1031,7 +1032,105 @@ static void scene_update_drivers(Main *UNUSED(bmain), Scene *scene)
 	}
 }
 
-static void scene_update_tagged_recursive(Main *bmain, Scene *scene, Scene *scene_parent)
+static void scene_update_base(Scene *scene_parent, Base *base)
+{
+	Object *ob = base->object;
+
+	BKE_object_handle_update(scene_parent, ob);
+
+	if (ob->dup_group && (ob->transflag & OB_DUPLIGROUP))
+		group_handle_recalc_and_update(scene_parent, ob, ob->dup_group);
+
+	/* always update layer, so that animating layers works (joshua july 2010) */
+	/* XXX commented out, this has depsgraph issues anyway - and this breaks setting scenes
+	 * (on scene-set, the base-lay is copied to ob-lay (ton nov 2012) */
+	// base->lay = ob->lay;
+}
+
+static void scene_update_island(Scene *scene_parent, DagIsland *island)
+{
+	LinkData *link;
+
+	for (link = island->bases.first; link; link = link->next)
+		scene_update_base(scene_parent, link->data);
+}
+
+/* metaballs are polygonized and softbodies are solved with global state */
+static int scene_island_is_threadsafe(DagIsland *island)
+{
+	LinkData *link;
+
+	for (link = island->bases.first; link; link = link->next) {
+		Object *ob = ((Base *)link->data)->object;
+
+		if (ob->type == OB_MBALL || ob->soft)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+typedef struct SceneIslandThread {
+	Scene *scene;
+	ThreadQueue *queue;
+} SceneIslandThread;
+
+static void *scene_update_island_thread(void *data_v)
+{
+	SceneIslandThread *data = data_v;
+	DagIsland *island;
+
+	while ((island = BLI_thread_queue_pop(data->queue)))
+		scene_update_island(data->scene, island);
+
+	return NULL;
+}
+
+/* Islands don't depend on each other, so they are updated in threads.
+ * Islands that can't be updated in threads are done here afterwards. */
+static void scene_update_islands(Scene *scene, ListBase *islands)
+{
+	SceneIslandThread data;
+	ListBase threads;
+	DagIsland *island;
+	int a, tot = 0, totthread = BLI_system_thread_count();
+
+	data.scene = scene;
+	data.queue = BLI_thread_queue_init();
+
+	for (island = islands->first; island; island = island->next) {
+		if ((island->flag & DAG_ISLAND_SKIP) == 0 && scene_island_is_threadsafe(island)) {
+			BLI_thread_queue_push(data.queue, island);
+			tot++;
+		}
+	}
+
+	BLI_thread_queue_nowait(data.queue);
+
+	if (tot > 1 && totthread > 1) {
+		totthread = MIN2(totthread, tot);
+
+		BLI_init_threads(&threads, scene_update_island_thread, totthread);
+
+		for (a = 0; a < totthread; a++)
+			BLI_insert_thread(&threads, &data);
+
+		BLI_end_threads(&threads);
+	}
+	else {
+		scene_update_island_thread(&data);
+	}
+
+	BLI_thread_queue_free(data.queue);
+
+	for (island = islands->first; island; island = island->next) {
+		if ((island->flag & DAG_ISLAND_SKIP) == 0 && !scene_island_is_threadsafe(island))
+			scene_update_island(scene, island);
+	}
+}
+
+/* islands is only used for objects of scene itself, not for sets */
+static void scene_update_tagged_recursive(Main *bmain, Scene *scene, Scene *scene_parent, ListBase *islands)
 {
 	Base *base;
 	
@@ -1041,21 +1140,15 @@ static void scene_update_tagged_recursive(Main *bmain, Scene *scene, Scene *scen
 	/* sets first, we allow per definition current scene to have
 	 * dependencies on sets, but not the other way around. */
 	if (scene->set)
-		scene_update_tagged_recursive(bmain, scene->set, scene_parent);
+		scene_update_tagged_recursive(bmain, scene->set, scene_parent, NULL);
 	
 	/* scene objects */
-	for (base = scene->base.first; base; base = base->next) {
-		Object *ob = base->object;
-		
-		BKE_object_handle_update(scene_parent, ob);
-		
-		if (ob->dup_group && (ob->transflag & OB_DUPLIGROUP))
-			group_handle_recalc_and_update(scene_parent, ob, ob->dup_group);
-			
-		/* always update layer, so that animating layers works (joshua july 2010) */
-		/* XXX commented out, this has depsgraph issues anyway - and this breaks setting scenes
-		 * (on scene-set, the base-lay is copied to ob-lay (ton nov 2012) */
-		// base->lay = ob->lay;
+	if (islands) {
+		scene_update_islands(scene_parent, islands);
+	}
+	else {
+		for (base = scene->base.first; base; base = base->next)
+			scene_update_base(scene_parent, base);
 	}
 	
 	/* scene drivers... */
@@ -1090,7 +1183,7 @@ void BKE_scene_update_tagged(Main *bmain, Scene *scene)
 	 *
 	 * in the future this should handle updates for all datablocks, not
 	 * only objects and scenes. - brecht */
-	scene_update_tagged_recursive(bmain, scene, scene);
+	scene_update_tagged_recursive(bmain, scene, scene, NULL);
 
 	/* extra call here to recalc scene animation (for sequencer) */
 	{
@@ -1109,8 +1202,7 @@ void BKE_scene_update_tagged(Main *bmain, Scene *scene)
 	DAG_ids_clear_recalc(bmain);
 }
 
-/* applies changes right away, does all sets too */
-void BKE_scene_update_for_newframe(Main *bmain, Scene *sce, unsigned int lay)
+static void scene_update_for_newframe(Main *bmain, Scene *sce, unsigned int lay, ListBase *islands)
 {
 	float ctime = BKE_scene_frame_get(sce);
 	Scene *sce_iter;
@@ -1156,7 +1248,7 @@ void BKE_scene_update_for_newframe(Main *bmain, Scene *sce, unsigned int lay)
 	tag_main_idcode(bmain, ID_LA, FALSE);
 
 	/* BKE_object_handle_update() on all objects, groups and sets */
-	scene_update_tagged_recursive(bmain, sce, sce);
+	scene_update_tagged_recursive(bmain, sce, sce, islands);
 
 	/* notify editors and python about recalc */
 	BLI_callback_exec(bmain, &sce->id, BLI_CB_EVT_SCENE_UPDATE_POST);
@@ -1168,6 +1260,19 @@ void BKE_scene_update_for_newframe(Main *bmain, Scene *sce, unsigned int lay)
 	DAG_ids_clear_recalc(bmain);
 }
 
+/* applies changes right away, does all sets too */
+void BKE_scene_update_for_newframe(Main *bmain, Scene *sce, unsigned int lay)
+{
+	scene_update_for_newframe(bmain, sce, lay, NULL);
+}
+
+/* Same, but the objects of sce are updated in threads per island from
+ * DAG_scene_islands, islands with DAG_ISLAND_SKIP are not updated. */
+void BKE_scene_update_for_newframe_islands(Main *bmain, Scene *sce, unsigned int lay, ListBase *islands)
+{
+	scene_update_for_newframe(bmain, sce, lay, islands);
+}
+
 /* return default layer, also used to patch old files */
 SceneRenderLayer *BKE_scene_add_render_layer(Scene *sce, const char *name)
 {
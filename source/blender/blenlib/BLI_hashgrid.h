@@ -0,0 +1,63 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * The Original Code is Copyright (C) 2013 Blender Foundation.
+ * All rights reserved.
+ *
+ * The Original Code is: all of this file.
+ *
+ * Contributor(s): none yet.
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ */
+
+#ifndef __BLI_HASHGRID_H__
+#define __BLI_HASHGRID_H__
+
+/** \file BLI_hashgrid.h
+ *  \ingroup bli
+ *  \brief A uniform spatial hash grid for fixed radius neighbor search.
+ *
+ * Points are bucketed into cubic cells of a fixed size, cells are hashed into
+ * a table and the points are counting sorted by cell, so points that are close
+ * in space are also close in memory. Range queries with a radius up to the
+ * cell size only have to visit the 27 cells around the query point.
+ */
+
+struct HashGrid;
+typedef struct HashGrid HashGrid;
+
+/* same signature as BVHTree_RangeQuery, so callbacks can be shared */
+typedef void (*HashGrid_RangeQuery)(void *userdata, int index, float squared_dist);
+
+/* Creates or free a hash grid */
+HashGrid *BLI_hashgrid_new(int maxsize, float cellsize);
+void BLI_hashgrid_free(HashGrid *grid);
+
+/* Construction: first insert points, then call balance. */
+void BLI_hashgrid_insert(HashGrid *grid, int index, const float co[3]);
+void BLI_hashgrid_balance(HashGrid *grid);
+
+/* Calls callback for all points closer than radius to co, returns number of hits */
+int BLI_hashgrid_range_query(HashGrid *grid, const float co[3], float radius,
+                             HashGrid_RangeQuery callback, void *userdata);
+
+/* Inserted point indices in cell order, only valid after balance */
+int BLI_hashgrid_size(HashGrid *grid);
+int BLI_hashgrid_index(HashGrid *grid, int i);
+
+#endif
@@ -82,6 +82,12 @@ void    BLI_fillrand(void *addr, int len);
 void    BLI_array_randomize(void *data, int elemSize, int numElems, unsigned int seed);
 
 
+/** Return a pseudo-random number N where 0.0f<=N<1.0f, depending only on \a seed.
+ * This routine does not use nor modify the state of any random number generator,
+ * so it gives the same results from any thread.
+ */
+float   BLI_hash_frand(unsigned int seed);
+
 /** Better seed for the random number generator, using noise.c hash[] */
 /** Allows up to BLENDER_MAX_THREADS threads to address */
 void    BLI_thread_srandom(int thread, unsigned int seed);
@@ -82,6 +82,7 @@ int     BLI_system_thread_count(void); /* gets the number of threads the system
 #define LOCK_NODES      6
 #define LOCK_MOVIECLIP  7
 #define LOCK_COLORMANAGE 8
+#define LOCK_DRIVERS    9
 
 void    BLI_lock_thread(int type);
 void    BLI_unlock_thread(int type);
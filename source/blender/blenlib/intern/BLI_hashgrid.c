@@ -0,0 +1,235 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * The Original Code is Copyright (C) 2013 Blender Foundation.
+ * All rights reserved.
+ *
+ * The Original Code is: all of this file.
+ *
+ * Contributor(s): none yet.
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ */
+
+/** \file blender/blenlib/intern/BLI_hashgrid.c
+ *  \ingroup bli
+ */
+
+#include <math.h>
+
+#include "MEM_guardedalloc.h"
+
+#include "BLI_math.h"
+#include "BLI_hashgrid.h"
+#include "BLI_utildefines.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/* cell coordinates are clamped so far away points can't overflow the int conversion */
+#define HASHGRID_MAX_CELL 1000000000.0f
+
+/* below this the key computation isn't worth spawning threads for */
+#define HASHGRID_OMP_LIMIT 10000
+
+typedef struct HashGridPoint {
+	float co[3];
+	int cell[3];
+	int index;
+	unsigned int key;
+} HashGridPoint;
+
+struct HashGrid {
+	HashGridPoint *points;
+	int totpoint, maxsize;
+
+	/* points of bucket i are points[cell_start[i]] to points[cell_start[i + 1] - 1] */
+	int *cell_start;
+	unsigned int tablesize, mask;
+
+	float cellsize, inv_cellsize;
+};
+
+HashGrid *BLI_hashgrid_new(int maxsize, float cellsize)
+{
+	HashGrid *grid;
+
+	BLI_assert(cellsize > 0.0f);
+
+	grid = MEM_callocN(sizeof(HashGrid), "HashGrid");
+	grid->points = MEM_mallocN(sizeof(HashGridPoint) * MAX2(maxsize, 1), "HashGridPoint");
+	grid->maxsize = maxsize;
+	grid->cellsize = cellsize;
+	grid->inv_cellsize = 1.0f / cellsize;
+
+	return grid;
+}
+
+void BLI_hashgrid_free(HashGrid *grid)
+{
+	if (grid) {
+		MEM_freeN(grid->points);
+		if (grid->cell_start)
+			MEM_freeN(grid->cell_start);
+		MEM_freeN(grid);
+	}
+}
+
+BLI_INLINE int hashgrid_cell_coord(const HashGrid *grid, float f)
+{
+	float c = floorf(f * grid->inv_cellsize);
+	CLAMP(c, -HASHGRID_MAX_CELL, HASHGRID_MAX_CELL);
+	return (int)c;
+}
+
+BLI_INLINE unsigned int hashgrid_key(const HashGrid *grid, const int cell[3])
+{
+	/* large primes from "Optimized Spatial Hashing for Collision Detection of Deformable Objects" */
+	return (((unsigned int)cell[0] * 73856093u) ^
+	        ((unsigned int)cell[1] * 19349663u) ^
+	        ((unsigned int)cell[2] * 83492791u)) & grid->mask;
+}
+
+void BLI_hashgrid_insert(HashGrid *grid, int index, const float co[3])
+{
+	HashGridPoint *pt;
+
+	BLI_assert(grid->totpoint < grid->maxsize);
+
+	pt = grid->points + grid->totpoint++;
+	copy_v3_v3(pt->co, co);
+	pt->cell[0] = hashgrid_cell_coord(grid, co[0]);
+	pt->cell[1] = hashgrid_cell_coord(grid, co[1]);
+	pt->cell[2] = hashgrid_cell_coord(grid, co[2]);
+	pt->index = index;
+}
+
+void BLI_hashgrid_balance(HashGrid *grid)
+{
+	HashGridPoint *sorted;
+	int *cell_start;
+	unsigned int k;
+	int i, totpoint = grid->totpoint;
+
+	/* keep the load factor at or below one half */
+	grid->tablesize = 64;
+	while (grid->tablesize < 2 * (unsigned int)totpoint)
+		grid->tablesize <<= 1;
+	grid->mask = grid->tablesize - 1;
+
+	if (grid->cell_start)
+		MEM_freeN(grid->cell_start);
+	cell_start = grid->cell_start = MEM_callocN(sizeof(int) * (grid->tablesize + 1), "HashGrid cell_start");
+
+#pragma omp parallel for private(i) schedule(static) if (totpoint > HASHGRID_OMP_LIMIT)
+	for (i = 0; i < totpoint; i++) {
+		grid->points[i].key = hashgrid_key(grid, grid->points[i].cell);
+	}
+
+	/* counting sort by bucket, stable so the result doesn't depend on thread count */
+	for (i = 0; i < totpoint; i++)
+		cell_start[grid->points[i].key + 1]++;
+
+	for (k = 0; k < grid->tablesize; k++)
+		cell_start[k + 1] += cell_start[k];
+
+	sorted = MEM_mallocN(sizeof(HashGridPoint) * MAX2(grid->maxsize, 1), "HashGridPoint");
+
+	for (i = 0; i < totpoint; i++)
+		sorted[cell_start[grid->points[i].key]++] = grid->points[i];
+
+	/* scattering advanced each start to the next one, shift them back */
+	for (k = grid->tablesize; k > 0; k--)
+		cell_start[k] = cell_start[k - 1];
+	cell_start[0] = 0;
+
+	MEM_freeN(grid->points);
+	grid->points = sorted;
+}
+
+int BLI_hashgrid_range_query(HashGrid *grid, const float co[3], float radius,
+                             HashGrid_RangeQuery callback, void *userdata)
+{
+	const float radius_sq = radius * radius;
+	HashGridPoint *pt, *pt_end;
+	int min[3], max[3], cell[3];
+	int hits = 0;
+
+	if (grid->totpoint == 0 || grid->cell_start == NULL)
+		return 0;
+
+	min[0] = hashgrid_cell_coord(grid, co[0] - radius);
+	min[1] = hashgrid_cell_coord(grid, co[1] - radius);
+	min[2] = hashgrid_cell_coord(grid, co[2] - radius);
+	max[0] = hashgrid_cell_coord(grid, co[0] + radius);
+	max[1] = hashgrid_cell_coord(grid, co[1] + radius);
+	max[2] = hashgrid_cell_coord(grid, co[2] + radius);
+
+	/* radius much larger than the cells, checking all points is cheaper */
+	if ((double)(max[0] - min[0] + 1) * (double)(max[1] - min[1] + 1) * (double)(max[2] - min[2] + 1) > (double)grid->totpoint) {
+		for (pt = grid->points, pt_end = pt + grid->totpoint; pt != pt_end; pt++) {
+			const float dist_sq = len_squared_v3v3(co, pt->co);
+
+			if (dist_sq < radius_sq) {
+				callback(userdata, pt->index, dist_sq);
+				hits++;
+			}
+		}
+		return hits;
+	}
+
+	for (cell[2] = min[2]; cell[2] <= max[2]; cell[2]++) {
+		for (cell[1] = min[1]; cell[1] <= max[1]; cell[1]++) {
+			for (cell[0] = min[0]; cell[0] <= max[0]; cell[0]++) {
+				const unsigned int key = hashgrid_key(grid, cell);
+
+				pt = grid->points + grid->cell_start[key];
+				pt_end = grid->points + grid->cell_start[key + 1];
+
+				for (; pt != pt_end; pt++) {
+					float dist_sq;
+
+					/* other cells can hash to the same bucket, skip them so
+					 * no point is reported twice */
+					if (pt->cell[0] != cell[0] || pt->cell[1] != cell[1] || pt->cell[2] != cell[2])
+						continue;
+
+					dist_sq = len_squared_v3v3(co, pt->co);
+
+					if (dist_sq < radius_sq) {
+						callback(userdata, pt->index, dist_sq);
+						hits++;
+					}
+				}
+			}
+		}
+	}
+
+	return hits;
+}
+
+int BLI_hashgrid_size(HashGrid *grid)
+{
+	return grid->totpoint;
+}
+
+int BLI_hashgrid_index(HashGrid *grid, int i)
+{
+	BLI_assert(i >= 0 && i < grid->totpoint);
+	return grid->points[i].index;
+}
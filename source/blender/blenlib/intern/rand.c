@@ -193,6 +193,14 @@ void BLI_array_randomize(void *data, int elemSize, int numElems, unsigned int se
 
 /* ********* for threaded random ************** */
 
+float BLI_hash_frand(unsigned int seed)
+{
+	RNG rng;
+
+	BLI_rng_srandom(&rng, seed);
+	return BLI_rng_get_float(&rng);
+}
+
 static RNG rng_tab[BLENDER_MAX_THREADS];
 
 void BLI_thread_srandom(int thread, unsigned int seed)
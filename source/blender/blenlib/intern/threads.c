@@ -114,6 +114,8 @@ static pthread_mutex_t _opengl_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t _nodes_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t _movieclip_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t _colormanage_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t _drivers_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t _thread_levels_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_t mainid;
 static int thread_levels = 0;  /* threads can be invoked inside threads */
 
@@ -165,6 +167,9 @@ void BLI_init_threads(ListBase *threadbase, void *(*do_thread)(void *), int tot)
 		}
 	}
 	
+	/* threads inside threads can start and end at the same time */
+	pthread_mutex_lock(&_thread_levels_lock);
+
 	if (thread_levels == 0) {
 		MEM_set_lock_callback(BLI_lock_malloc_thread, BLI_unlock_malloc_thread);
 
@@ -177,6 +182,8 @@ void BLI_init_threads(ListBase *threadbase, void *(*do_thread)(void *), int tot)
 	}
 
 	thread_levels++;
+
+	pthread_mutex_unlock(&_thread_levels_lock);
 }
 
 /* amount of available threads */
@@ -295,9 +302,11 @@ void BLI_end_threads(ListBase *threadbase)
 		BLI_freelistN(threadbase);
 	}
 
+	pthread_mutex_lock(&_thread_levels_lock);
 	thread_levels--;
 	if (thread_levels == 0)
 		MEM_set_lock_callback(NULL, NULL);
+	pthread_mutex_unlock(&_thread_levels_lock);
 }
 
 /* System Information */
@@ -354,6 +363,8 @@ void BLI_lock_thread(int type)
 		pthread_mutex_lock(&_movieclip_lock);
 	else if (type == LOCK_COLORMANAGE)
 		pthread_mutex_lock(&_colormanage_lock);
+	else if (type == LOCK_DRIVERS)
+		pthread_mutex_lock(&_drivers_lock);
 }
 
 void BLI_unlock_thread(int type)
@@ -376,6 +387,8 @@ void BLI_unlock_thread(int type)
 		pthread_mutex_unlock(&_movieclip_lock);
 	else if (type == LOCK_COLORMANAGE)
 		pthread_mutex_unlock(&_colormanage_lock);
+	else if (type == LOCK_DRIVERS)
+		pthread_mutex_unlock(&_drivers_lock);
 }
 
 /* Mutex Locks */
@@ -729,16 +742,20 @@ void BLI_thread_queue_wait_finish(ThreadQueue *queue)
 
 void BLI_begin_threaded_malloc(void)
 {
+	pthread_mutex_lock(&_thread_levels_lock);
 	if (thread_levels == 0) {
 		MEM_set_lock_callback(BLI_lock_malloc_thread, BLI_unlock_malloc_thread);
 	}
 	thread_levels++;
+	pthread_mutex_unlock(&_thread_levels_lock);
 }
 
 void BLI_end_threaded_malloc(void)
 {
+	pthread_mutex_lock(&_thread_levels_lock);
 	thread_levels--;
 	if (thread_levels == 0)
 		MEM_set_lock_callback(NULL, NULL);
+	pthread_mutex_unlock(&_thread_levels_lock);
 }
 
@@ -3619,11 +3619,6 @@ static void lib_link_particlesettings(FileData *fd, Main *main)
 	}
 }
 
-static void direct_link_partdeflect(PartDeflect *pd)
-{
-	if (pd) pd->rng = NULL;
-}
-
 static void direct_link_particlesettings(FileData *fd, ParticleSettings *part)
 {
 	int a;
@@ -3633,8 +3628,6 @@ static void direct_link_particlesettings(FileData *fd, ParticleSettings *part)
 	part->pd2 = newdataadr(fd, part->pd2);
 
 	direct_link_animdata(fd, part->adt);
-	direct_link_partdeflect(part->pd);
-	direct_link_partdeflect(part->pd2);
 
 	part->effector_weights = newdataadr(fd, part->effector_weights);
 	if (!part->effector_weights)
@@ -3768,7 +3761,8 @@ static void direct_link_particlesystems(FileData *fd, ListBase *particles)
 		}
 		
 		psys->tree = NULL;
-		psys->bvhtree = NULL;
+		psys->hashgrid = NULL;
+		psys->state_arrays = NULL;
 	}
 	return;
 }
@@ -4777,7 +4771,6 @@ static void direct_link_object(FileData *fd, Object *ob)
 	}
 	
 	ob->pd= newdataadr(fd, ob->pd);
-	direct_link_partdeflect(ob->pd);
 	ob->soft= newdataadr(fd, ob->soft);
 	if (ob->soft) {
 		SoftBody *sb = ob->soft;
@@ -96,6 +96,7 @@ static int ptcache_bake_all_exec(bContext *C, wmOperator *op)
 	Scene *scene= CTX_data_scene(C);
 	wmWindow *win = G.background ? NULL : CTX_wm_window(C);
 	PTCacheBaker baker;
+	int totfailed;
 
 	baker.main = bmain;
 	baker.scene = scene;
@@ -121,7 +122,10 @@ static int ptcache_bake_all_exec(bContext *C, wmOperator *op)
 		baker.progresscontext = NULL;
 	}
 
-	BKE_ptcache_bake(&baker);
+	totfailed = BKE_ptcache_bake(&baker);
+
+	if (totfailed)
+		BKE_reportf(op->reports, RPT_ERROR, "Could not write %d disk cache frames", totfailed);
 
 	WM_event_add_notifier(C, NC_SCENE|ND_FRAME, scene);
 	WM_event_add_notifier(C, NC_OBJECT|ND_POINTCACHE, NULL);
@@ -193,6 +197,7 @@ static int ptcache_bake_exec(bContext *C, wmOperator *op)
 	PTCacheBaker baker;
 	PTCacheID *pid;
 	ListBase pidlist;
+	int totfailed;
 
 	BKE_ptcache_ids_from_object(&pidlist, ob, scene, MAX_DUPLI_RECUR);
 	
@@ -226,7 +231,10 @@ static int ptcache_bake_exec(bContext *C, wmOperator *op)
 		baker.progresscontext = NULL;
 	}
 
-	BKE_ptcache_bake(&baker);
+	totfailed = BKE_ptcache_bake(&baker);
+
+	if (totfailed)
+		BKE_reportf(op->reports, RPT_ERROR, "Could not write %d disk cache frames", totfailed);
 
 	BLI_freelistN(&pidlist);
 
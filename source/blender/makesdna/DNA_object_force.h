@@ -108,7 +108,6 @@ typedef struct PartDeflect {
 	struct Tex *tex;	/* Texture of the texture effector			*/
 
 	/* effector noise */
-	struct RNG *rng;	/* random noise generator for e.g. wind */
 	float f_noise;		/* noise of force						*/
 	int seed;			/* noise random seed					*/
 
@@ -189,7 +188,7 @@ typedef struct PointCache {
 	int editframe;	/* frame being edited (runtime only) */
 	int last_exact; /* last exact frame that's cached */
 	int last_valid; /* used for editing cache - what is the last baked frame */
-	int pad;
+	float quantize_tolerance; /* largest location error of quantized disk caches */
 
 	/* for external cache files */
 	int totpoint;   /* number of cached points */
@@ -409,6 +408,10 @@ typedef struct SoftBody {
 /* high resolution cache is saved for smoke for backwards compatibility, so set this flag to know it's a "fake" cache */
 #define PTCACHE_FAKE_SMOKE			(1<<12)
 #define PTCACHE_IGNORE_CLEAR		(1<<13)
+/* store all frames of a disk cache in a single indexed file */
+#define PTCACHE_DISK_CONTAINER		(1<<14)
+/* store particle disk caches lossy, quantized and relative to key frames */
+#define PTCACHE_QUANTIZE			(1<<15)
 
 /* PTCACHE_OUTDATED + PTCACHE_FRAMES_SKIPPED */
 #define PTCACHE_REDO_NEEDED			258
@@ -274,7 +274,7 @@ typedef struct ParticleSystem {
 	char name[64];							/* particle system name, MAX_NAME */
 	
 	float imat[4][4];	/* used for duplicators */
-	float cfra, tree_frame, bvhtree_frame;
+	float cfra, tree_frame, hashgrid_frame;
 	int seed, child_seed;
 	int flag, totpart, totunexist, totchild, totcached, totchildcache;
 	short recalc, target_psys, totkeyed, bakespace;
@@ -297,7 +297,9 @@ typedef struct ParticleSystem {
 	int tot_fluidsprings, alloc_fluidsprings;
 
 	struct KDTree *tree;								/* used for interactions with self and other systems */
-	struct BVHTree *bvhtree;								/* used for interactions with self and other systems */
+	struct HashGrid *hashgrid;							/* used for fluid interactions with self and other systems */
+	struct ParticleStateArrays *state_arrays;			/* runtime copy of the particle state as separate arrays */
+	void *_pad2;
 
 	struct ParticleDrawData *pdd;
 
@@ -158,6 +158,29 @@ static void rna_Cache_toggle_disk_cache(Main *UNUSED(bmain), Scene *UNUSED(scene
 	BLI_freelistN(&pidlist);
 }
 
+static void rna_Cache_toggle_disk_container(Main *UNUSED(bmain), Scene *UNUSED(scene), PointerRNA *ptr)
+{
+	Object *ob = (Object *)ptr->id.data;
+	PointCache *cache = (PointCache *)ptr->data;
+	PTCacheID *pid = NULL;
+	ListBase pidlist;
+
+	if (!ob)
+		return;
+
+	BKE_ptcache_ids_from_object(&pidlist, ob, NULL, 0);
+
+	for (pid = pidlist.first; pid; pid = pid->next) {
+		if (pid->cache == cache)
+			break;
+	}
+
+	if (pid)
+		BKE_ptcache_toggle_disk_container(pid);
+
+	BLI_freelistN(&pidlist);
+}
+
 static void rna_Cache_idname_change(Main *UNUSED(bmain), Scene *UNUSED(scene), PointerRNA *ptr)
 {
 	Object *ob = (Object *)ptr->id.data;
@@ -789,6 +812,16 @@ static void rna_def_pointcache(BlenderRNA *brna)
 	RNA_def_property_enum_items(prop, point_cache_compress_items);
 	RNA_def_property_ui_text(prop, "Cache Compression", "Compression method to be used");
 
+	prop = RNA_def_property(srna, "use_quantize", PROP_BOOLEAN, PROP_NONE);
+	RNA_def_property_boolean_sdna(prop, NULL, "flag", PTCACHE_QUANTIZE);
+	RNA_def_property_ui_text(prop, "Quantize", "Store particle disk caches lossy and relative to key frames, for smaller files");
+
+	prop = RNA_def_property(srna, "quantize_tolerance", PROP_FLOAT, PROP_DISTANCE);
+	RNA_def_property_float_sdna(prop, NULL, "quantize_tolerance");
+	RNA_def_property_range(prop, 0.00001f, 1.0f);
+	RNA_def_property_ui_range(prop, 0.0001f, 0.1f, 0.01, 4);
+	RNA_def_property_ui_text(prop, "Tolerance", "Largest error of quantized particle locations");
+
 	/* flags */
 	prop = RNA_def_property(srna, "is_baked", PROP_BOOLEAN, PROP_NONE);
 	RNA_def_property_boolean_sdna(prop, NULL, "flag", PTCACHE_BAKED);
@@ -803,6 +836,11 @@ static void rna_def_pointcache(BlenderRNA *brna)
 	RNA_def_property_ui_text(prop, "Disk Cache", "Save cache files to disk (.blend file must be saved first)");
 	RNA_def_property_update(prop, NC_OBJECT, "rna_Cache_toggle_disk_cache");
 
+	prop = RNA_def_property(srna, "use_disk_container", PROP_BOOLEAN, PROP_NONE);
+	RNA_def_property_boolean_sdna(prop, NULL, "flag", PTCACHE_DISK_CONTAINER);
+	RNA_def_property_ui_text(prop, "Single File", "Store all frames of the disk cache in one indexed file");
+	RNA_def_property_update(prop, NC_OBJECT, "rna_Cache_toggle_disk_container");
+
 	prop = RNA_def_property(srna, "is_outdated", PROP_BOOLEAN, PROP_NONE);
 	RNA_def_property_boolean_sdna(prop, NULL, "flag", PTCACHE_OUTDATED);
 	RNA_def_property_clear_flag(prop, PROP_EDITABLE);
@@ -139,6 +139,69 @@ static PyObject *bpy_blend_paths(PyObject *UNUSED(self), PyObject *args, PyObjec
 }
 
 
+static void bpy_memory_alloc_stats_cb(const MEM_AllocStats *stats, void *userdata)
+{
+	PyObject *list = (PyObject *)userdata;
+	PyObject *histogram = PyTuple_New(MEM_ALLOC_STATS_HISTOGRAM_SIZE);
+	PyObject *item;
+	int i;
+
+	for (i = 0; i < MEM_ALLOC_STATS_HISTOGRAM_SIZE; i++) {
+		PyTuple_SET_ITEM(histogram, i, PyLong_FromSize_t(stats->histogram[i]));
+	}
+
+	item = Py_BuildValue("{s:s, s:n, s:n, s:n, s:n, s:n, s:n, s:N}",
+	                     "name", stats->name,
+	                     "allocs", (Py_ssize_t)stats->allocs,
+	                     "frees", (Py_ssize_t)stats->frees,
+	                     "reallocs", (Py_ssize_t)stats->reallocs,
+	                     "bytes", (Py_ssize_t)stats->bytes_alloc,
+	                     "bytes_in_use", (Py_ssize_t)stats->bytes_in_use,
+	                     "peak", (Py_ssize_t)stats->peak_in_use,
+	                     "histogram", histogram);
+	if (item) {
+		PyList_Append(list, item);
+		Py_DECREF(item);
+	}
+}
+
+PyDoc_STRVAR(bpy_memory_alloc_stats_doc,
+".. function:: memory_alloc_stats(reset=False)\n"
+"\n"
+"   Returns per-name allocation statistics gathered while :data:`bpy.app.debug_memory_alloc` is enabled,\n"
+"   sorted by number of allocations.\n"
+"\n"
+"   :arg reset: When true the statistics are cleared after reading them, "
+"so each call covers the time since the previous one (a frame or an operator for example).\n"
+"   :type reset: boolean\n"
+"   :return: list of dictionaries with keys name, allocs, frees, reallocs, bytes, bytes_in_use, peak\n"
+"      and histogram, a tuple of allocation counts for power of two sizes starting at 32 bytes.\n"
+"   :rtype: list of dicts\n"
+);
+static PyObject *bpy_memory_alloc_stats(PyObject *UNUSED(self), PyObject *args, PyObject *kw)
+{
+	PyObject *list;
+
+	int reset = false;
+	static const char *kwlist[] = {"reset", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kw, "|i:memory_alloc_stats",
+	                                 (char **)kwlist, &reset))
+	{
+		return NULL;
+	}
+
+	list = PyList_New(0);
+
+	MEM_callback_alloc_stats(bpy_memory_alloc_stats_cb, (void *)list);
+
+	if (reset) {
+		MEM_reset_alloc_stats();
+	}
+
+	return list;
+}
+
 // PyDoc_STRVAR(bpy_user_resource_doc[] = // now in bpy/utils.py
 static PyObject *bpy_user_resource(PyObject *UNUSED(self), PyObject *args, PyObject *kw)
 {
@@ -214,6 +277,8 @@ static PyMethodDef meth_bpy_script_paths =
 	{"script_paths", (PyCFunction)bpy_script_paths, METH_NOARGS, bpy_script_paths_doc};
 static PyMethodDef meth_bpy_blend_paths =
 	{"blend_paths", (PyCFunction)bpy_blend_paths, METH_VARARGS | METH_KEYWORDS, bpy_blend_paths_doc};
+static PyMethodDef meth_bpy_memory_alloc_stats =
+	{"memory_alloc_stats", (PyCFunction)bpy_memory_alloc_stats, METH_VARARGS | METH_KEYWORDS, bpy_memory_alloc_stats_doc};
 static PyMethodDef meth_bpy_user_resource =
 	{"user_resource", (PyCFunction)bpy_user_resource, METH_VARARGS | METH_KEYWORDS, NULL};
 static PyMethodDef meth_bpy_resource_path =
@@ -300,6 +365,7 @@ void BPy_init_modules(void)
 	/* utility func's that have nowhere else to go */
 	PyModule_AddObject(mod, meth_bpy_script_paths.ml_name, (PyObject *)PyCFunction_New(&meth_bpy_script_paths, NULL));
 	PyModule_AddObject(mod, meth_bpy_blend_paths.ml_name, (PyObject *)PyCFunction_New(&meth_bpy_blend_paths, NULL));
+	PyModule_AddObject(mod, meth_bpy_memory_alloc_stats.ml_name, (PyObject *)PyCFunction_New(&meth_bpy_memory_alloc_stats, NULL));
 	PyModule_AddObject(mod, meth_bpy_user_resource.ml_name, (PyObject *)PyCFunction_New(&meth_bpy_user_resource, NULL));
 	PyModule_AddObject(mod, meth_bpy_resource_path.ml_name, (PyObject *)PyCFunction_New(&meth_bpy_resource_path, NULL));
 
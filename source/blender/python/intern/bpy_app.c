@@ -42,6 +42,8 @@
 #include "BLI_path_util.h"
 #include "BLI_utildefines.h"
 
+#include "MEM_guardedalloc.h"
+
 
 #include "BKE_blender.h"
 #include "BKE_global.h"
@@ -215,6 +217,29 @@ static int bpy_app_debug_value_set(PyObject *UNUSED(self), PyObject *value, void
 	return 0;
 }
 
+PyDoc_STRVAR(bpy_app_debug_memory_alloc_doc,
+"Boolean, gather per-name allocation statistics, see :func:`bpy.utils.memory_alloc_stats` "
+"(enabling resets previous statistics)"
+);
+static PyObject *bpy_app_debug_memory_alloc_get(PyObject *UNUSED(self), void *UNUSED(closure))
+{
+	return PyBool_FromLong(MEM_get_alloc_stats());
+}
+
+static int bpy_app_debug_memory_alloc_set(PyObject *UNUSED(self), PyObject *value, void *UNUSED(closure))
+{
+	const int param = PyObject_IsTrue(value);
+
+	if (param == -1) {
+		PyErr_SetString(PyExc_TypeError, "bpy.app.debug_memory_alloc can only be True/False");
+		return -1;
+	}
+
+	MEM_set_alloc_stats(param);
+
+	return 0;
+}
+
 PyDoc_STRVAR(bpy_app_tempdir_doc,
 "String, the temp directory used by blender (read-only)"
 );
@@ -248,6 +273,8 @@ static PyGetSetDef bpy_app_getsets[] = {
 	{(char *)"debug_handlers", bpy_app_debug_get, bpy_app_debug_set, (char *)bpy_app_debug_doc, (void *)G_DEBUG_HANDLERS},
 	{(char *)"debug_wm",     bpy_app_debug_get, bpy_app_debug_set, (char *)bpy_app_debug_doc, (void *)G_DEBUG_WM},
 
+	{(char *)"debug_memory_alloc", bpy_app_debug_memory_alloc_get, bpy_app_debug_memory_alloc_set, (char *)bpy_app_debug_memory_alloc_doc, NULL},
+
 	{(char *)"debug_value", bpy_app_debug_value_get, bpy_app_debug_value_set, (char *)bpy_app_debug_value_doc, NULL},
 	{(char *)"tempdir", bpy_app_tempdir_get, NULL, (char *)bpy_app_tempdir_doc, NULL},
 	{(char *)"driver_namespace", bpy_app_driver_dict_get, NULL, (char *)bpy_app_driver_dict_doc, NULL},
@@ -2017,7 +2017,8 @@ static void update_physics_cache(Render *re, Scene *scene, int UNUSED(anim_init)
 	baker.break_data = re->tbh;
 	baker.progressbar = NULL;
 
-	BKE_ptcache_bake(&baker);
+	if (BKE_ptcache_bake(&baker))
+		BKE_report(re->reports, RPT_ERROR, "Could not write all physics disk cache frames");
 }
 /* evaluating scene options for general Blender render */
 static int render_initialize_from_main(Render *re, Main *bmain, Scene *scene, SceneRenderLayer *srl, Object *camera_override, unsigned int lay, int anim, int anim_init)
@@ -68,6 +68,7 @@
 
 #include "BKE_addon.h"
 #include "BKE_packedFile.h"
+#include "BKE_pointcache.h"
 #include "BKE_sequencer.h" /* free seq clipboard */
 #include "BKE_material.h" /* clear_matcopybuf */
 #include "BKE_tracking.h" /* free tracking clipboard */
@@ -432,6 +433,8 @@ void WM_exit_ext(bContext *C, const short do_python)
 
 	BKE_sequencer_free_clipboard(); /* sequencer.c */
 	BKE_tracking_clipboard_free();
+	BKE_ptcache_prefetch_free();
+	BKE_ptcache_free_containers();
 		
 #ifdef WITH_COMPOSITOR
 	COM_deinitialize();
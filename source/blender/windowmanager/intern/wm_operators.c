@@ -3797,6 +3797,11 @@ static void WM_OT_redraw_timer(wmOperatorType *ot)
 static int memory_statistics_exec(bContext *UNUSED(C), wmOperator *UNUSED(op))
 {
 	MEM_printmemlist_stats();
+	if (MEM_get_alloc_stats()) {
+		/* statistics since the previous call */
+		MEM_printmemlist_alloc_stats();
+		MEM_reset_alloc_stats();
+	}
 	return OPERATOR_FINISHED;
 }
 